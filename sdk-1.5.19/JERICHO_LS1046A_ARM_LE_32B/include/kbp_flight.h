@@ -0,0 +1,213 @@
+/*
+ * $Id$
+ *
+ * This license is set out in https://raw.githubusercontent.com/Broadcom/Broadcom-Compute-Connectivity-Software-KBP-SDK/master/Legal/LICENSE file.
+ *
+ * $Copyright: (c) 2023 Broadcom Inc.
+ * All Rights Reserved.$
+ *
+ */
+
+#ifndef __KBP_FLIGHT_H
+#define __KBP_FLIGHT_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "errors.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @file kbp_flight.h
+ *
+ * Flight recorder of recent SDK operations.
+ *
+ * Fixed size rings, one per thread, keep the last calls made through the
+ * kbp_latency_* wrappers, together with transport errors, counter ring
+ * drain errors and anything the application records itself. Each record
+ * holds the time, the object the call was made on, the entry or AD handle,
+ * a call specific argument, the status and the duration. Recording is a
+ * few stores into the calling thread's ring, without locks or atomic
+ * read-modify-writes, and the wrappers reuse the timestamps they take for
+ * the latency histograms, so it is on from the start.
+ *
+ * KBP_DEVICE_PROP_DUMP_ON_ASSERT dumps the device state at an assert; the
+ * flight recorder adds the history that led there. kbp_assert_detail()
+ * writes the ring to the dump path before aborting, kbp_flight_dump()
+ * writes it on demand. The dump is binary: a ::kbp_flight_dump_header
+ * followed by the records of all threads merged by time, oldest first.
+ * tools/kbp_flight_decode prints it.
+ *
+ * @addtogroup PORTABILITY_API
+ * @{
+ */
+
+/**
+ * Dump file magic, "KBPF" in the byte order of the writer
+ */
+
+#define KBP_FLIGHT_MAGIC            (0x4650424B)
+
+/**
+ * Dump file version
+ */
+
+#define KBP_FLIGHT_VERSION          (2)
+
+/**
+ * Recorded operations. Values from ::KBP_FLIGHT_USER upwards are free for
+ * the application.
+ */
+
+enum kbp_flight_op {
+    KBP_FLIGHT_DB_ADD = 1,          /**< kbp_db_add_ace(), arg is the priority */
+    KBP_FLIGHT_DB_ADD_PREFIX,       /**< kbp_db_add_prefix(), arg is the prefix length */
+    KBP_FLIGHT_DB_ADD_EM,           /**< kbp_db_add_em() */
+    KBP_FLIGHT_DB_DELETE,           /**< kbp_db_delete_entry() */
+    KBP_FLIGHT_DB_INSTALL,          /**< kbp_db_install(), arg is the microseconds in transport writes */
+    KBP_FLIGHT_SEARCH,              /**< kbp_instruction_search(), arg is cb_addrs */
+    KBP_FLIGHT_AD_ADD,              /**< kbp_ad_db_add_entry() */
+    KBP_FLIGHT_AD_UPDATE,           /**< kbp_ad_db_update_entry() */
+    KBP_FLIGHT_AD_DELETE,           /**< kbp_ad_db_delete_entry() */
+    KBP_FLIGHT_WB_SAVE,             /**< kbp_device_save_state(), kbp_device_save_state_and_continue() */
+    KBP_FLIGHT_WB_RESTORE,          /**< kbp_device_restore_state() */
+    KBP_FLIGHT_HB_TIMER,            /**< kbp_hb_db_timer() */
+    KBP_FLIGHT_XPT_ERROR,           /**< Failed transport call, arg is the ::kbp_xpt_trace_op */
+    KBP_FLIGHT_RING_DRAIN_ERROR,    /**< Failed counter ring drain, arg is the channel */
+    KBP_FLIGHT_ASSERT,              /**< kbp_assert_detail(), arg is the line */
+    KBP_FLIGHT_USER = 0x8000        /**< First application defined operation */
+};
+
+/**
+ * Dump on kbp_assert_detail(), on by default
+ */
+
+#define KBP_FLIGHT_DUMP_ON_ASSERT           (1U << 0)
+
+/**
+ * Dump when kbp_latency_db_install() fails
+ */
+
+#define KBP_FLIGHT_DUMP_ON_INSTALL_ERROR    (1U << 1)
+
+/**
+ * Flight recorder configuration
+ */
+
+struct kbp_flight_config {
+    uint32_t num_records;       /**< Records per thread, rounded up to a power of two. Zero picks 4096 */
+    uint32_t flags;             /**< KBP_FLIGHT_DUMP_ON_* */
+    uint32_t disable;           /**< Stop recording */
+    const char *dump_path;      /**< File written by automatic dumps, NULL picks "kbp_flight.bin" */
+};
+
+/**
+ * One record. Written in the byte order of the host.
+ */
+
+struct kbp_flight_record {
+    uint64_t ts_ns;             /**< Start of the call, CLOCK_MONOTONIC nanoseconds */
+    uint64_t object;            /**< Database, device or other object handle */
+    uint64_t handle;            /**< Entry or AD handle, zero if none */
+    uint32_t duration_ns;       /**< Duration, saturated */
+    uint32_t arg;               /**< Operation specific, see ::kbp_flight_op */
+    int32_t status;             /**< kbp_status of the call */
+    uint32_t tid;               /**< ID of the recording thread */
+    uint16_t op;                /**< ::kbp_flight_op */
+    uint16_t reserved[3];       /**< Zero */
+};
+
+/**
+ * Dump file header
+ */
+
+struct kbp_flight_dump_header {
+    uint32_t magic;             /**< ::KBP_FLIGHT_MAGIC */
+    uint16_t version;           /**< ::KBP_FLIGHT_VERSION */
+    uint16_t record_size;       /**< sizeof(struct kbp_flight_record) */
+    uint32_t num_records;       /**< Records that follow */
+    uint32_t total_records;     /**< Records made by all threads modulo 2^32, older ones were overwritten */
+    uint64_t dump_ns;           /**< Time of the dump, CLOCK_MONOTONIC nanoseconds like the records */
+    uint64_t dump_wall_ns;      /**< Time of the dump, nanoseconds since the epoch */
+};
+
+/**
+ * Flight recorder statistics
+ */
+
+struct kbp_flight_stats {
+    uint64_t num_records;       /**< Records made */
+    uint64_t num_dumps;         /**< Dumps written */
+    uint64_t num_dropped;       /**< Records lost because a thread ring could not be allocated */
+    uint32_t num_rings;         /**< Thread rings */
+    uint32_t ring_size;         /**< Records kept per thread */
+};
+
+/**
+ * Changes the flight recorder configuration. A new ring size applies to
+ * threads that record for the first time afterwards.
+ *
+ * @param config The configuration.
+ *
+ * @return KBP_OK on success or an error code otherwise.
+ */
+
+kbp_status kbp_flight_configure(const struct kbp_flight_config *config);
+
+/**
+ * Adds a record. Safe from any thread.
+ *
+ * @param op ::kbp_flight_op or an application value from ::KBP_FLIGHT_USER.
+ * @param object Object the operation was made on.
+ * @param handle Entry or AD handle, may be NULL.
+ * @param arg Operation specific argument.
+ * @param status Result of the operation.
+ * @param start_ns Start time in CLOCK_MONOTONIC nanoseconds. Zero takes the current time.
+ * @param duration_ns Duration in nanoseconds.
+ */
+
+void kbp_flight_record(uint32_t op, const void *object, const void *handle, uint32_t arg, kbp_status status,
+                       uint64_t start_ns, uint64_t duration_ns);
+
+/**
+ * Writes the rings to a stream. A record being made while the dump runs
+ * may be torn.
+ *
+ * @param fp Stream opened for binary writing.
+ *
+ * @return KBP_OK on success or an error code otherwise.
+ */
+
+kbp_status kbp_flight_dump(FILE *fp);
+
+/**
+ * Writes the rings to the configured dump path, if the reason is one of the
+ * configured KBP_FLIGHT_DUMP_ON_* flags. Used by kbp_assert_detail() and
+ * the install wrapper.
+ *
+ * @param reason A KBP_FLIGHT_DUMP_ON_* flag.
+ */
+
+void kbp_flight_auto_dump(uint32_t reason);
+
+/**
+ * Returns the flight recorder statistics.
+ *
+ * @param stats Valid pointer populated on return.
+ *
+ * @return KBP_OK on success or an error code otherwise.
+ */
+
+kbp_status kbp_flight_get_stats(struct kbp_flight_stats *stats);
+
+/**
+ * @}
+ */
+
+#ifdef __cplusplus
+}
+#endif
+#endif                          /* __KBP_FLIGHT_H */
@@ -0,0 +1,177 @@
+/*
+ * $Id$
+ *
+ * This license is set out in https://raw.githubusercontent.com/Broadcom/Broadcom-Compute-Connectivity-Software-KBP-SDK/master/Legal/LICENSE file.
+ *
+ * $Copyright: (c) 2023 Broadcom Inc.
+ * All Rights Reserved.$
+ *
+ */
+
+#ifndef __KBP_HB_BITMAP_H
+#define __KBP_HB_BITMAP_H
+
+#include <stdint.h>
+
+#include "errors.h"
+#include "device.h"
+#include "kbp_hb.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @file kbp_hb_bitmap.h
+ *
+ * Bulk hit bit scans exported as a bitmap.
+ *
+ * Each hit bit added through this module gets a stable ordinal, reusing
+ * released ordinals first. kbp_hb_bitmap_read() refreshes every hit bit bank of
+ * the database with one kbp_hb_db_read_initiate() bulk read (the age scan DMA
+ * channel on OP2) and returns the hit bits as a bitmap indexed by ordinal, so
+ * the caller handles one buffer instead of one call per entry.
+ * kbp_hb_bitmap_get_hb() maps an ordinal back to its hit bit handle.
+ *
+ * kbp_hb_bitmap_timer_slice() is an incremental alternative to
+ * kbp_hb_db_timer(). Each call ages a bounded number of hit bits, in ordinal
+ * order, from a cursor kept across calls: a hit bit that was hit has its idle
+ * count reset, one that was not has it incremented.
+ * kbp_hb_bitmap_timer_paced() sizes the slices so that a full sweep is spread
+ * evenly over an aging period.
+ *
+ * @addtogroup HB_API
+ * @{
+ */
+
+/**
+ * Opaque hit bit ordinal map
+ */
+
+struct kbp_hb_bitmap;
+
+/**
+ * Creates the ordinal map of a hit bit database.
+ *
+ * @param hb_db Valid HB database handle.
+ * @param capacity Largest number of hit bits tracked.
+ * @param map Ordinal map, initialized and returned on success.
+ *
+ * @return KBP_OK on success or an error code otherwise.
+ */
+
+kbp_status kbp_hb_bitmap_create(struct kbp_hb_db *hb_db, uint32_t capacity, struct kbp_hb_bitmap **map);
+
+/**
+ * Frees the ordinal map. The hit bits themselves are not deleted.
+ *
+ * @param map Valid ordinal map.
+ *
+ * @return KBP_OK on success or an error code otherwise.
+ */
+
+kbp_status kbp_hb_bitmap_destroy(struct kbp_hb_bitmap *map);
+
+/**
+ * kbp_hb_db_add_entry() that also assigns an ordinal.
+ *
+ * @param map Valid ordinal map.
+ * @param hb Hit bit handle returned on success.
+ * @param ordinal Ordinal of the hit bit returned on success.
+ *
+ * @return KBP_OK on success or an error code otherwise.
+ */
+
+kbp_status kbp_hb_bitmap_add_entry(struct kbp_hb_bitmap *map, struct kbp_hb **hb, uint32_t *ordinal);
+
+/**
+ * Assigns an ordinal to a hit bit created elsewhere, for example one
+ * restored by ISSU.
+ *
+ * @param map Valid ordinal map.
+ * @param hb Valid hit bit handle.
+ * @param ordinal Ordinal of the hit bit returned on success.
+ *
+ * @return KBP_OK on success or an error code otherwise.
+ */
+
+kbp_status kbp_hb_bitmap_register(struct kbp_hb_bitmap *map, struct kbp_hb *hb, uint32_t *ordinal);
+
+/**
+ * kbp_hb_db_delete_entry() on the hit bit at an ordinal, which is freed for reuse.
+ *
+ * @param map Valid ordinal map.
+ * @param ordinal Ordinal of the hit bit to delete.
+ *
+ * @return KBP_OK on success or an error code otherwise.
+ */
+
+kbp_status kbp_hb_bitmap_delete_entry(struct kbp_hb_bitmap *map, uint32_t ordinal);
+
+/**
+ * Returns the hit bit handle at an ordinal.
+ *
+ * @param map Valid ordinal map.
+ * @param ordinal Ordinal to look up.
+ * @param hb Hit bit handle, or NULL if the ordinal is free.
+ *
+ * @return KBP_OK on success or an error code otherwise.
+ */
+
+kbp_status kbp_hb_bitmap_get_hb(struct kbp_hb_bitmap *map, uint32_t ordinal, struct kbp_hb **hb);
+
+/**
+ * Reads all hit bits in bulk into a bitmap. Bit n (bit n % 8 of byte n / 8)
+ * is set if the hit bit at ordinal n was hit. Free ordinals read as zero.
+ *
+ * @param map Valid ordinal map.
+ * @param bitmap Caller buffer of at least (nbits + 7) / 8 bytes.
+ * @param nbits Number of ordinals to report, at most the map capacity.
+ * @param clear_on_read If 1, the hit bits are cleared in hardware.
+ * @param num_hit Number of bits set, returned if not NULL.
+ *
+ * @return KBP_OK on success, KBP_POLL_TIME_OUT if the bulk read does not complete within a second,
+ *         or an error code otherwise.
+ */
+
+kbp_status kbp_hb_bitmap_read(struct kbp_hb_bitmap *map, uint8_t *bitmap, uint32_t nbits, uint8_t clear_on_read,
+                              uint32_t *num_hit);
+
+/**
+ * Ages the next slice of hit bits. The hit bits are read and cleared with
+ * kbp_hb_entry_get_bit_value() and their idle counts updated with
+ * kbp_hb_entry_set_idle_count().
+ *
+ * @param map Valid ordinal map.
+ * @param max_entries Stop after this many ordinals, zero for no limit.
+ * @param max_us Stop after about this many microseconds, zero for no limit.
+ * @param cycle_done Set to one when the slice completed a sweep of all ordinals, zero otherwise.
+ *
+ * @return KBP_OK on success or an error code otherwise.
+ */
+
+kbp_status kbp_hb_bitmap_timer_slice(struct kbp_hb_bitmap *map, uint32_t max_entries, uint32_t max_us,
+                                     int32_t *cycle_done);
+
+/**
+ * Ages as many hit bits as needed to keep the current sweep on schedule to
+ * finish one aging period after it started. Meant to be called often, from
+ * the control thread's idle loop or a periodic timer.
+ *
+ * @param map Valid ordinal map.
+ * @param period_us Aging period in microseconds.
+ * @param cycle_done Set to one when the call completed a sweep of all ordinals, zero otherwise.
+ *
+ * @return KBP_OK on success or an error code otherwise.
+ */
+
+kbp_status kbp_hb_bitmap_timer_paced(struct kbp_hb_bitmap *map, uint32_t period_us, int32_t *cycle_done);
+
+/**
+ * @}
+ */
+
+#ifdef __cplusplus
+}
+#endif
+#endif                          /* __KBP_HB_BITMAP_H */
@@ -0,0 +1,178 @@
+/*
+ * $Id$
+ *
+ * This license is set out in https://raw.githubusercontent.com/Broadcom/Broadcom-Compute-Connectivity-Software-KBP-SDK/master/Legal/LICENSE file.
+ *
+ * $Copyright: (c) 2023 Broadcom Inc.
+ * All Rights Reserved.$
+ *
+ */
+
+#ifndef __KBP_INDEX_BATCH_H
+#define __KBP_INDEX_BATCH_H
+
+#include <stdint.h>
+
+#include "errors.h"
+#include "db.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @file kbp_index_batch.h
+ *
+ * Batched index change notifications.
+ *
+ * KBP_PROP_INDEX_CALLBACK reports every entry move with its own call. During
+ * a large shuffle most of those moves shift a run of neighbouring entries by
+ * the same distance. The index batch buffers the calls and hands them over
+ * as an array of ranges. Each range says that count entries moved from
+ * old_index onwards to new_index onwards. Applying each range as one
+ * memmove() of the caller's per index data, in the order given, gives the
+ * same result as applying the moves one by one.
+ *
+ * Buffered moves are delivered when the buffer is full, when a move for
+ * another database arrives, and at the end of kbp_index_batch_db_install().
+ * The batch is not thread safe; use one per device, as installs of a device
+ * are serialized.
+ *
+ * @addtogroup KBP_DB_API
+ * @{
+ */
+
+/**
+ * A run of moves. Entry i of the run moved from old_index + i to
+ * new_index + i. old_index is -1 for entries placed for the first time,
+ * in which case only new_index counts up.
+ */
+
+struct kbp_index_move_range {
+    int32_t old_index;          /**< First old index, or -1 */
+    int32_t new_index;          /**< First new index */
+    uint32_t count;             /**< Number of entries in the run */
+    uint32_t first_entry;       /**< Position of the first entry of the run in the entries array */
+};
+
+/**
+ * Batched index change callback.
+ *
+ * @param handle Handle passed to kbp_index_batch_create().
+ * @param db Database the entries belong to.
+ * @param ranges Runs of moves, to be applied in order.
+ * @param num_ranges Number of runs.
+ * @param entries Entry handles of all runs, run r owns entries[first_entry .. first_entry + count - 1].
+ * @param num_entries Number of entries.
+ */
+
+typedef void (*kbp_db_index_batch_callback) (void *handle, struct kbp_db *db,
+                                             const struct kbp_index_move_range *ranges, uint32_t num_ranges,
+                                             struct kbp_entry *const *entries, uint32_t num_entries);
+
+/**
+ * Opaque index batch handle
+ */
+
+struct kbp_index_batch;
+
+/**
+ * Index batch statistics
+ */
+
+struct kbp_index_batch_stats {
+    uint64_t num_moves;         /**< Single index callbacks received */
+    uint64_t num_ranges;        /**< Runs delivered */
+    uint64_t num_flushes;       /**< Batched callbacks made */
+};
+
+/**
+ * Creates an index batch.
+ *
+ * @param callback Batched callback.
+ * @param handle Passed to callback.
+ * @param max_moves Moves buffered before a delivery. Zero picks 4096.
+ * @param batch Index batch handle, initialized and returned on success.
+ *
+ * @return KBP_OK on success or an error code otherwise.
+ */
+
+kbp_status kbp_index_batch_create(kbp_db_index_batch_callback callback, void *handle, uint32_t max_moves,
+                                  struct kbp_index_batch **batch);
+
+/**
+ * Delivers anything still buffered and destroys the index batch.
+ *
+ * @param batch Valid index batch handle.
+ *
+ * @return KBP_OK on success or an error code otherwise.
+ */
+
+kbp_status kbp_index_batch_destroy(struct kbp_index_batch *batch);
+
+/**
+ * Sets KBP_PROP_INDEX_CALLBACK of a database to the batch. To count the
+ * callbacks as well, pass kbp_index_batch_index_callback() and the batch
+ * to kbp_install_stats_track_db() instead.
+ *
+ * @param batch Valid index batch handle.
+ * @param db Valid database handle, not yet locked.
+ *
+ * @return KBP_OK on success or an error code otherwise.
+ */
+
+kbp_status kbp_index_batch_attach(struct kbp_index_batch *batch, struct kbp_db *db);
+
+/**
+ * The single move callback that feeds the batch, for chaining.
+ *
+ * @param handle The index batch handle.
+ * @param db Database of the entry.
+ * @param entry Entry that moved.
+ * @param old_index Previous index, -1 if the entry is new.
+ * @param new_index New index.
+ */
+
+void kbp_index_batch_index_callback(void *handle, struct kbp_db *db, struct kbp_entry *entry,
+                                    int32_t old_index, int32_t new_index);
+
+/**
+ * Delivers the buffered moves now.
+ *
+ * @param batch Valid index batch handle.
+ *
+ * @return KBP_OK on success or an error code otherwise.
+ */
+
+kbp_status kbp_index_batch_flush(struct kbp_index_batch *batch);
+
+/**
+ * kbp_db_install() followed by kbp_index_batch_flush().
+ *
+ * @param batch Valid index batch handle.
+ * @param db Valid database handle.
+ *
+ * @return The status of kbp_db_install().
+ */
+
+kbp_status kbp_index_batch_db_install(struct kbp_index_batch *batch, struct kbp_db *db);
+
+/**
+ * Returns the batch statistics.
+ *
+ * @param batch Valid index batch handle.
+ * @param stats Valid pointer populated on return.
+ *
+ * @return KBP_OK on success or an error code otherwise.
+ */
+
+kbp_status kbp_index_batch_get_stats(struct kbp_index_batch *batch, struct kbp_index_batch_stats *stats);
+
+/**
+ * @}
+ */
+
+#ifdef __cplusplus
+}
+#endif
+#endif                          /* __KBP_INDEX_BATCH_H */
@@ -0,0 +1,167 @@
+/*
+ * $Id$
+ *
+ * This license is set out in https://raw.githubusercontent.com/Broadcom/Broadcom-Compute-Connectivity-Software-KBP-SDK/master/Legal/LICENSE file.
+ *
+ * $Copyright: (c) 2023 Broadcom Inc.
+ * All Rights Reserved.$
+ *
+ */
+
+#ifndef __KBP_INSTALL_STATS_H
+#define __KBP_INSTALL_STATS_H
+
+#include <stdint.h>
+
+#include "errors.h"
+#include "db.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @file kbp_install_stats.h
+ *
+ * Hardware write accounting per install.
+ *
+ * A slow kbp_db_install() may be spending its time in the placement
+ * algorithms or in device writes. The install statistics handle sits on the
+ * device transport and counts the writes each install issues, by kind, and
+ * the bytes they carry. It also counts the index change callbacks of the
+ * database, and how many of them moved an entry that was already in
+ * hardware.
+ *
+ * Create the handle on the transport, pass the returned transport to
+ * kbp_device_init(), register each database with
+ * kbp_install_stats_track_db() and install through
+ * kbp_install_stats_db_install(). Writes made by other threads during the
+ * install are counted towards it.
+ *
+ * @addtogroup DEVICE_API
+ * @{
+ */
+
+/**
+ * Device traffic and entry movement of one or more installs
+ */
+
+struct kbp_db_install_stats {
+    uint64_t num_installs;          /**< Installs counted */
+    uint64_t num_dba_writes;        /**< DBA entry writes */
+    uint64_t num_uda_writes;        /**< UDA writes */
+    uint64_t num_reg_writes;        /**< Register writes */
+    uint64_t num_commands;          /**< Commands: block copy, move and clear, and bulk writes */
+    uint64_t num_stats_writes;      /**< Statistics memory writes */
+    uint64_t num_reads;             /**< Reads of any kind */
+    uint64_t num_bytes;             /**< Bytes written to the device */
+    uint64_t write_ns;              /**< Time spent in transport writes */
+    uint64_t num_index_callbacks;   /**< Index change callbacks */
+    uint64_t num_moves;             /**< Callbacks for entries already in hardware */
+};
+
+/**
+ * Opaque install statistics handle
+ */
+
+struct kbp_install_stats;
+
+/**
+ * Creates an install statistics handle on the device transport.
+ *
+ * @param xpt The device transport, a struct op_xpt or struct op2_xpt.
+ * @param stats Install statistics handle, initialized and returned on success.
+ * @param counted_xpt Set to the transport to pass to kbp_device_init() in place of xpt.
+ *
+ * @return KBP_OK on success or an error code otherwise.
+ */
+
+kbp_status kbp_install_stats_create(void *xpt, struct kbp_install_stats **stats, void **counted_xpt);
+
+/**
+ * Destroys the install statistics handle. The device using the counting
+ * transport must be destroyed first.
+ *
+ * @param stats Valid install statistics handle.
+ *
+ * @return KBP_OK on success or an error code otherwise.
+ */
+
+kbp_status kbp_install_stats_destroy(struct kbp_install_stats *stats);
+
+/**
+ * Registers the index change callback of a database so callbacks are
+ * counted. The database callback is set to a counting wrapper that calls
+ * the user callback, if any. Call this instead of setting
+ * KBP_PROP_INDEX_CALLBACK, before the database is locked.
+ *
+ * @param stats Valid install statistics handle.
+ * @param db Valid database handle.
+ * @param callback User index change callback, may be NULL.
+ * @param handle Passed to callback.
+ *
+ * @return KBP_OK on success or an error code otherwise.
+ */
+
+kbp_status kbp_install_stats_track_db(struct kbp_install_stats *stats, struct kbp_db *db,
+                                      kbp_db_index_callback callback, void *handle);
+
+/**
+ * kbp_db_install() with accounting.
+ *
+ * @param stats Valid install statistics handle.
+ * @param db Valid database handle.
+ *
+ * @return The status of kbp_db_install().
+ */
+
+kbp_status kbp_install_stats_db_install(struct kbp_install_stats *stats, struct kbp_db *db);
+
+/**
+ * Returns the statistics of the last install of a database and the
+ * totals of all its installs.
+ *
+ * @param stats Valid install statistics handle.
+ * @param db Valid database handle.
+ * @param last Last install, may be NULL. Zero if the database was never installed.
+ * @param total Sum over all installs, may be NULL.
+ *
+ * @return KBP_OK on success or an error code otherwise.
+ */
+
+kbp_status kbp_db_get_install_stats(struct kbp_install_stats *stats, struct kbp_db *db,
+                                    struct kbp_db_install_stats *last, struct kbp_db_install_stats *total);
+
+/**
+ * Clears the totals of a database, or of every database if db is NULL.
+ *
+ * @param stats Valid install statistics handle.
+ * @param db Valid database handle or NULL.
+ *
+ * @return KBP_OK on success or an error code otherwise.
+ */
+
+kbp_status kbp_install_stats_reset(struct kbp_install_stats *stats, struct kbp_db *db);
+
+/**
+ * Drops the record of a database. Call it after kbp_db_destroy(), or a
+ * database allocated later at the same address inherits the totals. A
+ * database still in use stops being counted, and its user index callback
+ * is no longer called, until it is tracked again.
+ *
+ * @param stats Valid install statistics handle.
+ * @param db Database handle.
+ *
+ * @return KBP_OK on success or an error code otherwise.
+ */
+
+kbp_status kbp_install_stats_forget(struct kbp_install_stats *stats, struct kbp_db *db);
+
+/**
+ * @}
+ */
+
+#ifdef __cplusplus
+}
+#endif
+#endif                          /* __KBP_INSTALL_STATS_H */
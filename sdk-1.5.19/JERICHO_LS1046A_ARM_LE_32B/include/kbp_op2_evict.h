@@ -0,0 +1,145 @@
+/*
+ * $Id$
+ *
+ * This license is set out in https://raw.githubusercontent.com/Broadcom/Broadcom-Compute-Connectivity-Software-KBP-SDK/master/Legal/LICENSE file.
+ *
+ * $Copyright: (c) 2023 Broadcom Inc.
+ * All Rights Reserved.$
+ *
+ */
+
+#ifndef __KBP_OP2_EVICT_H
+#define __KBP_OP2_EVICT_H
+
+#include <stdint.h>
+
+#include "errors.h"
+#include "device.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @file kbp_op2_evict.h
+ *
+ * Direct reader for the OP2 counter eviction DMA channel.
+ *
+ * For applications that accumulate counters in their own store, the reader
+ * takes over KBP_OP2_TX_DMA_CHANNEL_COUNTER_EVICTION from the SDK. Each
+ * kbp_op2_evict_fetch() scrubs a batch of 64b words from the channel into one
+ * host buffer. kbp_op2_evict_next() decodes the records in place with the
+ * KBP_OP2_COUNTER_MESSAGE_* masks, without copying them to an intermediate
+ * table. kbp_op2_evict_ack() releases the whole batch at once.
+ *
+ * An eviction is a message word (host address, notification bit and counter
+ * type) followed by the 64b counter value. Message words with
+ * KBP_OP2_COUNTER_NOTIFICATION_BIT_MASK set are notifications and are
+ * skipped. The host address is mapped back to a counter database through the
+ * ranges registered with kbp_op2_evict_add_range(). A batch can end between a
+ * message word and its value; the message word is then kept and decoded
+ * with the value after the next fetch.
+ *
+ * While a reader is active the SDK does not see the evictions, so its own
+ * counter values are not updated from dynamic evictions.
+ *
+ * @addtogroup STATS_CE_CT_MGMT_SCHM
+ * @{
+ */
+
+/**
+ * Opaque counter eviction reader
+ */
+
+struct kbp_op2_evict;
+
+/**
+ * Decoded counter eviction
+ */
+
+struct kbp_op2_evict_record {
+    void *counter_db;           /**< Context of the matching range, NULL if no range matches */
+    uint64_t host_addr;         /**< Host memory address of the counter */
+    uint64_t value;             /**< Evicted counter value */
+    uint32_t offset;            /**< Counter offset within its range, in 64b words */
+    uint32_t counter_type;      /**< OP2 counter type */
+};
+
+/**
+ * Creates a counter eviction reader.
+ *
+ * @param device Valid OP2 device handle.
+ * @param batch_words Largest batch scrubbed per fetch in 64b words, zero for KBP_OP2_TX_DMA_BUFFER_SIZE_COUNTER_EVICTION.
+ * @param reader Reader handle, initialized and returned on success.
+ *
+ * @return KBP_OK on success or an error code otherwise.
+ */
+
+kbp_status kbp_op2_evict_create(struct kbp_device *device, uint32_t batch_words, struct kbp_op2_evict **reader);
+
+/**
+ * Destroys the reader. Records not yet fetched stay in the channel.
+ *
+ * @param reader Valid reader handle.
+ *
+ * @return KBP_OK on success or an error code otherwise.
+ */
+
+kbp_status kbp_op2_evict_destroy(struct kbp_op2_evict *reader);
+
+/**
+ * Maps a host address range to a counter database.
+ *
+ * @param reader Valid reader handle.
+ * @param counter_db Caller context returned in ::kbp_op2_evict_record for the range.
+ * @param host_base Host address of the first counter of the range.
+ * @param num_counters Number of 64b counters in the range.
+ *
+ * @return KBP_OK on success or an error code otherwise.
+ */
+
+kbp_status kbp_op2_evict_add_range(struct kbp_op2_evict *reader, void *counter_db, uint64_t host_base,
+                                   uint32_t num_counters);
+
+/**
+ * Scrubs the next batch from the channel. Fails with KBP_INVALID_ARGUMENT if
+ * the previous batch has not been acknowledged.
+ *
+ * @param reader Valid reader handle.
+ * @param num_words Number of 64b words scrubbed, zero if the channel was empty.
+ *
+ * @return KBP_OK on success or an error code otherwise.
+ */
+
+kbp_status kbp_op2_evict_fetch(struct kbp_op2_evict *reader, uint32_t *num_words);
+
+/**
+ * Decodes the next eviction of the current batch.
+ *
+ * @param reader Valid reader handle.
+ * @param record Populated on return when valid is one.
+ * @param valid Set to one if a record was decoded, zero at the end of the batch.
+ *
+ * @return KBP_OK on success or an error code otherwise.
+ */
+
+kbp_status kbp_op2_evict_next(struct kbp_op2_evict *reader, struct kbp_op2_evict_record *record, int32_t *valid);
+
+/**
+ * Acknowledges the current batch so the next fetch can reuse the buffer.
+ *
+ * @param reader Valid reader handle.
+ *
+ * @return KBP_OK on success or an error code otherwise.
+ */
+
+kbp_status kbp_op2_evict_ack(struct kbp_op2_evict *reader);
+
+/**
+ * @}
+ */
+
+#ifdef __cplusplus
+}
+#endif
+#endif                          /* __KBP_OP2_EVICT_H */
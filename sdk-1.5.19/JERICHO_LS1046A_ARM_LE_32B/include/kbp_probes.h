@@ -0,0 +1,93 @@
+/*
+ * $Id$
+ *
+ * This license is set out in https://raw.githubusercontent.com/Broadcom/Broadcom-Compute-Connectivity-Software-KBP-SDK/master/Legal/LICENSE file.
+ *
+ * $Copyright: (c) 2023 Broadcom Inc.
+ * All Rights Reserved.$
+ *
+ */
+
+#ifndef __KBP_PROBES_H
+#define __KBP_PROBES_H
+
+/**
+ * @file kbp_probes.h
+ *
+ * Static tracepoints (USDT) for perf, bpftrace and SystemTap.
+ *
+ * Building with -DKBP_USDT on Linux turns each KBP_PROBEn() into a
+ * sys/sdt.h probe in the "kbp" provider: a single nop in the code and a
+ * note in the ELF file, with the arguments only fetched while a tracer is
+ * attached. Without KBP_USDT the probes compile to nothing and their
+ * arguments are not evaluated. sys/sdt.h comes with the systemtap-sdt-dev
+ * (Debian) or systemtap-sdt-devel (Red Hat) package.
+ *
+ * Probes, all in provider kbp:
+ *
+ * | Probe | Arguments |
+ * | :--- | :--- |
+ * | entry_add_start, entry_add_done | db, status (done) |
+ * | entry_delete_start, entry_delete_done | db, status (done) |
+ * | install_start, install_done | db, status and ns in transport writes (done) |
+ * | search_start, search_done | instruction, status (done) |
+ * | ad_add_start, ad_update_start, ad_delete_start and their _done | ad_db, status (done) |
+ * | wb_save_start, wb_save_done, wb_restore_start, wb_restore_done | device, status (done) |
+ * | hb_timer_start, hb_timer_done | hb_db, status (done) |
+ * | wb_section_load, wb_section_store | image, section, section size |
+ * | entry_move | db, entry, old index, new index |
+ * | index_batch_flush | db, ranges, moves |
+ * | xpt_submit | trace, operation (::kbp_xpt_trace_op) |
+ * | xpt_complete | trace, operation, status, ns, payload bytes |
+ * | dba_parity | trace, address, parity bits |
+ * | ring_drain | channel name, words, percent full, status |
+ * | evict_fetch | device, words, status |
+ *
+ * The _start/_done pairs fire in the kbp_latency_* wrappers, the transport
+ * probes in the kbp_xpt_trace transport, entry_move in the index batch, and
+ * the ring probes in the counter service and the eviction reader. For
+ * example, to see install times per database:
+ *
+ * @code
+ * bpftrace -e 'usdt:./app:kbp:install_start { @s[arg0] = nsecs; }
+ *              usdt:./app:kbp:install_done /@s[arg0]/ { @ns = hist(nsecs - @s[arg0]); delete(@s[arg0]); }'
+ * @endcode
+ *
+ * @addtogroup PORTABILITY_API
+ * @{
+ */
+
+/* #define KBP_USDT */
+
+#if defined(KBP_USDT) && defined(__linux__)
+
+#include <sys/sdt.h>
+
+#define KBP_PROBE0(name)                        DTRACE_PROBE(kbp, name)
+#define KBP_PROBE1(name, a1)                    DTRACE_PROBE1(kbp, name, a1)
+#define KBP_PROBE2(name, a1, a2)                DTRACE_PROBE2(kbp, name, a1, a2)
+#define KBP_PROBE3(name, a1, a2, a3)            DTRACE_PROBE3(kbp, name, a1, a2, a3)
+#define KBP_PROBE4(name, a1, a2, a3, a4)        DTRACE_PROBE4(kbp, name, a1, a2, a3, a4)
+#define KBP_PROBE5(name, a1, a2, a3, a4, a5)    DTRACE_PROBE5(kbp, name, a1, a2, a3, a4, a5)
+
+#else
+
+/*
+ * Probes compiled out. sizeof marks the arguments as used, so variables only
+ * passed to probes do not warn, without evaluating them.
+ */
+
+#define KBP_PROBE0(name)                        do { } while (0)
+#define KBP_PROBE1(name, a1)                    do { (void) sizeof(a1); } while (0)
+#define KBP_PROBE2(name, a1, a2)                do { (void) sizeof(a1); (void) sizeof(a2); } while (0)
+#define KBP_PROBE3(name, a1, a2, a3)            do { KBP_PROBE2(name, a1, a2); (void) sizeof(a3); } while (0)
+#define KBP_PROBE4(name, a1, a2, a3, a4)        do { KBP_PROBE3(name, a1, a2, a3); (void) sizeof(a4); } while (0)
+#define KBP_PROBE5(name, a1, a2, a3, a4, a5)    do { KBP_PROBE4(name, a1, a2, a3, a4); (void) sizeof(a5); } while (0)
+
+#endif
+
+/**
+ * @}
+ */
+
+#endif                          /* __KBP_PROBES_H */
@@ -0,0 +1,296 @@
+/*
+ * $Id$
+ *
+ * This license is set out in https://raw.githubusercontent.com/Broadcom/Broadcom-Compute-Connectivity-Software-KBP-SDK/master/Legal/LICENSE file.
+ *
+ * $Copyright: (c) 2023 Broadcom Inc.
+ * All Rights Reserved.$
+ *
+ */
+
+#include <time.h>
+
+#include "kbp_portable.h"
+#include "kbp_hb_bitmap.h"
+
+/* The bulk read is a DMA; poll it every 100us and give up after at least a second */
+#define KBP_HB_BITMAP_POLL_US           (100)
+#define KBP_HB_BITMAP_MAX_POLLS         (10000)
+
+struct kbp_hb_bitmap {
+    struct kbp_hb_db *hb_db;
+    struct kbp_hb **hbs;        /* hit bit handle per ordinal */
+    uint32_t *free_list;        /* stack of released ordinals */
+    uint32_t num_free;
+    uint32_t high_water;        /* ordinals below this have been handed out */
+    uint32_t capacity;
+    uint32_t cursor;            /* next ordinal to age */
+    uint32_t cycle_running;     /* a paced sweep is in progress */
+    uint64_t cycle_start_ns;    /* start of the paced sweep */
+};
+
+static uint64_t kbp_hb_bitmap_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+kbp_status kbp_hb_bitmap_create(struct kbp_hb_db *hb_db, uint32_t capacity, struct kbp_hb_bitmap **map)
+{
+    struct kbp_hb_bitmap *m;
+
+    if (!hb_db || !capacity || !map)
+        return KBP_INVALID_ARGUMENT;
+
+    m = kbp_syscalloc(1, sizeof(*m));
+    if (!m)
+        return KBP_OUT_OF_MEMORY;
+
+    m->hb_db = hb_db;
+    m->capacity = capacity;
+    m->hbs = kbp_syscalloc(capacity, sizeof(*m->hbs));
+    m->free_list = kbp_sysmalloc(capacity * sizeof(uint32_t));
+    if (!m->hbs || !m->free_list) {
+        kbp_hb_bitmap_destroy(m);
+        return KBP_OUT_OF_MEMORY;
+    }
+
+    *map = m;
+    return KBP_OK;
+}
+
+kbp_status kbp_hb_bitmap_destroy(struct kbp_hb_bitmap *map)
+{
+    if (!map)
+        return KBP_INVALID_ARGUMENT;
+
+    kbp_sysfree(map->hbs);
+    kbp_sysfree(map->free_list);
+    kbp_sysfree(map);
+    return KBP_OK;
+}
+
+/*
+ * Reuses released ordinals first, so the bitmap stays dense
+ */
+static kbp_status kbp_hb_bitmap_alloc(struct kbp_hb_bitmap *map, uint32_t *ordinal)
+{
+    if (map->num_free) {
+        *ordinal = map->free_list[--map->num_free];
+        return KBP_OK;
+    }
+
+    if (map->high_water == map->capacity)
+        return KBP_OUT_OF_MEMORY;
+    *ordinal = map->high_water++;
+    return KBP_OK;
+}
+
+static void kbp_hb_bitmap_release(struct kbp_hb_bitmap *map, uint32_t ordinal)
+{
+    map->hbs[ordinal] = NULL;
+    map->free_list[map->num_free++] = ordinal;
+}
+
+kbp_status kbp_hb_bitmap_add_entry(struct kbp_hb_bitmap *map, struct kbp_hb **hb, uint32_t *ordinal)
+{
+    kbp_status status;
+    uint32_t ord;
+
+    if (!map || !hb || !ordinal)
+        return KBP_INVALID_ARGUMENT;
+
+    status = kbp_hb_bitmap_alloc(map, &ord);
+    if (status != KBP_OK)
+        return status;
+
+    status = kbp_hb_db_add_entry(map->hb_db, hb);
+    if (status != KBP_OK) {
+        kbp_hb_bitmap_release(map, ord);
+        return status;
+    }
+
+    map->hbs[ord] = *hb;
+    *ordinal = ord;
+    return KBP_OK;
+}
+
+kbp_status kbp_hb_bitmap_register(struct kbp_hb_bitmap *map, struct kbp_hb *hb, uint32_t *ordinal)
+{
+    kbp_status status;
+    uint32_t ord;
+
+    if (!map || !hb || !ordinal)
+        return KBP_INVALID_ARGUMENT;
+
+    status = kbp_hb_bitmap_alloc(map, &ord);
+    if (status != KBP_OK)
+        return status;
+
+    map->hbs[ord] = hb;
+    *ordinal = ord;
+    return KBP_OK;
+}
+
+kbp_status kbp_hb_bitmap_delete_entry(struct kbp_hb_bitmap *map, uint32_t ordinal)
+{
+    kbp_status status;
+
+    if (!map || ordinal >= map->high_water || !map->hbs[ordinal])
+        return KBP_INVALID_ARGUMENT;
+
+    status = kbp_hb_db_delete_entry(map->hb_db, map->hbs[ordinal]);
+    if (status != KBP_OK)
+        return status;
+
+    kbp_hb_bitmap_release(map, ordinal);
+    return KBP_OK;
+}
+
+kbp_status kbp_hb_bitmap_get_hb(struct kbp_hb_bitmap *map, uint32_t ordinal, struct kbp_hb **hb)
+{
+    if (!map || !hb || ordinal >= map->capacity)
+        return KBP_INVALID_ARGUMENT;
+
+    *hb = ordinal < map->high_water ? map->hbs[ordinal] : NULL;
+    return KBP_OK;
+}
+
+kbp_status kbp_hb_bitmap_read(struct kbp_hb_bitmap *map, uint8_t *bitmap, uint32_t nbits, uint8_t clear_on_read,
+                              uint32_t *num_hit)
+{
+    uint32_t ordinal, end, hits = 0;
+    int32_t is_complete = 0;
+    uint32_t polls;
+    kbp_status status;
+
+    if (!map || !bitmap || nbits > map->capacity)
+        return KBP_INVALID_ARGUMENT;
+
+    kbp_memset(bitmap, 0, (nbits + 7) / 8);
+
+    status = kbp_hb_db_read_initiate(map->hb_db);
+    if (status != KBP_OK)
+        return status;
+
+    for (polls = 0;; polls++) {
+        status = kbp_hb_db_is_read_complete(map->hb_db, &is_complete);
+        if (status != KBP_OK)
+            return status;
+        if (is_complete)
+            break;
+        if (polls == KBP_HB_BITMAP_MAX_POLLS)
+            return KBP_POLL_TIME_OUT;
+        kbp_usleep(KBP_HB_BITMAP_POLL_US);
+    }
+
+    end = nbits < map->high_water ? nbits : map->high_water;
+    for (ordinal = 0; ordinal < end; ordinal++) {
+        uint32_t bit_value;
+
+        if (!map->hbs[ordinal])
+            continue;
+
+        status = kbp_hb_entry_get_bit_value(map->hb_db, map->hbs[ordinal], &bit_value, clear_on_read);
+        if (status != KBP_OK)
+            return status;
+
+        if (bit_value) {
+            bitmap[ordinal >> 3] |= 1 << (ordinal & 7);
+            hits++;
+        }
+    }
+
+    if (num_hit)
+        *num_hit = hits;
+    return KBP_OK;
+}
+
+kbp_status kbp_hb_bitmap_timer_slice(struct kbp_hb_bitmap *map, uint32_t max_entries, uint32_t max_us,
+                                     int32_t *cycle_done)
+{
+    uint64_t deadline = 0;
+    uint32_t done = 0;
+    kbp_status status;
+
+    if (!map || !cycle_done)
+        return KBP_INVALID_ARGUMENT;
+
+    *cycle_done = 0;
+    if (max_us)
+        deadline = kbp_hb_bitmap_now_ns() + (uint64_t) max_us * 1000;
+
+    while (!max_entries || done < max_entries) {
+        struct kbp_hb *hb;
+
+        if (map->cursor >= map->high_water) {
+            map->cursor = 0;
+            *cycle_done = 1;
+            break;
+        }
+
+        hb = map->hbs[map->cursor++];
+        done++;
+        if (hb) {
+            uint32_t bit_value, idle_count = 0;
+
+            status = kbp_hb_entry_get_bit_value(map->hb_db, hb, &bit_value, 1);
+            if (status != KBP_OK)
+                return status;
+            if (!bit_value) {
+                status = kbp_hb_entry_get_idle_count(map->hb_db, hb, &idle_count);
+                if (status != KBP_OK)
+                    return status;
+                if (idle_count != 0xFFFFFFFF)
+                    idle_count++;
+            }
+            status = kbp_hb_entry_set_idle_count(map->hb_db, hb, idle_count);
+            if (status != KBP_OK)
+                return status;
+        }
+
+        if (map->cursor >= map->high_water) {
+            map->cursor = 0;
+            *cycle_done = 1;
+            break;
+        }
+
+        /* Reading the clock every 64 ordinals keeps it out of the fast path */
+        if (deadline && (done & 63) == 0 && kbp_hb_bitmap_now_ns() >= deadline)
+            break;
+    }
+
+    return KBP_OK;
+}
+
+kbp_status kbp_hb_bitmap_timer_paced(struct kbp_hb_bitmap *map, uint32_t period_us, int32_t *cycle_done)
+{
+    uint64_t now, elapsed, target;
+    kbp_status status;
+
+    if (!map || !period_us || !cycle_done)
+        return KBP_INVALID_ARGUMENT;
+
+    *cycle_done = 0;
+    now = kbp_hb_bitmap_now_ns();
+    if (!map->cycle_running) {
+        map->cycle_running = 1;
+        map->cycle_start_ns = now;
+    }
+
+    elapsed = (now - map->cycle_start_ns) / 1000;
+    if (elapsed >= period_us)
+        target = map->high_water;
+    else
+        target = (uint64_t) map->high_water * elapsed / period_us;
+
+    if (target <= map->cursor)
+        return KBP_OK;
+
+    status = kbp_hb_bitmap_timer_slice(map, (uint32_t) (target - map->cursor), 0, cycle_done);
+    if (*cycle_done)
+        map->cycle_running = 0;
+    return status;
+}
@@ -0,0 +1,363 @@
+/*
+ * $Id$
+ *
+ * This license is set out in https://raw.githubusercontent.com/Broadcom/Broadcom-Compute-Connectivity-Software-KBP-SDK/master/Legal/LICENSE file.
+ *
+ * $Copyright: (c) 2023 Broadcom Inc.
+ * All Rights Reserved.$
+ *
+ */
+
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include "kbp_portable.h"
+#include "default_allocator.h"
+#include "kbp_model_pool.h"
+
+#define KBP_MODEL_POOL_MAX_WORKERS      (64)
+
+/*
+ * One request in the shared batch area. The parent fills in the request,
+ * the worker process owning the slot fills in result and status.
+ */
+struct kbp_model_slot {
+    uint32_t instruction;
+    uint32_t cb_addrs;
+    uint8_t key[KBP_HW_MAX_SEARCH_KEY_WIDTH_8];
+    struct kbp_search_result result;
+    kbp_status status;
+};
+
+/* Parent to worker: evaluate slots [start, end) */
+struct kbp_model_cmd {
+    uint32_t start;
+    uint32_t end;
+};
+
+/* Worker to parent: setup status, or completion of a command */
+struct kbp_model_reply {
+    kbp_status status;
+    uint32_t num_errors;
+};
+
+struct kbp_model_worker {
+    pid_t pid;
+    int fd;                     /* parent end of the socket pair */
+    uint32_t dead;              /* the worker failed setup or stopped answering */
+    uint32_t start;             /* first slot of the current round */
+    uint32_t end;               /* one past the last slot */
+};
+
+struct kbp_model_pool {
+    struct kbp_model_pool_config config;
+    struct kbp_model_worker *workers;
+    struct kbp_model_slot *slots;   /* KBP_MODEL_POOL_BATCH slots shared with the workers */
+    struct kbp_model_pool_stats stats;
+};
+
+static uint64_t kbp_model_pool_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * Sends or receives exactly len bytes. Returns 0 on success, -1 if the
+ * peer is gone.
+ */
+static int32_t kbp_model_pool_send(int fd, const void *buf, uint32_t len)
+{
+    const uint8_t *p = (const uint8_t *) buf;
+
+    while (len) {
+        ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int32_t kbp_model_pool_recv(int fd, void *buf, uint32_t len)
+{
+    uint8_t *p = (uint8_t *) buf;
+
+    while (len) {
+        ssize_t n = recv(fd, p, len, 0);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/*
+ * Body of a worker process. Builds the model, then serves commands until
+ * the parent closes its end of the socket. Never returns.
+ */
+static void kbp_model_pool_worker(struct kbp_model_pool *pool, uint32_t id, int fd)
+{
+    struct kbp_model_pool_config *config = &pool->config;
+    struct kbp_allocator *alloc = NULL;
+    struct kbp_instruction **instructions = NULL;
+    struct kbp_model_reply reply;
+    struct kbp_model_cmd cmd;
+    uint32_t num_instructions = 0, setup_done = 0, i;
+    void *xpt = NULL, *state = NULL;
+
+    reply.num_errors = 0;
+    reply.status = default_allocator_create(&alloc);
+    if (reply.status == KBP_OK)
+        reply.status = kbp_sw_model_init(alloc, config->type, config->flags, config->model_config, &xpt);
+    if (reply.status == KBP_OK)
+        reply.status = config->setup(config->ctx, id, alloc, xpt, &instructions, &num_instructions, &state);
+    setup_done = reply.status == KBP_OK;
+
+    if (kbp_model_pool_send(fd, &reply, sizeof(reply)) == 0 && setup_done) {
+        while (kbp_model_pool_recv(fd, &cmd, sizeof(cmd)) == 0) {
+            reply.status = KBP_OK;
+            reply.num_errors = 0;
+            for (i = cmd.start; i < cmd.end && i < KBP_MODEL_POOL_BATCH; i++) {
+                struct kbp_model_slot *slot = &pool->slots[i];
+
+                if (slot->instruction >= num_instructions)
+                    slot->status = KBP_INVALID_ARGUMENT;
+                else
+                    slot->status = kbp_instruction_search(instructions[slot->instruction], slot->key,
+                                                          slot->cb_addrs, &slot->result);
+                if (slot->status != KBP_OK)
+                    reply.num_errors++;
+            }
+            if (kbp_model_pool_send(fd, &reply, sizeof(reply)) != 0)
+                break;
+        }
+    }
+
+    if (setup_done && config->teardown)
+        config->teardown(config->ctx, id, state);
+    if (xpt)
+        kbp_sw_model_destroy(xpt);
+    if (alloc)
+        default_allocator_destroy(alloc);
+    close(fd);
+    _exit(0);
+}
+
+kbp_status kbp_model_pool_destroy(struct kbp_model_pool *pool)
+{
+    uint32_t i;
+
+    if (!pool)
+        return KBP_INVALID_ARGUMENT;
+
+    /* Closing the socket tells the worker to tear down and exit */
+    for (i = 0; i < pool->config.num_workers; i++) {
+        struct kbp_model_worker *w = &pool->workers[i];
+
+        if (w->fd >= 0)
+            close(w->fd);
+    }
+    for (i = 0; i < pool->config.num_workers; i++) {
+        struct kbp_model_worker *w = &pool->workers[i];
+
+        while (w->pid > 0 && waitpid(w->pid, NULL, 0) < 0 && errno == EINTR)
+            ;
+    }
+
+    if (pool->slots)
+        munmap(pool->slots, KBP_MODEL_POOL_BATCH * sizeof(struct kbp_model_slot));
+    kbp_sysfree(pool->workers);
+    kbp_sysfree(pool);
+    return KBP_OK;
+}
+
+kbp_status kbp_model_pool_create(const struct kbp_model_pool_config *config, struct kbp_model_pool **pool)
+{
+    struct kbp_model_pool *p;
+    kbp_status status = KBP_OK;
+    void *slots;
+    uint32_t i, j;
+
+    if (!config || !config->setup || !pool || config->num_workers > KBP_MODEL_POOL_MAX_WORKERS
+        || !config->key_bytes || config->key_bytes > KBP_HW_MAX_SEARCH_KEY_WIDTH_8)
+        return KBP_INVALID_ARGUMENT;
+
+    p = kbp_syscalloc(1, sizeof(*p));
+    if (!p)
+        return KBP_OUT_OF_MEMORY;
+
+    kbp_memcpy(&p->config, config, sizeof(*config));
+    if (!p->config.num_workers)
+        p->config.num_workers = 1;
+
+    p->workers = kbp_syscalloc(p->config.num_workers, sizeof(*p->workers));
+    if (!p->workers) {
+        p->config.num_workers = 0;
+        kbp_model_pool_destroy(p);
+        return KBP_OUT_OF_MEMORY;
+    }
+    for (i = 0; i < p->config.num_workers; i++)
+        p->workers[i].fd = -1;
+
+    slots = mmap(NULL, KBP_MODEL_POOL_BATCH * sizeof(struct kbp_model_slot), PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (slots == MAP_FAILED) {
+        kbp_model_pool_destroy(p);
+        return KBP_OUT_OF_MEMORY;
+    }
+    p->slots = (struct kbp_model_slot *) slots;
+
+    /* Anything buffered would otherwise be printed again by every worker */
+    fflush(stdout);
+    fflush(stderr);
+
+    for (i = 0; i < p->config.num_workers; i++) {
+        struct kbp_model_worker *w = &p->workers[i];
+        int fds[2];
+
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+            kbp_model_pool_destroy(p);
+            return KBP_OUT_OF_MEMORY;
+        }
+
+        w->pid = fork();
+        if (w->pid < 0) {
+            close(fds[0]);
+            close(fds[1]);
+            kbp_model_pool_destroy(p);
+            return KBP_OUT_OF_MEMORY;
+        }
+        if (w->pid == 0) {
+            /* Drop the sockets of earlier workers, so their EOF is not held up by this process */
+            for (j = 0; j < i; j++)
+                close(p->workers[j].fd);
+            close(fds[0]);
+            kbp_model_pool_worker(p, i, fds[1]);
+        }
+
+        close(fds[1]);
+        w->fd = fds[0];
+    }
+
+    /* The workers set up in parallel; collect their results */
+    for (i = 0; i < p->config.num_workers; i++) {
+        struct kbp_model_reply reply;
+
+        if (kbp_model_pool_recv(p->workers[i].fd, &reply, sizeof(reply)) != 0)
+            reply.status = KBP_INTERNAL_ERROR;
+        if (reply.status != KBP_OK && status == KBP_OK)
+            status = reply.status;
+    }
+    if (status != KBP_OK) {
+        kbp_model_pool_destroy(p);
+        return status;
+    }
+
+    *pool = p;
+    return KBP_OK;
+}
+
+kbp_status kbp_model_pool_search(struct kbp_model_pool *pool, const struct kbp_model_search *requests,
+                                 uint32_t num_requests, struct kbp_search_result *results, kbp_status *status)
+{
+    kbp_status first_error = KBP_OK;
+    uint32_t base, count, i, per_worker, num_workers;
+    uint64_t start_ns, num_errors = 0;
+
+    if (!pool || (num_requests && (!requests || !results)))
+        return KBP_INVALID_ARGUMENT;
+    if (!num_requests)
+        return KBP_OK;
+
+    start_ns = kbp_model_pool_now_ns();
+    num_workers = pool->config.num_workers;
+
+    for (base = 0; base < num_requests; base += count) {
+        count = num_requests - base < KBP_MODEL_POOL_BATCH ? num_requests - base : KBP_MODEL_POOL_BATCH;
+
+        for (i = 0; i < count; i++) {
+            const struct kbp_model_search *req = &requests[base + i];
+            struct kbp_model_slot *slot = &pool->slots[i];
+
+            slot->instruction = req->master_key ? req->instruction : 0xFFFFFFFF;
+            slot->cb_addrs = req->cb_addrs;
+            if (req->master_key)
+                kbp_memcpy(slot->key, req->master_key, pool->config.key_bytes);
+            slot->status = KBP_INTERNAL_ERROR;
+        }
+
+        /* Contiguous chunks keep the result order independent of the worker count */
+        per_worker = (count + num_workers - 1) / num_workers;
+        for (i = 0; i < num_workers; i++) {
+            struct kbp_model_worker *w = &pool->workers[i];
+            struct kbp_model_cmd cmd;
+
+            w->start = i * per_worker < count ? i * per_worker : count;
+            w->end = w->start + per_worker < count ? w->start + per_worker : count;
+            if (w->start == w->end || w->dead)
+                continue;
+
+            cmd.start = w->start;
+            cmd.end = w->end;
+            if (kbp_model_pool_send(w->fd, &cmd, sizeof(cmd)) != 0)
+                w->dead = 1;
+        }
+
+        for (i = 0; i < num_workers; i++) {
+            struct kbp_model_worker *w = &pool->workers[i];
+            struct kbp_model_reply reply;
+
+            if (w->start == w->end || w->dead)
+                continue;
+            if (kbp_model_pool_recv(w->fd, &reply, sizeof(reply)) != 0)
+                w->dead = 1;
+        }
+
+        /* Slots of a worker that died keep KBP_INTERNAL_ERROR */
+        for (i = 0; i < count; i++) {
+            struct kbp_model_slot *slot = &pool->slots[i];
+
+            kbp_memcpy(&results[base + i], &slot->result, sizeof(slot->result));
+            if (status)
+                status[base + i] = slot->status;
+            if (slot->status != KBP_OK) {
+                num_errors++;
+                if (first_error == KBP_OK)
+                    first_error = slot->status;
+            }
+        }
+    }
+
+    pool->stats.num_searches += num_requests;
+    pool->stats.num_errors += num_errors;
+    pool->stats.busy_ns += kbp_model_pool_now_ns() - start_ns;
+
+    if (num_errors)
+        return status ? first_error : KBP_INTERNAL_ERROR;
+    return KBP_OK;
+}
+
+kbp_status kbp_model_pool_get_stats(struct kbp_model_pool *pool, struct kbp_model_pool_stats *stats)
+{
+    if (!pool || !stats)
+        return KBP_INVALID_ARGUMENT;
+
+    kbp_memcpy(stats, &pool->stats, sizeof(*stats));
+    stats->searches_per_sec = stats->busy_ns ? stats->num_searches * 1000000000ULL / stats->busy_ns : 0;
+    return KBP_OK;
+}
@@ -0,0 +1,305 @@
+/*
+ * $Id$
+ *
+ * This license is set out in https://raw.githubusercontent.com/Broadcom/Broadcom-Compute-Connectivity-Software-KBP-SDK/master/Legal/LICENSE file.
+ *
+ * $Copyright: (c) 2023 Broadcom Inc.
+ * All Rights Reserved.$
+ *
+ */
+
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "kbp_portable.h"
+#include "kbp_reconcile.h"
+
+#define KBP_RECONCILE_MAX_THREADS       (64)
+#define KBP_RECONCILE_INIT_ENTRIES      (1024)
+
+struct kbp_reconcile_db {
+    struct kbp_db *db;
+    uintptr_t *entries;         /* sorted entry handles */
+    uint32_t *marked;           /* one bit per entry */
+    uint32_t num_entries;
+    uint32_t num_marked;
+    uint32_t num_unmarked;
+};
+
+struct kbp_reconcile {
+    struct kbp_device *device;
+    struct kbp_reconcile_db *dbs;
+    uint32_t num_dbs;
+    uint32_t num_threads;
+    uint32_t next;              /* next database for the pool */
+    pthread_mutex_t lock;
+    void (*work) (struct kbp_reconcile_db *rdb);
+};
+
+static int kbp_reconcile_cmp(const void *a, const void *b)
+{
+    uintptr_t x = *(const uintptr_t *) a, y = *(const uintptr_t *) b;
+
+    return x < y ? -1 : x > y;
+}
+
+static void kbp_reconcile_sort(struct kbp_reconcile_db *rdb)
+{
+    qsort(rdb->entries, rdb->num_entries, sizeof(uintptr_t), kbp_reconcile_cmp);
+}
+
+/*
+ * Compacts the unmarked entry handles to the front of the snapshot
+ */
+static void kbp_reconcile_scan(struct kbp_reconcile_db *rdb)
+{
+    uint32_t i, n = 0;
+
+    for (i = 0; i < rdb->num_entries; i++) {
+        if ((i & 31) == 0 && rdb->marked[i >> 5] == 0xFFFFFFFF) {
+            i += 31;
+            continue;
+        }
+        if (!(rdb->marked[i >> 5] & (1U << (i & 31))))
+            rdb->entries[n++] = rdb->entries[i];
+    }
+    rdb->num_unmarked = n;
+}
+
+static void *kbp_reconcile_worker(void *arg)
+{
+    struct kbp_reconcile *rec = (struct kbp_reconcile *) arg;
+    uint32_t i;
+
+    for (;;) {
+        pthread_mutex_lock(&rec->lock);
+        i = rec->next++;
+        pthread_mutex_unlock(&rec->lock);
+        if (i >= rec->num_dbs)
+            break;
+        rec->work(&rec->dbs[i]);
+    }
+
+    return NULL;
+}
+
+/*
+ * Runs work on every database, spread over the thread pool
+ */
+static void kbp_reconcile_run(struct kbp_reconcile *rec, void (*work) (struct kbp_reconcile_db *rdb))
+{
+    pthread_t threads[KBP_RECONCILE_MAX_THREADS];
+    uint32_t i, num_threads = rec->num_threads;
+
+    rec->work = work;
+    rec->next = 0;
+
+    if (num_threads > rec->num_dbs)
+        num_threads = rec->num_dbs;
+    for (i = 1; i < num_threads; i++) {
+        if (pthread_create(&threads[i], NULL, kbp_reconcile_worker, rec) != 0)
+            break;
+    }
+    num_threads = i;
+
+    kbp_reconcile_worker(rec);
+    for (i = 1; i < num_threads; i++)
+        pthread_join(threads[i], NULL);
+}
+
+static kbp_status kbp_reconcile_snapshot(struct kbp_reconcile_db *rdb)
+{
+    struct kbp_entry_iter *iter;
+    struct kbp_entry *entry;
+    uint32_t max = KBP_RECONCILE_INIT_ENTRIES;
+    kbp_status status;
+
+    rdb->entries = kbp_sysmalloc(max * sizeof(uintptr_t));
+    if (!rdb->entries)
+        return KBP_OUT_OF_MEMORY;
+
+    status = kbp_db_entry_iter_init(rdb->db, &iter);
+    if (status != KBP_OK)
+        return status;
+
+    for (;;) {
+        status = kbp_db_entry_iter_next(rdb->db, iter, &entry);
+        if (status != KBP_OK || !entry)
+            break;
+
+        if (rdb->num_entries == max) {
+            uintptr_t *entries = kbp_sysmalloc(2 * max * sizeof(uintptr_t));
+
+            if (!entries) {
+                status = KBP_OUT_OF_MEMORY;
+                break;
+            }
+            kbp_memcpy(entries, rdb->entries, max * sizeof(uintptr_t));
+            kbp_sysfree(rdb->entries);
+            rdb->entries = entries;
+            max *= 2;
+        }
+        rdb->entries[rdb->num_entries++] = (uintptr_t) entry;
+    }
+
+    kbp_db_entry_iter_destroy(rdb->db, iter);
+    if (status != KBP_OK)
+        return status;
+
+    rdb->marked = kbp_syscalloc((rdb->num_entries + 31) / 32 + 1, sizeof(uint32_t));
+    if (!rdb->marked)
+        return KBP_OUT_OF_MEMORY;
+    return KBP_OK;
+}
+
+kbp_status kbp_reconcile_abort(struct kbp_reconcile *rec)
+{
+    uint32_t i;
+
+    if (!rec)
+        return KBP_INVALID_ARGUMENT;
+
+    for (i = 0; i < rec->num_dbs; i++) {
+        kbp_sysfree(rec->dbs[i].entries);
+        kbp_sysfree(rec->dbs[i].marked);
+    }
+    pthread_mutex_destroy(&rec->lock);
+    kbp_sysfree(rec->dbs);
+    kbp_sysfree(rec);
+    return KBP_OK;
+}
+
+kbp_status kbp_reconcile_start(struct kbp_device *device, struct kbp_db **dbs, uint32_t num_dbs,
+                               uint32_t num_threads, struct kbp_reconcile **rec)
+{
+    struct kbp_reconcile *r;
+    kbp_status status;
+    uint32_t i;
+
+    if (!device || !dbs || !num_dbs || !rec)
+        return KBP_INVALID_ARGUMENT;
+
+    r = kbp_syscalloc(1, sizeof(*r));
+    if (!r)
+        return KBP_OUT_OF_MEMORY;
+
+    pthread_mutex_init(&r->lock, NULL);
+    r->device = device;
+    r->num_threads = num_threads ? num_threads : 1;
+    if (r->num_threads > KBP_RECONCILE_MAX_THREADS)
+        r->num_threads = KBP_RECONCILE_MAX_THREADS;
+
+    r->dbs = kbp_syscalloc(num_dbs, sizeof(*r->dbs));
+    if (!r->dbs) {
+        kbp_reconcile_abort(r);
+        return KBP_OUT_OF_MEMORY;
+    }
+    r->num_dbs = num_dbs;
+
+    /* The SDK is walked from this thread only, the pool just sorts */
+    for (i = 0; i < num_dbs; i++) {
+        if (!dbs[i]) {
+            kbp_reconcile_abort(r);
+            return KBP_INVALID_ARGUMENT;
+        }
+        r->dbs[i].db = dbs[i];
+        status = kbp_reconcile_snapshot(&r->dbs[i]);
+        if (status != KBP_OK) {
+            kbp_reconcile_abort(r);
+            return status;
+        }
+    }
+
+    kbp_reconcile_run(r, kbp_reconcile_sort);
+
+    *rec = r;
+    return KBP_OK;
+}
+
+kbp_status kbp_reconcile_mark(struct kbp_reconcile *rec, struct kbp_db *db, struct kbp_entry **entries,
+                              uint32_t num_entries)
+{
+    struct kbp_reconcile_db *rdb = NULL;
+    kbp_status status = KBP_OK;
+    uint32_t i;
+
+    if (!rec || !db || (!entries && num_entries))
+        return KBP_INVALID_ARGUMENT;
+
+    for (i = 0; i < rec->num_dbs; i++) {
+        if (rec->dbs[i].db == db) {
+            rdb = &rec->dbs[i];
+            break;
+        }
+    }
+    if (!rdb)
+        return KBP_INVALID_ARGUMENT;
+
+    for (i = 0; i < num_entries; i++) {
+        uintptr_t key = (uintptr_t) entries[i];
+        uint32_t lo = 0, hi = rdb->num_entries;
+
+        while (lo < hi) {
+            uint32_t mid = lo + (hi - lo) / 2;
+
+            if (rdb->entries[mid] < key)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+
+        if (lo == rdb->num_entries || rdb->entries[lo] != key) {
+            status = KBP_INVALID_ARGUMENT;
+            continue;
+        }
+        if (!(rdb->marked[lo >> 5] & (1U << (lo & 31)))) {
+            rdb->marked[lo >> 5] |= 1U << (lo & 31);
+            rdb->num_marked++;
+        }
+    }
+
+    return status;
+}
+
+kbp_status kbp_reconcile_end(struct kbp_reconcile *rec, struct kbp_reconcile_stats *stats)
+{
+    kbp_status status = KBP_OK;
+    uint32_t i, j;
+
+    if (!rec)
+        return KBP_INVALID_ARGUMENT;
+
+    if (stats)
+        kbp_memset(stats, 0, sizeof(*stats));
+
+    kbp_reconcile_run(rec, kbp_reconcile_scan);
+
+    /* Deletes go through the SDK one database at a time */
+    for (i = 0; i < rec->num_dbs; i++) {
+        struct kbp_reconcile_db *rdb = &rec->dbs[i];
+
+        if (stats) {
+            stats->num_dbs++;
+            stats->num_entries += rdb->num_entries;
+            stats->num_marked += rdb->num_marked;
+        }
+
+        if (rdb->num_unmarked == 0)
+            continue;
+
+        for (j = 0; j < rdb->num_unmarked; j++) {
+            status = kbp_db_delete_entry(rdb->db, (struct kbp_entry *) rdb->entries[j]);
+            if (status != KBP_OK)
+                break;
+        }
+        if (status == KBP_OK)
+            status = kbp_db_install(rdb->db);
+        if (status != KBP_OK)
+            break;
+        if (stats)
+            stats->num_deleted += rdb->num_unmarked;
+    }
+
+    kbp_reconcile_abort(rec);
+    return status;
+}
@@ -0,0 +1,113 @@
+/*
+ * $Id$
+ *
+ * This license is set out in https://raw.githubusercontent.com/Broadcom/Broadcom-Compute-Connectivity-Software-KBP-SDK/master/Legal/LICENSE file.
+ *
+ * $Copyright: (c) 2023 Broadcom Inc.
+ * All Rights Reserved.$
+ *
+ */
+
+#include <pthread.h>
+
+#include "kbp_portable.h"
+#include "kbp_wb_async.h"
+
+struct kbp_wb_async {
+    struct kbp_device *device;
+    kbp_device_issu_read_fn read_fn;
+    kbp_device_issu_write_fn write_fn;
+    void *handle;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    uint32_t done;
+    kbp_status status;
+};
+
+static void *kbp_wb_async_worker(void *arg)
+{
+    struct kbp_wb_async *wb = (struct kbp_wb_async *) arg;
+    kbp_status status;
+
+    status = kbp_device_restore_state(wb->device, wb->read_fn, wb->write_fn, wb->handle);
+
+    pthread_mutex_lock(&wb->lock);
+    wb->status = status;
+    wb->done = 1;
+    pthread_cond_broadcast(&wb->cond);
+    pthread_mutex_unlock(&wb->lock);
+    return NULL;
+}
+
+kbp_status kbp_wb_async_restore(struct kbp_device *device, kbp_device_issu_read_fn read_fn,
+                                kbp_device_issu_write_fn write_fn, void *handle, struct kbp_wb_async **wb)
+{
+    struct kbp_wb_async *w;
+
+    if (!device || !read_fn || !write_fn || !wb)
+        return KBP_INVALID_ARGUMENT;
+
+    w = kbp_syscalloc(1, sizeof(*w));
+    if (!w)
+        return KBP_OUT_OF_MEMORY;
+
+    w->device = device;
+    w->read_fn = read_fn;
+    w->write_fn = write_fn;
+    w->handle = handle;
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_cond_init(&w->cond, NULL);
+
+    if (pthread_create(&w->thread, NULL, kbp_wb_async_worker, w) != 0) {
+        pthread_cond_destroy(&w->cond);
+        pthread_mutex_destroy(&w->lock);
+        kbp_sysfree(w);
+        return KBP_OUT_OF_MEMORY;
+    }
+
+    *wb = w;
+    return KBP_OK;
+}
+
+kbp_status kbp_wb_async_poll(struct kbp_wb_async *wb, int32_t *done)
+{
+    if (!wb || !done)
+        return KBP_INVALID_ARGUMENT;
+
+    pthread_mutex_lock(&wb->lock);
+    *done = wb->done;
+    pthread_mutex_unlock(&wb->lock);
+    return KBP_OK;
+}
+
+kbp_status kbp_wb_async_wait(struct kbp_wb_async *wb)
+{
+    kbp_status status;
+
+    if (!wb)
+        return KBP_INVALID_ARGUMENT;
+
+    pthread_mutex_lock(&wb->lock);
+    while (!wb->done)
+        pthread_cond_wait(&wb->cond, &wb->lock);
+    status = wb->status;
+    pthread_mutex_unlock(&wb->lock);
+    return status;
+}
+
+kbp_status kbp_wb_async_destroy(struct kbp_wb_async *wb)
+{
+    kbp_status status;
+
+    if (!wb)
+        return KBP_INVALID_ARGUMENT;
+
+    status = kbp_wb_async_wait(wb);
+    pthread_join(wb->thread, NULL);
+
+    pthread_cond_destroy(&wb->cond);
+    pthread_mutex_destroy(&wb->lock);
+    kbp_sysfree(wb);
+    return status;
+}
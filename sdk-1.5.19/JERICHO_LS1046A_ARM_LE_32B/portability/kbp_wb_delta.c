@@ -0,0 +1,478 @@
+/*
+ * $Id$
+ *
+ * This license is set out in https://raw.githubusercontent.com/Broadcom/Broadcom-Compute-Connectivity-Software-KBP-SDK/master/Legal/LICENSE file.
+ *
+ * $Copyright: (c) 2023 Broadcom Inc.
+ * All Rights Reserved.$
+ *
+ */
+
+#include <stddef.h>
+
+#include "kbp_portable.h"
+#include "kbp_math.h"
+#include "kbp_wb_delta.h"
+
+#define KBP_WB_DELTA_MAGIC              (0x4B574244)    /* KWBD */
+#define KBP_WB_DELTA_REC_MAGIC          (0x4B574252)    /* KWBR */
+#define KBP_WB_DELTA_VERSION            (1)
+#define KBP_WB_DELTA_SB_SPACING         (512)
+#define KBP_WB_DELTA_DATA_START         (4096)
+#define KBP_WB_DELTA_DEFAULT_BLOCK      (4096)
+#define KBP_WB_DELTA_DEFAULT_REBASE     (16)
+#define KBP_WB_DELTA_NO_LOC             (0xFFFFFFFF)
+
+/*
+ * Superblock, two copies at offsets 0 and 512. The copy with the highest
+ * generation and a good CRC describes the current checkpoint.
+ */
+struct kbp_wb_delta_sb {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t generation;
+    uint32_t block_size;
+    uint32_t capacity;
+    uint32_t log_capacity;
+    uint32_t base_slot;
+    uint32_t image_size;
+    uint32_t log_len;
+    uint32_t crc;
+};
+
+/*
+ * Delta log record header, followed by block_size bytes of data
+ */
+struct kbp_wb_delta_rec {
+    uint32_t magic;
+    uint32_t generation;
+    uint32_t block;
+    uint32_t crc;
+};
+
+struct kbp_wb_delta {
+    kbp_device_issu_read_fn read_fn;
+    kbp_device_issu_write_fn write_fn;
+    void *handle;
+    struct kbp_wb_delta_config config;
+    struct kbp_wb_delta_sb sb;          /* last committed superblock */
+    struct kbp_wb_delta_stats stats;
+    uint32_t nblocks;
+    uint32_t *loc;                      /* region offset holding the current content of each block */
+    uint64_t *hash;                     /* content hash of each block at the last save */
+    uint8_t *rec_buf;                   /* record header + staged block */
+    uint8_t *staging;
+    int32_t staged_block;
+    uint32_t full;                      /* current save rewrites the base */
+    uint32_t have_hashes;
+    uint32_t saves_since_base;
+    uint32_t log_len;
+    uint32_t image_size;
+    uint32_t changed_blocks;
+    uint64_t nv_bytes;
+    kbp_status failure;
+};
+
+static uint32_t kbp_wb_delta_base_offset(struct kbp_wb_delta *delta, uint32_t slot)
+{
+    return KBP_WB_DELTA_DATA_START + slot * delta->config.capacity;
+}
+
+static uint32_t kbp_wb_delta_log_offset(struct kbp_wb_delta *delta)
+{
+    return KBP_WB_DELTA_DATA_START + 2 * delta->config.capacity;
+}
+
+static uint32_t kbp_wb_delta_sb_crc(const struct kbp_wb_delta_sb *sb)
+{
+    return kbp_crc32(0, (const uint8_t *) sb, offsetof(struct kbp_wb_delta_sb, crc));
+}
+
+static uint32_t kbp_wb_delta_rec_crc(const struct kbp_wb_delta_rec *rec, const uint8_t *data, uint32_t len)
+{
+    uint32_t crc = kbp_crc32(0, (const uint8_t *) rec, offsetof(struct kbp_wb_delta_rec, crc));
+
+    return kbp_crc32(crc, data, len);
+}
+
+/*
+ * 64b content hash used to detect changed blocks. Wider than CRC32 so that a
+ * changed block is practically never mistaken for an unchanged one.
+ */
+static uint64_t kbp_wb_delta_hash(const uint8_t *data, uint32_t len)
+{
+    uint64_t h = 0x9E3779B97F4A7C15ULL ^ len;
+    uint32_t i;
+
+    for (i = 0; i < len; i += 8) {
+        uint64_t v;
+
+        kbp_memcpy(&v, &data[i], sizeof(v));
+        v *= 0x87C37B91114253D5ULL;
+        v = (v << 31) | (v >> 33);
+        h ^= v * 0x4CF5AD432745937FULL;
+        h = ((h << 27) | (h >> 37)) * 5 + 0x52DCE729;
+    }
+
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+    return h;
+}
+
+static kbp_status kbp_wb_delta_nv_write(struct kbp_wb_delta *delta, uint8_t *buffer, uint32_t size, uint32_t offset)
+{
+    if (delta->write_fn(delta->handle, buffer, size, offset) != 0)
+        return KBP_NV_READ_WRITE_FAILED;
+    delta->nv_bytes += size;
+    return KBP_OK;
+}
+
+static kbp_status kbp_wb_delta_load_sb(struct kbp_wb_delta *delta)
+{
+    struct kbp_wb_delta_sb sb;
+    uint32_t i, found = 0;
+
+    for (i = 0; i < 2; i++) {
+        if (delta->read_fn(delta->handle, (uint8_t *) &sb, sizeof(sb), i * KBP_WB_DELTA_SB_SPACING) != 0)
+            continue;
+        if (sb.magic != KBP_WB_DELTA_MAGIC || sb.version != KBP_WB_DELTA_VERSION
+            || sb.crc != kbp_wb_delta_sb_crc(&sb))
+            continue;
+        if (sb.block_size != delta->config.block_size || sb.capacity != delta->config.capacity
+            || sb.log_capacity != delta->config.log_capacity)
+            continue;
+        if (!found || sb.generation > delta->sb.generation) {
+            kbp_memcpy(&delta->sb, &sb, sizeof(sb));
+            found = 1;
+        }
+    }
+
+    if (!found)
+        return KBP_NV_DATA_CORRUPT;
+    return KBP_OK;
+}
+
+/*
+ * Writes out the staged block: into the new base slot for a full save, or
+ * appended to the log when its content changed since the last save.
+ */
+static kbp_status kbp_wb_delta_finalize(struct kbp_wb_delta *delta)
+{
+    struct kbp_wb_delta_rec *rec = (struct kbp_wb_delta_rec *) delta->rec_buf;
+    uint32_t bs = delta->config.block_size;
+    uint32_t blk, offset;
+    kbp_status status;
+    uint64_t h;
+
+    if (delta->staged_block < 0)
+        return KBP_OK;
+
+    blk = delta->staged_block;
+    delta->staged_block = -1;
+
+    h = kbp_wb_delta_hash(delta->staging, bs);
+    if (!delta->full && delta->have_hashes && delta->hash[blk] == h)
+        return KBP_OK;
+
+    if (delta->full) {
+        offset = kbp_wb_delta_base_offset(delta, delta->sb.base_slot ^ 1) + blk * bs;
+        status = kbp_wb_delta_nv_write(delta, delta->staging, bs, offset);
+        if (status != KBP_OK)
+            return status;
+        delta->loc[blk] = offset;
+    } else {
+        if (delta->config.log_capacity - delta->log_len < sizeof(*rec) + bs)
+            return KBP_EXHAUSTED_NV_MEMORY;
+        rec->magic = KBP_WB_DELTA_REC_MAGIC;
+        rec->generation = delta->sb.generation + 1;
+        rec->block = blk;
+        rec->crc = kbp_wb_delta_rec_crc(rec, delta->staging, bs);
+        offset = kbp_wb_delta_log_offset(delta) + delta->log_len;
+        status = kbp_wb_delta_nv_write(delta, delta->rec_buf, sizeof(*rec) + bs, offset);
+        if (status != KBP_OK)
+            return status;
+        delta->loc[blk] = offset + sizeof(*rec);
+        delta->log_len += sizeof(*rec) + bs;
+    }
+
+    delta->hash[blk] = h;
+    delta->changed_blocks++;
+    return KBP_OK;
+}
+
+static int32_t kbp_wb_delta_read_cb(void *handle, uint8_t *buffer, uint32_t size, uint32_t offset)
+{
+    struct kbp_wb_delta *delta = (struct kbp_wb_delta *) handle;
+    uint32_t bs = delta->config.block_size;
+
+    if ((uint64_t) offset + size > delta->config.capacity)
+        return 1;
+
+    while (size) {
+        uint32_t blk = offset / bs;
+        uint32_t off = offset % bs;
+        uint32_t n = bs - off;
+
+        if (n > size)
+            n = size;
+
+        if ((int32_t) blk == delta->staged_block) {
+            kbp_memcpy(buffer, &delta->staging[off], n);
+        } else if (delta->loc[blk] == KBP_WB_DELTA_NO_LOC) {
+            kbp_memset(buffer, 0, n);
+        } else {
+            /* Coalesce blocks that are contiguous in the region into one read */
+            while (n < size && blk + 1 < delta->nblocks && (int32_t) (blk + 1) != delta->staged_block
+                   && delta->loc[blk + 1] == delta->loc[blk] + bs) {
+                blk++;
+                n += (size - n < bs) ? size - n : bs;
+            }
+            if (delta->read_fn(delta->handle, buffer, n, delta->loc[offset / bs] + off) != 0)
+                return 1;
+        }
+
+        buffer += n;
+        offset += n;
+        size -= n;
+    }
+
+    return 0;
+}
+
+static int32_t kbp_wb_delta_write_cb(void *handle, uint8_t *buffer, uint32_t size, uint32_t offset)
+{
+    struct kbp_wb_delta *delta = (struct kbp_wb_delta *) handle;
+    uint32_t bs = delta->config.block_size;
+    kbp_status status;
+
+    if ((uint64_t) offset + size > delta->config.capacity) {
+        delta->failure = KBP_EXHAUSTED_NV_MEMORY;
+        return 1;
+    }
+
+    if (offset + size > delta->image_size)
+        delta->image_size = offset + size;
+
+    while (size) {
+        uint32_t blk = offset / bs;
+        uint32_t off = offset % bs;
+        uint32_t n = bs - off;
+
+        if (n > size)
+            n = size;
+
+        if ((int32_t) blk != delta->staged_block) {
+            status = kbp_wb_delta_finalize(delta);
+            if (status != KBP_OK) {
+                delta->failure = status;
+                return 1;
+            }
+            if (n < bs) {
+                /* Partial block, start from its current content */
+                if (delta->loc[blk] == KBP_WB_DELTA_NO_LOC)
+                    kbp_memset(delta->staging, 0, bs);
+                else if (delta->read_fn(delta->handle, delta->staging, bs, delta->loc[blk]) != 0) {
+                    delta->failure = KBP_NV_READ_WRITE_FAILED;
+                    return 1;
+                }
+            }
+            delta->staged_block = blk;
+        }
+
+        kbp_memcpy(&delta->staging[off], buffer, n);
+        buffer += n;
+        offset += n;
+        size -= n;
+    }
+
+    return 0;
+}
+
+static kbp_status kbp_wb_delta_do_save(struct kbp_wb_delta *delta, struct kbp_device *device, uint32_t full)
+{
+    struct kbp_wb_delta_sb sb;
+    kbp_status status;
+
+    delta->full = full;
+    delta->staged_block = -1;
+    delta->log_len = full ? 0 : delta->sb.log_len;
+    delta->image_size = 0;
+    delta->changed_blocks = 0;
+    delta->nv_bytes = 0;
+    delta->failure = KBP_OK;
+
+    status = kbp_device_save_state_and_continue(device, kbp_wb_delta_read_cb, kbp_wb_delta_write_cb, delta);
+    if (status == KBP_OK)
+        status = kbp_wb_delta_finalize(delta);
+    if (status != KBP_OK) {
+        delta->have_hashes = 0;
+        return delta->failure != KBP_OK ? delta->failure : status;
+    }
+
+    kbp_memcpy(&sb, &delta->sb, sizeof(sb));
+    sb.magic = KBP_WB_DELTA_MAGIC;
+    sb.version = KBP_WB_DELTA_VERSION;
+    sb.generation++;
+    sb.block_size = delta->config.block_size;
+    sb.capacity = delta->config.capacity;
+    sb.log_capacity = delta->config.log_capacity;
+    if (full)
+        sb.base_slot ^= 1;
+    sb.image_size = delta->image_size;
+    sb.log_len = delta->log_len;
+    sb.crc = kbp_wb_delta_sb_crc(&sb);
+
+    status = kbp_wb_delta_nv_write(delta, (uint8_t *) &sb, sizeof(sb), (sb.generation & 1) * KBP_WB_DELTA_SB_SPACING);
+    if (status != KBP_OK) {
+        delta->have_hashes = 0;
+        return status;
+    }
+
+    kbp_memcpy(&delta->sb, &sb, sizeof(sb));
+    delta->have_hashes = 1;
+    delta->saves_since_base = full ? 0 : delta->saves_since_base + 1;
+
+    delta->stats.num_saves++;
+    if (full)
+        delta->stats.num_full_saves++;
+    delta->stats.image_bytes += delta->image_size;
+    delta->stats.nv_bytes_written += delta->nv_bytes;
+    delta->stats.last_image_size = delta->image_size;
+    delta->stats.last_changed_blocks = delta->changed_blocks;
+    return KBP_OK;
+}
+
+kbp_status kbp_wb_delta_create(const struct kbp_wb_delta_config *config, kbp_device_issu_read_fn read_fn,
+                               kbp_device_issu_write_fn write_fn, void *handle, struct kbp_wb_delta **delta)
+{
+    struct kbp_wb_delta *d;
+    uint32_t bs, i;
+    uint64_t end;
+
+    if (!config || !read_fn || !write_fn || !delta)
+        return KBP_INVALID_ARGUMENT;
+
+    bs = config->block_size ? config->block_size : KBP_WB_DELTA_DEFAULT_BLOCK;
+    if (bs < 512 || (bs & (bs - 1)) || config->capacity == 0)
+        return KBP_INVALID_ARGUMENT;
+
+    d = kbp_syscalloc(1, sizeof(*d));
+    if (!d)
+        return KBP_OUT_OF_MEMORY;
+
+    d->read_fn = read_fn;
+    d->write_fn = write_fn;
+    d->handle = handle;
+    d->config.block_size = bs;
+    d->config.capacity = (config->capacity + bs - 1) & ~(bs - 1);
+    d->config.log_capacity = config->log_capacity;
+    d->config.rebase_interval = config->rebase_interval ? config->rebase_interval : KBP_WB_DELTA_DEFAULT_REBASE;
+
+    end = KBP_WB_DELTA_DATA_START + 2ULL * d->config.capacity + d->config.log_capacity;
+    if (end > 0xFFFFFFFFULL) {
+        kbp_sysfree(d);
+        return KBP_INVALID_ARGUMENT;
+    }
+
+    d->nblocks = d->config.capacity / bs;
+    d->loc = kbp_sysmalloc(d->nblocks * sizeof(uint32_t));
+    d->hash = kbp_syscalloc(d->nblocks, sizeof(uint64_t));
+    d->rec_buf = kbp_sysmalloc(sizeof(struct kbp_wb_delta_rec) + bs);
+    if (!d->loc || !d->hash || !d->rec_buf) {
+        kbp_wb_delta_destroy(d);
+        return KBP_OUT_OF_MEMORY;
+    }
+    d->staging = d->rec_buf + sizeof(struct kbp_wb_delta_rec);
+    d->staged_block = -1;
+    for (i = 0; i < d->nblocks; i++)
+        d->loc[i] = KBP_WB_DELTA_NO_LOC;
+
+    /* Pick up an existing checkpoint so the first full save goes to the other slot */
+    if (kbp_wb_delta_load_sb(d) != KBP_OK)
+        kbp_memset(&d->sb, 0, sizeof(d->sb));
+
+    *delta = d;
+    return KBP_OK;
+}
+
+kbp_status kbp_wb_delta_destroy(struct kbp_wb_delta *delta)
+{
+    if (!delta)
+        return KBP_INVALID_ARGUMENT;
+
+    kbp_sysfree(delta->loc);
+    kbp_sysfree(delta->hash);
+    kbp_sysfree(delta->rec_buf);
+    kbp_sysfree(delta);
+    return KBP_OK;
+}
+
+kbp_status kbp_wb_delta_save(struct kbp_wb_delta *delta, struct kbp_device *device)
+{
+    kbp_status status;
+    uint32_t full;
+
+    if (!delta || !device)
+        return KBP_INVALID_ARGUMENT;
+
+    full = !delta->have_hashes
+        || delta->saves_since_base >= delta->config.rebase_interval
+        || delta->sb.log_len > delta->config.log_capacity / 2;
+
+    status = kbp_wb_delta_do_save(delta, device, full);
+    if (status == KBP_EXHAUSTED_NV_MEMORY && !full)
+        status = kbp_wb_delta_do_save(delta, device, 1);
+
+    return status;
+}
+
+kbp_status kbp_wb_delta_restore(struct kbp_wb_delta *delta, struct kbp_device *device)
+{
+    struct kbp_wb_delta_rec rec;
+    uint32_t bs, i, nblocks, base, log, off;
+    kbp_status status;
+
+    if (!delta || !device)
+        return KBP_INVALID_ARGUMENT;
+
+    status = kbp_wb_delta_load_sb(delta);
+    if (status != KBP_OK)
+        return status;
+
+    bs = delta->config.block_size;
+    nblocks = (delta->sb.image_size + bs - 1) / bs;
+    if (nblocks > delta->nblocks || delta->sb.log_len > delta->config.log_capacity)
+        return KBP_NV_DATA_CORRUPT;
+
+    base = kbp_wb_delta_base_offset(delta, delta->sb.base_slot);
+    for (i = 0; i < delta->nblocks; i++)
+        delta->loc[i] = (i < nblocks) ? base + i * bs : KBP_WB_DELTA_NO_LOC;
+
+    /* Replay the committed log, later records override earlier ones */
+    log = kbp_wb_delta_log_offset(delta);
+    for (off = 0; off < delta->sb.log_len; off += sizeof(rec) + bs) {
+        if (delta->read_fn(delta->handle, (uint8_t *) &rec, sizeof(rec), log + off) != 0
+            || delta->read_fn(delta->handle, delta->staging, bs, log + off + sizeof(rec)) != 0)
+            return KBP_NV_READ_WRITE_FAILED;
+        if (rec.magic != KBP_WB_DELTA_REC_MAGIC || rec.generation > delta->sb.generation
+            || rec.block >= nblocks || rec.crc != kbp_wb_delta_rec_crc(&rec, delta->staging, bs))
+            return KBP_NV_DATA_CORRUPT;
+        delta->loc[rec.block] = log + off + sizeof(rec);
+    }
+
+    delta->staged_block = -1;
+    delta->have_hashes = 0;
+    delta->saves_since_base = 0;
+
+    return kbp_device_restore_state(device, kbp_wb_delta_read_cb, kbp_wb_delta_write_cb, delta);
+}
+
+kbp_status kbp_wb_delta_get_stats(struct kbp_wb_delta *delta, struct kbp_wb_delta_stats *stats)
+{
+    if (!delta || !stats)
+        return KBP_INVALID_ARGUMENT;
+
+    kbp_memcpy(stats, &delta->stats, sizeof(*stats));
+    return KBP_OK;
+}
@@ -0,0 +1,95 @@
+/*
+ * $Id$
+ *
+ * This license is set out in https://raw.githubusercontent.com/Broadcom/Broadcom-Compute-Connectivity-Software-KBP-SDK/master/Legal/LICENSE file.
+ *
+ * $Copyright: (c) 2023 Broadcom Inc.
+ * All Rights Reserved.$
+ *
+ */
+
+#ifndef __KBP_HB_VISIT_H
+#define __KBP_HB_VISIT_H
+
+#include <stdint.h>
+
+#include "errors.h"
+#include "db.h"
+#include "kbp_hb.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @file kbp_hb_visit.h
+ *
+ * Streaming visitor over aged entries.
+ *
+ * kbp_hb_db_for_each_aged() walks the aged entries of a hit bit database and
+ * calls back with the entry, its database, hit bit and idle count, so no
+ * handle buffer needs to be sized and the entries are not looked up a second
+ * time. The callback can ask for the entry to be deleted. Deletes are queued
+ * while the iterator is live and applied with a single kbp_db_install() once
+ * the walk is done.
+ *
+ * @addtogroup HB_API
+ * @{
+ */
+
+/**
+ * Callback return flag: keep the entry
+ */
+#define KBP_HB_AGED_KEEP (0)
+
+/**
+ * Callback return flag: delete the entry once the walk is done
+ */
+#define KBP_HB_AGED_DELETE (1 << 0)
+
+/**
+ * Callback return flag: stop the walk after this entry
+ */
+#define KBP_HB_AGED_STOP (1 << 1)
+
+/**
+ * Aged entry visitor.
+ *
+ * @param ctx Caller context passed to kbp_hb_db_for_each_aged().
+ * @param db Database the entry belongs to.
+ * @param entry Aged entry.
+ * @param hb Hit bit of the entry.
+ * @param idle_count Idle count of the hit bit.
+ *
+ * @return KBP_HB_AGED_KEEP, or a combination of KBP_HB_AGED_DELETE and KBP_HB_AGED_STOP.
+ */
+
+typedef uint32_t (*kbp_hb_aged_visit_fn) (void *ctx, struct kbp_db *db, struct kbp_entry *entry,
+                                          struct kbp_hb *hb, uint32_t idle_count);
+
+/**
+ * Calls visit for every aged entry, then deletes the entries it selected and
+ * installs the database once.
+ *
+ * @param hb_db Valid hit bit database handle.
+ * @param db Database whose entries use the hit bits.
+ * @param visit Visitor callback.
+ * @param ctx Passed back to visit.
+ * @param max Stop after this many entries, zero for no limit.
+ * @param num_visited Number of entries visited, returned if not NULL.
+ * @param num_deleted Number of entries deleted, returned if not NULL.
+ *
+ * @return KBP_OK on success or an error code otherwise.
+ */
+
+kbp_status kbp_hb_db_for_each_aged(struct kbp_hb_db *hb_db, struct kbp_db *db, kbp_hb_aged_visit_fn visit,
+                                   void *ctx, uint32_t max, uint32_t *num_visited, uint32_t *num_deleted);
+
+/**
+ * @}
+ */
+
+#ifdef __cplusplus
+}
+#endif
+#endif                          /* __KBP_HB_VISIT_H */
@@ -0,0 +1,146 @@
+/*
+ * $Id$
+ *
+ * This license is set out in https://raw.githubusercontent.com/Broadcom/Broadcom-Compute-Connectivity-Software-KBP-SDK/master/Legal/LICENSE file.
+ *
+ * $Copyright: (c) 2023 Broadcom Inc.
+ * All Rights Reserved.$
+ *
+ */
+
+#ifndef __KBP_LOG_H
+#define __KBP_LOG_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdarg.h>
+
+#include "errors.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @file kbp_log.h
+ *
+ * Asynchronous binary logging for the portability layer. When enabled,
+ * kbp_printf(), kbp_vprintf(), kbp_fprintf(), kbp_vfprintf() and the
+ * KBP_TRACE_IN/OUT macros do not format on the calling thread. Instead the
+ * timestamp, the format string pointer (used as the format ID) and the raw
+ * arguments are stored in a lock-free ring owned by the calling thread. A
+ * background drainer formats the records in timestamp order and hands the
+ * text to a pluggable sink. Records that do not fit in a full ring are
+ * dropped and counted.
+ *
+ * Format strings that do not live in the executable image, or that need more
+ * than ::KBP_LOG_MAX_ARGS arguments, are formatted on the calling thread into
+ * the record so that the output is always correct.
+ *
+ * Records keep the FILE pointer they were printed to. kbp_fclose() flushes
+ * the log first; a stream closed with plain fclose() needs a
+ * kbp_log_flush() before it.
+ *
+ * @addtogroup PORTABILITY_API
+ * @{
+ */
+
+/**
+ * Maximum number of arguments stored in binary form per record
+ */
+#define KBP_LOG_MAX_ARGS (16)
+
+/**
+ * Bytes available per record for copies of string (%s) arguments
+ */
+#define KBP_LOG_MAX_STR_BYTES (112)
+
+/**
+ * Sink callback invoked by the drainer thread with formatted text.
+ *
+ * @param handle The sink_handle passed in ::kbp_log_config.
+ * @param fp The stream the original print call was directed to (stdout for kbp_printf()).
+ * @param text The formatted message, not NUL terminated.
+ * @param len The number of valid bytes in text.
+ */
+typedef void (*kbp_log_sink_fn) (void *handle, FILE *fp, const char *text, uint32_t len);
+
+/**
+ * Configuration for the asynchronous log. ring_entries may be at most 2^31.
+ */
+struct kbp_log_config {
+    uint32_t ring_entries;      /**< Records per thread ring, rounded up to a power of two. Zero picks 4096 */
+    uint32_t drain_interval_us; /**< Drainer sleep when all rings are empty. Zero picks 1000 */
+    kbp_log_sink_fn sink;       /**< Output sink, NULL writes to the original stream */
+    void *sink_handle;          /**< Opaque handle passed back to sink */
+};
+
+/**
+ * Asynchronous log statistics
+ */
+struct kbp_log_stats {
+    uint64_t num_records;       /**< Records captured in binary form */
+    uint64_t num_preformatted;  /**< Records formatted on the calling thread */
+    uint64_t num_dropped;       /**< Records dropped because the thread ring was full */
+    uint64_t num_drained;       /**< Records written out by the drainer */
+    uint32_t num_rings;         /**< Thread rings currently registered */
+};
+
+/**
+ * Enables asynchronous logging and starts the drainer thread.
+ *
+ * @param config Configuration, NULL for defaults.
+ *
+ * @return KBP_OK on success or an error code otherwise.
+ */
+
+kbp_status kbp_log_async_enable(const struct kbp_log_config *config);
+
+/**
+ * Stops the drainer thread after writing out all pending records. Subsequent
+ * print calls are synchronous again.
+ *
+ * @return KBP_OK on success or an error code otherwise.
+ */
+
+kbp_status kbp_log_async_disable(void);
+
+/**
+ * Synchronously writes out every record captured so far. Safe to call from any
+ * thread, including from an assert path before aborting.
+ */
+
+void kbp_log_flush(void);
+
+/**
+ * Returns the asynchronous log statistics.
+ *
+ * @param stats Valid pointer populated on return.
+ *
+ * @return KBP_OK on success or an error code otherwise.
+ */
+
+kbp_status kbp_log_get_stats(struct kbp_log_stats *stats);
+
+/**
+ * Captures one print call into the calling thread's ring. Used by the
+ * portability print functions.
+ *
+ * @param fp Destination stream.
+ * @param fmt printf-style format.
+ * @param ap Arguments for fmt.
+ *
+ * @retval 0 The call was captured (or dropped and counted).
+ * @retval -1 Asynchronous logging is disabled; the caller must print synchronously.
+ */
+
+int32_t kbp_log_vrecord(FILE *fp, const char *fmt, va_list ap);
+
+/**
+ * @}
+ */
+
+#ifdef __cplusplus
+}
+#endif
+#endif                          /* __KBP_LOG_H */
@@ -0,0 +1,190 @@
+/*
+ * $Id$
+ *
+ * This license is set out in https://raw.githubusercontent.com/Broadcom/Broadcom-Compute-Connectivity-Software-KBP-SDK/master/Legal/LICENSE file.
+ *
+ * $Copyright: (c) 2023 Broadcom Inc.
+ * All Rights Reserved.$
+ *
+ */
+
+#ifndef __KBP_MODEL_POOL_H
+#define __KBP_MODEL_POOL_H
+
+#include <stdint.h>
+
+#include "errors.h"
+#include "allocator.h"
+#include "device.h"
+#include "instruction.h"
+#include "model.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @file kbp_model_pool.h
+ *
+ * Parallel search evaluation on the software model.
+ *
+ * A software model instance evaluates one search at a time, and the model
+ * library keeps global state, so two instances cannot run in the same process
+ * at once. The pool therefore forks one worker process per model instance.
+ * In each worker the caller's setup callback brings the model to the same
+ * configuration: device, databases, entries and instructions.
+ * kbp_model_pool_search() then splits a batch of independent searches across
+ * the workers. Requests and results travel through memory shared with the
+ * workers. Each result is written at the index of its request, so the output
+ * order is the same for any number of workers.
+ *
+ * Setup and teardown run in the worker process. They see a copy of the
+ * caller's memory as it was at kbp_model_pool_create(), and nothing they
+ * change is visible to the caller. Since fork() only copies the calling
+ * thread, create the pool before starting threads that hold locks setup may
+ * need.
+ *
+ * Every worker holds a full copy of the device state. Memory use grows with
+ * the number of workers, and entries must be added through the setup callback
+ * to keep the copies identical.
+ *
+ * @addtogroup DEVICE_API
+ * @{
+ */
+
+/**
+ * Number of requests handed to the workers at a time. Larger batches are
+ * evaluated in rounds of this size.
+ */
+#define KBP_MODEL_POOL_BATCH (1024)
+
+/**
+ * Opaque model pool handle
+ */
+
+struct kbp_model_pool;
+
+/**
+ * Worker setup callback, run in the worker process. Builds the device on the
+ * model transport and returns the instructions searches can refer to.
+ *
+ * @param ctx Context from ::kbp_model_pool_config.
+ * @param worker Worker number, starting at zero.
+ * @param alloc Allocator of the worker.
+ * @param xpt Model transport of the worker.
+ * @param instructions Set to an array of installed instructions, owned by the caller.
+ * @param num_instructions Set to the number of instructions.
+ * @param state Caller state of the worker, passed back to teardown.
+ *
+ * @return KBP_OK on success or an error code otherwise.
+ */
+
+typedef kbp_status (*kbp_model_pool_setup_fn) (void *ctx, uint32_t worker, struct kbp_allocator *alloc, void *xpt,
+                                               struct kbp_instruction ***instructions, uint32_t *num_instructions,
+                                               void **state);
+
+/**
+ * Worker teardown callback, run in the worker process before it exits.
+ * Destroys what setup created on the worker.
+ *
+ * @param ctx Context from ::kbp_model_pool_config.
+ * @param worker Worker number.
+ * @param state Caller state returned by setup.
+ */
+
+typedef void (*kbp_model_pool_teardown_fn) (void *ctx, uint32_t worker, void *state);
+
+/**
+ * Model pool configuration
+ */
+
+struct kbp_model_pool_config {
+    uint32_t num_workers;       /**< Number of worker processes, one model instance each. Zero for one */
+    enum kbp_device_type type;  /**< Device type passed to kbp_sw_model_init() */
+    uint32_t flags;             /**< ::kbp_device_flags passed to kbp_sw_model_init() */
+    struct kbp_sw_model_config *model_config; /**< Model configuration, NULL for the default */
+    kbp_model_pool_setup_fn setup; /**< Worker setup callback */
+    kbp_model_pool_teardown_fn teardown; /**< Worker teardown callback, may be NULL */
+    void *ctx;                  /**< Passed back to setup and teardown */
+    uint32_t key_bytes;         /**< Master key bytes sent per search, at most KBP_HW_MAX_SEARCH_KEY_WIDTH_8 */
+};
+
+/**
+ * One search request
+ */
+
+struct kbp_model_search {
+    uint32_t instruction;       /**< Index into the instructions returned by setup */
+    uint32_t cb_addrs;          /**< Context buffer address */
+    uint8_t *master_key;        /**< Master key, ::kbp_model_pool_config key_bytes long */
+};
+
+/**
+ * Model pool statistics
+ */
+
+struct kbp_model_pool_stats {
+    uint64_t num_searches;      /**< Searches evaluated */
+    uint64_t num_errors;        /**< Searches that returned an error */
+    uint64_t busy_ns;           /**< Wall clock time spent in kbp_model_pool_search() */
+    uint64_t searches_per_sec;  /**< Throughput over busy_ns */
+};
+
+/**
+ * Forks the worker processes and waits for setup to finish in each of them.
+ *
+ * @param config Pool configuration.
+ * @param pool Pool handle, initialized and returned on success.
+ *
+ * @return KBP_OK on success or an error code otherwise.
+ */
+
+kbp_status kbp_model_pool_create(const struct kbp_model_pool_config *config, struct kbp_model_pool **pool);
+
+/**
+ * Stops the worker processes, which run teardown and destroy their models, and
+ * waits for them to exit.
+ *
+ * @param pool Valid pool handle.
+ *
+ * @return KBP_OK on success or an error code otherwise.
+ */
+
+kbp_status kbp_model_pool_destroy(struct kbp_model_pool *pool);
+
+/**
+ * Evaluates a batch of searches across the workers.
+ *
+ * @param pool Valid pool handle.
+ * @param requests Search requests.
+ * @param num_requests Number of requests.
+ * @param results Caller array of num_requests results, result i belongs to request i.
+ * @param status Caller array of num_requests statuses, may be NULL.
+ *
+ * @return KBP_OK if every search succeeded, otherwise the error of the first failed request,
+ *         or KBP_INTERNAL_ERROR if status is NULL. Requests handled by a worker
+ *         process that has died fail with KBP_INTERNAL_ERROR.
+ */
+
+kbp_status kbp_model_pool_search(struct kbp_model_pool *pool, const struct kbp_model_search *requests,
+                                 uint32_t num_requests, struct kbp_search_result *results, kbp_status *status);
+
+/**
+ * Returns the pool statistics.
+ *
+ * @param pool Valid pool handle.
+ * @param stats Valid pointer populated on return.
+ *
+ * @return KBP_OK on success or an error code otherwise.
+ */
+
+kbp_status kbp_model_pool_get_stats(struct kbp_model_pool *pool, struct kbp_model_pool_stats *stats);
+
+/**
+ * @}
+ */
+
+#ifdef __cplusplus
+}
+#endif
+#endif                          /* __KBP_MODEL_POOL_H */
@@ -0,0 +1,114 @@
+/*
+ * $Id$
+ *
+ * This license is set out in https://raw.githubusercontent.com/Broadcom/Broadcom-Compute-Connectivity-Software-KBP-SDK/master/Legal/LICENSE file.
+ *
+ * $Copyright: (c) 2023 Broadcom Inc.
+ * All Rights Reserved.$
+ *
+ */
+
+#ifndef __KBP_TAP_SNAPSHOT_H
+#define __KBP_TAP_SNAPSHOT_H
+
+#include <stdint.h>
+
+#include "errors.h"
+#include "tap.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @file kbp_tap_snapshot.h
+ *
+ * Snapshot reads of a TAP database into a caller array.
+ *
+ * kbp_tap_snapshot_read() optionally refreshes the host copy of the database
+ * (kbp_tap_db_read_initiate() and kbp_tap_db_is_read_complete()), then
+ * copies a contiguous range of entries, all counter offsets of each, into one
+ * array in a single pass. It can clear the host copy as it reads, like the
+ * pa_entry variants, and can return the change since the previous snapshot
+ * instead of the running value.
+ *
+ * The array holds one 64b word per entry and offset for single entry
+ * databases, and a packet count followed by a byte count for pair databases,
+ * in entry major order.
+ *
+ * @addtogroup TAP_API
+ * @{
+ */
+
+/**
+ * Snapshot flag: refresh the host copy from the device before reading
+ */
+#define KBP_TAP_SNAPSHOT_REFRESH (1 << 0)
+
+/**
+ * Snapshot flag: clear the host copy of every counter read
+ */
+#define KBP_TAP_SNAPSHOT_CLEAR (1 << 1)
+
+/**
+ * Snapshot flag: return the change since the previous snapshot of each counter
+ */
+#define KBP_TAP_SNAPSHOT_DELTA (1 << 2)
+
+/**
+ * Opaque TAP snapshot handle
+ */
+
+struct kbp_tap_snapshot;
+
+/**
+ * Creates a snapshot handle for a TAP database.
+ *
+ * @param db Valid TAP database handle.
+ * @param type Entry type the database was created with.
+ * @param capacity Database capacity.
+ * @param set_size Database entry set size, the number of counter offsets per entry.
+ * @param snap Snapshot handle, initialized and returned on success.
+ *
+ * @return KBP_OK on success, KBP_INVALID_ARGUMENT if the counters of the whole
+ *         database (capacity * set_size, twice that for pairs) take more than
+ *         4GB as 64 bit values, or an error code otherwise.
+ */
+
+kbp_status kbp_tap_snapshot_create(struct kbp_tap_db *db, enum kbp_tap_entry_type type, uint32_t capacity,
+                                   uint32_t set_size, struct kbp_tap_snapshot **snap);
+
+/**
+ * Destroys the snapshot handle.
+ *
+ * @param snap Valid snapshot handle.
+ *
+ * @return KBP_OK on success or an error code otherwise.
+ */
+
+kbp_status kbp_tap_snapshot_destroy(struct kbp_tap_snapshot *snap);
+
+/**
+ * Reads a contiguous range of entries.
+ *
+ * @param snap Valid snapshot handle.
+ * @param first First entry to read.
+ * @param count Number of entries to read.
+ * @param values Caller array of count * set_size words, twice that for pair databases.
+ * @param flags Zero or a combination of KBP_TAP_SNAPSHOT_REFRESH, KBP_TAP_SNAPSHOT_CLEAR and KBP_TAP_SNAPSHOT_DELTA.
+ *
+ * @return KBP_OK on success, KBP_POLL_TIME_OUT if the bulk read does not complete within a second,
+ *         or an error code otherwise.
+ */
+
+kbp_status kbp_tap_snapshot_read(struct kbp_tap_snapshot *snap, uint32_t first, uint32_t count, uint64_t *values,
+                                 uint32_t flags);
+
+/**
+ * @}
+ */
+
+#ifdef __cplusplus
+}
+#endif
+#endif                          /* __KBP_TAP_SNAPSHOT_H */
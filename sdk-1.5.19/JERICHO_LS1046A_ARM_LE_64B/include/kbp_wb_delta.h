@@ -0,0 +1,149 @@
+/*
+ * $Id$
+ *
+ * This license is set out in https://raw.githubusercontent.com/Broadcom/Broadcom-Compute-Connectivity-Software-KBP-SDK/master/Legal/LICENSE file.
+ *
+ * $Copyright: (c) 2023 Broadcom Inc.
+ * All Rights Reserved.$
+ *
+ */
+
+#ifndef __KBP_WB_DELTA_H
+#define __KBP_WB_DELTA_H
+
+#include <stdint.h>
+
+#include "errors.h"
+#include "device.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @file kbp_wb_delta.h
+ *
+ * Incremental (delta) warmboot checkpoints layered over the user's ISSU
+ * read/write callbacks.
+ *
+ * The nonvolatile region is split into two superblocks, two base image
+ * slots and a delta log. A full save writes the complete image into the
+ * inactive base slot. A delta save splits the image the SDK writes into
+ * fixed size blocks, compares each block against a content hash kept from the
+ * previous save, and appends only the changed blocks to the log. A save
+ * becomes visible only once its superblock is written, so an interrupted
+ * save leaves the previous checkpoint intact. Restore presents the base
+ * image with the logged blocks applied on top to kbp_device_restore_state().
+ *
+ * The first save after kbp_wb_delta_create() or a restore is always a full
+ * save. After that a full save (rebase) is taken every rebase_interval saves,
+ * when the log is more than half full, or when a delta save runs out of
+ * log space.
+ *
+ * @addtogroup ISSU_API
+ * @{
+ */
+
+/**
+ * Opaque delta warmboot handle
+ */
+
+struct kbp_wb_delta;
+
+/**
+ * Delta warmboot configuration. Offsets passed to the user callbacks are
+ * relative to the start of the region, so the region must hold
+ * 4K + 2 * capacity + log_capacity bytes.
+ */
+
+struct kbp_wb_delta_config {
+    uint32_t block_size;        /**< Change tracking granularity, power of two >= 512. Zero picks 4K */
+    uint32_t capacity;          /**< Largest warmboot image in bytes that can be saved */
+    uint32_t log_capacity;      /**< Bytes reserved for the delta log */
+    uint32_t rebase_interval;   /**< Delta saves between full saves. Zero picks 16 */
+};
+
+/**
+ * Delta warmboot statistics
+ */
+
+struct kbp_wb_delta_stats {
+    uint64_t num_saves;         /**< Successful saves */
+    uint64_t num_full_saves;    /**< Successful saves that rewrote the base image */
+    uint64_t image_bytes;       /**< Image bytes produced by the SDK across all saves */
+    uint64_t nv_bytes_written;  /**< Bytes written to the nonvolatile region across all saves */
+    uint32_t last_image_size;   /**< Image size of the last save */
+    uint32_t last_changed_blocks; /**< Blocks written by the last save */
+};
+
+/**
+ * Creates a delta warmboot handle over a nonvolatile region. Any checkpoint
+ * already present in the region is picked up so that it is not overwritten
+ * by the first save.
+ *
+ * @param config Region layout and rebase policy.
+ * @param read_fn Callback to read data from the nonvolatile region.
+ * @param write_fn Callback to write data to the nonvolatile region.
+ * @param handle User handle passed back through read_fn and write_fn.
+ * @param delta Delta warmboot handle, initialized and returned on success.
+ *
+ * @return KBP_OK on success or an error code otherwise.
+ */
+
+kbp_status kbp_wb_delta_create(const struct kbp_wb_delta_config *config, kbp_device_issu_read_fn read_fn,
+                               kbp_device_issu_write_fn write_fn, void *handle, struct kbp_wb_delta **delta);
+
+/**
+ * Destroys the delta warmboot handle. The nonvolatile region is not touched.
+ *
+ * @param delta Valid delta warmboot handle.
+ *
+ * @return KBP_OK on success or an error code otherwise.
+ */
+
+kbp_status kbp_wb_delta_destroy(struct kbp_wb_delta *delta);
+
+/**
+ * Checkpoints the device state with kbp_device_save_state_and_continue(),
+ * writing either a full base image or only the blocks that changed since
+ * the previous save.
+ *
+ * @param delta Valid delta warmboot handle.
+ * @param device Valid device handle.
+ *
+ * @return KBP_OK on success or an error code otherwise.
+ */
+
+kbp_status kbp_wb_delta_save(struct kbp_wb_delta *delta, struct kbp_device *device);
+
+/**
+ * Restores the device state from the latest checkpoint (base image plus
+ * delta log) with kbp_device_restore_state().
+ *
+ * @param delta Valid delta warmboot handle.
+ * @param device Valid device handle.
+ *
+ * @return KBP_OK on success or an error code otherwise.
+ */
+
+kbp_status kbp_wb_delta_restore(struct kbp_wb_delta *delta, struct kbp_device *device);
+
+/**
+ * Returns the delta warmboot statistics.
+ *
+ * @param delta Valid delta warmboot handle.
+ * @param stats Valid pointer populated on return.
+ *
+ * @return KBP_OK on success or an error code otherwise.
+ */
+
+kbp_status kbp_wb_delta_get_stats(struct kbp_wb_delta *delta, struct kbp_wb_delta_stats *stats);
+
+/**
+ * @}
+ */
+
+#ifdef __cplusplus
+}
+#endif
+#endif                          /* __KBP_WB_DELTA_H */
@@ -0,0 +1,161 @@
+/*
+ * $Id$
+ *
+ * This license is set out in https://raw.githubusercontent.com/Broadcom/Broadcom-Compute-Connectivity-Software-KBP-SDK/master/Legal/LICENSE file.
+ *
+ * $Copyright: (c) 2023 Broadcom Inc.
+ * All Rights Reserved.$
+ *
+ */
+
+#ifndef __KBP_WB_IMAGE_H
+#define __KBP_WB_IMAGE_H
+
+#include <stdint.h>
+
+#include "errors.h"
+#include "device.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @file kbp_wb_image.h
+ *
+ * Self-validating, versioned warmboot images.
+ *
+ * The SDK image is wrapped in a container that records the SDK version
+ * that wrote it, a caller supplied device/configuration fingerprint, and a
+ * kbp_crc32() per fixed size section. kbp_wb_image_validate() checks a stored
+ * image in a single streaming pass with one section sized buffer and no SDK
+ * state, so a bad or mismatched image can be detected quickly and the caller
+ * can fall back to a cold boot. kbp_wb_image_restore() verifies each section as
+ * the SDK reads it and fails the restore on the first mismatch.
+ *
+ * @addtogroup ISSU_API
+ * @{
+ */
+
+/**
+ * Maximum SDK version string length stored in the image, including the terminator
+ */
+#define KBP_WB_IMAGE_VERSION_LEN (64)
+
+/**
+ * Validation flag: fail if the image was written by a different SDK version
+ */
+#define KBP_WB_IMAGE_SAME_SDK (1 << 0)
+
+/**
+ * Opaque validated warmboot image handle
+ */
+
+struct kbp_wb_image;
+
+/**
+ * Validated warmboot image configuration
+ */
+
+struct kbp_wb_image_config {
+    uint32_t section_size;      /**< Bytes covered by each CRC, power of two. Zero picks 64K */
+    uint32_t capacity;          /**< Largest image in bytes */
+    uint64_t fingerprint;       /**< Caller defined device/configuration fingerprint */
+};
+
+/**
+ * Image information recorded at save time
+ */
+
+struct kbp_wb_image_info {
+    char sdk_version[KBP_WB_IMAGE_VERSION_LEN]; /**< kbp_device_get_sdk_version() of the writer */
+    uint64_t fingerprint;       /**< Fingerprint passed in ::kbp_wb_image_config */
+    uint32_t image_size;        /**< Bytes written by the SDK */
+    uint32_t section_size;      /**< Bytes covered by each CRC */
+    uint32_t num_sections;      /**< Number of sections */
+};
+
+/**
+ * Creates a validated warmboot image handle.
+ *
+ * @param config Section size, capacity and fingerprint.
+ * @param read_fn Callback to read data from nonvolatile memory.
+ * @param write_fn Callback to write data to nonvolatile memory.
+ * @param handle User handle passed back through read_fn and write_fn.
+ * @param img Image handle, initialized and returned on success.
+ *
+ * @return KBP_OK on success or an error code otherwise.
+ */
+
+kbp_status kbp_wb_image_create(const struct kbp_wb_image_config *config, kbp_device_issu_read_fn read_fn,
+                               kbp_device_issu_write_fn write_fn, void *handle, struct kbp_wb_image **img);
+
+/**
+ * Destroys the image handle.
+ *
+ * @param img Valid image handle.
+ *
+ * @return KBP_OK on success or an error code otherwise.
+ */
+
+kbp_status kbp_wb_image_destroy(struct kbp_wb_image *img);
+
+/**
+ * Saves the device state with header and section CRCs.
+ *
+ * @param img Valid image handle.
+ * @param device Valid device handle.
+ * @param and_continue Use kbp_device_save_state_and_continue() instead of kbp_device_save_state().
+ *
+ * @return KBP_OK on success or an error code otherwise.
+ */
+
+kbp_status kbp_wb_image_save(struct kbp_wb_image *img, struct kbp_device *device, int32_t and_continue);
+
+/**
+ * Restores the device state, verifying the header, fingerprint and the CRC
+ * of every section read.
+ *
+ * @param img Valid image handle.
+ * @param device Valid device handle.
+ *
+ * @return KBP_OK on success, KBP_NV_DATA_CORRUPT or KBP_ISSU_MISMATCH if the image is bad, or an error code otherwise.
+ */
+
+kbp_status kbp_wb_image_restore(struct kbp_wb_image *img, struct kbp_device *device);
+
+/**
+ * Reads the image information from the header without checking the sections.
+ *
+ * @param read_fn Callback to read data from nonvolatile memory.
+ * @param handle User handle passed back through read_fn.
+ * @param info Valid pointer populated on return.
+ *
+ * @return KBP_OK on success, KBP_NV_DATA_CORRUPT if there is no valid header, or an error code otherwise.
+ */
+
+kbp_status kbp_wb_image_get_info(kbp_device_issu_read_fn read_fn, void *handle, struct kbp_wb_image_info *info);
+
+/**
+ * Verifies a stored image in a single streaming pass without creating any
+ * SDK state.
+ *
+ * @param read_fn Callback to read data from nonvolatile memory.
+ * @param handle User handle passed back through read_fn.
+ * @param fingerprint Expected fingerprint, zero to skip the check.
+ * @param flags Zero or KBP_WB_IMAGE_SAME_SDK.
+ *
+ * @return KBP_OK if the image is intact, KBP_NV_DATA_CORRUPT on a header or CRC error,
+ *         KBP_ISSU_MISMATCH on a fingerprint or SDK version mismatch, or an error code otherwise.
+ */
+
+kbp_status kbp_wb_image_validate(kbp_device_issu_read_fn read_fn, void *handle, uint64_t fingerprint, uint32_t flags);
+
+/**
+ * @}
+ */
+
+#ifdef __cplusplus
+}
+#endif
+#endif                          /* __KBP_WB_IMAGE_H */
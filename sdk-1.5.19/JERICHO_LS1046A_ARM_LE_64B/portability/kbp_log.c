@@ -0,0 +1,656 @@
+/*
+ * $Id$
+ *
+ * This license is set out in https://raw.githubusercontent.com/Broadcom/Broadcom-Compute-Connectivity-Software-KBP-SDK/master/Legal/LICENSE file.
+ *
+ * $Copyright: (c) 2023 Broadcom Inc.
+ * All Rights Reserved.$
+ *
+ */
+
+#include <time.h>
+#include <unistd.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#include "kbp_portable.h"
+#include "kbp_log.h"
+
+#define KBP_LOG_DEFAULT_RING_ENTRIES    (4096)
+#define KBP_LOG_DEFAULT_DRAIN_US        (1000)
+#define KBP_LOG_MAX_RING_ENTRIES        (0x80000000U)
+#define KBP_LOG_MAX_SPEC_LEN            (32)
+#define KBP_LOG_PREC_STAR               (-2)
+#define KBP_LOG_LINE_BYTES              (4096)
+#define KBP_LOG_TEXT_BYTES              (KBP_LOG_MAX_ARGS * sizeof(uint64_t) + KBP_LOG_MAX_STR_BYTES)
+
+/*
+ * Linker provided bounds of the executable image. Format strings inside
+ * these bounds outlive the call and can be referenced by pointer.
+ */
+extern const char __executable_start[];
+extern const char edata[];
+
+/*
+ * One captured print call. When fmt is NULL the message was formatted
+ * on the calling thread and u.text holds nbytes of output.
+ */
+struct kbp_log_rec {
+    uint64_t ts_ns;
+    const char *fmt;
+    FILE *fp;
+    uint32_t nbytes;
+    uint32_t nargs;
+    union {
+        struct {
+            uint64_t args[KBP_LOG_MAX_ARGS];
+            char str[KBP_LOG_MAX_STR_BYTES];
+        } bin;
+        char text[KBP_LOG_TEXT_BYTES];
+    } u;
+};
+
+/*
+ * Single producer (owner thread), single consumer (drainer) ring.
+ * head and tail are free running 32b counters.
+ */
+struct kbp_log_ring {
+    uint32_t head;
+    uint32_t tail;
+    uint32_t mask;
+    uint32_t orphaned;
+    uint64_t num_records;
+    uint64_t num_preformatted;
+    uint64_t num_dropped;
+    struct kbp_log_rec *recs;
+    struct kbp_log_ring *next;
+};
+
+/*
+ * Parsed conversion specification
+ */
+struct kbp_log_spec {
+    const char *start;      /* points at the '%' */
+    uint32_t len;           /* length including the conversion character */
+    uint32_t nstars;        /* '*' width/precision arguments */
+    int32_t prec;           /* precision, -1 if none, KBP_LOG_PREC_STAR if '.*' */
+    char lmod;              /* 0, 'H' (hh), 'h', 'l', 'q' (ll), 'j', 'z', 't', 'L' */
+    char conv;
+};
+
+static struct {
+    uint32_t enabled;
+    uint32_t stop;
+    uint32_t drainer_running;
+    struct kbp_log_config config;
+    pthread_mutex_t lock;
+    pthread_t drainer;
+    struct kbp_log_ring *rings;
+    uint64_t num_drained;
+    uint64_t retired_records;
+    uint64_t retired_preformatted;
+    uint64_t retired_dropped;
+} kbp_log = {
+    .lock = PTHREAD_MUTEX_INITIALIZER
+};
+
+static __thread struct kbp_log_ring *kbp_log_tls_ring;
+static __thread uint32_t kbp_log_tls_draining;
+static pthread_key_t kbp_log_key;
+static pthread_once_t kbp_log_key_once = PTHREAD_ONCE_INIT;
+
+static uint64_t kbp_log_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void kbp_log_thread_exit(void *arg)
+{
+    struct kbp_log_ring *ring = (struct kbp_log_ring *) arg;
+
+    __atomic_store_n(&ring->orphaned, 1, __ATOMIC_RELEASE);
+}
+
+static void kbp_log_key_init(void)
+{
+    pthread_key_create(&kbp_log_key, kbp_log_thread_exit);
+}
+
+static struct kbp_log_ring *kbp_log_get_ring(void)
+{
+    struct kbp_log_ring *ring = kbp_log_tls_ring;
+    uint32_t entries;
+
+    if (ring)
+        return ring;
+
+    pthread_once(&kbp_log_key_once, kbp_log_key_init);
+
+    entries = 1;
+    while (entries < kbp_log.config.ring_entries)
+        entries <<= 1;
+
+    ring = kbp_syscalloc(1, sizeof(*ring));
+    if (!ring)
+        return NULL;
+    ring->recs = kbp_syscalloc(entries, sizeof(struct kbp_log_rec));
+    if (!ring->recs) {
+        kbp_sysfree(ring);
+        return NULL;
+    }
+    ring->mask = entries - 1;
+
+    pthread_mutex_lock(&kbp_log.lock);
+    ring->next = kbp_log.rings;
+    kbp_log.rings = ring;
+    pthread_mutex_unlock(&kbp_log.lock);
+
+    pthread_setspecific(kbp_log_key, ring);
+    kbp_log_tls_ring = ring;
+    return ring;
+}
+
+/*
+ * Parses the conversion specification at p (which points past the '%').
+ * Returns the pointer past the specification, or NULL if it is not one
+ * the log can carry in binary form.
+ */
+static const char *kbp_log_parse_spec(const char *p, struct kbp_log_spec *spec)
+{
+    spec->nstars = 0;
+    spec->prec = -1;
+    spec->lmod = 0;
+
+    while (*p == '-' || *p == '+' || *p == ' ' || *p == '#' || *p == '0' || *p == '\'')
+        p++;
+
+    if (*p == '*') {
+        spec->nstars++;
+        p++;
+    } else {
+        while (*p >= '0' && *p <= '9')
+            p++;
+    }
+
+    if (*p == '.') {
+        p++;
+        if (*p == '*') {
+            spec->nstars++;
+            spec->prec = KBP_LOG_PREC_STAR;
+            p++;
+        } else {
+            spec->prec = 0;
+            while (*p >= '0' && *p <= '9') {
+                if (spec->prec < KBP_LOG_MAX_STR_BYTES)
+                    spec->prec = spec->prec * 10 + (*p - '0');
+                p++;
+            }
+        }
+    }
+
+    switch (*p) {
+    case 'h':
+        p++;
+        spec->lmod = 'h';
+        if (*p == 'h') {
+            spec->lmod = 'H';
+            p++;
+        }
+        break;
+    case 'l':
+        p++;
+        spec->lmod = 'l';
+        if (*p == 'l') {
+            spec->lmod = 'q';
+            p++;
+        }
+        break;
+    case 'q':
+    case 'j':
+    case 'z':
+    case 't':
+    case 'L':
+        spec->lmod = *p++;
+        break;
+    default:
+        break;
+    }
+
+    spec->conv = *p;
+    switch (spec->conv) {
+    case 'd': case 'i': case 'u': case 'o': case 'x': case 'X': case 'c':
+    case 'p':
+        break;
+    case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A':
+        if (spec->lmod == 'L')
+            return NULL;
+        break;
+    case 's':
+        if (spec->lmod == 'l')
+            return NULL;
+        break;
+    default:
+        return NULL;
+    }
+
+    p++;
+    spec->len = (uint32_t) (p - spec->start);
+    if (spec->len >= KBP_LOG_MAX_SPEC_LEN)
+        return NULL;
+    return p;
+}
+
+static uint64_t kbp_log_fetch_int(const struct kbp_log_spec *spec, va_list *ap)
+{
+    int32_t is_signed = (spec->conv == 'd' || spec->conv == 'i');
+
+    switch (spec->lmod) {
+    case 'l':
+        return is_signed ? (uint64_t) va_arg(*ap, long) : (uint64_t) va_arg(*ap, unsigned long);
+    case 'q':
+        return is_signed ? (uint64_t) va_arg(*ap, long long) : (uint64_t) va_arg(*ap, unsigned long long);
+    case 'j':
+        return is_signed ? (uint64_t) va_arg(*ap, intmax_t) : (uint64_t) va_arg(*ap, uintmax_t);
+    case 'z':
+        return (uint64_t) va_arg(*ap, size_t);
+    case 't':
+        return (uint64_t) va_arg(*ap, ptrdiff_t);
+    default:
+        return is_signed ? (uint64_t) (int64_t) va_arg(*ap, int) : (uint64_t) va_arg(*ap, unsigned int);
+    }
+}
+
+/*
+ * Stores the arguments of fmt into rec. Returns 0 on success, -1 if the
+ * call must be formatted on the calling thread instead.
+ */
+static int32_t kbp_log_capture(struct kbp_log_rec *rec, const char *fmt, va_list *ap)
+{
+    struct kbp_log_spec spec;
+    const char *p = fmt;
+    uint32_t nargs = 0, nstr = 0, i;
+    int32_t prec;
+
+    while (*p) {
+        if (*p++ != '%')
+            continue;
+        if (*p == '%') {
+            p++;
+            continue;
+        }
+
+        spec.start = p - 1;
+        p = kbp_log_parse_spec(p, &spec);
+        if (!p || nargs + spec.nstars + 1 > KBP_LOG_MAX_ARGS)
+            return -1;
+
+        prec = spec.prec;
+        for (i = 0; i < spec.nstars; i++) {
+            int32_t star = va_arg(*ap, int);
+
+            /* The precision star is always the last one; a negative value means no precision */
+            if (i == spec.nstars - 1 && spec.prec == KBP_LOG_PREC_STAR)
+                prec = star < 0 ? -1 : star;
+            rec->u.bin.args[nargs++] = (uint64_t) (int64_t) star;
+        }
+
+        switch (spec.conv) {
+        case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A':
+        {
+            double d = va_arg(*ap, double);
+
+            kbp_memcpy(&rec->u.bin.args[nargs++], &d, sizeof(d));
+            break;
+        }
+        case 's':
+        {
+            const char *s = va_arg(*ap, const char *);
+            uint32_t len;
+
+            if (!s) {
+                rec->u.bin.args[nargs++] = 0;
+                break;
+            }
+            /* Honour the precision: s need not be terminated within it */
+            if (prec >= 0) {
+                if (prec >= KBP_LOG_MAX_STR_BYTES)
+                    return -1;
+                len = strnlen(s, prec) + 1;
+            } else {
+                len = strlen(s) + 1;
+            }
+            if (nstr + len > KBP_LOG_MAX_STR_BYTES)
+                return -1;
+            kbp_memcpy(&rec->u.bin.str[nstr], s, len - 1);
+            rec->u.bin.str[nstr + len - 1] = '\0';
+            rec->u.bin.args[nargs++] = nstr + 1;
+            nstr += len;
+            break;
+        }
+        case 'p':
+            rec->u.bin.args[nargs++] = (uint64_t) (uintptr_t) va_arg(*ap, void *);
+            break;
+        default:
+            rec->u.bin.args[nargs++] = kbp_log_fetch_int(&spec, ap);
+            break;
+        }
+    }
+
+    rec->nargs = nargs;
+    rec->nbytes = nstr;
+    return 0;
+}
+
+/*
+ * Formats one specification with its stored value(s) into buf.
+ */
+static int32_t kbp_log_format_spec(char *buf, uint32_t size, const struct kbp_log_spec *spec,
+                                   const struct kbp_log_rec *rec, uint32_t *argno)
+{
+    char sfmt[KBP_LOG_MAX_SPEC_LEN];
+    int32_t star[2] = {0, 0};
+    uint64_t v;
+    uint32_t i;
+
+    kbp_memcpy(sfmt, spec->start, spec->len);
+    sfmt[spec->len] = '\0';
+
+    for (i = 0; i < spec->nstars; i++)
+        star[i] = (int32_t) rec->u.bin.args[(*argno)++];
+    v = rec->u.bin.args[(*argno)++];
+
+#define KBP_LOG_EMIT(value)                                                     \
+    (spec->nstars == 0 ? snprintf(buf, size, sfmt, value) :                     \
+     spec->nstars == 1 ? snprintf(buf, size, sfmt, star[0], value) :            \
+                         snprintf(buf, size, sfmt, star[0], star[1], value))
+
+    switch (spec->conv) {
+    case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A':
+    {
+        double d;
+
+        kbp_memcpy(&d, &v, sizeof(d));
+        return KBP_LOG_EMIT(d);
+    }
+    case 's':
+        return KBP_LOG_EMIT(v ? &rec->u.bin.str[v - 1] : "(null)");
+    case 'p':
+        return KBP_LOG_EMIT((void *) (uintptr_t) v);
+    default:
+        break;
+    }
+
+    switch (spec->lmod) {
+    case 'l':
+        return KBP_LOG_EMIT((long) v);
+    case 'q':
+        return KBP_LOG_EMIT((long long) v);
+    case 'j':
+        return KBP_LOG_EMIT((intmax_t) v);
+    case 'z':
+        return KBP_LOG_EMIT((size_t) v);
+    case 't':
+        return KBP_LOG_EMIT((ptrdiff_t) v);
+    default:
+        return KBP_LOG_EMIT((int) v);
+    }
+#undef KBP_LOG_EMIT
+}
+
+static uint32_t kbp_log_render(const struct kbp_log_rec *rec, char *out, uint32_t size)
+{
+    struct kbp_log_spec spec;
+    const char *p = rec->fmt;
+    uint32_t n = 0, argno = 0;
+
+    while (*p && n < size - 1) {
+        int32_t r;
+
+        if (*p != '%') {
+            out[n++] = *p++;
+            continue;
+        }
+        if (p[1] == '%') {
+            out[n++] = '%';
+            p += 2;
+            continue;
+        }
+
+        spec.start = p;
+        p = kbp_log_parse_spec(p + 1, &spec);
+        r = kbp_log_format_spec(&out[n], size - n, &spec, rec, &argno);
+        if (r > 0)
+            n += ((uint32_t) r < size - n) ? (uint32_t) r : size - n - 1;
+    }
+
+    return n;
+}
+
+static void kbp_log_emit(const struct kbp_log_rec *rec)
+{
+    char line[KBP_LOG_LINE_BYTES];
+    const char *text = line;
+    uint32_t len;
+
+    if (rec->fmt) {
+        len = kbp_log_render(rec, line, sizeof(line));
+    } else {
+        text = rec->u.text;
+        len = rec->nbytes;
+    }
+
+    if (kbp_log.config.sink)
+        kbp_log.config.sink(kbp_log.config.sink_handle, rec->fp, text, len);
+    else
+        fwrite(text, 1, len, rec->fp);
+}
+
+/*
+ * Writes out every pending record, oldest first across all rings, and
+ * reclaims rings whose threads have exited. Called with the lock held.
+ */
+static uint32_t kbp_log_drain_locked(void)
+{
+    struct kbp_log_ring *ring, **prev;
+    uint32_t num = 0;
+
+    kbp_log_tls_draining = 1;
+    for (;;) {
+        struct kbp_log_ring *oldest = NULL;
+        uint64_t oldest_ts = 0;
+
+        for (ring = kbp_log.rings; ring; ring = ring->next) {
+            uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+            struct kbp_log_rec *rec;
+
+            if (head == ring->tail)
+                continue;
+            rec = &ring->recs[ring->tail & ring->mask];
+            if (!oldest || rec->ts_ns < oldest_ts) {
+                oldest = ring;
+                oldest_ts = rec->ts_ns;
+            }
+        }
+
+        if (!oldest)
+            break;
+
+        kbp_log_emit(&oldest->recs[oldest->tail & oldest->mask]);
+        __atomic_store_n(&oldest->tail, oldest->tail + 1, __ATOMIC_RELEASE);
+        num++;
+    }
+    kbp_log_tls_draining = 0;
+
+    prev = &kbp_log.rings;
+    while ((ring = *prev) != NULL) {
+        if (__atomic_load_n(&ring->orphaned, __ATOMIC_ACQUIRE)
+            && __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == ring->tail) {
+            *prev = ring->next;
+            kbp_log.retired_records += ring->num_records;
+            kbp_log.retired_preformatted += ring->num_preformatted;
+            kbp_log.retired_dropped += ring->num_dropped;
+            kbp_sysfree(ring->recs);
+            kbp_sysfree(ring);
+            continue;
+        }
+        prev = &ring->next;
+    }
+
+    kbp_log.num_drained += num;
+    return num;
+}
+
+static void *kbp_log_drainer(void *arg)
+{
+    (void) arg;
+
+    while (!__atomic_load_n(&kbp_log.stop, __ATOMIC_ACQUIRE)) {
+        uint32_t num;
+
+        pthread_mutex_lock(&kbp_log.lock);
+        num = kbp_log_drain_locked();
+        if (kbp_log.config.sink == NULL && num)
+            fflush(NULL);
+        pthread_mutex_unlock(&kbp_log.lock);
+
+        if (num == 0)
+            usleep(kbp_log.config.drain_interval_us);
+    }
+    return NULL;
+}
+
+int32_t kbp_log_vrecord(FILE *fp, const char *fmt, va_list ap)
+{
+    struct kbp_log_ring *ring;
+    struct kbp_log_rec *rec;
+    uint32_t head;
+    va_list aq;
+    int32_t r;
+
+    if (!__atomic_load_n(&kbp_log.enabled, __ATOMIC_ACQUIRE) || kbp_log_tls_draining)
+        return -1;
+
+    ring = kbp_log_get_ring();
+    if (!ring)
+        return -1;
+
+    head = ring->head;
+    if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) > ring->mask) {
+        ring->num_dropped++;
+        return 0;
+    }
+
+    rec = &ring->recs[head & ring->mask];
+    rec->ts_ns = kbp_log_now_ns();
+    rec->fp = fp;
+
+    r = -1;
+    if (fmt >= __executable_start && fmt < edata) {
+        va_copy(aq, ap);
+        r = kbp_log_capture(rec, fmt, &aq);
+        va_end(aq);
+    }
+
+    if (r == 0) {
+        rec->fmt = fmt;
+        ring->num_records++;
+    } else {
+        va_copy(aq, ap);
+        r = vsnprintf(rec->u.text, sizeof(rec->u.text), fmt, aq);
+        va_end(aq);
+        if (r < 0)
+            return 0;
+        if ((uint32_t) r >= sizeof(rec->u.text)) {
+            /* Too long to carry, preserve ordering and let the caller print */
+            kbp_log_flush();
+            return -1;
+        }
+        rec->fmt = NULL;
+        rec->nbytes = r;
+        ring->num_preformatted++;
+    }
+
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+void kbp_log_flush(void)
+{
+    if (!kbp_log.rings || kbp_log_tls_draining)
+        return;
+
+    pthread_mutex_lock(&kbp_log.lock);
+    kbp_log_drain_locked();
+    pthread_mutex_unlock(&kbp_log.lock);
+    fflush(NULL);
+}
+
+kbp_status kbp_log_async_enable(const struct kbp_log_config *config)
+{
+    if (__atomic_load_n(&kbp_log.enabled, __ATOMIC_ACQUIRE))
+        return KBP_INVALID_ARGUMENT;
+    if (config && config->ring_entries > KBP_LOG_MAX_RING_ENTRIES)
+        return KBP_INVALID_ARGUMENT;
+
+    if (config)
+        kbp_memcpy(&kbp_log.config, config, sizeof(*config));
+    else
+        kbp_memset(&kbp_log.config, 0, sizeof(kbp_log.config));
+
+    if (kbp_log.config.ring_entries == 0)
+        kbp_log.config.ring_entries = KBP_LOG_DEFAULT_RING_ENTRIES;
+    if (kbp_log.config.drain_interval_us == 0)
+        kbp_log.config.drain_interval_us = KBP_LOG_DEFAULT_DRAIN_US;
+
+    kbp_log.stop = 0;
+    if (pthread_create(&kbp_log.drainer, NULL, kbp_log_drainer, NULL) != 0)
+        return KBP_OUT_OF_MEMORY;
+    kbp_log.drainer_running = 1;
+
+    __atomic_store_n(&kbp_log.enabled, 1, __ATOMIC_RELEASE);
+    return KBP_OK;
+}
+
+kbp_status kbp_log_async_disable(void)
+{
+    if (!__atomic_load_n(&kbp_log.enabled, __ATOMIC_ACQUIRE))
+        return KBP_INVALID_ARGUMENT;
+
+    __atomic_store_n(&kbp_log.enabled, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&kbp_log.stop, 1, __ATOMIC_RELEASE);
+    if (kbp_log.drainer_running) {
+        pthread_join(kbp_log.drainer, NULL);
+        kbp_log.drainer_running = 0;
+    }
+
+    kbp_log_flush();
+    return KBP_OK;
+}
+
+kbp_status kbp_log_get_stats(struct kbp_log_stats *stats)
+{
+    struct kbp_log_ring *ring;
+
+    if (!stats)
+        return KBP_INVALID_ARGUMENT;
+
+    kbp_memset(stats, 0, sizeof(*stats));
+
+    pthread_mutex_lock(&kbp_log.lock);
+    stats->num_records = kbp_log.retired_records;
+    stats->num_preformatted = kbp_log.retired_preformatted;
+    stats->num_dropped = kbp_log.retired_dropped;
+    stats->num_drained = kbp_log.num_drained;
+    for (ring = kbp_log.rings; ring; ring = ring->next) {
+        stats->num_records += ring->num_records;
+        stats->num_preformatted += ring->num_preformatted;
+        stats->num_dropped += ring->num_dropped;
+        stats->num_rings++;
+    }
+    pthread_mutex_unlock(&kbp_log.lock);
+
+    return KBP_OK;
+}
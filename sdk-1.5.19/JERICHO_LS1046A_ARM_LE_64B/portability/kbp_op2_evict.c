@@ -0,0 +1,201 @@
+/*
+ * $Id$
+ *
+ * This license is set out in https://raw.githubusercontent.com/Broadcom/Broadcom-Compute-Connectivity-Software-KBP-SDK/master/Legal/LICENSE file.
+ *
+ * $Copyright: (c) 2023 Broadcom Inc.
+ * All Rights Reserved.$
+ *
+ */
+
+#include "kbp_portable.h"
+#include "device_op2.h"
+#include "kbp_op2_evict.h"
+#include "kbp_probes.h"
+
+#define KBP_OP2_EVICT_INIT_RANGES       (16)
+
+struct kbp_op2_evict_range {
+    void *counter_db;
+    uint64_t base;
+    uint64_t end;
+};
+
+struct kbp_op2_evict {
+    struct kbp_device *device;
+    uint64_t *words;            /* batch_words + 1, the first for a carried message word */
+    uint32_t batch_words;
+    uint32_t num_words;         /* words in the current batch */
+    uint32_t pos;               /* next word to decode */
+    uint32_t carry;             /* carry_word ended the last batch without its value */
+    uint64_t carry_word;
+    struct kbp_op2_evict_range *ranges; /* sorted by base */
+    uint32_t num_ranges;
+    uint32_t max_ranges;
+};
+
+kbp_status kbp_op2_evict_create(struct kbp_device *device, uint32_t batch_words, struct kbp_op2_evict **reader)
+{
+    struct kbp_op2_evict *r;
+
+    if (!device || !reader)
+        return KBP_INVALID_ARGUMENT;
+
+    r = kbp_syscalloc(1, sizeof(*r));
+    if (!r)
+        return KBP_OUT_OF_MEMORY;
+
+    r->device = device;
+    r->batch_words = batch_words ? batch_words : KBP_OP2_TX_DMA_BUFFER_SIZE_COUNTER_EVICTION;
+    r->max_ranges = KBP_OP2_EVICT_INIT_RANGES;
+    r->words = kbp_sysmalloc((r->batch_words + 1) * sizeof(uint64_t));
+    r->ranges = kbp_sysmalloc(r->max_ranges * sizeof(*r->ranges));
+    if (!r->words || !r->ranges) {
+        kbp_op2_evict_destroy(r);
+        return KBP_OUT_OF_MEMORY;
+    }
+
+    *reader = r;
+    return KBP_OK;
+}
+
+kbp_status kbp_op2_evict_destroy(struct kbp_op2_evict *reader)
+{
+    if (!reader)
+        return KBP_INVALID_ARGUMENT;
+
+    kbp_sysfree(reader->words);
+    kbp_sysfree(reader->ranges);
+    kbp_sysfree(reader);
+    return KBP_OK;
+}
+
+kbp_status kbp_op2_evict_add_range(struct kbp_op2_evict *reader, void *counter_db, uint64_t host_base,
+                                   uint32_t num_counters)
+{
+    uint64_t end;
+    uint32_t i;
+
+    if (!reader || !num_counters || (host_base & ~KBP_OP2_COUNTER_MESSAGE_HOST_ADDR_MASK))
+        return KBP_INVALID_ARGUMENT;
+
+    end = host_base + ((uint64_t) num_counters << KBP_OP2_COUNTER_MESSAGE_HOST_ADDR_SHIFT);
+    for (i = 0; i < reader->num_ranges; i++) {
+        if (host_base < reader->ranges[i].end && reader->ranges[i].base < end)
+            return KBP_INVALID_ARGUMENT;
+    }
+
+    if (reader->num_ranges == reader->max_ranges) {
+        struct kbp_op2_evict_range *ranges = kbp_sysmalloc(2 * reader->max_ranges * sizeof(*ranges));
+
+        if (!ranges)
+            return KBP_OUT_OF_MEMORY;
+        kbp_memcpy(ranges, reader->ranges, reader->num_ranges * sizeof(*ranges));
+        kbp_sysfree(reader->ranges);
+        reader->ranges = ranges;
+        reader->max_ranges *= 2;
+    }
+
+    /* Insertion keeps the ranges sorted for the lookup in kbp_op2_evict_next() */
+    for (i = reader->num_ranges; i > 0 && reader->ranges[i - 1].base > host_base; i--)
+        reader->ranges[i] = reader->ranges[i - 1];
+    reader->ranges[i].counter_db = counter_db;
+    reader->ranges[i].base = host_base;
+    reader->ranges[i].end = end;
+    reader->num_ranges++;
+    return KBP_OK;
+}
+
+kbp_status kbp_op2_evict_fetch(struct kbp_op2_evict *reader, uint32_t *num_words)
+{
+    uint32_t base, scrubbed = 0;
+    kbp_status status;
+
+    if (!reader || !num_words)
+        return KBP_INVALID_ARGUMENT;
+    if (reader->num_words)
+        return KBP_INVALID_ARGUMENT;
+
+    /* A message word left over from the last batch goes in front of its value */
+    base = reader->carry;
+    if (base)
+        reader->words[0] = reader->carry_word;
+
+    status = kbp_dm_op2_scrub_dma_buffer(reader->device, KBP_OP2_TX_DMA_CHANNEL_COUNTER_EVICTION,
+                                         reader->words + base, reader->batch_words, &scrubbed);
+    KBP_PROBE3(evict_fetch, reader->device, status == KBP_OK ? scrubbed : 0, status);
+    if (status != KBP_OK)
+        return status;
+
+    reader->carry = 0;
+    reader->num_words = base + scrubbed;
+    reader->pos = 0;
+    *num_words = scrubbed;
+    return KBP_OK;
+}
+
+kbp_status kbp_op2_evict_next(struct kbp_op2_evict *reader, struct kbp_op2_evict_record *record, int32_t *valid)
+{
+    if (!reader || !record || !valid)
+        return KBP_INVALID_ARGUMENT;
+
+    *valid = 0;
+    while (reader->pos < reader->num_words) {
+        uint64_t msg = reader->words[reader->pos];
+        uint32_t lo, hi;
+
+        if (msg & KBP_OP2_COUNTER_NOTIFICATION_BIT_MASK) {
+            reader->pos++;
+            continue;
+        }
+
+        /* The value is in the next batch, decode the pair after the next fetch */
+        if (reader->pos + 1 >= reader->num_words) {
+            reader->carry = 1;
+            reader->carry_word = msg;
+            reader->pos = reader->num_words;
+            return KBP_OK;
+        }
+
+        record->host_addr = msg & KBP_OP2_COUNTER_MESSAGE_HOST_ADDR_MASK;
+        record->counter_type = (uint32_t) (msg & KBP_OP2_COUNTER_MESSAGE_COUNTER_TYPE_MASK);
+        record->value = reader->words[reader->pos + 1];
+        reader->pos += 2;
+
+        lo = 0;
+        hi = reader->num_ranges;
+        while (lo < hi) {
+            uint32_t mid = lo + (hi - lo) / 2;
+
+            if (reader->ranges[mid].end <= record->host_addr)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+
+        if (lo < reader->num_ranges && reader->ranges[lo].base <= record->host_addr) {
+            record->counter_db = reader->ranges[lo].counter_db;
+            record->offset = (uint32_t) ((record->host_addr - reader->ranges[lo].base)
+                                         >> KBP_OP2_COUNTER_MESSAGE_HOST_ADDR_SHIFT);
+        } else {
+            record->counter_db = NULL;
+            record->offset = (uint32_t) ((msg & KBP_OP2_COUNTER_MESSAGE_COUNTER_OFFSET_MASK)
+                                         >> KBP_OP2_COUNTER_MESSAGE_HOST_ADDR_SHIFT);
+        }
+
+        *valid = 1;
+        return KBP_OK;
+    }
+
+    return KBP_OK;
+}
+
+kbp_status kbp_op2_evict_ack(struct kbp_op2_evict *reader)
+{
+    if (!reader)
+        return KBP_INVALID_ARGUMENT;
+
+    reader->num_words = 0;
+    reader->pos = 0;
+    return KBP_OK;
+}
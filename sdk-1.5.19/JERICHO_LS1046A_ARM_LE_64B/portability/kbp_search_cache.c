@@ -0,0 +1,177 @@
+/*
+ * $Id$
+ *
+ * This license is set out in https://raw.githubusercontent.com/Broadcom/Broadcom-Compute-Connectivity-Software-KBP-SDK/master/Legal/LICENSE file.
+ *
+ * $Copyright: (c) 2023 Broadcom Inc.
+ * All Rights Reserved.$
+ *
+ */
+
+#include "kbp_portable.h"
+#include "hw_limits.h"
+#include "kbp_search_cache.h"
+
+#define KBP_SEARCH_CACHE_DEFAULT_SLOTS  (65536)
+
+struct kbp_search_cache_slot {
+    uint64_t generation;        /* valid only if equal to the cache generation */
+    struct kbp_instruction *instruction;
+    uint32_t cb_addrs;
+    uint32_t key_len;
+    uint8_t key[KBP_HW_MAX_SEARCH_KEY_WIDTH_8];
+    struct kbp_search_result result;
+};
+
+struct kbp_search_cache {
+    struct kbp_search_cache_slot *slots;
+    uint32_t mask;
+    uint64_t generation;
+    struct kbp_search_cache_stats stats;
+};
+
+/*
+ * FNV-1a over the key, mixed with the instruction and context address
+ */
+static uint32_t kbp_search_cache_hash(struct kbp_instruction *instruction, const uint8_t *key, uint32_t key_len,
+                                      uint32_t cb_addrs)
+{
+    uint64_t h = 0xcbf29ce484222325ULL ^ (uintptr_t) instruction ^ ((uint64_t) cb_addrs << 32);
+    uint32_t i;
+
+    for (i = 0; i < key_len; i++) {
+        h ^= key[i];
+        h *= 0x100000001b3ULL;
+    }
+    return (uint32_t) (h ^ (h >> 32));
+}
+
+kbp_status kbp_search_cache_create(uint32_t num_slots, struct kbp_search_cache **cache)
+{
+    struct kbp_search_cache *c;
+    uint32_t size = 1;
+
+    if (!cache || num_slots > (1U << 30))
+        return KBP_INVALID_ARGUMENT;
+
+    if (!num_slots)
+        num_slots = KBP_SEARCH_CACHE_DEFAULT_SLOTS;
+    while (size < num_slots)
+        size <<= 1;
+
+    c = kbp_syscalloc(1, sizeof(*c));
+    if (!c)
+        return KBP_OUT_OF_MEMORY;
+
+    /* Generation 0 never matches, so zeroed slots start out empty */
+    c->slots = kbp_syscalloc(size, sizeof(*c->slots));
+    if (!c->slots) {
+        kbp_sysfree(c);
+        return KBP_OUT_OF_MEMORY;
+    }
+    c->mask = size - 1;
+    c->generation = 1;
+
+    *cache = c;
+    return KBP_OK;
+}
+
+kbp_status kbp_search_cache_destroy(struct kbp_search_cache *cache)
+{
+    if (!cache)
+        return KBP_INVALID_ARGUMENT;
+
+    kbp_sysfree(cache->slots);
+    kbp_sysfree(cache);
+    return KBP_OK;
+}
+
+kbp_status kbp_search_cache_search(struct kbp_search_cache *cache, struct kbp_instruction *instruction,
+                                   uint8_t *master_key, uint32_t key_len, uint32_t cb_addrs,
+                                   struct kbp_search_result *result)
+{
+    struct kbp_search_cache_slot *slot;
+    kbp_status status;
+
+    if (!cache || !instruction || !master_key || !result || key_len > KBP_HW_MAX_SEARCH_KEY_WIDTH_8)
+        return KBP_INVALID_ARGUMENT;
+
+    slot = &cache->slots[kbp_search_cache_hash(instruction, master_key, key_len, cb_addrs) & cache->mask];
+    if (slot->generation == cache->generation && slot->instruction == instruction && slot->cb_addrs == cb_addrs
+        && slot->key_len == key_len && kbp_memcmp(slot->key, master_key, key_len) == 0) {
+        kbp_memcpy(result, &slot->result, sizeof(*result));
+        cache->stats.num_hits++;
+        return KBP_OK;
+    }
+
+    cache->stats.num_misses++;
+    status = kbp_instruction_search(instruction, master_key, cb_addrs, result);
+    if (status != KBP_OK)
+        return status;
+
+    slot->generation = cache->generation;
+    slot->instruction = instruction;
+    slot->cb_addrs = cb_addrs;
+    slot->key_len = key_len;
+    kbp_memcpy(slot->key, master_key, key_len);
+    kbp_memcpy(&slot->result, result, sizeof(*result));
+    return KBP_OK;
+}
+
+kbp_status kbp_search_cache_invalidate(struct kbp_search_cache *cache)
+{
+    if (!cache)
+        return KBP_INVALID_ARGUMENT;
+
+    cache->generation++;
+    cache->stats.num_invalidations++;
+    return KBP_OK;
+}
+
+kbp_status kbp_search_cache_install(struct kbp_search_cache *cache, struct kbp_db *db)
+{
+    kbp_status status;
+
+    if (!cache || !db)
+        return KBP_INVALID_ARGUMENT;
+
+    status = kbp_db_install(db);
+
+    /* A failed install may still have changed the device */
+    kbp_search_cache_invalidate(cache);
+    return status;
+}
+
+kbp_status kbp_search_cache_ad_update(struct kbp_search_cache *cache, struct kbp_ad_db *db, struct kbp_ad *ad,
+                                      uint8_t *value)
+{
+    kbp_status status;
+
+    if (!cache || !db || !ad)
+        return KBP_INVALID_ARGUMENT;
+
+    status = kbp_ad_db_update_entry(db, ad, value);
+    kbp_search_cache_invalidate(cache);
+    return status;
+}
+
+kbp_status kbp_search_cache_ad_delete(struct kbp_search_cache *cache, struct kbp_ad_db *db, struct kbp_ad *ad)
+{
+    kbp_status status;
+
+    if (!cache || !db || !ad)
+        return KBP_INVALID_ARGUMENT;
+
+    status = kbp_ad_db_delete_entry(db, ad);
+    kbp_search_cache_invalidate(cache);
+    return status;
+}
+
+kbp_status kbp_search_cache_get_stats(struct kbp_search_cache *cache, struct kbp_search_cache_stats *stats)
+{
+    if (!cache || !stats)
+        return KBP_INVALID_ARGUMENT;
+
+    kbp_memcpy(stats, &cache->stats, sizeof(*stats));
+    return KBP_OK;
+}
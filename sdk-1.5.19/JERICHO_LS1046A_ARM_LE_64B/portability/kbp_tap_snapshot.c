@@ -0,0 +1,134 @@
+/*
+ * $Id$
+ *
+ * This license is set out in https://raw.githubusercontent.com/Broadcom/Broadcom-Compute-Connectivity-Software-KBP-SDK/master/Legal/LICENSE file.
+ *
+ * $Copyright: (c) 2023 Broadcom Inc.
+ * All Rights Reserved.$
+ *
+ */
+
+#include "kbp_portable.h"
+#include "kbp_tap_snapshot.h"
+
+/* The bulk read is a DMA; poll it every 100us and give up after at least a second */
+#define KBP_TAP_SNAPSHOT_POLL_US        (100)
+#define KBP_TAP_SNAPSHOT_MAX_POLLS      (10000)
+
+struct kbp_tap_snapshot {
+    struct kbp_tap_db *db;
+    uint32_t capacity;
+    uint32_t set_size;
+    uint32_t words_per_counter; /* 1 for single, 2 for pair */
+    uint64_t *prev;             /* running values at the previous snapshot, allocated on first delta */
+};
+
+kbp_status kbp_tap_snapshot_create(struct kbp_tap_db *db, enum kbp_tap_entry_type type, uint32_t capacity,
+                                   uint32_t set_size, struct kbp_tap_snapshot **snap)
+{
+    struct kbp_tap_snapshot *s;
+    uint64_t words;
+
+    if (!db || !capacity || !set_size || !snap)
+        return KBP_INVALID_ARGUMENT;
+    if (type != KBP_TAP_ENTRY_TYPE_SINGLE && type != KBP_TAP_ENTRY_TYPE_PAIR)
+        return KBP_INVALID_ARGUMENT;
+
+    /* The delta buffer is sized and indexed with 32 bit arithmetic */
+    words = (uint64_t) capacity * set_size * (type == KBP_TAP_ENTRY_TYPE_PAIR ? 2 : 1);
+    if (words * sizeof(uint64_t) > 0xFFFFFFFFULL)
+        return KBP_INVALID_ARGUMENT;
+
+    s = kbp_syscalloc(1, sizeof(*s));
+    if (!s)
+        return KBP_OUT_OF_MEMORY;
+
+    s->db = db;
+    s->capacity = capacity;
+    s->set_size = set_size;
+    s->words_per_counter = type == KBP_TAP_ENTRY_TYPE_PAIR ? 2 : 1;
+
+    *snap = s;
+    return KBP_OK;
+}
+
+kbp_status kbp_tap_snapshot_destroy(struct kbp_tap_snapshot *snap)
+{
+    if (!snap)
+        return KBP_INVALID_ARGUMENT;
+
+    kbp_sysfree(snap->prev);
+    kbp_sysfree(snap);
+    return KBP_OK;
+}
+
+kbp_status kbp_tap_snapshot_read(struct kbp_tap_snapshot *snap, uint32_t first, uint32_t count, uint64_t *values,
+                                 uint32_t flags)
+{
+    uint32_t clear, entry, offset, pos, base;
+    kbp_status status;
+
+    if (!snap || !values || first >= snap->capacity || count > snap->capacity - first)
+        return KBP_INVALID_ARGUMENT;
+
+    if (flags & KBP_TAP_SNAPSHOT_REFRESH) {
+        int32_t is_complete = 0;
+        uint32_t polls;
+
+        status = kbp_tap_db_read_initiate(snap->db);
+        if (status != KBP_OK)
+            return status;
+        for (polls = 0;; polls++) {
+            status = kbp_tap_db_is_read_complete(snap->db, &is_complete);
+            if (status != KBP_OK)
+                return status;
+            if (is_complete)
+                break;
+            if (polls == KBP_TAP_SNAPSHOT_MAX_POLLS)
+                return KBP_POLL_TIME_OUT;
+            kbp_usleep(KBP_TAP_SNAPSHOT_POLL_US);
+        }
+    }
+
+    /* Cleared counters already read as the change since the last read */
+    clear = (flags & KBP_TAP_SNAPSHOT_CLEAR) ? 1 : 0;
+    if ((flags & KBP_TAP_SNAPSHOT_DELTA) && !clear && !snap->prev) {
+        snap->prev = kbp_syscalloc(snap->capacity * snap->set_size * snap->words_per_counter, sizeof(uint64_t));
+        if (!snap->prev)
+            return KBP_OUT_OF_MEMORY;
+    }
+
+    pos = 0;
+    base = first * snap->set_size * snap->words_per_counter;
+    for (entry = first; entry < first + count; entry++) {
+        for (offset = 0; offset < snap->set_size; offset++) {
+            if (snap->words_per_counter == 2)
+                status = kbp_tap_db_pa_entry_pair_get_value(snap->db, clear, entry, offset,
+                                                            &values[pos], &values[pos + 1]);
+            else
+                status = kbp_tap_db_pa_entry_get_value(snap->db, clear, entry, offset, &values[pos]);
+            if (status != KBP_OK)
+                return status;
+            pos += snap->words_per_counter;
+        }
+    }
+
+    if (snap->prev) {
+        uint64_t *prev = &snap->prev[base];
+
+        for (pos = 0; pos < count * snap->set_size * snap->words_per_counter; pos++) {
+            uint64_t cur = values[pos];
+
+            if (clear) {
+                /* Later non clearing deltas start from zero */
+                prev[pos] = 0;
+                continue;
+            }
+            if (flags & KBP_TAP_SNAPSHOT_DELTA)
+                values[pos] = cur - prev[pos];
+            prev[pos] = cur;
+        }
+    }
+
+    return KBP_OK;
+}
@@ -0,0 +1,515 @@
+/*
+ * $Id$
+ *
+ * This license is set out in https://raw.githubusercontent.com/Broadcom/Broadcom-Compute-Connectivity-Software-KBP-SDK/master/Legal/LICENSE file.
+ *
+ * $Copyright: (c) 2023 Broadcom Inc.
+ * All Rights Reserved.$
+ *
+ */
+
+#include <stddef.h>
+
+#include "kbp_portable.h"
+#include "kbp_math.h"
+#include "kbp_wb_compress.h"
+
+#define KBP_WB_CMP_MAGIC                (0x4B57425A)    /* KWBZ */
+#define KBP_WB_CMP_VERSION              (2)
+#define KBP_WB_CMP_DATA_START           (4096)
+#define KBP_WB_CMP_DEFAULT_BLOCK        (64 * 1024)
+
+#define KBP_WB_LZ_ID                    (1)
+#define KBP_WB_LZ_HASH_BITS             (12)
+#define KBP_WB_LZ_MIN_MATCH             (4)
+#define KBP_WB_LZ_MAX_OFFSET            (65535)
+
+/*
+ * Image header at offset 0. Cleared before a save writes any block and
+ * written last, so an interrupted save leaves no valid header behind.
+ */
+struct kbp_wb_cmp_hdr {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t codec_id;
+    uint32_t block_size;
+    uint32_t image_size;
+    uint32_t num_blocks;
+    uint32_t index_offset;
+    uint32_t index_crc;
+    uint32_t crc;
+};
+
+/*
+ * Block index entry. size == block_size means the block is stored raw,
+ * size == 0 means the block was never written and reads as zeros. crc
+ * covers the size stored bytes.
+ */
+struct kbp_wb_cmp_idx {
+    uint32_t offset;
+    uint32_t size;
+    uint32_t crc;
+};
+
+struct kbp_wb_compress {
+    kbp_device_issu_read_fn read_fn;
+    kbp_device_issu_write_fn write_fn;
+    void *handle;
+    const struct kbp_wb_codec *codec;
+    struct kbp_wb_compress_stats stats;
+    uint32_t block_size;
+    uint32_t max_blocks;
+    struct kbp_wb_cmp_idx *idx;
+    uint8_t *staging;           /* block being written */
+    uint8_t *cache;             /* last block decompressed for reads */
+    uint8_t *cbuf;              /* compressed data */
+    int32_t staged_block;
+    int32_t cached_block;
+    uint32_t data_end;
+    uint32_t image_size;
+    kbp_status failure;
+};
+
+/*
+ * Built-in LZ codec. The stream is a sequence of
+ *   token: literal count (high nibble) | match length - 4 (low nibble)
+ *   [literal count extension bytes] literals
+ *   16b little endian match offset [match length extension bytes]
+ * where a nibble of 15 is followed by extension bytes of 255 terminated by a
+ * byte below 255. The last sequence carries literals only.
+ */
+
+static uint32_t kbp_wb_lz_read32(const uint8_t *p)
+{
+    uint32_t v;
+
+    kbp_memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint32_t kbp_wb_lz_put_len(uint8_t *dst, uint32_t op, uint32_t len)
+{
+    while (len >= 255) {
+        dst[op++] = 255;
+        len -= 255;
+    }
+    dst[op++] = len;
+    return op;
+}
+
+static uint32_t kbp_wb_lz_compress(void *ctx, const uint8_t *src, uint32_t len, uint8_t *dst, uint32_t dst_cap)
+{
+    uint32_t table[1 << KBP_WB_LZ_HASH_BITS];
+    uint32_t ip = 0, anchor = 0, op = 0;
+
+    (void) ctx;
+    kbp_memset(table, 0, sizeof(table));
+
+    for (;;) {
+        uint32_t lit, mlen = 0, ref = 0, need;
+
+        /* Find the next match */
+        while (ip + KBP_WB_LZ_MIN_MATCH <= len) {
+            uint32_t seq = kbp_wb_lz_read32(&src[ip]);
+            uint32_t h = (seq * 2654435761U) >> (32 - KBP_WB_LZ_HASH_BITS);
+
+            ref = table[h];
+            table[h] = ip;
+            if (ref < ip && ip - ref <= KBP_WB_LZ_MAX_OFFSET && kbp_wb_lz_read32(&src[ref]) == seq) {
+                mlen = KBP_WB_LZ_MIN_MATCH;
+                while (ip + mlen < len && src[ref + mlen] == src[ip + mlen])
+                    mlen++;
+                break;
+            }
+            ip++;
+        }
+        if (mlen == 0)
+            ip = len;
+
+        lit = ip - anchor;
+        need = 1 + lit / 255 + 1 + lit + (mlen ? 2 + (mlen - KBP_WB_LZ_MIN_MATCH) / 255 + 1 : 0);
+        if (op + need > dst_cap)
+            return 0;
+
+        dst[op++] = ((lit < 15 ? lit : 15) << 4)
+            | (mlen ? ((mlen - KBP_WB_LZ_MIN_MATCH < 15) ? mlen - KBP_WB_LZ_MIN_MATCH : 15) : 0);
+        if (lit >= 15)
+            op = kbp_wb_lz_put_len(dst, op, lit - 15);
+        kbp_memcpy(&dst[op], &src[anchor], lit);
+        op += lit;
+
+        if (mlen == 0)
+            break;
+
+        dst[op++] = (ip - ref) & 0xFF;
+        dst[op++] = (ip - ref) >> 8;
+        if (mlen - KBP_WB_LZ_MIN_MATCH >= 15)
+            op = kbp_wb_lz_put_len(dst, op, mlen - KBP_WB_LZ_MIN_MATCH - 15);
+
+        ip += mlen;
+        anchor = ip;
+    }
+
+    return op;
+}
+
+static int32_t kbp_wb_lz_get_len(const uint8_t *src, uint32_t len, uint32_t *ip, uint32_t *value)
+{
+    uint8_t b;
+
+    do {
+        if (*ip >= len)
+            return 1;
+        b = src[(*ip)++];
+        *value += b;
+    } while (b == 255);
+    return 0;
+}
+
+static int32_t kbp_wb_lz_decompress(void *ctx, const uint8_t *src, uint32_t len, uint8_t *dst, uint32_t dst_len)
+{
+    uint32_t ip = 0, op = 0;
+
+    (void) ctx;
+
+    while (ip < len) {
+        uint8_t token = src[ip++];
+        uint32_t lit = token >> 4, mlen = token & 0xF, offset;
+
+        if (lit == 15 && kbp_wb_lz_get_len(src, len, &ip, &lit))
+            return 1;
+        if (lit > len - ip || lit > dst_len - op)
+            return 1;
+        kbp_memcpy(&dst[op], &src[ip], lit);
+        ip += lit;
+        op += lit;
+
+        if (ip == len)
+            break;
+
+        if (len - ip < 2)
+            return 1;
+        offset = src[ip] | (src[ip + 1] << 8);
+        ip += 2;
+        if (mlen == 15 && kbp_wb_lz_get_len(src, len, &ip, &mlen))
+            return 1;
+        mlen += KBP_WB_LZ_MIN_MATCH;
+
+        if (offset == 0 || offset > op || mlen > dst_len - op)
+            return 1;
+        /* Byte copy, the match may overlap its own output */
+        while (mlen--) {
+            dst[op] = dst[op - offset];
+            op++;
+        }
+    }
+
+    return op == dst_len ? 0 : 1;
+}
+
+const struct kbp_wb_codec kbp_wb_codec_lz = {
+    KBP_WB_LZ_ID,
+    "lz",
+    NULL,
+    kbp_wb_lz_compress,
+    kbp_wb_lz_decompress
+};
+
+static uint32_t kbp_wb_cmp_hdr_crc(const struct kbp_wb_cmp_hdr *hdr)
+{
+    return kbp_crc32(0, (const uint8_t *) hdr, offsetof(struct kbp_wb_cmp_hdr, crc));
+}
+
+static kbp_status kbp_wb_cmp_load_block(struct kbp_wb_compress *wc, uint32_t blk, uint8_t *dst)
+{
+    struct kbp_wb_cmp_idx *e = &wc->idx[blk];
+
+    if (e->size == 0) {
+        kbp_memset(dst, 0, wc->block_size);
+        return KBP_OK;
+    }
+
+    if (e->size == wc->block_size) {
+        if (wc->read_fn(wc->handle, dst, wc->block_size, e->offset) != 0)
+            return KBP_NV_READ_WRITE_FAILED;
+        if (kbp_crc32(0, dst, wc->block_size) != e->crc)
+            return KBP_NV_DATA_CORRUPT;
+        return KBP_OK;
+    }
+
+    if (wc->read_fn(wc->handle, wc->cbuf, e->size, e->offset) != 0)
+        return KBP_NV_READ_WRITE_FAILED;
+    if (kbp_crc32(0, wc->cbuf, e->size) != e->crc)
+        return KBP_NV_DATA_CORRUPT;
+    if (wc->codec->decompress(wc->codec->ctx, wc->cbuf, e->size, dst, wc->block_size) != 0)
+        return KBP_NV_DATA_CORRUPT;
+    return KBP_OK;
+}
+
+static kbp_status kbp_wb_cmp_finalize(struct kbp_wb_compress *wc)
+{
+    uint32_t blk, csize;
+    const uint8_t *src;
+
+    if (wc->staged_block < 0)
+        return KBP_OK;
+
+    blk = wc->staged_block;
+    wc->staged_block = -1;
+    if ((int32_t) blk == wc->cached_block)
+        wc->cached_block = -1;
+
+    csize = wc->codec->compress(wc->codec->ctx, wc->staging, wc->block_size, wc->cbuf, wc->block_size - 1);
+    if (csize) {
+        src = wc->cbuf;
+    } else {
+        src = wc->staging;
+        csize = wc->block_size;
+    }
+
+    if (wc->data_end + csize < wc->data_end)
+        return KBP_EXHAUSTED_NV_MEMORY;
+    if (wc->write_fn(wc->handle, (uint8_t *) src, csize, wc->data_end) != 0)
+        return KBP_NV_READ_WRITE_FAILED;
+
+    wc->idx[blk].offset = wc->data_end;
+    wc->idx[blk].size = csize;
+    wc->idx[blk].crc = kbp_crc32(0, src, csize);
+    wc->data_end += csize;
+    return KBP_OK;
+}
+
+static int32_t kbp_wb_cmp_read_cb(void *handle, uint8_t *buffer, uint32_t size, uint32_t offset)
+{
+    struct kbp_wb_compress *wc = (struct kbp_wb_compress *) handle;
+    uint32_t bs = wc->block_size;
+
+    if ((uint64_t) offset + size > (uint64_t) wc->max_blocks * bs)
+        return 1;
+
+    while (size) {
+        uint32_t blk = offset / bs;
+        uint32_t off = offset % bs;
+        uint32_t n = bs - off;
+        const uint8_t *src;
+
+        if (n > size)
+            n = size;
+
+        if ((int32_t) blk == wc->staged_block) {
+            src = wc->staging;
+        } else {
+            if ((int32_t) blk != wc->cached_block) {
+                wc->cached_block = -1;
+                if (kbp_wb_cmp_load_block(wc, blk, wc->cache) != KBP_OK)
+                    return 1;
+                wc->cached_block = blk;
+            }
+            src = wc->cache;
+        }
+
+        kbp_memcpy(buffer, &src[off], n);
+        buffer += n;
+        offset += n;
+        size -= n;
+    }
+
+    return 0;
+}
+
+static int32_t kbp_wb_cmp_write_cb(void *handle, uint8_t *buffer, uint32_t size, uint32_t offset)
+{
+    struct kbp_wb_compress *wc = (struct kbp_wb_compress *) handle;
+    uint32_t bs = wc->block_size;
+    kbp_status status;
+
+    if ((uint64_t) offset + size > (uint64_t) wc->max_blocks * bs) {
+        wc->failure = KBP_EXHAUSTED_NV_MEMORY;
+        return 1;
+    }
+
+    if (offset + size > wc->image_size)
+        wc->image_size = offset + size;
+
+    while (size) {
+        uint32_t blk = offset / bs;
+        uint32_t off = offset % bs;
+        uint32_t n = bs - off;
+
+        if (n > size)
+            n = size;
+
+        if ((int32_t) blk != wc->staged_block) {
+            status = kbp_wb_cmp_finalize(wc);
+            if (status == KBP_OK && n < bs)
+                status = kbp_wb_cmp_load_block(wc, blk, wc->staging);
+            if (status != KBP_OK) {
+                wc->failure = status;
+                return 1;
+            }
+            wc->staged_block = blk;
+        }
+
+        kbp_memcpy(&wc->staging[off], buffer, n);
+        buffer += n;
+        offset += n;
+        size -= n;
+    }
+
+    return 0;
+}
+
+kbp_status kbp_wb_compress_create(const struct kbp_wb_compress_config *config, kbp_device_issu_read_fn read_fn,
+                                  kbp_device_issu_write_fn write_fn, void *handle, struct kbp_wb_compress **wc)
+{
+    struct kbp_wb_compress *w;
+    uint32_t bs;
+
+    if (!config || !read_fn || !write_fn || !wc || config->capacity == 0)
+        return KBP_INVALID_ARGUMENT;
+
+    bs = config->block_size ? config->block_size : KBP_WB_CMP_DEFAULT_BLOCK;
+    if (bs < 256 || (bs & (bs - 1)))
+        return KBP_INVALID_ARGUMENT;
+
+    w = kbp_syscalloc(1, sizeof(*w));
+    if (!w)
+        return KBP_OUT_OF_MEMORY;
+
+    w->read_fn = read_fn;
+    w->write_fn = write_fn;
+    w->handle = handle;
+    w->codec = config->codec ? config->codec : &kbp_wb_codec_lz;
+    w->block_size = bs;
+    w->max_blocks = (uint32_t) (((uint64_t) config->capacity + bs - 1) / bs);
+    w->idx = kbp_syscalloc(w->max_blocks, sizeof(struct kbp_wb_cmp_idx));
+    w->staging = kbp_sysmalloc(bs);
+    w->cache = kbp_sysmalloc(bs);
+    w->cbuf = kbp_sysmalloc(bs);
+    w->staged_block = -1;
+    w->cached_block = -1;
+
+    if (!w->idx || !w->staging || !w->cache || !w->cbuf) {
+        kbp_wb_compress_destroy(w);
+        return KBP_OUT_OF_MEMORY;
+    }
+
+    *wc = w;
+    return KBP_OK;
+}
+
+kbp_status kbp_wb_compress_destroy(struct kbp_wb_compress *wc)
+{
+    if (!wc)
+        return KBP_INVALID_ARGUMENT;
+
+    kbp_sysfree(wc->idx);
+    kbp_sysfree(wc->staging);
+    kbp_sysfree(wc->cache);
+    kbp_sysfree(wc->cbuf);
+    kbp_sysfree(wc);
+    return KBP_OK;
+}
+
+kbp_status kbp_wb_compress_save(struct kbp_wb_compress *wc, struct kbp_device *device, int32_t and_continue)
+{
+    struct kbp_wb_cmp_hdr hdr;
+    kbp_status status;
+    uint32_t i;
+
+    if (!wc || !device)
+        return KBP_INVALID_ARGUMENT;
+
+    kbp_memset(wc->idx, 0, wc->max_blocks * sizeof(struct kbp_wb_cmp_idx));
+    kbp_memset(&wc->stats, 0, sizeof(wc->stats));
+    wc->staged_block = -1;
+    wc->cached_block = -1;
+    wc->data_end = KBP_WB_CMP_DATA_START;
+    wc->image_size = 0;
+    wc->failure = KBP_OK;
+
+    /* The old header must not describe the blocks about to be overwritten */
+    kbp_memset(&hdr, 0, sizeof(hdr));
+    if (wc->write_fn(wc->handle, (uint8_t *) &hdr, sizeof(hdr), 0) != 0)
+        return KBP_NV_READ_WRITE_FAILED;
+
+    if (and_continue)
+        status = kbp_device_save_state_and_continue(device, kbp_wb_cmp_read_cb, kbp_wb_cmp_write_cb, wc);
+    else
+        status = kbp_device_save_state(device, kbp_wb_cmp_read_cb, kbp_wb_cmp_write_cb, wc);
+    if (status == KBP_OK)
+        status = kbp_wb_cmp_finalize(wc);
+    if (status != KBP_OK)
+        return wc->failure != KBP_OK ? wc->failure : status;
+
+    kbp_memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = KBP_WB_CMP_MAGIC;
+    hdr.version = KBP_WB_CMP_VERSION;
+    hdr.codec_id = wc->codec->id;
+    hdr.block_size = wc->block_size;
+    hdr.image_size = wc->image_size;
+    hdr.num_blocks = (wc->image_size + wc->block_size - 1) / wc->block_size;
+    hdr.index_offset = wc->data_end;
+    hdr.index_crc = kbp_crc32(0, (const uint8_t *) wc->idx, hdr.num_blocks * sizeof(struct kbp_wb_cmp_idx));
+    hdr.crc = kbp_wb_cmp_hdr_crc(&hdr);
+
+    if (wc->write_fn(wc->handle, (uint8_t *) wc->idx, hdr.num_blocks * sizeof(struct kbp_wb_cmp_idx), hdr.index_offset) != 0
+        || wc->write_fn(wc->handle, (uint8_t *) &hdr, sizeof(hdr), 0) != 0)
+        return KBP_NV_READ_WRITE_FAILED;
+
+    wc->stats.image_size = hdr.image_size;
+    wc->stats.stored_size = hdr.index_offset + hdr.num_blocks * sizeof(struct kbp_wb_cmp_idx);
+    wc->stats.num_blocks = hdr.num_blocks;
+    for (i = 0; i < hdr.num_blocks; i++) {
+        if (wc->idx[i].size == wc->block_size)
+            wc->stats.num_raw_blocks++;
+    }
+
+    return KBP_OK;
+}
+
+kbp_status kbp_wb_compress_restore(struct kbp_wb_compress *wc, struct kbp_device *device)
+{
+    struct kbp_wb_cmp_hdr hdr;
+    uint32_t i;
+
+    if (!wc || !device)
+        return KBP_INVALID_ARGUMENT;
+
+    if (wc->read_fn(wc->handle, (uint8_t *) &hdr, sizeof(hdr), 0) != 0)
+        return KBP_NV_READ_WRITE_FAILED;
+    if (hdr.magic != KBP_WB_CMP_MAGIC || hdr.version != KBP_WB_CMP_VERSION || hdr.crc != kbp_wb_cmp_hdr_crc(&hdr))
+        return KBP_NV_DATA_CORRUPT;
+    if (hdr.codec_id != wc->codec->id || hdr.block_size != wc->block_size || hdr.num_blocks > wc->max_blocks)
+        return KBP_ISSU_MISMATCH;
+
+    kbp_memset(wc->idx, 0, wc->max_blocks * sizeof(struct kbp_wb_cmp_idx));
+    if (wc->read_fn(wc->handle, (uint8_t *) wc->idx, hdr.num_blocks * sizeof(struct kbp_wb_cmp_idx), hdr.index_offset) != 0)
+        return KBP_NV_READ_WRITE_FAILED;
+    if (kbp_crc32(0, (const uint8_t *) wc->idx, hdr.num_blocks * sizeof(struct kbp_wb_cmp_idx)) != hdr.index_crc)
+        return KBP_NV_DATA_CORRUPT;
+
+    kbp_memset(&wc->stats, 0, sizeof(wc->stats));
+    wc->stats.image_size = hdr.image_size;
+    wc->stats.stored_size = hdr.index_offset + hdr.num_blocks * sizeof(struct kbp_wb_cmp_idx);
+    wc->stats.num_blocks = hdr.num_blocks;
+    for (i = 0; i < hdr.num_blocks; i++) {
+        if (wc->idx[i].size > wc->block_size)
+            return KBP_NV_DATA_CORRUPT;
+        if (wc->idx[i].size == wc->block_size)
+            wc->stats.num_raw_blocks++;
+    }
+
+    wc->staged_block = -1;
+    wc->cached_block = -1;
+    return kbp_device_restore_state(device, kbp_wb_cmp_read_cb, kbp_wb_cmp_write_cb, wc);
+}
+
+kbp_status kbp_wb_compress_get_stats(struct kbp_wb_compress *wc, struct kbp_wb_compress_stats *stats)
+{
+    if (!wc || !stats)
+        return KBP_INVALID_ARGUMENT;
+
+    kbp_memcpy(stats, &wc->stats, sizeof(*stats));
+    return KBP_OK;
+}
@@ -0,0 +1,173 @@
+/*
+ * $Id$
+ *
+ * This license is set out in https://raw.githubusercontent.com/Broadcom/Broadcom-Compute-Connectivity-Software-KBP-SDK/master/Legal/LICENSE file.
+ *
+ * $Copyright: (c) 2023 Broadcom Inc.
+ * All Rights Reserved.$
+ *
+ */
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "kbp_portable.h"
+#include "kbp_wb_mmap.h"
+
+#define KBP_WB_MMAP_READ_AHEAD          (8 * 1024 * 1024)
+
+struct kbp_wb_mmap {
+    uint8_t *base;
+    uint32_t length;
+    uint32_t writable;
+    uint32_t owned;             /* mapped by kbp_wb_mmap_open() */
+    uint32_t advised;           /* end of the range already advised WILLNEED */
+    uint32_t released;          /* start of the range not yet released */
+    uintptr_t page_mask;
+};
+
+kbp_status kbp_wb_mmap_open(const char *path, uint32_t save_size, struct kbp_wb_mmap **map)
+{
+    struct kbp_wb_mmap *m;
+    struct stat st;
+    void *base;
+    int fd;
+
+    if (!path || !map)
+        return KBP_INVALID_ARGUMENT;
+
+    if (save_size) {
+        fd = kbp_open(path, O_RDWR | O_CREAT, 0644);
+        if (fd < 0)
+            return KBP_INVALID_FILE;
+        if (ftruncate(fd, save_size) != 0) {
+            close(fd);
+            return KBP_EXHAUSTED_NV_MEMORY;
+        }
+        st.st_size = save_size;
+    } else {
+        fd = kbp_open(path, O_RDONLY, 0);
+        if (fd < 0)
+            return KBP_INVALID_FILE;
+        if (fstat(fd, &st) != 0 || st.st_size == 0 || (uint64_t) st.st_size > 0xFFFFFFFFULL) {
+            close(fd);
+            return KBP_INVALID_FILE;
+        }
+    }
+
+    base = kbp_mmap(NULL, st.st_size, save_size ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+        return KBP_OUT_OF_MEMORY;
+
+    m = kbp_syscalloc(1, sizeof(*m));
+    if (!m) {
+        kbp_munmap(base, st.st_size);
+        return KBP_OUT_OF_MEMORY;
+    }
+
+    m->base = base;
+    m->length = st.st_size;
+    m->writable = save_size != 0;
+    m->owned = 1;
+    m->page_mask = sysconf(_SC_PAGESIZE) - 1;
+    if (!m->writable)
+        madvise(m->base, m->length, MADV_SEQUENTIAL);
+
+    *map = m;
+    return KBP_OK;
+}
+
+kbp_status kbp_wb_mmap_attach(void *image, uint32_t length, int32_t writable, struct kbp_wb_mmap **map)
+{
+    struct kbp_wb_mmap *m;
+
+    if (!image || !length || !map)
+        return KBP_INVALID_ARGUMENT;
+
+    m = kbp_syscalloc(1, sizeof(*m));
+    if (!m)
+        return KBP_OUT_OF_MEMORY;
+
+    m->base = image;
+    m->length = length;
+    m->writable = writable != 0;
+    m->page_mask = sysconf(_SC_PAGESIZE) - 1;
+
+    *map = m;
+    return KBP_OK;
+}
+
+kbp_status kbp_wb_mmap_close(struct kbp_wb_mmap *map)
+{
+    kbp_status status = KBP_OK;
+
+    if (!map)
+        return KBP_INVALID_ARGUMENT;
+
+    if (map->owned) {
+        if (map->writable && msync(map->base, map->length, MS_SYNC) != 0)
+            status = KBP_NV_READ_WRITE_FAILED;
+        kbp_munmap(map->base, map->length);
+    }
+    kbp_sysfree(map);
+
+    return status;
+}
+
+int32_t kbp_wb_mmap_read(void *handle, uint8_t *buffer, uint32_t size, uint32_t offset)
+{
+    struct kbp_wb_mmap *map = (struct kbp_wb_mmap *) handle;
+
+    if (offset > map->length || size > map->length - offset)
+        return 1;
+
+    if (map->owned) {
+        uintptr_t start, end;
+
+        /* Keep the page cache ahead of the SDK's cursor */
+        if (offset + size + KBP_WB_MMAP_READ_AHEAD / 2 > map->advised) {
+            start = (uintptr_t) (map->base + offset) & ~map->page_mask;
+            end = offset + size + KBP_WB_MMAP_READ_AHEAD;
+            if (end > map->length)
+                end = map->length;
+            madvise((void *) start, (uintptr_t) (map->base + end) - start, MADV_WILLNEED);
+            map->advised = end;
+        }
+
+        /* Drop pages well behind the cursor of a read-only restore */
+        if (!map->writable && offset > map->released + KBP_WB_MMAP_READ_AHEAD) {
+            start = (uintptr_t) (map->base + map->released) & ~map->page_mask;
+            end = (uintptr_t) (map->base + offset - KBP_WB_MMAP_READ_AHEAD / 2) & ~map->page_mask;
+            if (end > start)
+                madvise((void *) start, end - start, MADV_DONTNEED);
+            map->released = offset - KBP_WB_MMAP_READ_AHEAD / 2;
+        }
+    }
+
+    kbp_memcpy(buffer, map->base + offset, size);
+    return 0;
+}
+
+int32_t kbp_wb_mmap_write(void *handle, uint8_t *buffer, uint32_t size, uint32_t offset)
+{
+    struct kbp_wb_mmap *map = (struct kbp_wb_mmap *) handle;
+
+    if (!map->writable || offset > map->length || size > map->length - offset)
+        return 1;
+
+    kbp_memcpy(map->base + offset, buffer, size);
+    return 0;
+}
+
+kbp_status kbp_wb_mmap_restore(struct kbp_wb_mmap *map, struct kbp_device *device)
+{
+    if (!map || !device)
+        return KBP_INVALID_ARGUMENT;
+
+    map->advised = 0;
+    map->released = 0;
+    return kbp_device_restore_state(device, kbp_wb_mmap_read, kbp_wb_mmap_write, map);
+}
@@ -0,0 +1,508 @@
+/*
+ * $Id$
+ *
+ * This license is set out in https://raw.githubusercontent.com/Broadcom/Broadcom-Compute-Connectivity-Software-KBP-SDK/master/Legal/LICENSE file.
+ *
+ * $Copyright: (c) 2023 Broadcom Inc.
+ * All Rights Reserved.$
+ *
+ */
+
+#include <pthread.h>
+
+#include "kbp_portable.h"
+#include "kbp_wb_parallel.h"
+
+#define KBP_WB_PAR_DEFAULT_THREADS      (4)
+#define KBP_WB_PAR_DEFAULT_CHUNK        (1024 * 1024)
+#define KBP_WB_PAR_MAX_THREADS          (64)
+
+enum kbp_wb_par_state {
+    KBP_WB_PAR_FREE,
+    KBP_WB_PAR_FILLING,     /* write chunk being coalesced by the SDK thread */
+    KBP_WB_PAR_QUEUED,
+    KBP_WB_PAR_BUSY,
+    KBP_WB_PAR_DONE         /* read-ahead data available */
+};
+
+struct kbp_wb_par_chunk {
+    uint8_t *buf;
+    uint32_t offset;
+    uint32_t size;
+    uint32_t seq;
+    enum kbp_wb_par_state state;
+    uint32_t is_read;
+    uint32_t discard;
+    int32_t error;
+};
+
+struct kbp_wb_parallel {
+    kbp_device_issu_read_fn read_fn;
+    kbp_device_issu_write_fn write_fn;
+    void *handle;
+    struct kbp_wb_parallel_config config;
+    struct kbp_wb_parallel_stats stats;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;                /* broadcast on every chunk state change */
+    pthread_t threads[KBP_WB_PAR_MAX_THREADS];
+    uint32_t num_started;
+    uint32_t stop;
+    uint32_t seq;
+    uint32_t write_error;
+    uint32_t ra_active;
+    uint32_t ra_next;
+    struct kbp_wb_par_chunk *fill;
+    struct kbp_wb_par_chunk *chunks;
+};
+
+static int32_t kbp_wb_par_overlaps(const struct kbp_wb_par_chunk *a, const struct kbp_wb_par_chunk *b)
+{
+    return a->offset < b->offset + b->size && b->offset < a->offset + a->size;
+}
+
+/*
+ * Oldest queued chunk that does not overlap an in-flight or older queued
+ * write, so that rewrites of the same offset land in order.
+ */
+static struct kbp_wb_par_chunk *kbp_wb_par_pick(struct kbp_wb_parallel *par)
+{
+    struct kbp_wb_par_chunk *best = NULL;
+    uint32_t i, j;
+
+    for (i = 0; i < par->config.num_chunks; i++) {
+        struct kbp_wb_par_chunk *c = &par->chunks[i];
+        int32_t blocked = 0;
+
+        if (c->state != KBP_WB_PAR_QUEUED)
+            continue;
+        if (best && (int32_t) (c->seq - best->seq) > 0)
+            continue;
+
+        if (!c->is_read) {
+            for (j = 0; j < par->config.num_chunks && !blocked; j++) {
+                struct kbp_wb_par_chunk *o = &par->chunks[j];
+
+                if (o == c || o->is_read || !kbp_wb_par_overlaps(c, o))
+                    continue;
+                if (o->state == KBP_WB_PAR_BUSY
+                    || (o->state == KBP_WB_PAR_QUEUED && (int32_t) (o->seq - c->seq) < 0))
+                    blocked = 1;
+            }
+        }
+
+        if (!blocked)
+            best = c;
+    }
+
+    return best;
+}
+
+static void *kbp_wb_par_worker(void *arg)
+{
+    struct kbp_wb_parallel *par = (struct kbp_wb_parallel *) arg;
+
+    pthread_mutex_lock(&par->lock);
+    for (;;) {
+        struct kbp_wb_par_chunk *c = kbp_wb_par_pick(par);
+        int32_t r;
+
+        if (!c) {
+            if (par->stop)
+                break;
+            pthread_cond_wait(&par->cond, &par->lock);
+            continue;
+        }
+
+        c->state = KBP_WB_PAR_BUSY;
+        pthread_mutex_unlock(&par->lock);
+
+        if (c->is_read)
+            r = par->read_fn(par->handle, c->buf, c->size, c->offset);
+        else
+            r = par->write_fn(par->handle, c->buf, c->size, c->offset);
+
+        pthread_mutex_lock(&par->lock);
+        c->error = r;
+        if (c->is_read) {
+            if (r == 0)
+                par->stats.bytes_read_ahead += c->size;
+            c->state = c->discard ? KBP_WB_PAR_FREE : KBP_WB_PAR_DONE;
+        } else {
+            if (r != 0)
+                par->write_error = 1;
+            else
+                par->stats.bytes_written += c->size;
+            c->state = KBP_WB_PAR_FREE;
+        }
+        pthread_cond_broadcast(&par->cond);
+    }
+    pthread_mutex_unlock(&par->lock);
+
+    return NULL;
+}
+
+static void kbp_wb_par_submit(struct kbp_wb_parallel *par, struct kbp_wb_par_chunk *c)
+{
+    c->state = KBP_WB_PAR_QUEUED;
+    c->seq = ++par->seq;
+    if (par->fill == c)
+        par->fill = NULL;
+    pthread_cond_broadcast(&par->cond);
+}
+
+static struct kbp_wb_par_chunk *kbp_wb_par_find_free(struct kbp_wb_parallel *par)
+{
+    uint32_t i;
+
+    for (i = 0; i < par->config.num_chunks; i++) {
+        if (par->chunks[i].state == KBP_WB_PAR_FREE)
+            return &par->chunks[i];
+    }
+    return NULL;
+}
+
+static void kbp_wb_par_drop_reads(struct kbp_wb_parallel *par)
+{
+    uint32_t i;
+
+    for (i = 0; i < par->config.num_chunks; i++) {
+        struct kbp_wb_par_chunk *c = &par->chunks[i];
+
+        if (!c->is_read)
+            continue;
+        if (c->state == KBP_WB_PAR_BUSY)
+            c->discard = 1;
+        else if (c->state == KBP_WB_PAR_QUEUED || c->state == KBP_WB_PAR_DONE)
+            c->state = KBP_WB_PAR_FREE;
+    }
+    par->ra_active = 0;
+}
+
+static void kbp_wb_par_read_ahead(struct kbp_wb_parallel *par)
+{
+    struct kbp_wb_par_chunk *c;
+
+    while (par->ra_active && (c = kbp_wb_par_find_free(par)) != NULL) {
+        uint32_t size = par->config.chunk_size;
+
+        if (par->config.region_size) {
+            if (par->ra_next >= par->config.region_size)
+                break;
+            if (par->config.region_size - par->ra_next < size)
+                size = par->config.region_size - par->ra_next;
+        } else if (par->ra_next + size < par->ra_next) {
+            break;
+        }
+
+        c->is_read = 1;
+        c->discard = 0;
+        c->error = 0;
+        c->offset = par->ra_next;
+        c->size = size;
+        par->ra_next += size;
+        kbp_wb_par_submit(par, c);
+    }
+}
+
+static int32_t kbp_wb_par_writes_pending(struct kbp_wb_parallel *par)
+{
+    uint32_t i;
+
+    for (i = 0; i < par->config.num_chunks; i++) {
+        struct kbp_wb_par_chunk *c = &par->chunks[i];
+
+        if (!c->is_read && (c->state == KBP_WB_PAR_QUEUED || c->state == KBP_WB_PAR_BUSY))
+            return 1;
+    }
+    return 0;
+}
+
+static void kbp_wb_par_drain_writes(struct kbp_wb_parallel *par)
+{
+    if (par->fill)
+        kbp_wb_par_submit(par, par->fill);
+    while (kbp_wb_par_writes_pending(par))
+        pthread_cond_wait(&par->cond, &par->lock);
+}
+
+int32_t kbp_wb_parallel_write(void *handle, uint8_t *buffer, uint32_t size, uint32_t offset)
+{
+    struct kbp_wb_parallel *par = (struct kbp_wb_parallel *) handle;
+    uint32_t chunk = par->config.chunk_size;
+
+    while (size) {
+        struct kbp_wb_par_chunk *c = par->fill;
+        uint32_t n;
+
+        if (!c || c->offset + c->size != offset || c->size == chunk) {
+            pthread_mutex_lock(&par->lock);
+            if (par->write_error) {
+                pthread_mutex_unlock(&par->lock);
+                return 1;
+            }
+            if (par->ra_active)
+                kbp_wb_par_drop_reads(par);
+            if (c)
+                kbp_wb_par_submit(par, c);
+            while ((c = kbp_wb_par_find_free(par)) == NULL)
+                pthread_cond_wait(&par->cond, &par->lock);
+            c->state = KBP_WB_PAR_FILLING;
+            c->is_read = 0;
+            c->offset = offset;
+            c->size = 0;
+            par->fill = c;
+            pthread_mutex_unlock(&par->lock);
+        }
+
+        /* The filling chunk is owned by this thread, copy without the lock */
+        n = chunk - c->size;
+        if (n > size)
+            n = size;
+        kbp_memcpy(&c->buf[c->size], buffer, n);
+        c->size += n;
+        buffer += n;
+        offset += n;
+        size -= n;
+    }
+
+    return 0;
+}
+
+int32_t kbp_wb_parallel_read(void *handle, uint8_t *buffer, uint32_t size, uint32_t offset)
+{
+    struct kbp_wb_parallel *par = (struct kbp_wb_parallel *) handle;
+    uint32_t i, restarted = 0;
+
+    if (par->config.region_size && (uint64_t) offset + size > par->config.region_size)
+        return 1;
+
+    pthread_mutex_lock(&par->lock);
+
+    /* Reads issued during a save must observe the data written so far */
+    if (par->fill || kbp_wb_par_writes_pending(par)) {
+        kbp_wb_par_drain_writes(par);
+        if (par->write_error) {
+            pthread_mutex_unlock(&par->lock);
+            return 1;
+        }
+    }
+
+    while (size) {
+        struct kbp_wb_par_chunk *c = NULL;
+        uint32_t n;
+
+        for (i = 0; i < par->config.num_chunks; i++) {
+            struct kbp_wb_par_chunk *t = &par->chunks[i];
+
+            if (t->is_read && !t->discard && t->state != KBP_WB_PAR_FREE
+                && offset >= t->offset && offset - t->offset < t->size) {
+                c = t;
+                break;
+            }
+        }
+
+        if (!c && restarted) {
+            /* Read-ahead cannot reach this offset, read the rest directly */
+            par->stats.read_misses++;
+            pthread_mutex_unlock(&par->lock);
+            return par->read_fn(par->handle, buffer, size, offset);
+        }
+
+        if (!c) {
+            /* Not covered by read-ahead, restart it from here */
+            kbp_wb_par_drop_reads(par);
+            par->ra_active = 1;
+            par->ra_next = offset & ~(par->config.chunk_size - 1);
+            kbp_wb_par_read_ahead(par);
+            restarted = 1;
+            continue;
+        }
+        restarted = 0;
+
+        while (c->state != KBP_WB_PAR_DONE)
+            pthread_cond_wait(&par->cond, &par->lock);
+
+        n = c->offset + c->size - offset;
+        if (n > size)
+            n = size;
+
+        if (c->error) {
+            int32_t r;
+
+            par->stats.read_misses++;
+            pthread_mutex_unlock(&par->lock);
+            r = par->read_fn(par->handle, buffer, n, offset);
+            pthread_mutex_lock(&par->lock);
+            if (r != 0) {
+                pthread_mutex_unlock(&par->lock);
+                return r;
+            }
+        } else {
+            par->stats.read_hits++;
+            kbp_memcpy(buffer, &c->buf[offset - c->offset], n);
+        }
+
+        buffer += n;
+        offset += n;
+        size -= n;
+
+        /* Recycle chunks the reader has moved past */
+        for (i = 0; i < par->config.num_chunks; i++) {
+            struct kbp_wb_par_chunk *t = &par->chunks[i];
+
+            if (t->is_read && t->state == KBP_WB_PAR_DONE && t->offset + t->size <= offset)
+                t->state = KBP_WB_PAR_FREE;
+        }
+        kbp_wb_par_read_ahead(par);
+    }
+
+    pthread_mutex_unlock(&par->lock);
+    return 0;
+}
+
+kbp_status kbp_wb_parallel_sync(struct kbp_wb_parallel *par)
+{
+    kbp_status status = KBP_OK;
+
+    if (!par)
+        return KBP_INVALID_ARGUMENT;
+
+    pthread_mutex_lock(&par->lock);
+    kbp_wb_par_drain_writes(par);
+    kbp_wb_par_drop_reads(par);
+    if (par->write_error)
+        status = KBP_NV_READ_WRITE_FAILED;
+    par->write_error = 0;
+    pthread_mutex_unlock(&par->lock);
+
+    return status;
+}
+
+kbp_status kbp_wb_parallel_create(const struct kbp_wb_parallel_config *config, kbp_device_issu_read_fn read_fn,
+                                  kbp_device_issu_write_fn write_fn, void *handle, struct kbp_wb_parallel **par)
+{
+    struct kbp_wb_parallel *p;
+    uint32_t i;
+
+    if (!read_fn || !write_fn || !par)
+        return KBP_INVALID_ARGUMENT;
+
+    p = kbp_syscalloc(1, sizeof(*p));
+    if (!p)
+        return KBP_OUT_OF_MEMORY;
+
+    if (config)
+        kbp_memcpy(&p->config, config, sizeof(*config));
+    if (p->config.num_threads == 0)
+        p->config.num_threads = KBP_WB_PAR_DEFAULT_THREADS;
+    if (p->config.chunk_size == 0)
+        p->config.chunk_size = KBP_WB_PAR_DEFAULT_CHUNK;
+    if (p->config.num_chunks == 0)
+        p->config.num_chunks = 2 * p->config.num_threads;
+
+    if (p->config.num_threads > KBP_WB_PAR_MAX_THREADS
+        || (p->config.chunk_size & (p->config.chunk_size - 1))) {
+        kbp_sysfree(p);
+        return KBP_INVALID_ARGUMENT;
+    }
+
+    p->read_fn = read_fn;
+    p->write_fn = write_fn;
+    p->handle = handle;
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->cond, NULL);
+
+    p->chunks = kbp_syscalloc(p->config.num_chunks, sizeof(struct kbp_wb_par_chunk));
+    if (!p->chunks) {
+        kbp_wb_parallel_destroy(p);
+        return KBP_OUT_OF_MEMORY;
+    }
+    for (i = 0; i < p->config.num_chunks; i++) {
+        p->chunks[i].buf = kbp_sysmalloc(p->config.chunk_size);
+        if (!p->chunks[i].buf) {
+            kbp_wb_parallel_destroy(p);
+            return KBP_OUT_OF_MEMORY;
+        }
+    }
+
+    for (i = 0; i < p->config.num_threads; i++) {
+        if (pthread_create(&p->threads[i], NULL, kbp_wb_par_worker, p) != 0) {
+            kbp_wb_parallel_destroy(p);
+            return KBP_OUT_OF_MEMORY;
+        }
+        p->num_started++;
+    }
+
+    *par = p;
+    return KBP_OK;
+}
+
+kbp_status kbp_wb_parallel_destroy(struct kbp_wb_parallel *par)
+{
+    kbp_status status;
+    uint32_t i;
+
+    if (!par)
+        return KBP_INVALID_ARGUMENT;
+
+    status = par->chunks ? kbp_wb_parallel_sync(par) : KBP_OK;
+
+    pthread_mutex_lock(&par->lock);
+    par->stop = 1;
+    pthread_cond_broadcast(&par->cond);
+    pthread_mutex_unlock(&par->lock);
+    for (i = 0; i < par->num_started; i++)
+        pthread_join(par->threads[i], NULL);
+
+    if (par->chunks) {
+        for (i = 0; i < par->config.num_chunks; i++)
+            kbp_sysfree(par->chunks[i].buf);
+        kbp_sysfree(par->chunks);
+    }
+    pthread_cond_destroy(&par->cond);
+    pthread_mutex_destroy(&par->lock);
+    kbp_sysfree(par);
+
+    return status;
+}
+
+kbp_status kbp_wb_parallel_save(struct kbp_wb_parallel *par, struct kbp_device *device, int32_t and_continue)
+{
+    kbp_status status, sync_status;
+
+    if (!par || !device)
+        return KBP_INVALID_ARGUMENT;
+
+    if (and_continue)
+        status = kbp_device_save_state_and_continue(device, kbp_wb_parallel_read, kbp_wb_parallel_write, par);
+    else
+        status = kbp_device_save_state(device, kbp_wb_parallel_read, kbp_wb_parallel_write, par);
+
+    sync_status = kbp_wb_parallel_sync(par);
+    return status != KBP_OK ? status : sync_status;
+}
+
+kbp_status kbp_wb_parallel_restore(struct kbp_wb_parallel *par, struct kbp_device *device)
+{
+    kbp_status status, sync_status;
+
+    if (!par || !device)
+        return KBP_INVALID_ARGUMENT;
+
+    status = kbp_device_restore_state(device, kbp_wb_parallel_read, kbp_wb_parallel_write, par);
+
+    sync_status = kbp_wb_parallel_sync(par);
+    return status != KBP_OK ? status : sync_status;
+}
+
+kbp_status kbp_wb_parallel_get_stats(struct kbp_wb_parallel *par, struct kbp_wb_parallel_stats *stats)
+{
+    if (!par || !stats)
+        return KBP_INVALID_ARGUMENT;
+
+    pthread_mutex_lock(&par->lock);
+    kbp_memcpy(stats, &par->stats, sizeof(*stats));
+    pthread_mutex_unlock(&par->lock);
+
+    return KBP_OK;
+}
@@ -0,0 +1,777 @@
+/*
+ * $Id$
+ *
+ * This license is set out in https://raw.githubusercontent.com/Broadcom/Broadcom-Compute-Connectivity-Software-KBP-SDK/master/Legal/LICENSE file.
+ *
+ * $Copyright: (c) 2023 Broadcom Inc.
+ * All Rights Reserved.$
+ *
+ */
+
+/*
+ * Control plane update benchmark on the software model.
+ *
+ * Builds one database on a kbp_sw_model_init() device, loads it, churns it
+ * and empties it again. It reports adds/s, deletes/s, installs/s, device
+ * writes and entry moves per update and peak memory as a single JSON object
+ * on stdout, so results of different SDK releases can be compared by script.
+ * A failed add, delete or install ends the run. The JSON object still
+ * reports the phases up to that point, with the error in "status" and
+ * "failed_phase", and the exit status is 1.
+ *
+ * Workloads:
+ *   ipv4   BGP like IPv4 LPM table, prefix lengths follow a routing table mix
+ *   ipv6   BGP like IPv6 LPM table
+ *   acl    5-tuple ACL with source and destination port ranges
+ *   em     EM host table keyed by VRF and IPv4 address
+ *   mixed  IPv4 LPM table with 32b, 64b and 128b AD databases
+ *
+ * Entries come from a seeded generator, or from a file with -f:
+ *   ipv4, ipv6, mixed  one prefix per line, a.b.c.d/len or x:x::x/len
+ *   em                 one "vrf a.b.c.d" per line
+ *   acl                "sip/len dip/len sport_lo-sport_hi dport_lo-dport_hi proto" per line
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <arpa/inet.h>
+#include <sys/resource.h>
+#include <time.h>
+
+#include "kbp_portable.h"
+#include "default_allocator.h"
+#include "init.h"
+#include "device.h"
+#include "db.h"
+#include "ad.h"
+#include "key.h"
+#include "instruction.h"
+#include "model.h"
+#include "kbp_install_stats.h"
+
+#define BENCH_MAX_KEY_BYTES     (16)
+#define BENCH_MAX_AD_DBS        (3)
+#define BENCH_AD_POOL           (4096)
+#define BENCH_DB_ID             (1)
+#define BENCH_LTR               (1)
+
+enum bench_workload {
+    BENCH_IPV4,
+    BENCH_IPV6,
+    BENCH_ACL,
+    BENCH_EM,
+    BENCH_MIXED
+};
+
+static const char *bench_workload_names[] = { "ipv4", "ipv6", "acl", "em", "mixed" };
+
+/*
+ * One generated or parsed entry. For LPM the prefix length is in len,
+ * for ACL the key is data/mask plus two port ranges.
+ */
+
+struct bench_rule {
+    uint8_t data[BENCH_MAX_KEY_BYTES];
+    uint8_t mask[BENCH_MAX_KEY_BYTES];
+    uint32_t len;
+    uint16_t range_lo[2];
+    uint16_t range_hi[2];
+};
+
+struct bench_phase {
+    const char *name;
+    uint64_t num_ops;           /* adds or deletes that succeeded */
+    uint64_t num_failed;        /* duplicates and other rejected updates */
+    uint64_t num_installs;
+    uint64_t update_ns;         /* time in add and delete calls */
+    uint64_t install_ns;        /* time in kbp_db_install */
+    uint64_t num_writes;        /* device writes, only with -p */
+    uint64_t num_moves;         /* entries moved in hardware, only with -p */
+};
+
+struct bench {
+    enum bench_workload workload;
+    uint32_t num_entries;
+    uint32_t num_churn;
+    uint32_t batch;
+    uint32_t ad_width_1;
+    uint64_t seed;              /* generator state */
+    uint64_t seed_arg;
+    const char *file;
+    uint32_t count_writes;
+
+    struct kbp_allocator *alloc;
+    void *model_xpt;
+    void *xpt;
+    struct kbp_install_stats *istats;
+    struct kbp_device *device;
+    struct kbp_db *db;
+    struct kbp_ad_db *ad_db[BENCH_MAX_AD_DBS];
+    struct kbp_ad **ads[BENCH_MAX_AD_DBS];
+    uint32_t ad_width[BENCH_MAX_AD_DBS];
+    uint32_t num_ad_dbs;
+
+    struct bench_rule *rules;   /* from the file, or NULL for the generator */
+    uint32_t num_rules;
+    uint32_t next_rule;
+    struct kbp_entry **entries; /* live entries, compacted */
+    uint32_t num_live;
+};
+
+static uint64_t bench_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint64_t bench_rand(struct bench *b)
+{
+    /* xorshift64*, same sequence for the same seed on every host */
+    b->seed ^= b->seed >> 12;
+    b->seed ^= b->seed << 25;
+    b->seed ^= b->seed >> 27;
+    return b->seed * 0x2545F4914F6CDD1DULL;
+}
+
+static void bench_set_prefix(struct bench_rule *r, uint32_t width_8, uint32_t len, struct bench *b)
+{
+    uint32_t i;
+
+    for (i = 0; i < width_8; i++)
+        r->data[i] = (uint8_t) bench_rand(b);
+    /* LPM ignores the bits past len, keep them zero so duplicates are real duplicates */
+    for (i = 0; i < width_8 * 8; i++) {
+        if (i >= len)
+            r->data[i / 8] &= ~(0x80 >> (i % 8));
+    }
+    r->len = len;
+}
+
+static uint32_t bench_ipv4_len(struct bench *b)
+{
+    uint32_t p = bench_rand(b) % 100;
+
+    /* Rough public IPv4 table mix, dominated by /24 */
+    if (p < 58)
+        return 24;
+    if (p < 68)
+        return 22;
+    if (p < 76)
+        return 23;
+    if (p < 82)
+        return 21;
+    if (p < 87)
+        return 20;
+    if (p < 91)
+        return 19;
+    if (p < 95)
+        return 16;
+    return 8 + bench_rand(b) % 24;
+}
+
+static uint32_t bench_ipv6_len(struct bench *b)
+{
+    uint32_t p = bench_rand(b) % 100;
+
+    /* Rough public IPv6 table mix, dominated by /48 */
+    if (p < 46)
+        return 48;
+    if (p < 58)
+        return 32;
+    if (p < 66)
+        return 44;
+    if (p < 73)
+        return 40;
+    if (p < 79)
+        return 36;
+    if (p < 84)
+        return 29;
+    if (p < 89)
+        return 64;
+    return 16 + bench_rand(b) % 49;
+}
+
+static void bench_gen_acl(struct bench *b, struct bench_rule *r)
+{
+    static const uint8_t protos[] = { 6, 17, 1 };
+    uint32_t i, sl = 16 + bench_rand(b) % 17, dl = 8 + bench_rand(b) % 25;
+
+    /* sip 32 ternary, dip 32 ternary, sport 16 range, dport 16 range, proto 8 ternary */
+    kbp_memset(r, 0, sizeof(*r));
+    for (i = 0; i < 8; i++)
+        r->data[i] = (uint8_t) bench_rand(b);
+    for (i = 0; i < 32; i++) {
+        if (i >= sl)
+            r->mask[i / 8] |= 0x80 >> (i % 8);
+        if (i >= dl)
+            r->mask[4 + i / 8] |= 0x80 >> (i % 8);
+    }
+    /* Range fields are matched by kbp_entry_add_range(), their key bytes are don't care */
+    kbp_memset(&r->mask[8], 0xFF, 4);
+    r->data[12] = protos[bench_rand(b) % 3];
+    if (bench_rand(b) % 4 == 0)
+        r->mask[12] = 0xFF;
+
+    for (i = 0; i < 2; i++) {
+        switch (bench_rand(b) % 4) {
+        case 0:                /* any */
+            r->range_lo[i] = 0;
+            r->range_hi[i] = 0xFFFF;
+            break;
+        case 1:                /* well known */
+            r->range_lo[i] = r->range_hi[i] = (uint16_t) (1 + bench_rand(b) % 1023);
+            break;
+        case 2:                /* ephemeral */
+            r->range_lo[i] = 1024;
+            r->range_hi[i] = 0xFFFF;
+            break;
+        default:
+            r->range_lo[i] = (uint16_t) (bench_rand(b) % 0x8000);
+            r->range_hi[i] = (uint16_t) (r->range_lo[i] + bench_rand(b) % 0x8000);
+            break;
+        }
+    }
+}
+
+static void bench_next_rule(struct bench *b, struct bench_rule *r)
+{
+    uint32_t i;
+
+    if (b->rules) {
+        kbp_memcpy(r, &b->rules[b->next_rule], sizeof(*r));
+        b->next_rule = (b->next_rule + 1) % b->num_rules;
+        return;
+    }
+
+    kbp_memset(r, 0, sizeof(*r));
+    switch (b->workload) {
+    case BENCH_IPV4:
+    case BENCH_MIXED:
+        bench_set_prefix(r, 4, bench_ipv4_len(b), b);
+        break;
+    case BENCH_IPV6:
+        bench_set_prefix(r, 16, bench_ipv6_len(b), b);
+        break;
+    case BENCH_ACL:
+        bench_gen_acl(b, r);
+        break;
+    case BENCH_EM:
+        /* vrf 16, host 32; a few VRFs with many hosts each */
+        r->data[1] = (uint8_t) (bench_rand(b) % 16);
+        for (i = 2; i < 6; i++)
+            r->data[i] = (uint8_t) bench_rand(b);
+        break;
+    }
+}
+
+static int bench_parse_prefix(const char *s, int v6, uint8_t *data, uint32_t *len)
+{
+    char buf[64], *slash;
+    uint32_t width = v6 ? 128 : 32;
+
+    if (strlen(s) >= sizeof(buf))
+        return -1;
+    strcpy(buf, s);
+    slash = strchr(buf, '/');
+    *len = width;
+    if (slash) {
+        *slash = 0;
+        *len = (uint32_t) strtoul(slash + 1, NULL, 10);
+        if (*len > width)
+            return -1;
+    }
+    return inet_pton(v6 ? AF_INET6 : AF_INET, buf, data) == 1 ? 0 : -1;
+}
+
+static int bench_load_file(struct bench *b)
+{
+    FILE *fp = kbp_fopen(b->file, "r");
+    char line[256];
+    uint32_t max = 1024, lineno = 0;
+
+    if (!fp) {
+        kbp_printf("Cannot open %s\n", b->file);
+        return -1;
+    }
+
+    b->rules = kbp_sysmalloc(max * sizeof(*b->rules));
+    while (b->rules && fgets(line, sizeof(line), fp)) {
+        struct bench_rule *r;
+        char f[5][64];
+        int n;
+
+        lineno++;
+        n = sscanf(line, "%63s %63s %63s %63s %63s", f[0], f[1], f[2], f[3], f[4]);
+        if (n <= 0 || f[0][0] == '#')
+            continue;
+
+        if (b->num_rules == max) {
+            struct bench_rule *grown = kbp_sysmalloc(2 * max * sizeof(*grown));
+
+            if (grown)
+                kbp_memcpy(grown, b->rules, max * sizeof(*grown));
+            kbp_sysfree(b->rules);
+            b->rules = grown;
+            max *= 2;
+            if (!grown)
+                break;
+        }
+        r = &b->rules[b->num_rules];
+        kbp_memset(r, 0, sizeof(*r));
+
+        switch (b->workload) {
+        case BENCH_IPV4:
+        case BENCH_MIXED:
+        case BENCH_IPV6:
+            if (bench_parse_prefix(f[0], b->workload == BENCH_IPV6, r->data, &r->len) != 0)
+                goto bad;
+            break;
+        case BENCH_EM: {
+            uint32_t vrf, len;
+
+            if (n < 2 || sscanf(f[0], "%u", &vrf) != 1 || bench_parse_prefix(f[1], 0, &r->data[2], &len) != 0)
+                goto bad;
+            r->data[0] = (uint8_t) (vrf >> 8);
+            r->data[1] = (uint8_t) vrf;
+            break;
+        }
+        case BENCH_ACL: {
+            uint32_t i, sl, dl, lo[2], hi[2], proto;
+
+            if (n < 5 || bench_parse_prefix(f[0], 0, &r->data[0], &sl) != 0
+                || bench_parse_prefix(f[1], 0, &r->data[4], &dl) != 0
+                || sscanf(f[2], "%u-%u", &lo[0], &hi[0]) != 2 || sscanf(f[3], "%u-%u", &lo[1], &hi[1]) != 2
+                || lo[0] > hi[0] || hi[0] > 0xFFFF || lo[1] > hi[1] || hi[1] > 0xFFFF)
+                goto bad;
+            for (i = 0; i < 32; i++) {
+                if (i >= sl)
+                    r->mask[i / 8] |= 0x80 >> (i % 8);
+                if (i >= dl)
+                    r->mask[4 + i / 8] |= 0x80 >> (i % 8);
+            }
+            kbp_memset(&r->mask[8], 0xFF, 4);
+            if (strcmp(f[4], "*") == 0) {
+                r->mask[12] = 0xFF;
+            } else {
+                if (sscanf(f[4], "%u", &proto) != 1 || proto > 0xFF)
+                    goto bad;
+                r->data[12] = (uint8_t) proto;
+            }
+            for (i = 0; i < 2; i++) {
+                r->range_lo[i] = (uint16_t) lo[i];
+                r->range_hi[i] = (uint16_t) hi[i];
+            }
+            break;
+        }
+        }
+        b->num_rules++;
+        continue;
+
+    bad:
+        kbp_printf("%s:%u: cannot parse \"%s\"\n", b->file, lineno, strtok(line, "\n"));
+    }
+    kbp_fclose(fp);
+
+    if (!b->rules) {
+        kbp_printf("Out of memory loading %s\n", b->file);
+        return -1;
+    }
+    if (!b->num_rules) {
+        kbp_printf("No entries in %s\n", b->file);
+        return -1;
+    }
+    return 0;
+}
+
+#define BENCH_TRY(f)                                                            \
+    do {                                                                        \
+        kbp_status __st = (f);                                                  \
+        if (__st != KBP_OK) {                                                   \
+            kbp_printf("%s:%d: %s failed: %s\n", __FILE__, __LINE__, #f,        \
+                       kbp_get_status_string(__st));                            \
+            return __st;                                                        \
+        }                                                                       \
+    } while (0)
+
+static kbp_status bench_build(struct bench *b)
+{
+    struct kbp_key *key, *master;
+    struct kbp_instruction *inst;
+    enum kbp_db_type type;
+    uint32_t i, j, capacity = b->num_entries + b->num_entries / 4 + 1;
+
+    BENCH_TRY(default_allocator_create(&b->alloc));
+    BENCH_TRY(kbp_sw_model_init(b->alloc, KBP_DEVICE_OP2, KBP_DEVICE_DEFAULT, NULL, &b->model_xpt));
+    b->xpt = b->model_xpt;
+    if (b->count_writes)
+        BENCH_TRY(kbp_install_stats_create(b->model_xpt, &b->istats, &b->xpt));
+    BENCH_TRY(kbp_device_init(b->alloc, KBP_DEVICE_OP2, KBP_DEVICE_DEFAULT, b->xpt, NULL, &b->device));
+
+    type = b->workload == BENCH_ACL ? KBP_DB_ACL : b->workload == BENCH_EM ? KBP_DB_EM : KBP_DB_LPM;
+    BENCH_TRY(kbp_db_init(b->device, type, BENCH_DB_ID, capacity, &b->db));
+    BENCH_TRY(kbp_key_init(b->device, &key));
+    BENCH_TRY(kbp_key_init(b->device, &master));
+
+    for (i = 0; i < 2; i++) {
+        struct kbp_key *k = i ? master : key;
+
+        switch (b->workload) {
+        case BENCH_IPV4:
+        case BENCH_MIXED:
+            BENCH_TRY(kbp_key_add_field(k, "dip", 32, KBP_KEY_FIELD_PREFIX));
+            break;
+        case BENCH_IPV6:
+            BENCH_TRY(kbp_key_add_field(k, "dip6", 128, KBP_KEY_FIELD_PREFIX));
+            break;
+        case BENCH_EM:
+            BENCH_TRY(kbp_key_add_field(k, "vrf", 16, KBP_KEY_FIELD_EM));
+            BENCH_TRY(kbp_key_add_field(k, "host", 32, KBP_KEY_FIELD_EM));
+            break;
+        case BENCH_ACL:
+            BENCH_TRY(kbp_key_add_field(k, "sip", 32, KBP_KEY_FIELD_TERNARY));
+            BENCH_TRY(kbp_key_add_field(k, "dip", 32, KBP_KEY_FIELD_TERNARY));
+            BENCH_TRY(kbp_key_add_field(k, "sport", 16, KBP_KEY_FIELD_RANGE));
+            BENCH_TRY(kbp_key_add_field(k, "dport", 16, KBP_KEY_FIELD_RANGE));
+            BENCH_TRY(kbp_key_add_field(k, "proto", 8, KBP_KEY_FIELD_TERNARY));
+            break;
+        }
+    }
+    BENCH_TRY(kbp_db_set_key(b->db, key));
+    if (b->istats)
+        BENCH_TRY(kbp_install_stats_track_db(b->istats, b->db, NULL, NULL));
+
+    if (b->workload == BENCH_MIXED) {
+        b->num_ad_dbs = 3;
+        b->ad_width[0] = 32;
+        b->ad_width[1] = 64;
+        b->ad_width[2] = 128;
+    } else {
+        b->num_ad_dbs = 1;
+        b->ad_width[0] = b->ad_width_1;
+    }
+
+    for (i = 0; i < b->num_ad_dbs; i++) {
+        BENCH_TRY(kbp_ad_db_init(b->device, BENCH_DB_ID + i, capacity, b->ad_width[i], &b->ad_db[i]));
+        BENCH_TRY(kbp_db_set_ad(b->db, b->ad_db[i]));
+    }
+
+    BENCH_TRY(kbp_instruction_init(b->device, BENCH_LTR, BENCH_LTR, &inst));
+    BENCH_TRY(kbp_instruction_set_key(inst, master));
+    BENCH_TRY(kbp_instruction_add_db(inst, b->db, 0));
+    BENCH_TRY(kbp_device_lock(b->device));
+    BENCH_TRY(kbp_instruction_install(inst));
+
+    /* Entries share a pool of AD values, as routes share next hops */
+    for (i = 0; i < b->num_ad_dbs; i++) {
+        b->ads[i] = kbp_syscalloc(BENCH_AD_POOL, sizeof(struct kbp_ad *));
+        if (!b->ads[i])
+            return KBP_OUT_OF_MEMORY;
+        for (j = 0; j < BENCH_AD_POOL; j++) {
+            uint8_t value[16];
+
+            kbp_memset(value, 0, sizeof(value));
+            value[0] = (uint8_t) (j >> 8);
+            value[1] = (uint8_t) j;
+            BENCH_TRY(kbp_ad_db_add_entry(b->ad_db[i], value, &b->ads[i][j]));
+        }
+    }
+
+    b->entries = kbp_syscalloc(capacity, sizeof(*b->entries));
+    if (!b->entries)
+        return KBP_OUT_OF_MEMORY;
+    return KBP_OK;
+}
+
+static kbp_status bench_add_one(struct bench *b, struct bench_phase *ph)
+{
+    struct bench_rule r;
+    struct kbp_entry *entry = NULL;
+    kbp_status status;
+    uint32_t ad_db;
+    uint64_t t0;
+
+    bench_next_rule(b, &r);
+    ad_db = b->num_live % b->num_ad_dbs;
+
+    t0 = bench_now_ns();
+    if (b->workload == BENCH_ACL)
+        status = kbp_db_add_ace(b->db, r.data, r.mask, b->num_live, &entry);
+    else if (b->workload == BENCH_EM)
+        status = kbp_db_add_em(b->db, r.data, &entry);
+    else
+        status = kbp_db_add_prefix(b->db, r.data, r.len, &entry);
+    if (status == KBP_OK && b->workload == BENCH_ACL) {
+        status = kbp_entry_add_range(b->db, entry, r.range_lo[0], r.range_hi[0], 0);
+        if (status == KBP_OK)
+            status = kbp_entry_add_range(b->db, entry, r.range_lo[1], r.range_hi[1], 1);
+    }
+    if (status == KBP_OK)
+        status = kbp_entry_add_ad(b->db, entry, b->ads[ad_db][bench_rand(b) % BENCH_AD_POOL]);
+    ph->update_ns += bench_now_ns() - t0;
+
+    if (status != KBP_OK) {
+        /* Generated and real tables both contain duplicates, count and move on */
+        if (entry)
+            kbp_db_delete_entry(b->db, entry);
+        ph->num_failed++;
+        return status == KBP_DUPLICATE ? KBP_OK : status;
+    }
+
+    b->entries[b->num_live++] = entry;
+    ph->num_ops++;
+    return KBP_OK;
+}
+
+static kbp_status bench_delete_one(struct bench *b, struct bench_phase *ph, uint32_t slot)
+{
+    kbp_status status;
+    uint64_t t0;
+
+    t0 = bench_now_ns();
+    status = kbp_db_delete_entry(b->db, b->entries[slot]);
+    ph->update_ns += bench_now_ns() - t0;
+    if (status != KBP_OK) {
+        ph->num_failed++;
+        return status;
+    }
+
+    b->entries[slot] = b->entries[--b->num_live];
+    ph->num_ops++;
+    return KBP_OK;
+}
+
+static kbp_status bench_install(struct bench *b, struct bench_phase *ph)
+{
+    kbp_status status;
+    uint64_t t0;
+
+    t0 = bench_now_ns();
+    if (b->istats)
+        status = kbp_install_stats_db_install(b->istats, b->db);
+    else
+        status = kbp_db_install(b->db);
+    ph->install_ns += bench_now_ns() - t0;
+    ph->num_installs++;
+
+    if (b->istats) {
+        struct kbp_db_install_stats last;
+
+        kbp_db_get_install_stats(b->istats, b->db, &last, NULL);
+        ph->num_writes += last.num_dba_writes + last.num_uda_writes + last.num_reg_writes
+            + last.num_commands + last.num_stats_writes;
+        ph->num_moves += last.num_moves;
+    }
+    return status;
+}
+
+static void bench_print_phase(const struct bench_phase *ph, int last)
+{
+    uint64_t total_ns = ph->update_ns + ph->install_ns;
+
+    printf("    \"%s\": {\"ops\": %llu, \"failed\": %llu, \"installs\": %llu, "
+           "\"update_ns\": %llu, \"install_ns\": %llu, \"ops_per_sec\": %.1f, "
+           "\"installs_per_sec\": %.1f, \"updates_per_sec\": %.1f, \"writes\": %llu, "
+           "\"writes_per_update\": %.2f, \"moves\": %llu}%s\n",
+           ph->name, (unsigned long long) ph->num_ops, (unsigned long long) ph->num_failed,
+           (unsigned long long) ph->num_installs, (unsigned long long) ph->update_ns,
+           (unsigned long long) ph->install_ns,
+           ph->update_ns ? ph->num_ops * 1e9 / ph->update_ns : 0.0,
+           ph->install_ns ? ph->num_installs * 1e9 / ph->install_ns : 0.0,
+           total_ns ? ph->num_ops * 1e9 / total_ns : 0.0,
+           (unsigned long long) ph->num_writes,
+           ph->num_ops ? (double) ph->num_writes / ph->num_ops : 0.0, (unsigned long long) ph->num_moves,
+           last ? "" : ",");
+}
+
+/*
+ * Prints s as a JSON string
+ */
+
+static void bench_print_string(const char *s)
+{
+    putchar('"');
+    for (; *s; s++) {
+        unsigned char c = (unsigned char) *s;
+
+        if (c == '"' || c == '\\')
+            printf("\\%c", c);
+        else if (c < 0x20)
+            printf("\\u%04x", c);
+        else
+            putchar(c);
+    }
+    putchar('"');
+}
+
+static void bench_usage(const char *prog)
+{
+    printf("Usage: %s [options]\n"
+           "  -w ipv4|ipv6|acl|em|mixed  Workload (ipv4)\n"
+           "  -n entries                 Entries loaded before churn (100000)\n"
+           "  -c updates                 Churn updates, one delete plus one add each (entries / 10)\n"
+           "  -b batch                   Updates per kbp_db_install() (1000)\n"
+           "  -a width                   AD width in bits, 32, 64 or 128 (32)\n"
+           "  -s seed                    Generator seed (1)\n"
+           "  -f file                    Read entries from file instead of generating them\n"
+           "  -p                         Count device writes and entry moves per install\n",
+           prog);
+}
+
+int main(int argc, char **argv)
+{
+    struct bench b;
+    struct bench_phase phases[3];
+    struct default_allocator_stats astats;
+    struct rusage ru;
+    kbp_status status = KBP_OK;
+    int32_t failed_phase = -1;
+    uint32_t i;
+    int opt;
+
+    kbp_memset(&b, 0, sizeof(b));
+    kbp_memset(phases, 0, sizeof(phases));
+    b.workload = BENCH_IPV4;
+    b.num_entries = 100000;
+    b.num_churn = 0xFFFFFFFF;
+    b.batch = 1000;
+    b.ad_width_1 = 32;
+    b.seed = 1;
+
+    while ((opt = getopt(argc, argv, "w:n:c:b:a:s:f:ph")) != -1) {
+        switch (opt) {
+        case 'w':
+            for (i = 0; i < sizeof(bench_workload_names) / sizeof(bench_workload_names[0]); i++) {
+                if (strcmp(optarg, bench_workload_names[i]) == 0)
+                    break;
+            }
+            if (i == sizeof(bench_workload_names) / sizeof(bench_workload_names[0])) {
+                bench_usage(argv[0]);
+                return 1;
+            }
+            b.workload = (enum bench_workload) i;
+            break;
+        case 'n':
+            b.num_entries = (uint32_t) strtoul(optarg, NULL, 0);
+            break;
+        case 'c':
+            b.num_churn = (uint32_t) strtoul(optarg, NULL, 0);
+            break;
+        case 'b':
+            b.batch = (uint32_t) strtoul(optarg, NULL, 0);
+            break;
+        case 'a':
+            b.ad_width_1 = (uint32_t) strtoul(optarg, NULL, 0);
+            break;
+        case 's':
+            b.seed = strtoull(optarg, NULL, 0);
+            break;
+        case 'f':
+            b.file = optarg;
+            break;
+        case 'p':
+            b.count_writes = 1;
+            break;
+        default:
+            bench_usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    if (!b.num_entries || !b.batch || !b.seed
+        || (b.ad_width_1 != 32 && b.ad_width_1 != 64 && b.ad_width_1 != 128)) {
+        bench_usage(argv[0]);
+        return 1;
+    }
+    b.seed_arg = b.seed;
+    if (b.num_churn == 0xFFFFFFFF)
+        b.num_churn = b.num_entries / 10;
+    if (b.file && bench_load_file(&b) != 0)
+        return 1;
+
+    if (bench_build(&b) != KBP_OK)
+        return 1;
+
+    phases[0].name = "load";
+    phases[1].name = "churn";
+    phases[2].name = "drain";
+
+    /* Load. A failed call ends the run, the results so far are still reported */
+    for (i = 0; status == KBP_OK && i < b.num_entries; i++) {
+        status = bench_add_one(&b, &phases[0]);
+        if (status == KBP_OK && (i + 1) % b.batch == 0)
+            status = bench_install(&b, &phases[0]);
+    }
+    if (status == KBP_OK)
+        status = bench_install(&b, &phases[0]);
+    if (status != KBP_OK)
+        failed_phase = 0;
+
+    /* Churn: withdraw a random entry and announce a new one */
+    for (i = 0; status == KBP_OK && i < b.num_churn && b.num_live; i++) {
+        status = bench_delete_one(&b, &phases[1], bench_rand(&b) % b.num_live);
+        if (status == KBP_OK)
+            status = bench_add_one(&b, &phases[1]);
+        if (status == KBP_OK && (i + 1) % b.batch == 0)
+            status = bench_install(&b, &phases[1]);
+    }
+    if (status == KBP_OK)
+        status = bench_install(&b, &phases[1]);
+    if (status != KBP_OK && failed_phase < 0)
+        failed_phase = 1;
+
+    /* Drain */
+    for (i = 0; status == KBP_OK && b.num_live; i++) {
+        status = bench_delete_one(&b, &phases[2], b.num_live - 1);
+        if (status == KBP_OK && (i + 1) % b.batch == 0)
+            status = bench_install(&b, &phases[2]);
+    }
+    if (status == KBP_OK)
+        status = bench_install(&b, &phases[2]);
+    if (status != KBP_OK && failed_phase < 0)
+        failed_phase = 2;
+
+    default_allocator_get_stats(b.alloc, &astats);
+    getrusage(RUSAGE_SELF, &ru);
+
+    printf("{\n");
+    printf("  \"sdk\": ");
+    bench_print_string(kbp_device_get_sdk_version());
+    printf(",\n");
+    printf("  \"workload\": \"%s\",\n", bench_workload_names[b.workload]);
+    printf("  \"source\": ");
+    bench_print_string(b.file ? b.file : "generator");
+    printf(",\n");
+    printf("  \"status\": ");
+    bench_print_string(status == KBP_OK ? "ok" : kbp_get_status_string(status));
+    printf(",\n");
+    if (failed_phase >= 0)
+        printf("  \"failed_phase\": \"%s\",\n", phases[failed_phase].name);
+    else
+        printf("  \"failed_phase\": null,\n");
+    printf("  \"entries\": %u,\n  \"churn\": %u,\n  \"batch\": %u,\n  \"ad_width\": %u,\n  \"seed\": %llu,\n",
+           b.num_entries, b.num_churn, b.batch, b.workload == BENCH_MIXED ? 0 : b.ad_width_1,
+           (unsigned long long) b.seed_arg);
+    printf("  \"count_writes\": %s,\n", b.count_writes ? "true" : "false");
+    printf("  \"phases\": {\n");
+    for (i = 0; i < 3; i++)
+        bench_print_phase(&phases[i], i == 2);
+    printf("  },\n");
+    printf("  \"peak_sdk_bytes\": %llu,\n", (unsigned long long) astats.peak_bytes);
+    printf("  \"peak_rss_kb\": %ld\n", ru.ru_maxrss);
+    printf("}\n");
+
+    kbp_device_destroy(b.device);
+    if (b.istats)
+        kbp_install_stats_destroy(b.istats);
+    kbp_sw_model_destroy(b.model_xpt);
+    default_allocator_destroy(b.alloc);
+    for (i = 0; i < b.num_ad_dbs; i++)
+        kbp_sysfree(b.ads[i]);
+    kbp_sysfree(b.entries);
+    kbp_sysfree(b.rules);
+    return status == KBP_OK ? 0 : 1;
+}
@@ -0,0 +1,94 @@
+/*
+ * $Id$
+ *
+ * This license is set out in https://raw.githubusercontent.com/Broadcom/Broadcom-Compute-Connectivity-Software-KBP-SDK/master/Legal/LICENSE file.
+ *
+ * $Copyright: (c) 2023 Broadcom Inc.
+ * All Rights Reserved.$
+ *
+ */
+
+#ifndef __KBP_CNTR_BATCH_H
+#define __KBP_CNTR_BATCH_H
+
+#include <stdint.h>
+
+#include "errors.h"
+#include "db.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @file kbp_cntr_batch.h
+ *
+ * Batched reads of search-dependent counters.
+ *
+ * kbp_db_get_counter_values() returns the counters of an array of entries in
+ * one call. kbp_db_for_each_counter() walks every entry of a database in
+ * hardware index order and reports each entry with its counter. With
+ * KBP_CNTR_BATCH_REFRESH, both first run one kbp_db_counter_read_initiate()
+ * bulk read, so all the values returned come from the same DMA pass.
+ *
+ * @addtogroup STATS_API
+ * @{
+ */
+
+/**
+ * Batch flag: bulk read the counters from the device before returning them
+ */
+#define KBP_CNTR_BATCH_REFRESH (1 << 0)
+
+/**
+ * Counter visitor.
+ *
+ * @param ctx Caller context passed to kbp_db_for_each_counter().
+ * @param entry Entry handle.
+ * @param index Lowest hardware index of the entry.
+ * @param value 64b counter value.
+ */
+
+typedef void (*kbp_cntr_visit_fn) (void *ctx, struct kbp_entry *entry, int32_t index, uint64_t value);
+
+/**
+ * Returns the counters of an array of entries.
+ *
+ * @param db Valid database handle.
+ * @param entries Entry handles.
+ * @param num_entries Number of entries.
+ * @param values Caller array of num_entries counter values, populated on return.
+ * @param flags Zero or KBP_CNTR_BATCH_REFRESH.
+ *
+ * @return KBP_OK on success, KBP_POLL_TIME_OUT if the bulk read does not complete within a second,
+ *         or an error code otherwise.
+ */
+
+kbp_status kbp_db_get_counter_values(struct kbp_db *db, struct kbp_entry **entries, uint32_t num_entries,
+                                     uint64_t *values, uint32_t flags);
+
+/**
+ * Calls visit for every entry of the database that has a hardware index,
+ * in increasing index order.
+ *
+ * @param db Valid database handle.
+ * @param visit Visitor callback.
+ * @param ctx Passed back to visit.
+ * @param flags Zero or KBP_CNTR_BATCH_REFRESH.
+ * @param num_visited Number of entries visited, returned if not NULL.
+ *
+ * @return KBP_OK on success, KBP_POLL_TIME_OUT if the bulk read does not complete within a second,
+ *         or an error code otherwise.
+ */
+
+kbp_status kbp_db_for_each_counter(struct kbp_db *db, kbp_cntr_visit_fn visit, void *ctx, uint32_t flags,
+                                   uint32_t *num_visited);
+
+/**
+ * @}
+ */
+
+#ifdef __cplusplus
+}
+#endif
+#endif                          /* __KBP_CNTR_BATCH_H */
@@ -0,0 +1,311 @@
+/*
+ * $Id$
+ *
+ * This license is set out in https://raw.githubusercontent.com/Broadcom/Broadcom-Compute-Connectivity-Software-KBP-SDK/master/Legal/LICENSE file.
+ *
+ * $Copyright: (c) 2023 Broadcom Inc.
+ * All Rights Reserved.$
+ *
+ */
+
+#ifndef __KBP_LATENCY_H
+#define __KBP_LATENCY_H
+
+#include <stdint.h>
+
+#include "errors.h"
+#include "device.h"
+#include "db.h"
+#include "ad.h"
+#include "instruction.h"
+#include "kbp_hb.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @file kbp_latency.h
+ *
+ * Per API latency histograms.
+ *
+ * The kbp_latency_* wrappers call the API of the same name and add the time
+ * it took to a histogram of the device, and to one of the database (or AD
+ * or hit bit database) the call was made on. Histogram buckets are
+ * log-linear: eight linear steps per power of two, so any recorded value is
+ * off by at most 12.5%, from nanoseconds up to minutes, in a fixed 1.2KB
+ * per histogram. Times come from CLOCK_MONOTONIC, so a wall clock step does
+ * not distort them. Recording takes two clock reads and a few increments
+ * under a mutex, which is small next to any of the wrapped calls. Passing a
+ * NULL latency handle to a wrapper makes the plain call.
+ *
+ * If the latency handle is created on the device transport, the time an
+ * install spends in transport writes is recorded as
+ * ::KBP_LATENCY_DB_INSTALL_HW and the rest as
+ * ::KBP_LATENCY_DB_INSTALL_PLACEMENT. Writes made by other threads during the
+ * install are counted towards it.
+ *
+ * @addtogroup DEVICE_API
+ * @{
+ */
+
+/**
+ * Linear steps per power of two
+ */
+
+#define KBP_LATENCY_SUB_BUCKETS  (8)
+
+/**
+ * Number of histogram buckets, the last one also holds every larger value
+ */
+
+#define KBP_LATENCY_NUM_BUCKETS  (304)
+
+/**
+ * Timed APIs
+ */
+
+enum kbp_latency_api {
+    KBP_LATENCY_DB_ADD,              /**< kbp_db_add_ace(), kbp_db_add_prefix(), kbp_db_add_em() */
+    KBP_LATENCY_DB_DELETE,           /**< kbp_db_delete_entry() */
+    KBP_LATENCY_DB_INSTALL,          /**< kbp_db_install() */
+    KBP_LATENCY_DB_INSTALL_PLACEMENT, /**< kbp_db_install() outside transport writes */
+    KBP_LATENCY_DB_INSTALL_HW,       /**< kbp_db_install() in transport writes */
+    KBP_LATENCY_SEARCH,              /**< kbp_instruction_search() */
+    KBP_LATENCY_AD_ADD,              /**< kbp_ad_db_add_entry() */
+    KBP_LATENCY_AD_UPDATE,           /**< kbp_ad_db_update_entry() */
+    KBP_LATENCY_AD_DELETE,           /**< kbp_ad_db_delete_entry() */
+    KBP_LATENCY_WB_SAVE,             /**< kbp_device_save_state(), kbp_device_save_state_and_continue() */
+    KBP_LATENCY_WB_RESTORE,          /**< kbp_device_restore_state() */
+    KBP_LATENCY_HB_TIMER,            /**< kbp_hb_db_timer() */
+    KBP_LATENCY_NUM_APIS             /**< Must be last */
+};
+
+/**
+ * Latency histogram. Failed calls are counted in num_errors and
+ * recorded like the others.
+ */
+
+struct kbp_latency_hist {
+    uint64_t count;             /**< Calls recorded */
+    uint64_t num_errors;        /**< Calls that did not return KBP_OK */
+    uint64_t total_ns;          /**< Sum of all latencies */
+    uint64_t min_ns;            /**< Smallest latency, zero if count is zero */
+    uint64_t max_ns;            /**< Largest latency */
+    uint32_t buckets[KBP_LATENCY_NUM_BUCKETS]; /**< Calls per bucket, see kbp_latency_bucket_floor() */
+};
+
+/**
+ * Opaque latency handle
+ */
+
+struct kbp_latency;
+
+/**
+ * Creates a latency handle for one device.
+ *
+ * @param xpt The device transport, or NULL to record installs without the placement and hardware split.
+ * @param latency Latency handle, initialized and returned on success.
+ * @param timed_xpt Set to the transport to pass to kbp_device_init() in place of xpt. NULL if xpt is NULL.
+ *
+ * @return KBP_OK on success or an error code otherwise.
+ */
+
+kbp_status kbp_latency_create(void *xpt, struct kbp_latency **latency, void **timed_xpt);
+
+/**
+ * Destroys the latency handle. If it was created on a transport, the
+ * device using it must be destroyed first.
+ *
+ * @param latency Valid latency handle.
+ *
+ * @return KBP_OK on success or an error code otherwise.
+ */
+
+kbp_status kbp_latency_destroy(struct kbp_latency *latency);
+
+/**
+ * Returns a histogram.
+ *
+ * @param latency Valid latency handle.
+ * @param object Database, AD database or hit bit database handle, or NULL for the whole device.
+ * @param api The API.
+ * @param hist Valid pointer populated on return. Zero if nothing was recorded for the object.
+ *
+ * @return KBP_OK on success or an error code otherwise.
+ */
+
+kbp_status kbp_latency_get(struct kbp_latency *latency, const void *object, enum kbp_latency_api api,
+                           struct kbp_latency_hist *hist);
+
+/**
+ * Clears histograms.
+ *
+ * @param latency Valid latency handle.
+ * @param object Clear the histograms of this object only, or all of them if NULL.
+ *
+ * @return KBP_OK on success or an error code otherwise.
+ */
+
+kbp_status kbp_latency_reset(struct kbp_latency *latency, const void *object);
+
+/**
+ * Drops the histograms of an object. Call it when the database, AD
+ * database or hit bit database is destroyed, or a new one allocated at the
+ * same address inherits them. The device histograms keep its calls.
+ *
+ * @param latency Valid latency handle.
+ * @param object Database, AD database or hit bit database handle.
+ *
+ * @return KBP_OK on success or an error code otherwise.
+ */
+
+kbp_status kbp_latency_forget(struct kbp_latency *latency, const void *object);
+
+/**
+ * Returns the smallest latency that falls in a bucket.
+ *
+ * @param bucket Bucket number below ::KBP_LATENCY_NUM_BUCKETS.
+ *
+ * @return Lower bound of the bucket in nanoseconds.
+ */
+
+uint64_t kbp_latency_bucket_floor(uint32_t bucket);
+
+/**
+ * Estimates a percentile from a histogram, to the upper bound of its bucket.
+ *
+ * @param hist Histogram.
+ * @param percentile Percentile between 0 and 100.
+ *
+ * @return Latency in nanoseconds, zero for an empty histogram.
+ */
+
+uint64_t kbp_latency_percentile(const struct kbp_latency_hist *hist, double percentile);
+
+/**
+ * Timed kbp_db_add_ace().
+ *
+ * @return The status of kbp_db_add_ace().
+ */
+
+kbp_status kbp_latency_db_add_ace(struct kbp_latency *latency, struct kbp_db *db, uint8_t *data, uint8_t *mask,
+                                  uint32_t priority, struct kbp_entry **entry);
+
+/**
+ * Timed kbp_db_add_prefix().
+ *
+ * @return The status of kbp_db_add_prefix().
+ */
+
+kbp_status kbp_latency_db_add_prefix(struct kbp_latency *latency, struct kbp_db *db, uint8_t *prefix,
+                                     uint32_t length, struct kbp_entry **entry);
+
+/**
+ * Timed kbp_db_add_em().
+ *
+ * @return The status of kbp_db_add_em().
+ */
+
+kbp_status kbp_latency_db_add_em(struct kbp_latency *latency, struct kbp_db *db, uint8_t *data,
+                                 struct kbp_entry **entry);
+
+/**
+ * Timed kbp_db_delete_entry().
+ *
+ * @return The status of kbp_db_delete_entry().
+ */
+
+kbp_status kbp_latency_db_delete_entry(struct kbp_latency *latency, struct kbp_db *db, struct kbp_entry *entry);
+
+/**
+ * Timed kbp_db_install(), split into placement and hardware writes when
+ * the latency handle was created on the transport.
+ *
+ * @return The status of kbp_db_install().
+ */
+
+kbp_status kbp_latency_db_install(struct kbp_latency *latency, struct kbp_db *db);
+
+/**
+ * Timed kbp_instruction_search(), recorded for the device only.
+ *
+ * @return The status of kbp_instruction_search().
+ */
+
+kbp_status kbp_latency_instruction_search(struct kbp_latency *latency, struct kbp_instruction *instruction,
+                                          uint8_t *master_key, uint32_t cb_addrs,
+                                          struct kbp_search_result *result);
+
+/**
+ * Timed kbp_ad_db_add_entry().
+ *
+ * @return The status of kbp_ad_db_add_entry().
+ */
+
+kbp_status kbp_latency_ad_db_add_entry(struct kbp_latency *latency, struct kbp_ad_db *db, uint8_t *value,
+                                       struct kbp_ad **ad);
+
+/**
+ * Timed kbp_ad_db_update_entry().
+ *
+ * @return The status of kbp_ad_db_update_entry().
+ */
+
+kbp_status kbp_latency_ad_db_update_entry(struct kbp_latency *latency, struct kbp_ad_db *db, struct kbp_ad *ad,
+                                          uint8_t *value);
+
+/**
+ * Timed kbp_ad_db_delete_entry().
+ *
+ * @return The status of kbp_ad_db_delete_entry().
+ */
+
+kbp_status kbp_latency_ad_db_delete_entry(struct kbp_latency *latency, struct kbp_ad_db *db, struct kbp_ad *ad);
+
+/**
+ * Timed kbp_device_save_state().
+ *
+ * @return The status of kbp_device_save_state().
+ */
+
+kbp_status kbp_latency_device_save_state(struct kbp_latency *latency, struct kbp_device *device,
+                                         kbp_device_issu_read_fn read_fn, kbp_device_issu_write_fn write_fn,
+                                         void *handle);
+
+/**
+ * Timed kbp_device_save_state_and_continue(), recorded as ::KBP_LATENCY_WB_SAVE.
+ *
+ * @return The status of kbp_device_save_state_and_continue().
+ */
+
+kbp_status kbp_latency_device_save_state_and_continue(struct kbp_latency *latency, struct kbp_device *device,
+                                                      kbp_device_issu_read_fn read_fn,
+                                                      kbp_device_issu_write_fn write_fn, void *handle);
+
+/**
+ * Timed kbp_device_restore_state().
+ *
+ * @return The status of kbp_device_restore_state().
+ */
+
+kbp_status kbp_latency_device_restore_state(struct kbp_latency *latency, struct kbp_device *device,
+                                            kbp_device_issu_read_fn read_fn, kbp_device_issu_write_fn write_fn,
+                                            void *handle);
+
+/**
+ * Timed kbp_hb_db_timer().
+ *
+ * @return The status of kbp_hb_db_timer().
+ */
+
+kbp_status kbp_latency_hb_db_timer(struct kbp_latency *latency, struct kbp_hb_db *hb_db);
+
+/**
+ * @}
+ */
+
+#ifdef __cplusplus
+}
+#endif
+#endif                          /* __KBP_LATENCY_H */
@@ -0,0 +1,116 @@
+/*
+ * $Id$
+ *
+ * This license is set out in https://raw.githubusercontent.com/Broadcom/Broadcom-Compute-Connectivity-Software-KBP-SDK/master/Legal/LICENSE file.
+ *
+ * $Copyright: (c) 2023 Broadcom Inc.
+ * All Rights Reserved.$
+ *
+ */
+
+#ifndef __KBP_WB_MMAP_H
+#define __KBP_WB_MMAP_H
+
+#include <stdint.h>
+
+#include "errors.h"
+#include "device.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @file kbp_wb_mmap.h
+ *
+ * Warmboot images held in memory-mapped files or shared memory.
+ *
+ * The image is mapped once with kbp_mmap(), and the ISSU callbacks are
+ * served straight from the mapping. A restore then costs a single copy
+ * from the page cache into the SDK's buffers, with no read system call and
+ * no intermediate buffer per request. Pages are read ahead of the SDK's
+ * cursor with madvise(), and the pages already consumed are released.
+ *
+ * An image that is already mapped (for example a shared memory segment
+ * kept across the upgrade) can be attached by pointer and length.
+ *
+ * @addtogroup ISSU_API
+ * @{
+ */
+
+/**
+ * Opaque mapped warmboot image handle
+ */
+
+struct kbp_wb_mmap;
+
+/**
+ * Maps a warmboot image file.
+ *
+ * @param path File holding the image.
+ * @param save_size Zero to map an existing image read-only for restore. Otherwise the file
+ *                  is created or resized to save_size bytes and mapped writable for save.
+ * @param map Mapped image handle, initialized and returned on success.
+ *
+ * @return KBP_OK on success or an error code otherwise.
+ */
+
+kbp_status kbp_wb_mmap_open(const char *path, uint32_t save_size, struct kbp_wb_mmap **map);
+
+/**
+ * Attaches an image that is already mapped by the caller. The memory is
+ * neither copied nor unmapped by kbp_wb_mmap_close().
+ *
+ * @param image Start of the image.
+ * @param length Image length in bytes.
+ * @param writable Nonzero if saves may write into the memory.
+ * @param map Mapped image handle, initialized and returned on success.
+ *
+ * @return KBP_OK on success or an error code otherwise.
+ */
+
+kbp_status kbp_wb_mmap_attach(void *image, uint32_t length, int32_t writable, struct kbp_wb_mmap **map);
+
+/**
+ * Flushes a writable file mapping to its file, then unmaps it and frees the handle.
+ *
+ * @param map Valid mapped image handle.
+ *
+ * @return KBP_OK on success or an error code otherwise.
+ */
+
+kbp_status kbp_wb_mmap_close(struct kbp_wb_mmap *map);
+
+/**
+ * ISSU read callback serving data from the mapping. The handle is the
+ * struct kbp_wb_mmap.
+ */
+
+int32_t kbp_wb_mmap_read(void *handle, uint8_t *buffer, uint32_t size, uint32_t offset);
+
+/**
+ * ISSU write callback storing data into a writable mapping. The handle is
+ * the struct kbp_wb_mmap.
+ */
+
+int32_t kbp_wb_mmap_write(void *handle, uint8_t *buffer, uint32_t size, uint32_t offset);
+
+/**
+ * Restores the device state from the mapped image.
+ *
+ * @param map Valid mapped image handle.
+ * @param device Valid device handle.
+ *
+ * @return KBP_OK on success or an error code otherwise.
+ */
+
+kbp_status kbp_wb_mmap_restore(struct kbp_wb_mmap *map, struct kbp_device *device);
+
+/**
+ * @}
+ */
+
+#ifdef __cplusplus
+}
+#endif
+#endif                          /* __KBP_WB_MMAP_H */
@@ -0,0 +1,167 @@
+/*
+ * $Id$
+ *
+ * This license is set out in https://raw.githubusercontent.com/Broadcom/Broadcom-Compute-Connectivity-Software-KBP-SDK/master/Legal/LICENSE file.
+ *
+ * $Copyright: (c) 2023 Broadcom Inc.
+ * All Rights Reserved.$
+ *
+ */
+
+#include <stdlib.h>
+
+#include "kbp_portable.h"
+#include "kbp_cntr_batch.h"
+
+#define KBP_CNTR_BATCH_INIT_ENTRIES     (1024)
+
+/* The bulk read is a DMA; poll it every 100us and give up after at least a second */
+#define KBP_CNTR_BATCH_POLL_US          (100)
+#define KBP_CNTR_BATCH_MAX_POLLS        (10000)
+
+struct kbp_cntr_batch_slot {
+    int32_t index;
+    struct kbp_entry *entry;
+};
+
+static int kbp_cntr_batch_cmp(const void *a, const void *b)
+{
+    const struct kbp_cntr_batch_slot *x = a, *y = b;
+
+    return x->index < y->index ? -1 : x->index > y->index;
+}
+
+static kbp_status kbp_cntr_batch_refresh(struct kbp_db *db)
+{
+    int32_t is_complete = 0;
+    uint32_t polls;
+    kbp_status status;
+
+    status = kbp_db_counter_read_initiate(db);
+    if (status != KBP_OK)
+        return status;
+
+    for (polls = 0;; polls++) {
+        status = kbp_db_is_counter_read_complete(db, &is_complete);
+        if (status != KBP_OK)
+            return status;
+        if (is_complete)
+            break;
+        if (polls == KBP_CNTR_BATCH_MAX_POLLS)
+            return KBP_POLL_TIME_OUT;
+        kbp_usleep(KBP_CNTR_BATCH_POLL_US);
+    }
+
+    return KBP_OK;
+}
+
+kbp_status kbp_db_get_counter_values(struct kbp_db *db, struct kbp_entry **entries, uint32_t num_entries,
+                                     uint64_t *values, uint32_t flags)
+{
+    kbp_status status;
+    uint32_t i;
+
+    if (!db || (num_entries && (!entries || !values)))
+        return KBP_INVALID_ARGUMENT;
+
+    if (flags & KBP_CNTR_BATCH_REFRESH) {
+        status = kbp_cntr_batch_refresh(db);
+        if (status != KBP_OK)
+            return status;
+    }
+
+    for (i = 0; i < num_entries; i++) {
+        status = kbp_entry_get_counter_value(db, entries[i], &values[i]);
+        if (status != KBP_OK)
+            return status;
+    }
+
+    return KBP_OK;
+}
+
+kbp_status kbp_db_for_each_counter(struct kbp_db *db, kbp_cntr_visit_fn visit, void *ctx, uint32_t flags,
+                                   uint32_t *num_visited)
+{
+    struct kbp_cntr_batch_slot *slots;
+    struct kbp_entry_iter *iter;
+    uint32_t num = 0, max = KBP_CNTR_BATCH_INIT_ENTRIES, i;
+    kbp_status status;
+
+    if (!db || !visit)
+        return KBP_INVALID_ARGUMENT;
+
+    slots = kbp_sysmalloc(max * sizeof(*slots));
+    if (!slots)
+        return KBP_OUT_OF_MEMORY;
+
+    status = kbp_db_entry_iter_init(db, &iter);
+    if (status != KBP_OK) {
+        kbp_sysfree(slots);
+        return status;
+    }
+
+    for (;;) {
+        struct kbp_entry *entry;
+        int32_t nindices = 0, *indices = NULL, lowest;
+
+        status = kbp_db_entry_iter_next(db, iter, &entry);
+        if (status != KBP_OK || !entry)
+            break;
+
+        status = kbp_entry_get_index(db, entry, &nindices, &indices);
+        if (status != KBP_OK)
+            break;
+        if (nindices == 0) {
+            /* Not installed yet */
+            if (indices)
+                kbp_entry_free_index_array(db, indices);
+            continue;
+        }
+
+        lowest = indices[0];
+        for (i = 1; i < (uint32_t) nindices; i++) {
+            if (indices[i] < lowest)
+                lowest = indices[i];
+        }
+        kbp_entry_free_index_array(db, indices);
+
+        if (num == max) {
+            struct kbp_cntr_batch_slot *grown = kbp_sysmalloc(2 * max * sizeof(*grown));
+
+            if (!grown) {
+                status = KBP_OUT_OF_MEMORY;
+                break;
+            }
+            kbp_memcpy(grown, slots, num * sizeof(*grown));
+            kbp_sysfree(slots);
+            slots = grown;
+            max *= 2;
+        }
+        slots[num].index = lowest;
+        slots[num].entry = entry;
+        num++;
+    }
+
+    kbp_db_entry_iter_destroy(db, iter);
+
+    if (status == KBP_OK && (flags & KBP_CNTR_BATCH_REFRESH))
+        status = kbp_cntr_batch_refresh(db);
+
+    if (status == KBP_OK) {
+        qsort(slots, num, sizeof(*slots), kbp_cntr_batch_cmp);
+
+        for (i = 0; i < num; i++) {
+            uint64_t value;
+
+            status = kbp_entry_get_counter_value(db, slots[i].entry, &value);
+            if (status != KBP_OK)
+                break;
+            visit(ctx, slots[i].entry, slots[i].index, value);
+        }
+        if (num_visited)
+            *num_visited = i;
+    }
+
+    kbp_sysfree(slots);
+    return status;
+}
@@ -0,0 +1,603 @@
+/*
+ * $Id$
+ *
+ * This license is set out in https://raw.githubusercontent.com/Broadcom/Broadcom-Compute-Connectivity-Software-KBP-SDK/master/Legal/LICENSE file.
+ *
+ * $Copyright: (c) 2023 Broadcom Inc.
+ * All Rights Reserved.$
+ *
+ */
+
+#include <stddef.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "kbp_portable.h"
+#include "kbp_math.h"
+#include "kbp_cr_journal.h"
+
+#define KBP_CR_JNL_MAGIC                (0x4B43524A)    /* KCRJ */
+#define KBP_CR_JNL_REC_MAGIC            (0x4B435252)    /* KCRR */
+#define KBP_CR_JNL_SB_SPACING           (512)
+#define KBP_CR_JNL_DATA_START           (4096)
+#define KBP_CR_JNL_PAGE_SHIFT           (9)
+#define KBP_CR_JNL_PAGE_SIZE            (1 << KBP_CR_JNL_PAGE_SHIFT)
+#define KBP_CR_JNL_INIT_RANGES          (64)
+#define KBP_CR_JNL_ALIGN(x)             (((x) + 7) & ~7U)
+
+/*
+ * Superblock, two copies at offsets 0 and 512, rewritten after every
+ * compaction. next_seq is the sequence number of the record at the
+ * start of the log.
+ */
+struct kbp_cr_jnl_sb {
+    uint32_t magic;
+    uint32_t nv_size;
+    uint32_t log_size;
+    uint32_t epoch;
+    uint32_t next_seq;
+    uint32_t crc;
+};
+
+/*
+ * Journal record: header, num_ranges range descriptors, then the data of
+ * each range back to back. crc covers the whole record with crc = 0.
+ */
+struct kbp_cr_jnl_rec {
+    uint32_t magic;
+    uint32_t seq;
+    uint32_t num_ranges;
+    uint32_t len;
+    uint32_t crc;
+};
+
+struct kbp_cr_jnl_range {
+    uint32_t offset;
+    uint32_t len;
+};
+
+struct kbp_cr_journal {
+    kbp_device_issu_read_fn read_fn;
+    kbp_device_issu_write_fn write_fn;
+    void *handle;
+    struct kbp_cr_journal_config config;
+    struct kbp_cr_journal_stats stats;
+    struct kbp_cr_jnl_sb sb;
+    pthread_mutex_t lock;
+    pthread_t thread;
+    uint32_t thread_running;
+    uint32_t stop;
+    uint8_t *working;                   /* NV contents as seen by the SDK */
+    uint8_t *committed;                 /* NV contents as of the last committed record */
+    uint8_t *dirty;                     /* pages of committed not yet in the slot area */
+    uint32_t num_pages;
+    struct kbp_cr_jnl_range *ranges;    /* SDK writes since the last commit */
+    uint32_t num_ranges;
+    uint32_t max_ranges;
+    uint32_t range_bytes;
+    uint32_t depth;                     /* nested begin count */
+    uint8_t *rec_buf;
+    uint32_t rec_cap;
+    uint32_t log_len;
+    uint32_t next_seq;
+};
+
+static uint32_t kbp_cr_jnl_sb_crc(const struct kbp_cr_jnl_sb *sb)
+{
+    return kbp_crc32(0, (const uint8_t *) sb, offsetof(struct kbp_cr_jnl_sb, crc));
+}
+
+static uint32_t kbp_cr_jnl_log_offset(struct kbp_cr_journal *journal)
+{
+    return KBP_CR_JNL_DATA_START + journal->config.nv_size;
+}
+
+static void kbp_cr_jnl_mark_dirty(struct kbp_cr_journal *journal, uint32_t offset, uint32_t len)
+{
+    uint32_t page;
+
+    for (page = offset >> KBP_CR_JNL_PAGE_SHIFT; page <= (offset + len - 1) >> KBP_CR_JNL_PAGE_SHIFT; page++)
+        journal->dirty[page] = 1;
+}
+
+/*
+ * Writes the dirty pages of the committed image to the slot area, then
+ * empties the log by advancing the superblock. Called with the lock held.
+ */
+static kbp_status kbp_cr_jnl_compact_locked(struct kbp_cr_journal *journal)
+{
+    struct kbp_cr_jnl_sb sb;
+    uint32_t page = 0;
+
+    while (page < journal->num_pages) {
+        uint32_t start, end, len;
+
+        if (!journal->dirty[page]) {
+            page++;
+            continue;
+        }
+
+        start = page;
+        while (page < journal->num_pages && journal->dirty[page])
+            journal->dirty[page++] = 0;
+
+        end = page << KBP_CR_JNL_PAGE_SHIFT;
+        if (end > journal->config.nv_size)
+            end = journal->config.nv_size;
+        len = end - (start << KBP_CR_JNL_PAGE_SHIFT);
+
+        if (journal->write_fn(journal->handle, &journal->committed[start << KBP_CR_JNL_PAGE_SHIFT], len,
+                              KBP_CR_JNL_DATA_START + (start << KBP_CR_JNL_PAGE_SHIFT)) != 0) {
+            /* Leave the remaining pages dirty, the log still covers them */
+            kbp_memset(&journal->dirty[start], 1, page - start);
+            return KBP_NV_READ_WRITE_FAILED;
+        }
+        journal->stats.bytes_compacted += len;
+    }
+
+    if (journal->log_len == 0 && journal->sb.magic == KBP_CR_JNL_MAGIC)
+        return KBP_OK;
+
+    kbp_memcpy(&sb, &journal->sb, sizeof(sb));
+    sb.magic = KBP_CR_JNL_MAGIC;
+    sb.nv_size = journal->config.nv_size;
+    sb.log_size = journal->config.log_size;
+    sb.epoch++;
+    sb.next_seq = journal->next_seq;
+    sb.crc = kbp_cr_jnl_sb_crc(&sb);
+
+    if (journal->write_fn(journal->handle, (uint8_t *) &sb, sizeof(sb), (sb.epoch & 1) * KBP_CR_JNL_SB_SPACING) != 0)
+        return KBP_NV_READ_WRITE_FAILED;
+
+    kbp_memcpy(&journal->sb, &sb, sizeof(sb));
+    journal->log_len = 0;
+    journal->stats.num_compactions++;
+    return KBP_OK;
+}
+
+/*
+ * Turns the collected ranges into one journal record. Called with the
+ * lock held.
+ */
+static kbp_status kbp_cr_jnl_commit_locked(struct kbp_cr_journal *journal)
+{
+    struct kbp_cr_jnl_rec *rec;
+    uint32_t size, i, pos;
+    kbp_status status;
+
+    if (journal->num_ranges == 0)
+        return KBP_OK;
+
+    size = sizeof(*rec) + journal->num_ranges * sizeof(struct kbp_cr_jnl_range) + journal->range_bytes;
+
+    if (KBP_CR_JNL_ALIGN(size) > journal->config.log_size) {
+        /*
+         * Larger than the whole log, so it cannot be made atomic. Fold the
+         * log into the slot area first, so that only this transaction is
+         * exposed to a crash, then write it through with a full checkpoint.
+         * NV stays in step with what the SDK has written.
+         */
+        status = kbp_cr_jnl_compact_locked(journal);
+        if (status != KBP_OK)
+            return status;
+
+        for (i = 0; i < journal->num_ranges; i++) {
+            struct kbp_cr_jnl_range *r = &journal->ranges[i];
+
+            kbp_memcpy(&journal->committed[r->offset], &journal->working[r->offset], r->len);
+            kbp_cr_jnl_mark_dirty(journal, r->offset, r->len);
+        }
+        journal->num_ranges = 0;
+        journal->range_bytes = 0;
+        journal->stats.num_checkpoints++;
+
+        /* On failure the pages stay dirty and the next compaction retries them */
+        return kbp_cr_jnl_compact_locked(journal);
+    }
+
+    if (journal->log_len + KBP_CR_JNL_ALIGN(size) > journal->config.log_size) {
+        status = kbp_cr_jnl_compact_locked(journal);
+        if (status != KBP_OK)
+            return status;
+    }
+
+    if (size > journal->rec_cap) {
+        uint8_t *buf = kbp_sysmalloc(size);
+
+        if (!buf)
+            return KBP_OUT_OF_MEMORY;
+        kbp_sysfree(journal->rec_buf);
+        journal->rec_buf = buf;
+        journal->rec_cap = size;
+    }
+
+    rec = (struct kbp_cr_jnl_rec *) journal->rec_buf;
+    rec->magic = KBP_CR_JNL_REC_MAGIC;
+    rec->seq = journal->next_seq;
+    rec->num_ranges = journal->num_ranges;
+    rec->len = size;
+    rec->crc = 0;
+
+    pos = sizeof(*rec);
+    kbp_memcpy(&journal->rec_buf[pos], journal->ranges, journal->num_ranges * sizeof(struct kbp_cr_jnl_range));
+    pos += journal->num_ranges * sizeof(struct kbp_cr_jnl_range);
+    for (i = 0; i < journal->num_ranges; i++) {
+        struct kbp_cr_jnl_range *r = &journal->ranges[i];
+
+        kbp_memcpy(&journal->rec_buf[pos], &journal->working[r->offset], r->len);
+        pos += r->len;
+    }
+    rec->crc = kbp_crc32(0, journal->rec_buf, size);
+
+    if (journal->write_fn(journal->handle, journal->rec_buf, size, kbp_cr_jnl_log_offset(journal) + journal->log_len) != 0)
+        return KBP_NV_READ_WRITE_FAILED;
+
+    for (i = 0; i < journal->num_ranges; i++) {
+        struct kbp_cr_jnl_range *r = &journal->ranges[i];
+
+        kbp_memcpy(&journal->committed[r->offset], &journal->working[r->offset], r->len);
+        kbp_cr_jnl_mark_dirty(journal, r->offset, r->len);
+    }
+
+    journal->log_len += KBP_CR_JNL_ALIGN(size);
+    journal->next_seq++;
+    journal->num_ranges = 0;
+    journal->range_bytes = 0;
+    journal->stats.num_commits++;
+    journal->stats.bytes_logged += size;
+    return KBP_OK;
+}
+
+/*
+ * Replays the log over the committed image. Stops at the first record that
+ * is torn, stale or out of sequence.
+ */
+static kbp_status kbp_cr_jnl_replay(struct kbp_cr_journal *journal)
+{
+    struct kbp_cr_jnl_rec hdr;
+    uint32_t off = 0, seq = journal->sb.next_seq;
+
+    while (off + sizeof(hdr) <= journal->config.log_size) {
+        struct kbp_cr_jnl_range *ranges;
+        uint32_t i, pos, crc;
+
+        if (journal->read_fn(journal->handle, (uint8_t *) &hdr, sizeof(hdr), kbp_cr_jnl_log_offset(journal) + off) != 0)
+            return KBP_NV_READ_WRITE_FAILED;
+        if (hdr.magic != KBP_CR_JNL_REC_MAGIC || hdr.seq != seq || hdr.len < sizeof(hdr)
+            || hdr.len > journal->config.log_size - off
+            || hdr.num_ranges > (hdr.len - sizeof(hdr)) / sizeof(struct kbp_cr_jnl_range))
+            break;
+
+        if (hdr.len > journal->rec_cap) {
+            uint8_t *buf = kbp_sysmalloc(hdr.len);
+
+            if (!buf)
+                return KBP_OUT_OF_MEMORY;
+            kbp_sysfree(journal->rec_buf);
+            journal->rec_buf = buf;
+            journal->rec_cap = hdr.len;
+        }
+
+        if (journal->read_fn(journal->handle, journal->rec_buf, hdr.len, kbp_cr_jnl_log_offset(journal) + off) != 0)
+            return KBP_NV_READ_WRITE_FAILED;
+        ((struct kbp_cr_jnl_rec *) journal->rec_buf)->crc = 0;
+        crc = kbp_crc32(0, journal->rec_buf, hdr.len);
+        if (crc != hdr.crc)
+            break;
+
+        /* Validate every range before applying any of them */
+        ranges = (struct kbp_cr_jnl_range *) &journal->rec_buf[sizeof(hdr)];
+        pos = sizeof(hdr) + hdr.num_ranges * sizeof(struct kbp_cr_jnl_range);
+        for (i = 0; i < hdr.num_ranges; i++) {
+            if (ranges[i].len == 0 || ranges[i].offset > journal->config.nv_size
+                || ranges[i].len > journal->config.nv_size - ranges[i].offset || ranges[i].len > hdr.len - pos)
+                return KBP_NV_DATA_CORRUPT;
+            pos += ranges[i].len;
+        }
+
+        pos = sizeof(hdr) + hdr.num_ranges * sizeof(struct kbp_cr_jnl_range);
+        for (i = 0; i < hdr.num_ranges; i++) {
+            kbp_memcpy(&journal->committed[ranges[i].offset], &journal->rec_buf[pos], ranges[i].len);
+            kbp_cr_jnl_mark_dirty(journal, ranges[i].offset, ranges[i].len);
+            pos += ranges[i].len;
+        }
+
+        off += KBP_CR_JNL_ALIGN(hdr.len);
+        seq++;
+        journal->stats.num_replayed++;
+    }
+
+    journal->log_len = off;
+    journal->next_seq = seq;
+    return KBP_OK;
+}
+
+static void *kbp_cr_jnl_compactor(void *arg)
+{
+    struct kbp_cr_journal *journal = (struct kbp_cr_journal *) arg;
+
+    for (;;) {
+        usleep(journal->config.compact_interval_us);
+
+        pthread_mutex_lock(&journal->lock);
+        if (journal->stop) {
+            pthread_mutex_unlock(&journal->lock);
+            break;
+        }
+        if (journal->log_len)
+            kbp_cr_jnl_compact_locked(journal);
+        pthread_mutex_unlock(&journal->lock);
+    }
+
+    return NULL;
+}
+
+int32_t kbp_cr_journal_read(void *handle, uint8_t *buffer, uint32_t size, uint32_t offset)
+{
+    struct kbp_cr_journal *journal = (struct kbp_cr_journal *) handle;
+
+    if (offset > journal->config.nv_size || size > journal->config.nv_size - offset)
+        return 1;
+
+    kbp_memcpy(buffer, &journal->working[offset], size);
+    return 0;
+}
+
+int32_t kbp_cr_journal_write(void *handle, uint8_t *buffer, uint32_t size, uint32_t offset)
+{
+    struct kbp_cr_journal *journal = (struct kbp_cr_journal *) handle;
+    struct kbp_cr_jnl_range *last;
+    kbp_status status = KBP_OK;
+
+    if (offset > journal->config.nv_size || size > journal->config.nv_size - offset)
+        return 1;
+    if (size == 0)
+        return 0;
+
+    pthread_mutex_lock(&journal->lock);
+    journal->stats.num_sdk_writes++;
+
+    /* Extend the previous range when the SDK writes sequentially */
+    last = journal->num_ranges ? &journal->ranges[journal->num_ranges - 1] : NULL;
+    if (!last || offset < last->offset || offset > last->offset + last->len)
+        last = NULL;
+
+    /* Make room for a new range before touching the working image */
+    if (!last && journal->num_ranges == journal->max_ranges) {
+        struct kbp_cr_jnl_range *ranges;
+
+        ranges = kbp_sysmalloc(2 * journal->max_ranges * sizeof(*ranges));
+        if (!ranges) {
+            pthread_mutex_unlock(&journal->lock);
+            return 1;
+        }
+        kbp_memcpy(ranges, journal->ranges, journal->num_ranges * sizeof(*ranges));
+        kbp_sysfree(journal->ranges);
+        journal->ranges = ranges;
+        journal->max_ranges *= 2;
+    }
+
+    kbp_memcpy(&journal->working[offset], buffer, size);
+
+    if (last) {
+        if (offset + size > last->offset + last->len) {
+            journal->range_bytes += offset + size - (last->offset + last->len);
+            last->len = offset + size - last->offset;
+        }
+    } else {
+        journal->ranges[journal->num_ranges].offset = offset;
+        journal->ranges[journal->num_ranges].len = size;
+        journal->num_ranges++;
+        journal->range_bytes += size;
+    }
+
+    if (journal->depth == 0)
+        status = kbp_cr_jnl_commit_locked(journal);
+    pthread_mutex_unlock(&journal->lock);
+
+    return status == KBP_OK ? 0 : 1;
+}
+
+kbp_status kbp_cr_journal_begin(struct kbp_cr_journal *journal)
+{
+    if (!journal)
+        return KBP_INVALID_ARGUMENT;
+
+    pthread_mutex_lock(&journal->lock);
+    journal->depth++;
+    pthread_mutex_unlock(&journal->lock);
+    return KBP_OK;
+}
+
+kbp_status kbp_cr_journal_commit(struct kbp_cr_journal *journal)
+{
+    kbp_status status = KBP_OK;
+
+    if (!journal)
+        return KBP_INVALID_ARGUMENT;
+
+    pthread_mutex_lock(&journal->lock);
+    if (journal->depth == 0) {
+        pthread_mutex_unlock(&journal->lock);
+        return KBP_INVALID_ARGUMENT;
+    }
+    if (--journal->depth == 0)
+        status = kbp_cr_jnl_commit_locked(journal);
+    pthread_mutex_unlock(&journal->lock);
+
+    return status;
+}
+
+kbp_status kbp_cr_journal_start_transaction(struct kbp_cr_journal *journal, struct kbp_device *device)
+{
+    kbp_status status;
+
+    if (!journal || !device)
+        return KBP_INVALID_ARGUMENT;
+
+    status = kbp_device_start_transaction(device);
+    if (status != KBP_OK)
+        return status;
+    return kbp_cr_journal_begin(journal);
+}
+
+kbp_status kbp_cr_journal_end_transaction(struct kbp_cr_journal *journal, struct kbp_device *device)
+{
+    kbp_status status, commit_status;
+
+    if (!journal || !device)
+        return KBP_INVALID_ARGUMENT;
+
+    status = kbp_device_end_transaction(device);
+    commit_status = kbp_cr_journal_commit(journal);
+    return status != KBP_OK ? status : commit_status;
+}
+
+kbp_status kbp_cr_journal_install(struct kbp_cr_journal *journal, struct kbp_db *db)
+{
+    kbp_status status, commit_status;
+
+    if (!journal || !db)
+        return KBP_INVALID_ARGUMENT;
+
+    kbp_cr_journal_begin(journal);
+    status = kbp_db_install(db);
+    commit_status = kbp_cr_journal_commit(journal);
+    return status != KBP_OK ? status : commit_status;
+}
+
+kbp_status kbp_cr_journal_compact(struct kbp_cr_journal *journal)
+{
+    kbp_status status;
+
+    if (!journal)
+        return KBP_INVALID_ARGUMENT;
+
+    pthread_mutex_lock(&journal->lock);
+    status = kbp_cr_jnl_compact_locked(journal);
+    pthread_mutex_unlock(&journal->lock);
+    return status;
+}
+
+kbp_status kbp_cr_journal_create(const struct kbp_cr_journal_config *config, kbp_device_issu_read_fn read_fn,
+                                 kbp_device_issu_write_fn write_fn, void *handle, struct kbp_cr_journal **journal)
+{
+    struct kbp_cr_journal *j;
+    struct kbp_cr_jnl_sb sb;
+    kbp_status status;
+    uint32_t i;
+
+    if (!config || !read_fn || !write_fn || !journal || !config->nv_size
+        || config->log_size < sizeof(struct kbp_cr_jnl_rec) + sizeof(struct kbp_cr_jnl_range) + 8)
+        return KBP_INVALID_ARGUMENT;
+    if ((uint64_t) KBP_CR_JNL_DATA_START + config->nv_size + config->log_size > 0xFFFFFFFFULL)
+        return KBP_INVALID_ARGUMENT;
+
+    j = kbp_syscalloc(1, sizeof(*j));
+    if (!j)
+        return KBP_OUT_OF_MEMORY;
+
+    j->read_fn = read_fn;
+    j->write_fn = write_fn;
+    j->handle = handle;
+    kbp_memcpy(&j->config, config, sizeof(*config));
+    pthread_mutex_init(&j->lock, NULL);
+
+    j->num_pages = (config->nv_size + KBP_CR_JNL_PAGE_SIZE - 1) >> KBP_CR_JNL_PAGE_SHIFT;
+    j->max_ranges = KBP_CR_JNL_INIT_RANGES;
+    j->working = kbp_sysmalloc(config->nv_size);
+    j->committed = kbp_sysmalloc(config->nv_size);
+    j->dirty = kbp_syscalloc(j->num_pages, 1);
+    j->ranges = kbp_sysmalloc(j->max_ranges * sizeof(struct kbp_cr_jnl_range));
+    if (!j->working || !j->committed || !j->dirty || !j->ranges) {
+        kbp_cr_journal_destroy(j);
+        return KBP_OUT_OF_MEMORY;
+    }
+
+    if (read_fn(handle, j->committed, config->nv_size, KBP_CR_JNL_DATA_START) != 0) {
+        kbp_cr_journal_destroy(j);
+        return KBP_NV_READ_WRITE_FAILED;
+    }
+
+    for (i = 0; i < 2; i++) {
+        if (read_fn(handle, (uint8_t *) &sb, sizeof(sb), i * KBP_CR_JNL_SB_SPACING) != 0)
+            continue;
+        if (sb.magic != KBP_CR_JNL_MAGIC || sb.crc != kbp_cr_jnl_sb_crc(&sb)
+            || sb.nv_size != config->nv_size || sb.log_size != config->log_size)
+            continue;
+        if (j->sb.magic != KBP_CR_JNL_MAGIC || sb.epoch > j->sb.epoch)
+            kbp_memcpy(&j->sb, &sb, sizeof(sb));
+    }
+
+    if (j->sb.magic == KBP_CR_JNL_MAGIC) {
+        status = kbp_cr_jnl_replay(j);
+    } else {
+        j->next_seq = 1;
+        status = KBP_OK;
+    }
+
+    /* Fold the replayed records into the slot area and start an empty log */
+    if (status == KBP_OK)
+        status = kbp_cr_jnl_compact_locked(j);
+    if (status != KBP_OK) {
+        kbp_cr_journal_destroy(j);
+        return status;
+    }
+
+    kbp_memcpy(j->working, j->committed, config->nv_size);
+
+    if (config->compact_interval_us) {
+        if (pthread_create(&j->thread, NULL, kbp_cr_jnl_compactor, j) != 0) {
+            kbp_cr_journal_destroy(j);
+            return KBP_OUT_OF_MEMORY;
+        }
+        j->thread_running = 1;
+    }
+
+    *journal = j;
+    return KBP_OK;
+}
+
+kbp_status kbp_cr_journal_destroy(struct kbp_cr_journal *journal)
+{
+    kbp_status status = KBP_OK;
+
+    if (!journal)
+        return KBP_INVALID_ARGUMENT;
+
+    if (journal->thread_running) {
+        pthread_mutex_lock(&journal->lock);
+        journal->stop = 1;
+        pthread_mutex_unlock(&journal->lock);
+        pthread_join(journal->thread, NULL);
+    }
+
+    if (journal->working && journal->committed && journal->dirty && journal->ranges
+        && journal->sb.magic == KBP_CR_JNL_MAGIC) {
+        pthread_mutex_lock(&journal->lock);
+        status = kbp_cr_jnl_commit_locked(journal);
+        if (status == KBP_OK)
+            status = kbp_cr_jnl_compact_locked(journal);
+        pthread_mutex_unlock(&journal->lock);
+    }
+
+    pthread_mutex_destroy(&journal->lock);
+    kbp_sysfree(journal->working);
+    kbp_sysfree(journal->committed);
+    kbp_sysfree(journal->dirty);
+    kbp_sysfree(journal->ranges);
+    kbp_sysfree(journal->rec_buf);
+    kbp_sysfree(journal);
+    return status;
+}
+
+kbp_status kbp_cr_journal_get_stats(struct kbp_cr_journal *journal, struct kbp_cr_journal_stats *stats)
+{
+    if (!journal || !stats)
+        return KBP_INVALID_ARGUMENT;
+
+    pthread_mutex_lock(&journal->lock);
+    kbp_memcpy(stats, &journal->stats, sizeof(*stats));
+    pthread_mutex_unlock(&journal->lock);
+    return KBP_OK;
+}
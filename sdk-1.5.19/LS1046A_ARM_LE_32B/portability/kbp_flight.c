@@ -0,0 +1,282 @@
+/*
+ * $Id$
+ *
+ * This license is set out in https://raw.githubusercontent.com/Broadcom/Broadcom-Compute-Connectivity-Software-KBP-SDK/master/Legal/LICENSE file.
+ *
+ * $Copyright: (c) 2023 Broadcom Inc.
+ * All Rights Reserved.$
+ *
+ */
+
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+
+#include "kbp_portable.h"
+#include "kbp_flight.h"
+
+#define KBP_FLIGHT_DEFAULT_RECORDS      (4096)
+#define KBP_FLIGHT_DEFAULT_PATH         "kbp_flight.bin"
+#define KBP_FLIGHT_MAX_PATH             (256)
+
+/*
+ * Ring of one thread. Only the owner writes; dumps read it without
+ * synchronization, which can tear the record being written. head is a
+ * free running 32b counter. Rings of exited threads keep their records
+ * and are handed to the next new thread.
+ */
+struct kbp_flight_ring {
+    uint32_t head;
+    uint32_t mask;
+    uint32_t orphaned;
+    uint32_t tid;
+    uint32_t pos;               /* dump cursor, under the lock */
+    uint32_t end;
+    struct kbp_flight_record *recs;
+    struct kbp_flight_ring *next;
+};
+
+static struct {
+    uint32_t disabled;
+    uint32_t flags;
+    uint32_t num_records;
+    uint32_t dumping;
+    uint64_t num_dumps;
+    uint64_t num_dropped;
+    pthread_mutex_t lock;
+    struct kbp_flight_ring *rings;
+    char path[KBP_FLIGHT_MAX_PATH];
+} kbp_flight = {
+    .flags = KBP_FLIGHT_DUMP_ON_ASSERT,
+    .num_records = KBP_FLIGHT_DEFAULT_RECORDS,
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .path = KBP_FLIGHT_DEFAULT_PATH
+};
+
+static __thread struct kbp_flight_ring *kbp_flight_tls_ring;
+static pthread_key_t kbp_flight_key;
+static pthread_once_t kbp_flight_key_once = PTHREAD_ONCE_INIT;
+
+static uint64_t kbp_flight_clock_ns(clockid_t clock)
+{
+    struct timespec ts;
+
+    clock_gettime(clock, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint64_t kbp_flight_now_ns(void)
+{
+    return kbp_flight_clock_ns(CLOCK_MONOTONIC);
+}
+
+static void kbp_flight_thread_exit(void *arg)
+{
+    struct kbp_flight_ring *ring = (struct kbp_flight_ring *) arg;
+
+    __atomic_store_n(&ring->orphaned, 1, __ATOMIC_RELEASE);
+}
+
+static void kbp_flight_key_init(void)
+{
+    pthread_key_create(&kbp_flight_key, kbp_flight_thread_exit);
+}
+
+static struct kbp_flight_ring *kbp_flight_get_ring(void)
+{
+    struct kbp_flight_ring *ring;
+
+    pthread_once(&kbp_flight_key_once, kbp_flight_key_init);
+
+    pthread_mutex_lock(&kbp_flight.lock);
+    for (ring = kbp_flight.rings; ring; ring = ring->next) {
+        if (ring->orphaned && ring->mask + 1 == kbp_flight.num_records)
+            break;
+    }
+    if (ring) {
+        ring->orphaned = 0;
+    } else {
+        ring = kbp_syscalloc(1, sizeof(*ring));
+        if (ring)
+            ring->recs = kbp_syscalloc(kbp_flight.num_records, sizeof(struct kbp_flight_record));
+        if (ring && !ring->recs) {
+            kbp_sysfree(ring);
+            ring = NULL;
+        }
+        if (ring) {
+            ring->mask = kbp_flight.num_records - 1;
+            ring->next = kbp_flight.rings;
+            kbp_flight.rings = ring;
+        }
+    }
+    if (!ring) {
+        kbp_flight.num_dropped++;
+        pthread_mutex_unlock(&kbp_flight.lock);
+        return NULL;
+    }
+    ring->tid = (uint32_t) syscall(SYS_gettid);
+    pthread_mutex_unlock(&kbp_flight.lock);
+
+    pthread_setspecific(kbp_flight_key, ring);
+    kbp_flight_tls_ring = ring;
+    return ring;
+}
+
+void kbp_flight_record(uint32_t op, const void *object, const void *handle, uint32_t arg, kbp_status status,
+                       uint64_t start_ns, uint64_t duration_ns)
+{
+    struct kbp_flight_ring *ring = kbp_flight_tls_ring;
+    struct kbp_flight_record *r;
+
+    if (kbp_flight.disabled)
+        return;
+    if (!ring) {
+        ring = kbp_flight_get_ring();
+        if (!ring)
+            return;
+    }
+    if (!start_ns)
+        start_ns = kbp_flight_now_ns();
+
+    r = &ring->recs[ring->head & ring->mask];
+    r->ts_ns = start_ns;
+    r->object = (uintptr_t) object;
+    r->handle = (uintptr_t) handle;
+    r->duration_ns = duration_ns > 0xFFFFFFFFULL ? 0xFFFFFFFF : (uint32_t) duration_ns;
+    r->arg = arg;
+    r->status = status;
+    r->op = (uint16_t) op;
+    r->tid = ring->tid;
+    __atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+}
+
+kbp_status kbp_flight_configure(const struct kbp_flight_config *config)
+{
+    const char *path;
+    uint32_t entries;
+
+    if (!config)
+        return KBP_INVALID_ARGUMENT;
+
+    path = config->dump_path ? config->dump_path : KBP_FLIGHT_DEFAULT_PATH;
+    if (strlen(path) >= KBP_FLIGHT_MAX_PATH)
+        return KBP_INVALID_ARGUMENT;
+
+    entries = 1;
+    while (entries < (config->num_records ? config->num_records : KBP_FLIGHT_DEFAULT_RECORDS)) {
+        if (entries >= 0x80000000U)
+            return KBP_INVALID_ARGUMENT;
+        entries <<= 1;
+    }
+
+    pthread_mutex_lock(&kbp_flight.lock);
+    kbp_flight.num_records = entries;
+    kbp_flight.flags = config->flags;
+    kbp_flight.disabled = config->disable;
+    kbp_memcpy(kbp_flight.path, path, strlen(path) + 1);
+    pthread_mutex_unlock(&kbp_flight.lock);
+    return KBP_OK;
+}
+
+/*
+ * Merges the rings by time into fp. Called with the lock held.
+ */
+
+static kbp_status kbp_flight_dump_locked(FILE *fp)
+{
+    struct kbp_flight_dump_header hdr;
+    struct kbp_flight_ring *ring, *min;
+
+    kbp_memset(&hdr, 0, sizeof(hdr));
+    for (ring = kbp_flight.rings; ring; ring = ring->next) {
+        ring->end = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        ring->pos = ring->end > ring->mask ? ring->end - ring->mask - 1 : 0;
+        hdr.num_records += ring->end - ring->pos;
+        hdr.total_records += ring->end;
+    }
+    hdr.magic = KBP_FLIGHT_MAGIC;
+    hdr.version = KBP_FLIGHT_VERSION;
+    hdr.record_size = sizeof(struct kbp_flight_record);
+    hdr.dump_ns = kbp_flight_now_ns();
+    hdr.dump_wall_ns = kbp_flight_clock_ns(CLOCK_REALTIME);
+
+    if (fwrite(&hdr, sizeof(hdr), 1, fp) != 1)
+        return KBP_NV_READ_WRITE_FAILED;
+
+    /* Each ring is in time order already, so the oldest head goes next */
+    for (;;) {
+        min = NULL;
+        for (ring = kbp_flight.rings; ring; ring = ring->next) {
+            if (ring->pos != ring->end
+                && (!min || ring->recs[ring->pos & ring->mask].ts_ns < min->recs[min->pos & min->mask].ts_ns))
+                min = ring;
+        }
+        if (!min)
+            break;
+        if (fwrite(&min->recs[min->pos & min->mask], sizeof(struct kbp_flight_record), 1, fp) != 1)
+            return KBP_NV_READ_WRITE_FAILED;
+        min->pos++;
+    }
+
+    if (fflush(fp) != 0)
+        return KBP_NV_READ_WRITE_FAILED;
+    kbp_flight.num_dumps++;
+    return KBP_OK;
+}
+
+kbp_status kbp_flight_dump(FILE *fp)
+{
+    kbp_status status;
+
+    if (!fp)
+        return KBP_INVALID_ARGUMENT;
+
+    pthread_mutex_lock(&kbp_flight.lock);
+    status = kbp_flight_dump_locked(fp);
+    pthread_mutex_unlock(&kbp_flight.lock);
+    return status;
+}
+
+void kbp_flight_auto_dump(uint32_t reason)
+{
+    FILE *fp;
+
+    if (!(kbp_flight.flags & reason))
+        return;
+
+    /* An assert raised while dumping must not dump, or deadlock, again */
+    if (__atomic_exchange_n(&kbp_flight.dumping, 1, __ATOMIC_ACQUIRE))
+        return;
+
+    pthread_mutex_lock(&kbp_flight.lock);
+    fp = fopen(kbp_flight.path, "wb");
+    if (fp) {
+        if (kbp_flight_dump_locked(fp) == KBP_OK)
+            kbp_printf("Flight recorder written to %s\n", kbp_flight.path);
+        fclose(fp);
+    }
+    pthread_mutex_unlock(&kbp_flight.lock);
+
+    __atomic_store_n(&kbp_flight.dumping, 0, __ATOMIC_RELEASE);
+}
+
+kbp_status kbp_flight_get_stats(struct kbp_flight_stats *stats)
+{
+    struct kbp_flight_ring *ring;
+
+    if (!stats)
+        return KBP_INVALID_ARGUMENT;
+
+    kbp_memset(stats, 0, sizeof(*stats));
+    pthread_mutex_lock(&kbp_flight.lock);
+    for (ring = kbp_flight.rings; ring; ring = ring->next) {
+        stats->num_records += __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+        stats->num_rings++;
+    }
+    stats->num_dumps = kbp_flight.num_dumps;
+    stats->num_dropped = kbp_flight.num_dropped;
+    stats->ring_size = kbp_flight.num_records;
+    pthread_mutex_unlock(&kbp_flight.lock);
+    return KBP_OK;
+}
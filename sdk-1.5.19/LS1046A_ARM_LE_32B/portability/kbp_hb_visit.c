@@ -0,0 +1,100 @@
+/*
+ * $Id$
+ *
+ * This license is set out in https://raw.githubusercontent.com/Broadcom/Broadcom-Compute-Connectivity-Software-KBP-SDK/master/Legal/LICENSE file.
+ *
+ * $Copyright: (c) 2023 Broadcom Inc.
+ * All Rights Reserved.$
+ *
+ */
+
+#include "kbp_portable.h"
+#include "kbp_hb_visit.h"
+
+#define KBP_HB_VISIT_INIT_DELETES       (256)
+
+kbp_status kbp_hb_db_for_each_aged(struct kbp_hb_db *hb_db, struct kbp_db *db, kbp_hb_aged_visit_fn visit,
+                                   void *ctx, uint32_t max, uint32_t *num_visited, uint32_t *num_deleted)
+{
+    struct kbp_aged_entry_iter *iter;
+    struct kbp_entry **deletes = NULL;
+    uint32_t num_deletes = 0, max_deletes = 0, visited = 0, i;
+    kbp_status status;
+
+    if (!hb_db || !db || !visit)
+        return KBP_INVALID_ARGUMENT;
+
+    status = kbp_hb_db_aged_entry_iter_init(hb_db, &iter);
+    if (status != KBP_OK)
+        return status;
+
+    while (!max || visited < max) {
+        struct kbp_entry *entry;
+        struct kbp_hb *hb = NULL;
+        uint32_t idle_count = 0, action;
+
+        status = kbp_hb_db_aged_entry_iter_next(hb_db, iter, &entry);
+        if (status != KBP_OK || !entry)
+            break;
+
+        status = kbp_entry_get_hb(db, entry, &hb);
+        if (status != KBP_OK)
+            break;
+        if (hb) {
+            status = kbp_hb_entry_get_idle_count(hb_db, hb, &idle_count);
+            if (status != KBP_OK)
+                break;
+        }
+
+        visited++;
+        action = visit(ctx, db, entry, hb, idle_count);
+
+        if (action & KBP_HB_AGED_DELETE) {
+            /* Entries cannot be deleted while the iterator is live */
+            if (num_deletes == max_deletes) {
+                struct kbp_entry **grown;
+
+                max_deletes = max_deletes ? 2 * max_deletes : KBP_HB_VISIT_INIT_DELETES;
+                grown = kbp_sysmalloc(max_deletes * sizeof(*grown));
+                if (!grown) {
+                    status = KBP_OUT_OF_MEMORY;
+                    break;
+                }
+                if (num_deletes)
+                    kbp_memcpy(grown, deletes, num_deletes * sizeof(*grown));
+                kbp_sysfree(deletes);
+                deletes = grown;
+            }
+            deletes[num_deletes++] = entry;
+        }
+
+        if (action & KBP_HB_AGED_STOP)
+            break;
+    }
+
+    kbp_hb_db_aged_entry_iter_destroy(hb_db, iter);
+
+    /* Apply whatever was queued even if the walk stopped on an error */
+    for (i = 0; i < num_deletes; i++) {
+        kbp_status del_status = kbp_db_delete_entry(db, deletes[i]);
+
+        if (del_status != KBP_OK) {
+            if (status == KBP_OK)
+                status = del_status;
+            break;
+        }
+    }
+    if (i) {
+        kbp_status install_status = kbp_db_install(db);
+
+        if (status == KBP_OK)
+            status = install_status;
+    }
+    kbp_sysfree(deletes);
+
+    if (num_visited)
+        *num_visited = visited;
+    if (num_deleted)
+        *num_deleted = i;
+    return status;
+}
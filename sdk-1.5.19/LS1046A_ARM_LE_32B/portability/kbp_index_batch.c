@@ -0,0 +1,208 @@
+/*
+ * $Id$
+ *
+ * This license is set out in https://raw.githubusercontent.com/Broadcom/Broadcom-Compute-Connectivity-Software-KBP-SDK/master/Legal/LICENSE file.
+ *
+ * $Copyright: (c) 2023 Broadcom Inc.
+ * All Rights Reserved.$
+ *
+ */
+
+#include "kbp_portable.h"
+#include "kbp_index_batch.h"
+#include "kbp_probes.h"
+
+#define KBP_INDEX_BATCH_DEFAULT_MOVES   (4096)
+
+struct kbp_index_batch {
+    kbp_db_index_batch_callback callback;
+    void *handle;
+    uint32_t max_moves;
+    struct kbp_db *db;                  /* database of the buffered moves */
+    struct kbp_index_move_range *ranges;
+    struct kbp_entry **entries;
+    uint32_t num_ranges;
+    uint32_t num_entries;
+    uint32_t descending;                /* the last run was built downwards */
+    struct kbp_index_batch_stats stats;
+};
+
+/*
+ * Puts the entries of a run built downwards in index order
+ */
+
+static void kbp_index_batch_close_run(struct kbp_index_batch *b)
+{
+    struct kbp_index_move_range *r;
+    uint32_t i, j;
+
+    if (!b->num_ranges || !b->descending)
+        return;
+
+    r = &b->ranges[b->num_ranges - 1];
+    for (i = r->first_entry, j = r->first_entry + r->count - 1; i < j; i++, j--) {
+        struct kbp_entry *tmp = b->entries[i];
+
+        b->entries[i] = b->entries[j];
+        b->entries[j] = tmp;
+    }
+    b->descending = 0;
+}
+
+kbp_status kbp_index_batch_flush(struct kbp_index_batch *batch)
+{
+    if (!batch)
+        return KBP_INVALID_ARGUMENT;
+    if (!batch->num_entries)
+        return KBP_OK;
+
+    kbp_index_batch_close_run(batch);
+    KBP_PROBE3(index_batch_flush, batch->db, batch->num_ranges, batch->num_entries);
+    batch->callback(batch->handle, batch->db, batch->ranges, batch->num_ranges,
+                    (struct kbp_entry * const *) batch->entries, batch->num_entries);
+    batch->stats.num_ranges += batch->num_ranges;
+    batch->stats.num_flushes++;
+    batch->num_ranges = 0;
+    batch->num_entries = 0;
+    return KBP_OK;
+}
+
+/*
+ * Whether the move can join the last run. A run is applied as one
+ * memmove, which reads every old index before writing any new one, while
+ * the single moves read and write in turn. They agree as long as no move
+ * reads an index an earlier move of the run wrote.
+ */
+
+static int32_t kbp_index_batch_extends(struct kbp_index_batch *b, int32_t old_index, int32_t new_index,
+                                       uint32_t *down)
+{
+    struct kbp_index_move_range *r = &b->ranges[b->num_ranges - 1];
+    int32_t count = (int32_t) r->count;
+    int32_t up_ok = r->count == 1 || !b->descending;
+    int32_t down_ok = r->count == 1 || b->descending;
+
+    if ((old_index < 0) != (r->old_index < 0))
+        return 0;
+
+    if (old_index >= 0 && old_index >= r->new_index && old_index < r->new_index + count)
+        return 0;
+
+    if (up_ok && new_index == r->new_index + count
+        && (old_index < 0 || old_index == r->old_index + count)) {
+        *down = 0;
+        return 1;
+    }
+    if (down_ok && new_index == r->new_index - 1
+        && (old_index < 0 || old_index == r->old_index - 1)) {
+        *down = 1;
+        return 1;
+    }
+    return 0;
+}
+
+void kbp_index_batch_index_callback(void *handle, struct kbp_db *db, struct kbp_entry *entry,
+                                    int32_t old_index, int32_t new_index)
+{
+    struct kbp_index_batch *b = handle;
+    struct kbp_index_move_range *r;
+    uint32_t down = 0;
+
+    if (b->num_entries && (b->db != db || b->num_entries == b->max_moves))
+        kbp_index_batch_flush(b);
+    b->db = db;
+    b->stats.num_moves++;
+    KBP_PROBE4(entry_move, db, entry, old_index, new_index);
+
+    if (b->num_ranges && kbp_index_batch_extends(b, old_index, new_index, &down)) {
+        r = &b->ranges[b->num_ranges - 1];
+        if (down) {
+            if (r->old_index >= 0)
+                r->old_index--;
+            r->new_index--;
+        }
+        r->count++;
+        b->descending = down;
+        b->entries[b->num_entries++] = entry;
+        return;
+    }
+
+    kbp_index_batch_close_run(b);
+    r = &b->ranges[b->num_ranges++];
+    r->old_index = old_index < 0 ? -1 : old_index;
+    r->new_index = new_index;
+    r->count = 1;
+    r->first_entry = b->num_entries;
+    b->entries[b->num_entries++] = entry;
+}
+
+kbp_status kbp_index_batch_create(kbp_db_index_batch_callback callback, void *handle, uint32_t max_moves,
+                                  struct kbp_index_batch **batch)
+{
+    struct kbp_index_batch *b;
+
+    if (!callback || !batch)
+        return KBP_INVALID_ARGUMENT;
+
+    b = kbp_syscalloc(1, sizeof(*b));
+    if (!b)
+        return KBP_OUT_OF_MEMORY;
+
+    b->callback = callback;
+    b->handle = handle;
+    b->max_moves = max_moves ? max_moves : KBP_INDEX_BATCH_DEFAULT_MOVES;
+    b->ranges = kbp_sysmalloc(b->max_moves * sizeof(*b->ranges));
+    b->entries = kbp_sysmalloc(b->max_moves * sizeof(*b->entries));
+    if (!b->ranges || !b->entries) {
+        kbp_sysfree(b->ranges);
+        kbp_sysfree(b->entries);
+        kbp_sysfree(b);
+        return KBP_OUT_OF_MEMORY;
+    }
+
+    *batch = b;
+    return KBP_OK;
+}
+
+kbp_status kbp_index_batch_destroy(struct kbp_index_batch *batch)
+{
+    if (!batch)
+        return KBP_INVALID_ARGUMENT;
+
+    kbp_index_batch_flush(batch);
+    kbp_sysfree(batch->ranges);
+    kbp_sysfree(batch->entries);
+    kbp_sysfree(batch);
+    return KBP_OK;
+}
+
+kbp_status kbp_index_batch_attach(struct kbp_index_batch *batch, struct kbp_db *db)
+{
+    if (!batch || !db)
+        return KBP_INVALID_ARGUMENT;
+
+    return kbp_db_set_property(db, KBP_PROP_INDEX_CALLBACK, kbp_index_batch_index_callback, batch);
+}
+
+kbp_status kbp_index_batch_db_install(struct kbp_index_batch *batch, struct kbp_db *db)
+{
+    kbp_status status;
+
+    if (!batch || !db)
+        return KBP_INVALID_ARGUMENT;
+
+    status = kbp_db_install(db);
+
+    /* Moves made before a failure are real and must be delivered too */
+    kbp_index_batch_flush(batch);
+    return status;
+}
+
+kbp_status kbp_index_batch_get_stats(struct kbp_index_batch *batch, struct kbp_index_batch_stats *stats)
+{
+    if (!batch || !stats)
+        return KBP_INVALID_ARGUMENT;
+
+    kbp_memcpy(stats, &batch->stats, sizeof(*stats));
+    return KBP_OK;
+}
@@ -0,0 +1,354 @@
+/*
+ * $Id$
+ *
+ * This license is set out in https://raw.githubusercontent.com/Broadcom/Broadcom-Compute-Connectivity-Software-KBP-SDK/master/Legal/LICENSE file.
+ *
+ * $Copyright: (c) 2023 Broadcom Inc.
+ * All Rights Reserved.$
+ *
+ */
+
+#include <pthread.h>
+
+#include "kbp_portable.h"
+#include "kbp_xpt_trace.h"
+#include "kbp_install_stats.h"
+
+#define KBP_INSTALL_STATS_HASH_SIZE     (64)
+
+struct kbp_install_stats_db {
+    struct kbp_db *db;
+    struct kbp_install_stats_db *next;
+    uint64_t serial;                /* tells a record apart from one created again for the same db */
+    kbp_db_index_callback callback;
+    void *handle;
+    uint64_t num_index_callbacks;   /* running, since tracking started */
+    uint64_t num_moves;
+    struct kbp_db_install_stats last;
+    struct kbp_db_install_stats total;
+};
+
+struct kbp_install_stats {
+    pthread_mutex_t lock;
+    struct kbp_xpt_trace *trace;
+    struct kbp_db_install_stats running; /* transport traffic since create */
+    uint64_t next_serial;
+    struct kbp_install_stats_db *dbs[KBP_INSTALL_STATS_HASH_SIZE];
+};
+
+static uint32_t kbp_install_stats_hash(const struct kbp_db *db)
+{
+    uintptr_t p = (uintptr_t) db;
+
+    return (uint32_t) ((p >> 4) ^ (p >> 10)) & (KBP_INSTALL_STATS_HASH_SIZE - 1);
+}
+
+/*
+ * Called with the lock held
+ */
+
+static struct kbp_install_stats_db *kbp_install_stats_find(struct kbp_install_stats *s, struct kbp_db *db,
+                                                           uint32_t create)
+{
+    struct kbp_install_stats_db *d;
+    uint32_t h = kbp_install_stats_hash(db);
+
+    for (d = s->dbs[h]; d; d = d->next) {
+        if (d->db == db)
+            return d;
+    }
+    if (!create)
+        return NULL;
+
+    d = kbp_syscalloc(1, sizeof(*d));
+    if (!d)
+        return NULL;
+    d->db = db;
+    d->serial = s->next_serial++;
+    d->next = s->dbs[h];
+    s->dbs[h] = d;
+    return d;
+}
+
+static void kbp_install_stats_sink(void *ctx, const struct kbp_xpt_trace_record *record)
+{
+    struct kbp_install_stats *s = ctx;
+    struct kbp_db_install_stats *r = &s->running;
+    uint32_t bytes = 0, is_write = 1;
+
+    pthread_mutex_lock(&s->lock);
+
+    /* Payload is the uint32_t arguments followed by the data, see kbp_xpt_trace.h */
+    switch (record->op) {
+    case KBP_XPT_TRACE_WRITE_REG:
+        r->num_reg_writes++;
+        bytes = record->len - 2 * sizeof(uint32_t);
+        break;
+    case KBP_XPT_TRACE_WRITE_DBA:
+        r->num_dba_writes++;
+        bytes = record->len - 4 * sizeof(uint32_t);
+        break;
+    case KBP_XPT_TRACE_WRITE_UDA:
+        r->num_uda_writes++;
+        bytes = record->len - 3 * sizeof(uint32_t);
+        break;
+    case KBP_XPT_TRACE_COMMAND:
+        /* Input and output copies of the command buffer */
+        r->num_commands++;
+        bytes = (record->len - 3 * sizeof(uint32_t)) / 2;
+        break;
+    case KBP_XPT_TRACE_STATS_WRITE:
+        r->num_stats_writes++;
+        bytes = record->len - 2 * sizeof(uint32_t);
+        break;
+    case KBP_XPT_TRACE_READ_REG:
+    case KBP_XPT_TRACE_READ_DBA:
+    case KBP_XPT_TRACE_READ_UDA:
+    case KBP_XPT_TRACE_STATS_READ:
+        r->num_reads++;
+        is_write = 0;
+        break;
+    default:
+        is_write = 0;
+        break;
+    }
+    if (is_write) {
+        r->num_bytes += bytes;
+        r->write_ns += record->duration_ns;
+    }
+
+    pthread_mutex_unlock(&s->lock);
+}
+
+/*
+ * The record is looked up by db rather than passed as the handle, so a
+ * forgotten record is never touched again
+ */
+
+static void kbp_install_stats_index_cb(void *handle, struct kbp_db *db, struct kbp_entry *entry,
+                                       int32_t old_index, int32_t new_index)
+{
+    struct kbp_install_stats *s = handle;
+    struct kbp_install_stats_db *d;
+    kbp_db_index_callback callback = NULL;
+    void *user_handle = NULL;
+
+    pthread_mutex_lock(&s->lock);
+    d = kbp_install_stats_find(s, db, 0);
+    if (d) {
+        d->num_index_callbacks++;
+        if (old_index >= 0 && new_index >= 0)
+            d->num_moves++;
+        callback = d->callback;
+        user_handle = d->handle;
+    }
+    pthread_mutex_unlock(&s->lock);
+
+    if (callback)
+        callback(user_handle, db, entry, old_index, new_index);
+}
+
+kbp_status kbp_install_stats_create(void *xpt, struct kbp_install_stats **stats, void **counted_xpt)
+{
+    struct kbp_install_stats *s;
+    kbp_status status;
+
+    if (!xpt || !stats || !counted_xpt)
+        return KBP_INVALID_ARGUMENT;
+
+    s = kbp_syscalloc(1, sizeof(*s));
+    if (!s)
+        return KBP_OUT_OF_MEMORY;
+    pthread_mutex_init(&s->lock, NULL);
+
+    status = kbp_xpt_trace_create_sink(xpt, kbp_install_stats_sink, s, &s->trace, counted_xpt);
+    if (status != KBP_OK) {
+        pthread_mutex_destroy(&s->lock);
+        kbp_sysfree(s);
+        return status;
+    }
+
+    *stats = s;
+    return KBP_OK;
+}
+
+kbp_status kbp_install_stats_destroy(struct kbp_install_stats *stats)
+{
+    uint32_t i;
+
+    if (!stats)
+        return KBP_INVALID_ARGUMENT;
+
+    kbp_xpt_trace_destroy(stats->trace);
+    for (i = 0; i < KBP_INSTALL_STATS_HASH_SIZE; i++) {
+        while (stats->dbs[i]) {
+            struct kbp_install_stats_db *d = stats->dbs[i];
+
+            stats->dbs[i] = d->next;
+            kbp_sysfree(d);
+        }
+    }
+    pthread_mutex_destroy(&stats->lock);
+    kbp_sysfree(stats);
+    return KBP_OK;
+}
+
+kbp_status kbp_install_stats_track_db(struct kbp_install_stats *stats, struct kbp_db *db,
+                                      kbp_db_index_callback callback, void *handle)
+{
+    struct kbp_install_stats_db *d;
+
+    if (!stats || !db)
+        return KBP_INVALID_ARGUMENT;
+
+    pthread_mutex_lock(&stats->lock);
+    d = kbp_install_stats_find(stats, db, 1);
+    if (d) {
+        d->callback = callback;
+        d->handle = handle;
+    }
+    pthread_mutex_unlock(&stats->lock);
+    if (!d)
+        return KBP_OUT_OF_MEMORY;
+
+    return kbp_db_set_property(db, KBP_PROP_INDEX_CALLBACK, kbp_install_stats_index_cb, stats);
+}
+
+static void kbp_install_stats_accumulate(struct kbp_db_install_stats *total, const struct kbp_db_install_stats *s)
+{
+    total->num_installs += s->num_installs;
+    total->num_dba_writes += s->num_dba_writes;
+    total->num_uda_writes += s->num_uda_writes;
+    total->num_reg_writes += s->num_reg_writes;
+    total->num_commands += s->num_commands;
+    total->num_stats_writes += s->num_stats_writes;
+    total->num_reads += s->num_reads;
+    total->num_bytes += s->num_bytes;
+    total->write_ns += s->write_ns;
+    total->num_index_callbacks += s->num_index_callbacks;
+    total->num_moves += s->num_moves;
+}
+
+kbp_status kbp_install_stats_db_install(struct kbp_install_stats *stats, struct kbp_db *db)
+{
+    struct kbp_db_install_stats before, *last;
+    struct kbp_install_stats_db *d;
+    uint64_t callbacks = 0, moves = 0, serial;
+    kbp_status status;
+
+    if (!stats || !db)
+        return KBP_INVALID_ARGUMENT;
+
+    pthread_mutex_lock(&stats->lock);
+    d = kbp_install_stats_find(stats, db, 1);
+    kbp_memcpy(&before, &stats->running, sizeof(before));
+    if (d) {
+        callbacks = d->num_index_callbacks;
+        moves = d->num_moves;
+        serial = d->serial;
+    }
+    pthread_mutex_unlock(&stats->lock);
+
+    /* Without memory for the record the install still happens, uncounted */
+    if (!d)
+        return kbp_db_install(db);
+
+    status = kbp_db_install(db);
+
+    /*
+     * The record may have been forgotten, and even created again, while the
+     * lock was dropped. Only the record that saw the whole install gets it.
+     */
+    pthread_mutex_lock(&stats->lock);
+    d = kbp_install_stats_find(stats, db, 0);
+    if (!d || d->serial != serial) {
+        pthread_mutex_unlock(&stats->lock);
+        return status;
+    }
+    last = &d->last;
+    kbp_memset(last, 0, sizeof(*last));
+    last->num_installs = 1;
+    last->num_dba_writes = stats->running.num_dba_writes - before.num_dba_writes;
+    last->num_uda_writes = stats->running.num_uda_writes - before.num_uda_writes;
+    last->num_reg_writes = stats->running.num_reg_writes - before.num_reg_writes;
+    last->num_commands = stats->running.num_commands - before.num_commands;
+    last->num_stats_writes = stats->running.num_stats_writes - before.num_stats_writes;
+    last->num_reads = stats->running.num_reads - before.num_reads;
+    last->num_bytes = stats->running.num_bytes - before.num_bytes;
+    last->write_ns = stats->running.write_ns - before.write_ns;
+    last->num_index_callbacks = d->num_index_callbacks - callbacks;
+    last->num_moves = d->num_moves - moves;
+    kbp_install_stats_accumulate(&d->total, last);
+    pthread_mutex_unlock(&stats->lock);
+
+    return status;
+}
+
+kbp_status kbp_db_get_install_stats(struct kbp_install_stats *stats, struct kbp_db *db,
+                                    struct kbp_db_install_stats *last, struct kbp_db_install_stats *total)
+{
+    struct kbp_install_stats_db *d;
+
+    if (!stats || !db)
+        return KBP_INVALID_ARGUMENT;
+
+    pthread_mutex_lock(&stats->lock);
+    d = kbp_install_stats_find(stats, db, 0);
+    if (last) {
+        if (d)
+            kbp_memcpy(last, &d->last, sizeof(*last));
+        else
+            kbp_memset(last, 0, sizeof(*last));
+    }
+    if (total) {
+        if (d)
+            kbp_memcpy(total, &d->total, sizeof(*total));
+        else
+            kbp_memset(total, 0, sizeof(*total));
+    }
+    pthread_mutex_unlock(&stats->lock);
+    return KBP_OK;
+}
+
+kbp_status kbp_install_stats_reset(struct kbp_install_stats *stats, struct kbp_db *db)
+{
+    struct kbp_install_stats_db *d;
+    uint32_t i;
+
+    if (!stats)
+        return KBP_INVALID_ARGUMENT;
+
+    pthread_mutex_lock(&stats->lock);
+    if (db) {
+        d = kbp_install_stats_find(stats, db, 0);
+        if (d)
+            kbp_memset(&d->total, 0, sizeof(d->total));
+    } else {
+        for (i = 0; i < KBP_INSTALL_STATS_HASH_SIZE; i++) {
+            for (d = stats->dbs[i]; d; d = d->next)
+                kbp_memset(&d->total, 0, sizeof(d->total));
+        }
+    }
+    pthread_mutex_unlock(&stats->lock);
+    return KBP_OK;
+}
+
+kbp_status kbp_install_stats_forget(struct kbp_install_stats *stats, struct kbp_db *db)
+{
+    struct kbp_install_stats_db **link, *d;
+
+    if (!stats || !db)
+        return KBP_INVALID_ARGUMENT;
+
+    pthread_mutex_lock(&stats->lock);
+    for (link = &stats->dbs[kbp_install_stats_hash(db)]; *link; link = &(*link)->next) {
+        if ((*link)->db == db) {
+            d = *link;
+            *link = d->next;
+            kbp_sysfree(d);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&stats->lock);
+    return KBP_OK;
+}
@@ -0,0 +1,433 @@
+/*
+ * $Id$
+ *
+ * This license is set out in https://raw.githubusercontent.com/Broadcom/Broadcom-Compute-Connectivity-Software-KBP-SDK/master/Legal/LICENSE file.
+ *
+ * $Copyright: (c) 2023 Broadcom Inc.
+ * All Rights Reserved.$
+ *
+ */
+
+#include <time.h>
+#include <pthread.h>
+
+#include "kbp_portable.h"
+#include "kbp_xpt_trace.h"
+#include "kbp_latency.h"
+#include "kbp_probes.h"
+#include "kbp_flight.h"
+
+#define KBP_LATENCY_HASH_SIZE   (64)
+
+struct kbp_latency_object {
+    const void *object;
+    struct kbp_latency_object *next;
+    struct kbp_latency_hist hist[KBP_LATENCY_NUM_APIS];
+};
+
+struct kbp_latency {
+    pthread_mutex_t lock;
+    struct kbp_xpt_trace *trace;    /* NULL without the install split */
+    uint64_t write_ns;              /* time spent in transport writes so far */
+    struct kbp_latency_hist device[KBP_LATENCY_NUM_APIS];
+    struct kbp_latency_object *objects[KBP_LATENCY_HASH_SIZE];
+};
+
+static uint64_t kbp_latency_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint32_t kbp_latency_bucket(uint64_t ns)
+{
+    uint32_t e;
+
+    if (ns < KBP_LATENCY_SUB_BUCKETS)
+        return (uint32_t) ns;
+
+    /* Power of two, then the three bits below the leading one */
+    e = 63 - __builtin_clzll(ns);
+    if (e - 2 >= KBP_LATENCY_NUM_BUCKETS / KBP_LATENCY_SUB_BUCKETS)
+        return KBP_LATENCY_NUM_BUCKETS - 1;
+    return (e - 2) * KBP_LATENCY_SUB_BUCKETS + ((ns >> (e - 3)) & (KBP_LATENCY_SUB_BUCKETS - 1));
+}
+
+uint64_t kbp_latency_bucket_floor(uint32_t bucket)
+{
+    uint32_t e;
+
+    if (bucket < KBP_LATENCY_SUB_BUCKETS)
+        return bucket;
+    if (bucket >= KBP_LATENCY_NUM_BUCKETS)
+        bucket = KBP_LATENCY_NUM_BUCKETS - 1;
+
+    e = bucket / KBP_LATENCY_SUB_BUCKETS + 2;
+    return (uint64_t) (KBP_LATENCY_SUB_BUCKETS + bucket % KBP_LATENCY_SUB_BUCKETS) << (e - 3);
+}
+
+uint64_t kbp_latency_percentile(const struct kbp_latency_hist *hist, double percentile)
+{
+    uint64_t target, seen = 0, upper;
+    uint32_t i;
+
+    if (!hist || !hist->count)
+        return 0;
+
+    if (percentile <= 0)
+        return hist->min_ns;
+    target = (uint64_t) (hist->count * (percentile / 100.0) + 0.5);
+    if (target == 0)
+        target = 1;
+
+    for (i = 0; i < KBP_LATENCY_NUM_BUCKETS; i++) {
+        seen += hist->buckets[i];
+        if (seen >= target)
+            break;
+    }
+    if (i >= KBP_LATENCY_NUM_BUCKETS - 1)
+        return hist->max_ns;
+
+    upper = kbp_latency_bucket_floor(i + 1) - 1;
+    return upper < hist->max_ns ? upper : hist->max_ns;
+}
+
+static uint32_t kbp_latency_hash(const void *object)
+{
+    uintptr_t p = (uintptr_t) object;
+
+    return (uint32_t) ((p >> 4) ^ (p >> 10)) & (KBP_LATENCY_HASH_SIZE - 1);
+}
+
+static void kbp_latency_hist_add(struct kbp_latency_hist *h, uint64_t ns, kbp_status status)
+{
+    if (!h->count || ns < h->min_ns)
+        h->min_ns = ns;
+    if (ns > h->max_ns)
+        h->max_ns = ns;
+    h->count++;
+    h->total_ns += ns;
+    h->buckets[kbp_latency_bucket(ns)]++;
+    if (status != KBP_OK)
+        h->num_errors++;
+}
+
+static void kbp_latency_record(struct kbp_latency *lat, const void *object, enum kbp_latency_api api,
+                               uint64_t ns, kbp_status status)
+{
+    struct kbp_latency_object *o = NULL;
+    uint32_t h;
+
+    pthread_mutex_lock(&lat->lock);
+    kbp_latency_hist_add(&lat->device[api], ns, status);
+
+    if (object) {
+        h = kbp_latency_hash(object);
+        for (o = lat->objects[h]; o; o = o->next) {
+            if (o->object == object)
+                break;
+        }
+        if (!o) {
+            /* On allocation failure only the device histogram is kept */
+            o = kbp_syscalloc(1, sizeof(*o));
+            if (o) {
+                o->object = object;
+                o->next = lat->objects[h];
+                lat->objects[h] = o;
+            }
+        }
+        if (o)
+            kbp_latency_hist_add(&o->hist[api], ns, status);
+    }
+    pthread_mutex_unlock(&lat->lock);
+}
+
+static void kbp_latency_sink(void *ctx, const struct kbp_xpt_trace_record *record)
+{
+    struct kbp_latency *lat = ctx;
+
+    switch (record->op) {
+    case KBP_XPT_TRACE_WRITE_REG:
+    case KBP_XPT_TRACE_WRITE_DBA:
+    case KBP_XPT_TRACE_WRITE_UDA:
+    case KBP_XPT_TRACE_COMMAND:
+    case KBP_XPT_TRACE_STATS_WRITE:
+        pthread_mutex_lock(&lat->lock);
+        lat->write_ns += record->duration_ns;
+        pthread_mutex_unlock(&lat->lock);
+        break;
+    default:
+        break;
+    }
+}
+
+kbp_status kbp_latency_create(void *xpt, struct kbp_latency **latency, void **timed_xpt)
+{
+    struct kbp_latency *lat;
+    kbp_status status;
+
+    if (!latency || (xpt && !timed_xpt))
+        return KBP_INVALID_ARGUMENT;
+
+    lat = kbp_syscalloc(1, sizeof(*lat));
+    if (!lat)
+        return KBP_OUT_OF_MEMORY;
+    pthread_mutex_init(&lat->lock, NULL);
+
+    if (xpt) {
+        status = kbp_xpt_trace_create_sink(xpt, kbp_latency_sink, lat, &lat->trace, timed_xpt);
+        if (status != KBP_OK) {
+            pthread_mutex_destroy(&lat->lock);
+            kbp_sysfree(lat);
+            return status;
+        }
+    } else if (timed_xpt) {
+        *timed_xpt = NULL;
+    }
+
+    *latency = lat;
+    return KBP_OK;
+}
+
+kbp_status kbp_latency_destroy(struct kbp_latency *latency)
+{
+    uint32_t i;
+
+    if (!latency)
+        return KBP_INVALID_ARGUMENT;
+
+    if (latency->trace)
+        kbp_xpt_trace_destroy(latency->trace);
+    for (i = 0; i < KBP_LATENCY_HASH_SIZE; i++) {
+        while (latency->objects[i]) {
+            struct kbp_latency_object *o = latency->objects[i];
+
+            latency->objects[i] = o->next;
+            kbp_sysfree(o);
+        }
+    }
+    pthread_mutex_destroy(&latency->lock);
+    kbp_sysfree(latency);
+    return KBP_OK;
+}
+
+kbp_status kbp_latency_get(struct kbp_latency *latency, const void *object, enum kbp_latency_api api,
+                           struct kbp_latency_hist *hist)
+{
+    struct kbp_latency_object *o;
+
+    if (!latency || !hist || (uint32_t) api >= KBP_LATENCY_NUM_APIS)
+        return KBP_INVALID_ARGUMENT;
+
+    pthread_mutex_lock(&latency->lock);
+    if (!object) {
+        kbp_memcpy(hist, &latency->device[api], sizeof(*hist));
+    } else {
+        for (o = latency->objects[kbp_latency_hash(object)]; o; o = o->next) {
+            if (o->object == object)
+                break;
+        }
+        if (o)
+            kbp_memcpy(hist, &o->hist[api], sizeof(*hist));
+        else
+            kbp_memset(hist, 0, sizeof(*hist));
+    }
+    pthread_mutex_unlock(&latency->lock);
+    return KBP_OK;
+}
+
+kbp_status kbp_latency_reset(struct kbp_latency *latency, const void *object)
+{
+    struct kbp_latency_object *o;
+    uint32_t i;
+
+    if (!latency)
+        return KBP_INVALID_ARGUMENT;
+
+    pthread_mutex_lock(&latency->lock);
+    if (!object) {
+        kbp_memset(latency->device, 0, sizeof(latency->device));
+        for (i = 0; i < KBP_LATENCY_HASH_SIZE; i++) {
+            for (o = latency->objects[i]; o; o = o->next)
+                kbp_memset(o->hist, 0, sizeof(o->hist));
+        }
+    } else {
+        for (o = latency->objects[kbp_latency_hash(object)]; o; o = o->next) {
+            if (o->object == object)
+                kbp_memset(o->hist, 0, sizeof(o->hist));
+        }
+    }
+    pthread_mutex_unlock(&latency->lock);
+    return KBP_OK;
+}
+
+kbp_status kbp_latency_forget(struct kbp_latency *latency, const void *object)
+{
+    struct kbp_latency_object **link, *o;
+
+    if (!latency || !object)
+        return KBP_INVALID_ARGUMENT;
+
+    pthread_mutex_lock(&latency->lock);
+    for (link = &latency->objects[kbp_latency_hash(object)]; *link; link = &(*link)->next) {
+        if ((*link)->object == object) {
+            o = *link;
+            *link = o->next;
+            kbp_sysfree(o);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&latency->lock);
+    return KBP_OK;
+}
+
+/*
+ * Wrappers. The call is made even without a latency handle, so callers can
+ * switch timing off by passing NULL. The probe pair and the flight record
+ * are made either way, on probe_object, which is the database or the
+ * device. handle and arg are evaluated after the call.
+ */
+
+#define KBP_LATENCY_TIME(lat, object, api, probe, probe_object, flight_op, handle, arg, call) \
+    do {                                                                        \
+        uint64_t __start, __ns;                                                 \
+        kbp_status __status;                                                    \
+        KBP_PROBE1(probe##_start, probe_object);                                \
+        __start = kbp_latency_now_ns();                                         \
+        __status = (call);                                                      \
+        __ns = kbp_latency_now_ns() - __start;                                  \
+        if (lat)                                                                \
+            kbp_latency_record(lat, object, api, __ns, __status);               \
+        kbp_flight_record(flight_op, probe_object, handle, arg, __status, __start, __ns); \
+        KBP_PROBE2(probe##_done, probe_object, __status);                       \
+        return __status;                                                        \
+    } while (0)
+
+/*
+ * Handle returned through an out parameter, for the flight record
+ */
+
+#define KBP_LATENCY_OUT(out) ((__status == KBP_OK && (out)) ? (const void *) *(out) : NULL)
+
+kbp_status kbp_latency_db_add_ace(struct kbp_latency *latency, struct kbp_db *db, uint8_t *data, uint8_t *mask,
+                                  uint32_t priority, struct kbp_entry **entry)
+{
+    KBP_LATENCY_TIME(latency, db, KBP_LATENCY_DB_ADD, entry_add, db, KBP_FLIGHT_DB_ADD, KBP_LATENCY_OUT(entry),
+                     priority, kbp_db_add_ace(db, data, mask, priority, entry));
+}
+
+kbp_status kbp_latency_db_add_prefix(struct kbp_latency *latency, struct kbp_db *db, uint8_t *prefix,
+                                     uint32_t length, struct kbp_entry **entry)
+{
+    KBP_LATENCY_TIME(latency, db, KBP_LATENCY_DB_ADD, entry_add, db, KBP_FLIGHT_DB_ADD_PREFIX, KBP_LATENCY_OUT(entry),
+                     length, kbp_db_add_prefix(db, prefix, length, entry));
+}
+
+kbp_status kbp_latency_db_add_em(struct kbp_latency *latency, struct kbp_db *db, uint8_t *data,
+                                 struct kbp_entry **entry)
+{
+    KBP_LATENCY_TIME(latency, db, KBP_LATENCY_DB_ADD, entry_add, db, KBP_FLIGHT_DB_ADD_EM, KBP_LATENCY_OUT(entry),
+                     0, kbp_db_add_em(db, data, entry));
+}
+
+kbp_status kbp_latency_db_delete_entry(struct kbp_latency *latency, struct kbp_db *db, struct kbp_entry *entry)
+{
+    KBP_LATENCY_TIME(latency, db, KBP_LATENCY_DB_DELETE, entry_delete, db, KBP_FLIGHT_DB_DELETE, entry, 0,
+                     kbp_db_delete_entry(db, entry));
+}
+
+kbp_status kbp_latency_db_install(struct kbp_latency *latency, struct kbp_db *db)
+{
+    uint64_t start, total, hw = 0, write_ns = 0;
+    kbp_status status;
+
+    if (latency && latency->trace) {
+        pthread_mutex_lock(&latency->lock);
+        write_ns = latency->write_ns;
+        pthread_mutex_unlock(&latency->lock);
+    }
+
+    KBP_PROBE1(install_start, db);
+    start = kbp_latency_now_ns();
+    status = kbp_db_install(db);
+    total = kbp_latency_now_ns() - start;
+
+    if (latency) {
+        kbp_latency_record(latency, db, KBP_LATENCY_DB_INSTALL, total, status);
+        if (latency->trace) {
+            pthread_mutex_lock(&latency->lock);
+            hw = latency->write_ns - write_ns;
+            pthread_mutex_unlock(&latency->lock);
+            if (hw > total)
+                hw = total;
+            kbp_latency_record(latency, db, KBP_LATENCY_DB_INSTALL_PLACEMENT, total - hw, status);
+            kbp_latency_record(latency, db, KBP_LATENCY_DB_INSTALL_HW, hw, status);
+        }
+    }
+    kbp_flight_record(KBP_FLIGHT_DB_INSTALL, db, NULL, (uint32_t) (hw / 1000), status, start, total);
+    KBP_PROBE3(install_done, db, status, hw);
+
+    if (status != KBP_OK)
+        kbp_flight_auto_dump(KBP_FLIGHT_DUMP_ON_INSTALL_ERROR);
+    return status;
+}
+
+kbp_status kbp_latency_instruction_search(struct kbp_latency *latency, struct kbp_instruction *instruction,
+                                          uint8_t *master_key, uint32_t cb_addrs,
+                                          struct kbp_search_result *result)
+{
+    KBP_LATENCY_TIME(latency, NULL, KBP_LATENCY_SEARCH, search, instruction, KBP_FLIGHT_SEARCH, NULL, cb_addrs,
+                     kbp_instruction_search(instruction, master_key, cb_addrs, result));
+}
+
+kbp_status kbp_latency_ad_db_add_entry(struct kbp_latency *latency, struct kbp_ad_db *db, uint8_t *value,
+                                       struct kbp_ad **ad)
+{
+    KBP_LATENCY_TIME(latency, db, KBP_LATENCY_AD_ADD, ad_add, db, KBP_FLIGHT_AD_ADD, KBP_LATENCY_OUT(ad), 0,
+                     kbp_ad_db_add_entry(db, value, ad));
+}
+
+kbp_status kbp_latency_ad_db_update_entry(struct kbp_latency *latency, struct kbp_ad_db *db, struct kbp_ad *ad,
+                                          uint8_t *value)
+{
+    KBP_LATENCY_TIME(latency, db, KBP_LATENCY_AD_UPDATE, ad_update, db, KBP_FLIGHT_AD_UPDATE, ad, 0,
+                     kbp_ad_db_update_entry(db, ad, value));
+}
+
+kbp_status kbp_latency_ad_db_delete_entry(struct kbp_latency *latency, struct kbp_ad_db *db, struct kbp_ad *ad)
+{
+    KBP_LATENCY_TIME(latency, db, KBP_LATENCY_AD_DELETE, ad_delete, db, KBP_FLIGHT_AD_DELETE, ad, 0,
+                     kbp_ad_db_delete_entry(db, ad));
+}
+
+kbp_status kbp_latency_device_save_state(struct kbp_latency *latency, struct kbp_device *device,
+                                         kbp_device_issu_read_fn read_fn, kbp_device_issu_write_fn write_fn,
+                                         void *handle)
+{
+    KBP_LATENCY_TIME(latency, NULL, KBP_LATENCY_WB_SAVE, wb_save, device, KBP_FLIGHT_WB_SAVE, NULL, 0,
+                     kbp_device_save_state(device, read_fn, write_fn, handle));
+}
+
+kbp_status kbp_latency_device_save_state_and_continue(struct kbp_latency *latency, struct kbp_device *device,
+                                                      kbp_device_issu_read_fn read_fn,
+                                                      kbp_device_issu_write_fn write_fn, void *handle)
+{
+    KBP_LATENCY_TIME(latency, NULL, KBP_LATENCY_WB_SAVE, wb_save, device, KBP_FLIGHT_WB_SAVE, NULL, 0,
+                     kbp_device_save_state_and_continue(device, read_fn, write_fn, handle));
+}
+
+kbp_status kbp_latency_device_restore_state(struct kbp_latency *latency, struct kbp_device *device,
+                                            kbp_device_issu_read_fn read_fn, kbp_device_issu_write_fn write_fn,
+                                            void *handle)
+{
+    KBP_LATENCY_TIME(latency, NULL, KBP_LATENCY_WB_RESTORE, wb_restore, device, KBP_FLIGHT_WB_RESTORE, NULL, 0,
+                     kbp_device_restore_state(device, read_fn, write_fn, handle));
+}
+
+kbp_status kbp_latency_hb_db_timer(struct kbp_latency *latency, struct kbp_hb_db *hb_db)
+{
+    KBP_LATENCY_TIME(latency, hb_db, KBP_LATENCY_HB_TIMER, hb_timer, hb_db, KBP_FLIGHT_HB_TIMER, NULL, 0,
+                     kbp_hb_db_timer(hb_db));
+}
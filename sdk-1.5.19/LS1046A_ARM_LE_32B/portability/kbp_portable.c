@@ -11,6 +11,8 @@
 #define _FILE_OFFSET_BITS 64
 
 #include <kbp_portable.h>
+#include <kbp_log.h>
+#include <kbp_flight.h>
 #include <time.h>
 #include <errno.h>
 #include <string.h>
@@ -168,30 +170,66 @@ int kbp_snprintf(char *buff, uint32_t buffsize, const char *fmt, ...)
 }
 
 
+/*
+ * All print calls funnel through here. When the asynchronous log is
+ * enabled the call is captured and formatted later by the drainer.
+ */
+static int kbp_log_or_vfprintf(FILE * fp, const char *fmt, va_list ap)
+{
+    va_list aq;
+    int32_t r;
+
+    va_copy(aq, ap);
+    r = kbp_log_vrecord(fp, fmt, aq);
+    va_end(aq);
+    if (r == 0)
+        return 0;
+
+    return vfprintf(fp, fmt, ap);
+}
+
 int kbp_printf(const char *fmt, ...)
 {
     va_list ap;
     int r;
 
     va_start(ap, fmt);
-    r = vprintf(fmt, ap);
+    r = kbp_log_or_vfprintf(stdout, fmt, ap);
     va_end(ap);
 
     return r;
 }
 
 
+/*
+ * Queues a print on the asynchronous log. Returns 0 if it was queued.
+ */
+static int32_t kbp_log_try_record(FILE * fp, const char *fmt, ...)
+{
+    va_list ap;
+    int32_t r;
+
+    va_start(ap, fmt);
+    r = kbp_log_vrecord(fp, fmt, ap);
+    va_end(ap);
+
+    return r;
+}
+
 int kbp_fputs(const char *str, FILE *fp)
 {
     int r;
 
+    if (kbp_log_try_record(fp, "%s", str) == 0)
+        return 0;
+
     r = fputs(str, fp);
     return r;
 }
 
 int kbp_vprintf(const char *fmt, va_list ap)
 {
-    return vprintf(fmt, ap);
+    return kbp_log_or_vfprintf(stdout, fmt, ap);
 }
 
 int kbp_vfprintf(FILE * fp, const char *fmt, va_list ap)
@@ -199,7 +237,7 @@ int kbp_vfprintf(FILE * fp, const char *fmt, va_list ap)
     if (!fp)
         return 0;
 
-    return vfprintf(fp, fmt, ap);
+    return kbp_log_or_vfprintf(fp, fmt, ap);
 }
 
 int kbp_fprintf(FILE * fp, const char *fmt, ...)
@@ -211,7 +249,7 @@ int kbp_fprintf(FILE * fp, const char *fmt, ...)
         return 0;
 
     va_start(ap, fmt);
-    r = vfprintf(fp, fmt, ap);
+    r = kbp_log_or_vfprintf(fp, fmt, ap);
     va_end(ap);
 
     return r;
@@ -440,6 +478,8 @@ int kbp_fseek(FILE * fp, int32_t offset, int whence)
 
 int kbp_fclose(FILE * fp)
 {
+    /* Queued kbp_fprintf() output still references fp */
+    kbp_log_flush();
     return fclose(fp);
 }
 
@@ -472,6 +512,9 @@ int32_t kbp_identity(const int32_t b)
 int32_t kbp_assert_detail(const char *msg, const char *file, int32_t line)
 {
     kbp_printf("ERROR %s:%d: %s\n", file, line, msg);
+    kbp_flight_record(KBP_FLIGHT_ASSERT, NULL, NULL, line, KBP_INTERNAL_ERROR, 0, 0);
+    kbp_flight_auto_dump(KBP_FLIGHT_DUMP_ON_ASSERT);
+    kbp_log_flush();
     kbp_abort();
     return 0;
 }
@@ -479,6 +522,10 @@ int32_t kbp_assert_detail(const char *msg, const char *file, int32_t line)
 int32_t kbp_assert_detail_or_error(const char *msg, uint32_t return_error, uint32_t error_code, const char *file, int32_t line)
 {
     kbp_printf("ERROR %s:%d: %s\n", file, line, msg);
+    kbp_flight_record(KBP_FLIGHT_ASSERT, NULL, NULL, line, return_error ? error_code : KBP_INTERNAL_ERROR, 0, 0);
+    if (!return_error)
+        kbp_flight_auto_dump(KBP_FLIGHT_DUMP_ON_ASSERT);
+    kbp_log_flush();
     if (!return_error)
         kbp_abort();
     return error_code;
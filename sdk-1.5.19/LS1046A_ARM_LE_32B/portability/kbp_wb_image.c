@@ -0,0 +1,404 @@
+/*
+ * $Id$
+ *
+ * This license is set out in https://raw.githubusercontent.com/Broadcom/Broadcom-Compute-Connectivity-Software-KBP-SDK/master/Legal/LICENSE file.
+ *
+ * $Copyright: (c) 2023 Broadcom Inc.
+ * All Rights Reserved.$
+ *
+ */
+
+#include <stddef.h>
+#include <string.h>
+
+#include "kbp_portable.h"
+#include "kbp_math.h"
+#include "kbp_wb_image.h"
+#include "kbp_probes.h"
+
+#define KBP_WB_IMAGE_MAGIC              (0x4B574249)    /* KWBI */
+#define KBP_WB_IMAGE_FORMAT             (1)
+#define KBP_WB_IMAGE_DATA_START         (4096)
+#define KBP_WB_IMAGE_DEFAULT_SECTION    (64 * 1024)
+
+/*
+ * Container header at offset 0, written last. The section CRC table
+ * follows the last section.
+ */
+struct kbp_wb_image_hdr {
+    uint32_t magic;
+    uint32_t format;
+    char sdk_version[KBP_WB_IMAGE_VERSION_LEN];
+    uint64_t fingerprint;
+    uint32_t section_size;
+    uint32_t image_size;
+    uint32_t num_sections;
+    uint32_t table_offset;
+    uint32_t table_crc;
+    uint32_t crc;
+};
+
+struct kbp_wb_image {
+    kbp_device_issu_read_fn read_fn;
+    kbp_device_issu_write_fn write_fn;
+    void *handle;
+    struct kbp_wb_image_config config;
+    uint32_t max_sections;
+    uint32_t *crcs;
+    uint8_t *written;           /* sections written by the current save */
+    uint8_t *buf;               /* staged section on save, verified section on restore */
+    int32_t cur_section;
+    uint32_t dirty;             /* staged section has unwritten changes */
+    uint32_t verify;            /* check section CRCs on read (restore) */
+    uint32_t num_sections;      /* sections in the image being restored */
+    uint32_t image_size;
+    kbp_status failure;
+};
+
+static uint32_t kbp_wb_image_hdr_crc(const struct kbp_wb_image_hdr *hdr)
+{
+    return kbp_crc32(0, (const uint8_t *) hdr, offsetof(struct kbp_wb_image_hdr, crc));
+}
+
+static kbp_status kbp_wb_image_read_hdr(kbp_device_issu_read_fn read_fn, void *handle, struct kbp_wb_image_hdr *hdr)
+{
+    if (read_fn(handle, (uint8_t *) hdr, sizeof(*hdr), 0) != 0)
+        return KBP_NV_READ_WRITE_FAILED;
+
+    if (hdr->magic != KBP_WB_IMAGE_MAGIC || hdr->format != KBP_WB_IMAGE_FORMAT
+        || hdr->crc != kbp_wb_image_hdr_crc(hdr))
+        return KBP_NV_DATA_CORRUPT;
+
+    if (hdr->section_size == 0 || (hdr->section_size & (hdr->section_size - 1))
+        || hdr->num_sections != (uint32_t) (((uint64_t) hdr->image_size + hdr->section_size - 1) / hdr->section_size)
+        || hdr->sdk_version[KBP_WB_IMAGE_VERSION_LEN - 1] != '\0')
+        return KBP_NV_DATA_CORRUPT;
+
+    return KBP_OK;
+}
+
+static kbp_status kbp_wb_image_read_table(kbp_device_issu_read_fn read_fn, void *handle,
+                                          const struct kbp_wb_image_hdr *hdr, uint32_t *crcs)
+{
+    uint32_t len = hdr->num_sections * sizeof(uint32_t);
+
+    if (len && read_fn(handle, (uint8_t *) crcs, len, hdr->table_offset) != 0)
+        return KBP_NV_READ_WRITE_FAILED;
+    if (kbp_crc32(0, (const uint8_t *) crcs, len) != hdr->table_crc)
+        return KBP_NV_DATA_CORRUPT;
+    return KBP_OK;
+}
+
+/*
+ * Writes the staged section to its place and records its CRC. The tail
+ * of the last section is zero filled, so every CRC covers a full section.
+ */
+static kbp_status kbp_wb_image_flush(struct kbp_wb_image *img)
+{
+    uint32_t ss = img->config.section_size;
+    uint32_t sec;
+
+    if (img->cur_section < 0)
+        return KBP_OK;
+
+    sec = img->cur_section;
+    img->cur_section = -1;
+    if (!img->dirty)
+        return KBP_OK;
+    img->dirty = 0;
+
+    img->crcs[sec] = kbp_crc32(0, img->buf, ss);
+    KBP_PROBE3(wb_section_store, img, sec, ss);
+    if (img->write_fn(img->handle, img->buf, ss, KBP_WB_IMAGE_DATA_START + sec * ss) != 0)
+        return KBP_NV_READ_WRITE_FAILED;
+    return KBP_OK;
+}
+
+static int32_t kbp_wb_image_read_cb(void *handle, uint8_t *buffer, uint32_t size, uint32_t offset)
+{
+    struct kbp_wb_image *img = (struct kbp_wb_image *) handle;
+    uint32_t ss = img->config.section_size;
+
+    if ((uint64_t) offset + size > (uint64_t) img->max_sections * ss)
+        return 1;
+
+    while (size) {
+        uint32_t sec = offset / ss;
+        uint32_t off = offset % ss;
+        uint32_t n = ss - off;
+
+        if (n > size)
+            n = size;
+
+        if ((int32_t) sec != img->cur_section) {
+            if (kbp_wb_image_flush(img) != KBP_OK)
+                return 1;
+            KBP_PROBE3(wb_section_load, img, sec, ss);
+            if (img->read_fn(img->handle, img->buf, ss, KBP_WB_IMAGE_DATA_START + sec * ss) != 0)
+                return 1;
+            if (img->verify && (sec >= img->num_sections || kbp_crc32(0, img->buf, ss) != img->crcs[sec])) {
+                img->failure = KBP_NV_DATA_CORRUPT;
+                return 1;
+            }
+            img->cur_section = sec;
+            img->dirty = 0;
+        }
+
+        kbp_memcpy(buffer, &img->buf[off], n);
+        buffer += n;
+        offset += n;
+        size -= n;
+    }
+
+    return 0;
+}
+
+static int32_t kbp_wb_image_write_cb(void *handle, uint8_t *buffer, uint32_t size, uint32_t offset)
+{
+    struct kbp_wb_image *img = (struct kbp_wb_image *) handle;
+    uint32_t ss = img->config.section_size;
+
+    if ((uint64_t) offset + size > (uint64_t) img->max_sections * ss) {
+        img->failure = KBP_EXHAUSTED_NV_MEMORY;
+        return 1;
+    }
+
+    if (offset + size > img->image_size)
+        img->image_size = offset + size;
+
+    while (size) {
+        uint32_t sec = offset / ss;
+        uint32_t off = offset % ss;
+        uint32_t n = ss - off;
+
+        if (n > size)
+            n = size;
+
+        if ((int32_t) sec != img->cur_section) {
+            if (kbp_wb_image_flush(img) != KBP_OK) {
+                img->failure = KBP_NV_READ_WRITE_FAILED;
+                return 1;
+            }
+            if (n < ss) {
+                if (!img->written[sec]
+                    || img->read_fn(img->handle, img->buf, ss, KBP_WB_IMAGE_DATA_START + sec * ss) != 0)
+                    kbp_memset(img->buf, 0, ss);
+            }
+            img->cur_section = sec;
+            img->written[sec] = 1;
+        }
+
+        img->dirty = 1;
+        kbp_memcpy(&img->buf[off], buffer, n);
+        buffer += n;
+        offset += n;
+        size -= n;
+    }
+
+    return 0;
+}
+
+kbp_status kbp_wb_image_create(const struct kbp_wb_image_config *config, kbp_device_issu_read_fn read_fn,
+                               kbp_device_issu_write_fn write_fn, void *handle, struct kbp_wb_image **img)
+{
+    struct kbp_wb_image *i;
+    uint32_t ss;
+
+    if (!config || !read_fn || !write_fn || !img || config->capacity == 0)
+        return KBP_INVALID_ARGUMENT;
+
+    ss = config->section_size ? config->section_size : KBP_WB_IMAGE_DEFAULT_SECTION;
+    if (ss < 512 || (ss & (ss - 1)))
+        return KBP_INVALID_ARGUMENT;
+
+    i = kbp_syscalloc(1, sizeof(*i));
+    if (!i)
+        return KBP_OUT_OF_MEMORY;
+
+    i->read_fn = read_fn;
+    i->write_fn = write_fn;
+    i->handle = handle;
+    i->config.section_size = ss;
+    i->config.capacity = config->capacity;
+    i->config.fingerprint = config->fingerprint;
+    i->max_sections = (uint32_t) (((uint64_t) config->capacity + ss - 1) / ss);
+    i->crcs = kbp_syscalloc(i->max_sections, sizeof(uint32_t));
+    i->written = kbp_syscalloc(i->max_sections, sizeof(uint8_t));
+    i->buf = kbp_sysmalloc(ss);
+    i->cur_section = -1;
+
+    if (!i->crcs || !i->written || !i->buf) {
+        kbp_wb_image_destroy(i);
+        return KBP_OUT_OF_MEMORY;
+    }
+
+    *img = i;
+    return KBP_OK;
+}
+
+kbp_status kbp_wb_image_destroy(struct kbp_wb_image *img)
+{
+    if (!img)
+        return KBP_INVALID_ARGUMENT;
+
+    kbp_sysfree(img->crcs);
+    kbp_sysfree(img->written);
+    kbp_sysfree(img->buf);
+    kbp_sysfree(img);
+    return KBP_OK;
+}
+
+kbp_status kbp_wb_image_save(struct kbp_wb_image *img, struct kbp_device *device, int32_t and_continue)
+{
+    struct kbp_wb_image_hdr hdr;
+    uint32_t ss, sec;
+    kbp_status status;
+
+    if (!img || !device)
+        return KBP_INVALID_ARGUMENT;
+
+    ss = img->config.section_size;
+    img->cur_section = -1;
+    img->dirty = 0;
+    img->verify = 0;
+    img->image_size = 0;
+    kbp_memset(img->written, 0, img->max_sections);
+    img->failure = KBP_OK;
+
+    if (and_continue)
+        status = kbp_device_save_state_and_continue(device, kbp_wb_image_read_cb, kbp_wb_image_write_cb, img);
+    else
+        status = kbp_device_save_state(device, kbp_wb_image_read_cb, kbp_wb_image_write_cb, img);
+    if (status == KBP_OK)
+        status = kbp_wb_image_flush(img);
+    if (status != KBP_OK)
+        return img->failure != KBP_OK ? img->failure : status;
+
+    kbp_memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = KBP_WB_IMAGE_MAGIC;
+    hdr.format = KBP_WB_IMAGE_FORMAT;
+    strncpy(hdr.sdk_version, kbp_device_get_sdk_version(), KBP_WB_IMAGE_VERSION_LEN - 1);
+    hdr.fingerprint = img->config.fingerprint;
+    hdr.section_size = ss;
+    hdr.image_size = img->image_size;
+    hdr.num_sections = (img->image_size + ss - 1) / ss;
+    hdr.table_offset = KBP_WB_IMAGE_DATA_START + hdr.num_sections * ss;
+
+    /* Sections the SDK skipped over read back as zeros */
+    kbp_memset(img->buf, 0, ss);
+    for (sec = 0; sec < hdr.num_sections; sec++) {
+        if (img->written[sec])
+            continue;
+        img->cur_section = sec;
+        img->dirty = 1;
+        status = kbp_wb_image_flush(img);
+        if (status != KBP_OK)
+            return status;
+    }
+
+    hdr.table_crc = kbp_crc32(0, (const uint8_t *) img->crcs, hdr.num_sections * sizeof(uint32_t));
+    hdr.crc = kbp_wb_image_hdr_crc(&hdr);
+
+    if ((hdr.num_sections
+         && img->write_fn(img->handle, (uint8_t *) img->crcs, hdr.num_sections * sizeof(uint32_t), hdr.table_offset) != 0)
+        || img->write_fn(img->handle, (uint8_t *) &hdr, sizeof(hdr), 0) != 0)
+        return KBP_NV_READ_WRITE_FAILED;
+
+    return KBP_OK;
+}
+
+kbp_status kbp_wb_image_restore(struct kbp_wb_image *img, struct kbp_device *device)
+{
+    struct kbp_wb_image_hdr hdr;
+    kbp_status status;
+
+    if (!img || !device)
+        return KBP_INVALID_ARGUMENT;
+
+    status = kbp_wb_image_read_hdr(img->read_fn, img->handle, &hdr);
+    if (status != KBP_OK)
+        return status;
+    if (hdr.section_size != img->config.section_size || hdr.num_sections > img->max_sections)
+        return KBP_ISSU_MISMATCH;
+    if (img->config.fingerprint && hdr.fingerprint != img->config.fingerprint)
+        return KBP_ISSU_MISMATCH;
+
+    status = kbp_wb_image_read_table(img->read_fn, img->handle, &hdr, img->crcs);
+    if (status != KBP_OK)
+        return status;
+
+    img->cur_section = -1;
+    img->dirty = 0;
+    img->verify = 1;
+    img->num_sections = hdr.num_sections;
+    img->image_size = hdr.image_size;
+    img->failure = KBP_OK;
+
+    status = kbp_device_restore_state(device, kbp_wb_image_read_cb, kbp_wb_image_write_cb, img);
+    img->cur_section = -1;
+    img->verify = 0;
+    if (status != KBP_OK && img->failure != KBP_OK)
+        return img->failure;
+    return status;
+}
+
+kbp_status kbp_wb_image_get_info(kbp_device_issu_read_fn read_fn, void *handle, struct kbp_wb_image_info *info)
+{
+    struct kbp_wb_image_hdr hdr;
+    kbp_status status;
+
+    if (!read_fn || !info)
+        return KBP_INVALID_ARGUMENT;
+
+    status = kbp_wb_image_read_hdr(read_fn, handle, &hdr);
+    if (status != KBP_OK)
+        return status;
+
+    kbp_memcpy(info->sdk_version, hdr.sdk_version, KBP_WB_IMAGE_VERSION_LEN);
+    info->fingerprint = hdr.fingerprint;
+    info->image_size = hdr.image_size;
+    info->section_size = hdr.section_size;
+    info->num_sections = hdr.num_sections;
+    return KBP_OK;
+}
+
+kbp_status kbp_wb_image_validate(kbp_device_issu_read_fn read_fn, void *handle, uint64_t fingerprint, uint32_t flags)
+{
+    struct kbp_wb_image_hdr hdr;
+    uint32_t *crcs = NULL;
+    uint8_t *buf = NULL;
+    kbp_status status;
+    uint32_t sec;
+
+    if (!read_fn)
+        return KBP_INVALID_ARGUMENT;
+
+    status = kbp_wb_image_read_hdr(read_fn, handle, &hdr);
+    if (status != KBP_OK)
+        return status;
+
+    if (fingerprint && hdr.fingerprint != fingerprint)
+        return KBP_ISSU_MISMATCH;
+    if ((flags & KBP_WB_IMAGE_SAME_SDK) && strcmp(hdr.sdk_version, kbp_device_get_sdk_version()) != 0)
+        return KBP_ISSU_MISMATCH;
+
+    crcs = kbp_sysmalloc(hdr.num_sections * sizeof(uint32_t) + 1);
+    buf = kbp_sysmalloc(hdr.section_size);
+    if (!crcs || !buf) {
+        status = KBP_OUT_OF_MEMORY;
+        goto done;
+    }
+
+    status = kbp_wb_image_read_table(read_fn, handle, &hdr, crcs);
+    for (sec = 0; status == KBP_OK && sec < hdr.num_sections; sec++) {
+        if (read_fn(handle, buf, hdr.section_size, KBP_WB_IMAGE_DATA_START + sec * hdr.section_size) != 0)
+            status = KBP_NV_READ_WRITE_FAILED;
+        else if (kbp_crc32(0, buf, hdr.section_size) != crcs[sec])
+            status = KBP_NV_DATA_CORRUPT;
+    }
+
+done:
+    kbp_sysfree(crcs);
+    kbp_sysfree(buf);
+    return status;
+}
@@ -0,0 +1,971 @@
+/*
+ * $Id$
+ *
+ * This license is set out in https://raw.githubusercontent.com/Broadcom/Broadcom-Compute-Connectivity-Software-KBP-SDK/master/Legal/LICENSE file.
+ *
+ * $Copyright: (c) 2023 Broadcom Inc.
+ * All Rights Reserved.$
+ *
+ */
+
+#include <time.h>
+#include <pthread.h>
+
+#include "kbp_portable.h"
+#include "init.h"
+#include "instruction.h"
+#include "kbp_xpt_trace.h"
+#include "kbp_probes.h"
+#include "kbp_flight.h"
+
+#define KBP_XPT_TRACE_REG_BYTES         (10)
+#define KBP_XPT_TRACE_STATS_BYTES       (8)
+#define KBP_XPT_TRACE_MAX_PAYLOAD       (64 * 1024 * 1024)
+#define KBP_XPT_TRACE_NO_KEY            (0xFFFFFFFF)
+
+struct kbp_xpt_trace {
+    struct op2_xpt xpt;         /* handed to the SDK, op_xpt_info.handle points back here */
+    struct op_xpt *inner;
+    struct op2_xpt *inner2;     /* NULL unless the inner transport is OP2 */
+    FILE *fp;                   /* NULL when records go to sink */
+    kbp_xpt_trace_sink_fn sink;
+    void *sink_ctx;
+    pthread_mutex_t lock;
+    uint64_t start_ns;
+    struct kbp_xpt_trace_stats stats;
+};
+
+struct kbp_xpt_trace_piece {
+    const void *data;
+    uint32_t len;
+};
+
+static uint64_t kbp_xpt_trace_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint64_t kbp_xpt_trace_begin(struct kbp_xpt_trace *t, uint32_t op)
+{
+    KBP_PROBE2(xpt_submit, t, op);
+    return kbp_xpt_trace_now_ns();
+}
+
+static void kbp_xpt_trace_emit(struct kbp_xpt_trace *t, uint32_t op, kbp_status status, uint64_t start_ns,
+                               const struct kbp_xpt_trace_piece *pieces, uint32_t num_pieces)
+{
+    struct kbp_xpt_trace_record rec;
+    uint64_t duration = kbp_xpt_trace_now_ns() - start_ns;
+    uint32_t i, ok;
+
+    kbp_memset(&rec, 0, sizeof(rec));
+    rec.op = op;
+    rec.status = status;
+    rec.duration_ns = duration > 0xFFFFFFFFULL ? 0xFFFFFFFF : (uint32_t) duration;
+    for (i = 0; i < num_pieces; i++)
+        rec.len += pieces[i].len;
+
+    rec.timestamp_ns = start_ns - t->start_ns;
+    KBP_PROBE5(xpt_complete, t, op, status, rec.duration_ns, rec.len);
+    if (status != KBP_OK)
+        kbp_flight_record(KBP_FLIGHT_XPT_ERROR, t, NULL, op, status, start_ns, duration);
+    if (t->sink) {
+        t->sink(t->sink_ctx, &rec);
+        return;
+    }
+
+    pthread_mutex_lock(&t->lock);
+    ok = fwrite(&rec, sizeof(rec), 1, t->fp) == 1;
+    for (i = 0; ok && i < num_pieces; i++) {
+        if (pieces[i].len)
+            ok = fwrite(pieces[i].data, pieces[i].len, 1, t->fp) == 1;
+    }
+    if (ok) {
+        t->stats.num_records++;
+        t->stats.num_bytes += sizeof(rec) + rec.len;
+    } else {
+        t->stats.num_write_errors++;
+    }
+    pthread_mutex_unlock(&t->lock);
+}
+
+static kbp_status kbp_xpt_trace_write_reg(void *handle, uint32_t address, const uint8_t *data, uint32_t core_bitmap)
+{
+    struct kbp_xpt_trace *t = handle;
+    struct kbp_xpt_trace_piece p[2];
+    uint32_t args[2];
+    uint64_t start = kbp_xpt_trace_begin(t, KBP_XPT_TRACE_WRITE_REG);
+    kbp_status status;
+
+    status = t->inner->op_write_reg(t->inner->handle, address, data, core_bitmap);
+    args[0] = address;
+    args[1] = core_bitmap;
+    p[0].data = args;
+    p[0].len = sizeof(args);
+    p[1].data = data;
+    p[1].len = KBP_XPT_TRACE_REG_BYTES;
+    kbp_xpt_trace_emit(t, KBP_XPT_TRACE_WRITE_REG, status, start, p, 2);
+    return status;
+}
+
+static kbp_status kbp_xpt_trace_read_reg(void *handle, uint32_t address, uint8_t *data, uint32_t core_bitmap)
+{
+    struct kbp_xpt_trace *t = handle;
+    struct kbp_xpt_trace_piece p[2];
+    uint32_t args[2];
+    uint64_t start = kbp_xpt_trace_begin(t, KBP_XPT_TRACE_READ_REG);
+    kbp_status status;
+
+    status = t->inner->op_read_reg(t->inner->handle, address, data, core_bitmap);
+    args[0] = address;
+    args[1] = core_bitmap;
+    p[0].data = args;
+    p[0].len = sizeof(args);
+    p[1].data = data;
+    p[1].len = KBP_XPT_TRACE_REG_BYTES;
+    kbp_xpt_trace_emit(t, KBP_XPT_TRACE_READ_REG, status, start, p, 2);
+    return status;
+}
+
+static kbp_status kbp_xpt_trace_write_dba(void *handle, uint32_t address, const uint8_t *data, const uint8_t *mask,
+                                          uint32_t is_xy, uint32_t valid_bit, uint32_t core_bitmap)
+{
+    struct kbp_xpt_trace *t = handle;
+    struct kbp_xpt_trace_piece p[3];
+    uint32_t args[4];
+    uint64_t start = kbp_xpt_trace_begin(t, KBP_XPT_TRACE_WRITE_DBA);
+    kbp_status status;
+
+    status = t->inner->op_write_dba_entry(t->inner->handle, address, data, mask, is_xy, valid_bit, core_bitmap);
+    args[0] = address;
+    args[1] = is_xy;
+    args[2] = valid_bit;
+    args[3] = core_bitmap;
+    p[0].data = args;
+    p[0].len = sizeof(args);
+    p[1].data = data;
+    p[1].len = KBP_XPT_TRACE_REG_BYTES;
+    p[2].data = mask;
+    p[2].len = KBP_XPT_TRACE_REG_BYTES;
+    kbp_xpt_trace_emit(t, KBP_XPT_TRACE_WRITE_DBA, status, start, p, 3);
+    return status;
+}
+
+static kbp_status kbp_xpt_trace_read_dba(void *handle, uint32_t address, uint32_t read_x_or_y, uint8_t *entry_x_or_y,
+                                         uint32_t *valid_bit, uint32_t *parity, uint32_t core_bitmap)
+{
+    struct kbp_xpt_trace *t = handle;
+    struct kbp_xpt_trace_piece p[2];
+    uint32_t args[5];
+    uint64_t start = kbp_xpt_trace_begin(t, KBP_XPT_TRACE_READ_DBA);
+    kbp_status status;
+
+    status = t->inner->op_read_dba_entry(t->inner->handle, address, read_x_or_y, entry_x_or_y, valid_bit, parity,
+                                         core_bitmap);
+    args[0] = address;
+    args[1] = read_x_or_y;
+    args[2] = core_bitmap;
+    args[3] = valid_bit ? *valid_bit : 0;
+    args[4] = parity ? *parity : 0;
+    if (args[4])
+        KBP_PROBE3(dba_parity, t, address, args[4]);
+    p[0].data = args;
+    p[0].len = sizeof(args);
+    p[1].data = entry_x_or_y;
+    p[1].len = KBP_XPT_TRACE_REG_BYTES;
+    kbp_xpt_trace_emit(t, KBP_XPT_TRACE_READ_DBA, status, start, p, 2);
+    return status;
+}
+
+static kbp_status kbp_xpt_trace_write_uda(void *handle, uint32_t address_32, uint8_t is_uda_64b, uint64_t value,
+                                          uint32_t core_bitmap)
+{
+    struct kbp_xpt_trace *t = handle;
+    struct kbp_xpt_trace_piece p[2];
+    uint32_t args[3];
+    uint64_t start = kbp_xpt_trace_begin(t, KBP_XPT_TRACE_WRITE_UDA);
+    kbp_status status;
+
+    status = t->inner->op_write_uda(t->inner->handle, address_32, is_uda_64b, value, core_bitmap);
+    args[0] = address_32;
+    args[1] = is_uda_64b;
+    args[2] = core_bitmap;
+    p[0].data = args;
+    p[0].len = sizeof(args);
+    p[1].data = &value;
+    p[1].len = sizeof(value);
+    kbp_xpt_trace_emit(t, KBP_XPT_TRACE_WRITE_UDA, status, start, p, 2);
+    return status;
+}
+
+static kbp_status kbp_xpt_trace_read_uda(void *handle, uint32_t address_32, uint8_t is_uda_64b, uint64_t *value,
+                                         uint32_t core_bitmap)
+{
+    struct kbp_xpt_trace *t = handle;
+    struct kbp_xpt_trace_piece p[2];
+    uint32_t args[3];
+    uint64_t start = kbp_xpt_trace_begin(t, KBP_XPT_TRACE_READ_UDA);
+    kbp_status status;
+
+    status = t->inner->op_read_uda(t->inner->handle, address_32, is_uda_64b, value, core_bitmap);
+    args[0] = address_32;
+    args[1] = is_uda_64b;
+    args[2] = core_bitmap;
+    p[0].data = args;
+    p[0].len = sizeof(args);
+    p[1].data = value;
+    p[1].len = sizeof(*value);
+    kbp_xpt_trace_emit(t, KBP_XPT_TRACE_READ_UDA, status, start, p, 2);
+    return status;
+}
+
+static kbp_status kbp_xpt_trace_command(void *handle, uint32_t opcode, uint32_t nbytes, uint8_t *bytes,
+                                        uint32_t core_bitmap)
+{
+    struct kbp_xpt_trace *t = handle;
+    struct kbp_xpt_trace_piece p[3];
+    uint32_t args[3];
+    uint8_t *in = NULL;
+    uint64_t start;
+    kbp_status status;
+
+    /* The buffer is in and out, keep a copy of what was sent */
+    if (nbytes && t->fp) {
+        in = kbp_sysmalloc(nbytes);
+        if (in)
+            kbp_memcpy(in, bytes, nbytes);
+    }
+
+    start = kbp_xpt_trace_begin(t, KBP_XPT_TRACE_COMMAND);
+    status = t->inner->op_kbp_command(t->inner->handle, opcode, nbytes, bytes, core_bitmap);
+    if (nbytes && t->fp && !in) {
+        pthread_mutex_lock(&t->lock);
+        t->stats.num_write_errors++;
+        pthread_mutex_unlock(&t->lock);
+        return status;
+    }
+
+    args[0] = opcode;
+    args[1] = nbytes;
+    args[2] = core_bitmap;
+    p[0].data = args;
+    p[0].len = sizeof(args);
+    p[1].data = in;
+    p[1].len = nbytes;
+    p[2].data = bytes;
+    p[2].len = nbytes;
+    kbp_xpt_trace_emit(t, KBP_XPT_TRACE_COMMAND, status, start, p, 3);
+    kbp_sysfree(in);
+    return status;
+}
+
+static int32_t kbp_xpt_trace_mdio_read(void *handle, int32_t chip_no, uint8_t dev, uint16_t reg, uint16_t *value)
+{
+    struct kbp_xpt_trace *t = handle;
+
+    return t->inner->mdio_read(t->inner->handle, chip_no, dev, reg, value);
+}
+
+static int32_t kbp_xpt_trace_mdio_write(void *handle, int32_t chip_no, uint8_t dev, uint16_t reg, uint16_t value)
+{
+    struct kbp_xpt_trace *t = handle;
+
+    return t->inner->mdio_write(t->inner->handle, chip_no, dev, reg, value);
+}
+
+static int32_t kbp_xpt_trace_ext_mdio_read(void *handle, int32_t chip_no, uint8_t dev, uint16_t reg, uint16_t *value)
+{
+    struct kbp_xpt_trace *t = handle;
+
+    return t->inner->ext_mdio_read(t->inner->handle, chip_no, dev, reg, value);
+}
+
+static int32_t kbp_xpt_trace_ext_mdio_write(void *handle, int32_t chip_no, uint8_t dev, uint16_t reg, uint16_t value)
+{
+    struct kbp_xpt_trace *t = handle;
+
+    return t->inner->ext_mdio_write(t->inner->handle, chip_no, dev, reg, value);
+}
+
+static kbp_status kbp_xpt_trace_search(void *handle, uint32_t ltr, uint32_t ctx, const uint8_t *key,
+                                       uint32_t key_len, struct kbp_search_result *result)
+{
+    struct kbp_xpt_trace *t = handle;
+    struct kbp_xpt_trace_piece p[3];
+    uint32_t args[3];
+    uint64_t start = kbp_xpt_trace_begin(t, KBP_XPT_TRACE_SEARCH);
+    kbp_status status;
+
+    status = t->inner->op_search(t->inner->search_handle, ltr, ctx, key, key_len, result);
+    args[0] = ltr;
+    args[1] = ctx;
+    args[2] = key_len;
+    p[0].data = args;
+    p[0].len = sizeof(args);
+    p[1].data = key;
+    p[1].len = key_len;
+    p[2].data = result;
+    p[2].len = sizeof(*result);
+    kbp_xpt_trace_emit(t, KBP_XPT_TRACE_SEARCH, status, start, p, 3);
+    return status;
+}
+
+static kbp_status kbp_xpt_trace_sw_reset(uint32_t device_type, void *handle, uint32_t reset_type)
+{
+    struct kbp_xpt_trace *t = handle;
+    struct kbp_xpt_trace_piece p[1];
+    uint32_t args[2];
+    uint64_t start = kbp_xpt_trace_begin(t, KBP_XPT_TRACE_SW_RESET);
+    kbp_status status;
+
+    status = t->inner->sw_reset(device_type, t->inner->handle, reset_type);
+    args[0] = device_type;
+    args[1] = reset_type;
+    p[0].data = args;
+    p[0].len = sizeof(args);
+    kbp_xpt_trace_emit(t, KBP_XPT_TRACE_SW_RESET, status, start, p, 1);
+    return status;
+}
+
+static kbp_status kbp_xpt_trace_op2_search(void *handle,
+                                           uint32_t port_id0, int32_t ltr0, uint32_t ctx0, const uint8_t *key0,
+                                           uint32_t key_len0, struct kbp_search_result *result0,
+                                           uint32_t port_id1, int32_t ltr1, uint32_t ctx1, const uint8_t *key1,
+                                           uint32_t key_len1, struct kbp_search_result *result1)
+{
+    struct kbp_xpt_trace *t = handle;
+    struct kbp_xpt_trace_piece p[5];
+    uint32_t args[8];
+    uint64_t start = kbp_xpt_trace_begin(t, KBP_XPT_TRACE_OP2_SEARCH);
+    kbp_status status;
+
+    status = t->inner2->op2_search(t->inner->search_handle, port_id0, ltr0, ctx0, key0, key_len0, result0,
+                                   port_id1, ltr1, ctx1, key1, key_len1, result1);
+    args[0] = port_id0;
+    args[1] = ltr0;
+    args[2] = ctx0;
+    args[3] = key_len0;
+    args[4] = port_id1;
+    args[5] = ltr1;
+    args[6] = ctx1;
+    args[7] = key1 ? key_len1 : KBP_XPT_TRACE_NO_KEY;
+    p[0].data = args;
+    p[0].len = sizeof(args);
+    p[1].data = key0;
+    p[1].len = key_len0;
+    p[2].data = result0;
+    p[2].len = sizeof(*result0);
+    p[3].data = key1;
+    p[3].len = key1 ? key_len1 : 0;
+    p[4].data = result1;
+    p[4].len = key1 && result1 ? sizeof(*result1) : 0;
+    kbp_xpt_trace_emit(t, KBP_XPT_TRACE_OP2_SEARCH, status, start, p, 5);
+    return status;
+}
+
+static kbp_status kbp_xpt_trace_stats_process(void *handle, uint8_t *records, uint32_t num_bytes, uint8_t pipe_id,
+                                              uint8_t port_id)
+{
+    struct kbp_xpt_trace *t = handle;
+    struct kbp_xpt_trace_piece p[2];
+    uint32_t args[3];
+    uint64_t start = kbp_xpt_trace_begin(t, KBP_XPT_TRACE_STATS_PROCESS);
+    kbp_status status;
+
+    status = t->inner2->op2_stats_process(t->inner->handle, records, num_bytes, pipe_id, port_id);
+    args[0] = num_bytes;
+    args[1] = pipe_id;
+    args[2] = port_id;
+    p[0].data = args;
+    p[0].len = sizeof(args);
+    p[1].data = records;
+    p[1].len = num_bytes;
+    kbp_xpt_trace_emit(t, KBP_XPT_TRACE_STATS_PROCESS, status, start, p, 2);
+    return status;
+}
+
+static kbp_status kbp_xpt_trace_stats_write(void *handle, uint32_t address_64, uint8_t *value, uint32_t core_bitmap)
+{
+    struct kbp_xpt_trace *t = handle;
+    struct kbp_xpt_trace_piece p[2];
+    uint32_t args[2];
+    uint64_t start = kbp_xpt_trace_begin(t, KBP_XPT_TRACE_STATS_WRITE);
+    kbp_status status;
+
+    status = t->inner2->op2_stats_write(t->inner->handle, address_64, value, core_bitmap);
+    args[0] = address_64;
+    args[1] = core_bitmap;
+    p[0].data = args;
+    p[0].len = sizeof(args);
+    p[1].data = value;
+    p[1].len = KBP_XPT_TRACE_STATS_BYTES;
+    kbp_xpt_trace_emit(t, KBP_XPT_TRACE_STATS_WRITE, status, start, p, 2);
+    return status;
+}
+
+static kbp_status kbp_xpt_trace_stats_read(void *handle, uint32_t address_64, uint8_t *value, uint32_t core_id)
+{
+    struct kbp_xpt_trace *t = handle;
+    struct kbp_xpt_trace_piece p[2];
+    uint32_t args[2];
+    uint64_t start = kbp_xpt_trace_begin(t, KBP_XPT_TRACE_STATS_READ);
+    kbp_status status;
+
+    status = t->inner2->op2_stats_read(t->inner->handle, address_64, value, core_id);
+    args[0] = address_64;
+    args[1] = core_id;
+    p[0].data = args;
+    p[0].len = sizeof(args);
+    p[1].data = value;
+    p[1].len = KBP_XPT_TRACE_STATS_BYTES;
+    kbp_xpt_trace_emit(t, KBP_XPT_TRACE_STATS_READ, status, start, p, 2);
+    return status;
+}
+
+static kbp_status kbp_xpt_trace_scrub(void *handle, int32_t ch_num, uint64_t *buffer, uint32_t buffer_size,
+                                      uint32_t *num_scrubbed_64b_words)
+{
+    struct kbp_xpt_trace *t = handle;
+    struct kbp_xpt_trace_piece p[2];
+    uint32_t args[3];
+    uint64_t start = kbp_xpt_trace_begin(t, KBP_XPT_TRACE_SCRUB);
+    kbp_status status;
+
+    status = t->inner2->op2_scrub_dma_buffer(t->inner->handle, ch_num, buffer, buffer_size, num_scrubbed_64b_words);
+
+    /* Counter maintenance polls all the time, empty successful polls would swamp the trace */
+    if (status == KBP_OK && num_scrubbed_64b_words && *num_scrubbed_64b_words == 0) {
+        KBP_PROBE5(xpt_complete, t, KBP_XPT_TRACE_SCRUB, status, kbp_xpt_trace_now_ns() - start, 0);
+        return status;
+    }
+
+    args[0] = ch_num;
+    args[1] = buffer_size;
+    args[2] = (status == KBP_OK && num_scrubbed_64b_words) ? *num_scrubbed_64b_words : 0;
+    p[0].data = args;
+    p[0].len = sizeof(args);
+    p[1].data = buffer;
+    p[1].len = args[2] * sizeof(uint64_t);
+    kbp_xpt_trace_emit(t, KBP_XPT_TRACE_SCRUB, status, start, p, 2);
+    return status;
+}
+
+static kbp_status kbp_xpt_trace_mutex_lock(void *handle)
+{
+    struct kbp_xpt_trace *t = handle;
+
+    return t->inner2->op2_mutex_lock(t->inner->handle);
+}
+
+static kbp_status kbp_xpt_trace_mutex_unlock(void *handle)
+{
+    struct kbp_xpt_trace *t = handle;
+
+    return t->inner2->op2_mutex_unlock(t->inner->handle);
+}
+
+static struct kbp_xpt_trace *kbp_xpt_trace_alloc(void *xpt)
+{
+    struct kbp_xpt_trace *t;
+    struct op_xpt *inner = xpt;
+    struct op_xpt *w;
+
+    t = kbp_syscalloc(1, sizeof(*t));
+    if (!t)
+        return NULL;
+
+    t->inner = inner;
+    if (inner->device_type == KBP_DEVICE_OP2) {
+        t->inner2 = xpt;
+        kbp_memcpy(&t->xpt, xpt, sizeof(t->xpt));
+    } else {
+        kbp_memcpy(&t->xpt.op_xpt_info, xpt, sizeof(t->xpt.op_xpt_info));
+    }
+    pthread_mutex_init(&t->lock, NULL);
+    t->start_ns = kbp_xpt_trace_now_ns();
+
+    /* Only interpose what the inner transport implements, NULL stays NULL */
+    w = &t->xpt.op_xpt_info;
+    w->handle = t;
+    w->search_handle = t;
+    if (inner->op_write_reg)
+        w->op_write_reg = kbp_xpt_trace_write_reg;
+    if (inner->op_read_reg)
+        w->op_read_reg = kbp_xpt_trace_read_reg;
+    if (inner->op_write_dba_entry)
+        w->op_write_dba_entry = kbp_xpt_trace_write_dba;
+    if (inner->op_read_dba_entry)
+        w->op_read_dba_entry = kbp_xpt_trace_read_dba;
+    if (inner->op_write_uda)
+        w->op_write_uda = kbp_xpt_trace_write_uda;
+    if (inner->op_read_uda)
+        w->op_read_uda = kbp_xpt_trace_read_uda;
+    if (inner->op_kbp_command)
+        w->op_kbp_command = kbp_xpt_trace_command;
+    if (inner->mdio_read)
+        w->mdio_read = kbp_xpt_trace_mdio_read;
+    if (inner->mdio_write)
+        w->mdio_write = kbp_xpt_trace_mdio_write;
+    if (inner->op_search)
+        w->op_search = kbp_xpt_trace_search;
+    if (inner->sw_reset)
+        w->sw_reset = kbp_xpt_trace_sw_reset;
+    if (inner->ext_mdio_read)
+        w->ext_mdio_read = kbp_xpt_trace_ext_mdio_read;
+    if (inner->ext_mdio_write)
+        w->ext_mdio_write = kbp_xpt_trace_ext_mdio_write;
+
+    if (t->inner2) {
+        if (t->inner2->op2_search)
+            t->xpt.op2_search = kbp_xpt_trace_op2_search;
+        if (t->inner2->op2_stats_process)
+            t->xpt.op2_stats_process = kbp_xpt_trace_stats_process;
+        if (t->inner2->op2_stats_write)
+            t->xpt.op2_stats_write = kbp_xpt_trace_stats_write;
+        if (t->inner2->op2_stats_read)
+            t->xpt.op2_stats_read = kbp_xpt_trace_stats_read;
+        if (t->inner2->op2_scrub_dma_buffer)
+            t->xpt.op2_scrub_dma_buffer = kbp_xpt_trace_scrub;
+        if (t->inner2->op2_mutex_lock)
+            t->xpt.op2_mutex_lock = kbp_xpt_trace_mutex_lock;
+        if (t->inner2->op2_mutex_unlock)
+            t->xpt.op2_mutex_unlock = kbp_xpt_trace_mutex_unlock;
+    }
+
+    return t;
+}
+
+kbp_status kbp_xpt_trace_create(void *xpt, FILE *fp, struct kbp_xpt_trace **trace, void **traced_xpt)
+{
+    struct kbp_xpt_trace_file_header hdr;
+    struct kbp_xpt_trace *t;
+
+    if (!xpt || !fp || !trace || !traced_xpt)
+        return KBP_INVALID_ARGUMENT;
+
+    kbp_memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = KBP_XPT_TRACE_MAGIC;
+    hdr.version = KBP_XPT_TRACE_VERSION;
+    hdr.device_type = ((struct op_xpt *) xpt)->device_type;
+    if (fwrite(&hdr, sizeof(hdr), 1, fp) != 1)
+        return KBP_NV_READ_WRITE_FAILED;
+
+    t = kbp_xpt_trace_alloc(xpt);
+    if (!t)
+        return KBP_OUT_OF_MEMORY;
+    t->fp = fp;
+    t->stats.num_bytes = sizeof(hdr);
+
+    *trace = t;
+    *traced_xpt = &t->xpt;
+    return KBP_OK;
+}
+
+kbp_status kbp_xpt_trace_create_sink(void *xpt, kbp_xpt_trace_sink_fn sink, void *ctx,
+                                     struct kbp_xpt_trace **trace, void **traced_xpt)
+{
+    struct kbp_xpt_trace *t;
+
+    if (!xpt || !sink || !trace || !traced_xpt)
+        return KBP_INVALID_ARGUMENT;
+
+    t = kbp_xpt_trace_alloc(xpt);
+    if (!t)
+        return KBP_OUT_OF_MEMORY;
+    t->sink = sink;
+    t->sink_ctx = ctx;
+
+    *trace = t;
+    *traced_xpt = &t->xpt;
+    return KBP_OK;
+}
+
+kbp_status kbp_xpt_trace_destroy(struct kbp_xpt_trace *trace)
+{
+    kbp_status status = KBP_OK;
+
+    if (!trace)
+        return KBP_INVALID_ARGUMENT;
+
+    if (trace->fp && fflush(trace->fp) != 0)
+        status = KBP_NV_READ_WRITE_FAILED;
+    pthread_mutex_destroy(&trace->lock);
+    kbp_sysfree(trace);
+    return status;
+}
+
+kbp_status kbp_xpt_trace_get_stats(struct kbp_xpt_trace *trace, struct kbp_xpt_trace_stats *stats)
+{
+    if (!trace || !stats)
+        return KBP_INVALID_ARGUMENT;
+
+    pthread_mutex_lock(&trace->lock);
+    kbp_memcpy(stats, &trace->stats, sizeof(*stats));
+    pthread_mutex_unlock(&trace->lock);
+    return KBP_OK;
+}
+
+/*
+ * Replay
+ */
+
+struct kbp_xpt_replay_cursor {
+    uint8_t *pos;
+    uint8_t *end;
+    uint32_t bad;
+};
+
+static uint32_t kbp_xpt_replay_u32(struct kbp_xpt_replay_cursor *c)
+{
+    uint32_t v = 0;
+
+    if (c->end - c->pos < (int) sizeof(v)) {
+        c->bad = 1;
+        return 0;
+    }
+    kbp_memcpy(&v, c->pos, sizeof(v));
+    c->pos += sizeof(v);
+    return v;
+}
+
+static uint8_t *kbp_xpt_replay_bytes(struct kbp_xpt_replay_cursor *c, uint32_t len)
+{
+    uint8_t *p = c->pos;
+
+    if ((uint64_t) (c->end - c->pos) < len) {
+        c->bad = 1;
+        return NULL;
+    }
+    c->pos += len;
+    return p;
+}
+
+/*
+ * Compares the parts of two search results the device defines
+ */
+
+static int32_t kbp_xpt_replay_result_differs(const struct kbp_search_result *a, const uint8_t *recorded)
+{
+    struct kbp_search_result b_copy, *b = &b_copy;
+    uint32_t i;
+
+    /* Recorded results follow variable length keys and may be unaligned */
+    kbp_memcpy(&b_copy, recorded, sizeof(b_copy));
+
+    for (i = 0; i < KBP_INSTRUCTION_MAX_RESULTS; i++) {
+        if (a->result_valid[i] != b->result_valid[i])
+            return 1;
+        if (a->result_valid[i] != KBP_RESULT_IS_VALID)
+            continue;
+        if (a->hit_or_miss[i] != b->hit_or_miss[i])
+            return 1;
+        if (a->hit_or_miss[i] != KBP_HIT)
+            continue;
+        if (a->hit_index[i] != b->hit_index[i]
+            || kbp_memcmp(a->assoc_data[i], b->assoc_data[i], KBP_INSTRUCTION_MAX_AD_BYTES) != 0)
+            return 1;
+    }
+    return 0;
+}
+
+static kbp_status kbp_xpt_replay_one(struct op_xpt *x, struct op2_xpt *x2, const struct kbp_xpt_trace_record *rec,
+                                     struct kbp_xpt_replay_cursor *c, uint32_t verify,
+                                     struct kbp_xpt_replay_stats *st, uint32_t *mismatch)
+{
+    uint32_t a[8];
+    uint8_t *d0, *d1, *d2, *d3;
+    uint8_t out[KBP_XPT_TRACE_REG_BYTES];
+    struct kbp_search_result r0, r1;
+    kbp_status status = KBP_OK;
+    uint32_t i;
+
+    *mismatch = 0;
+
+    switch (rec->op) {
+    case KBP_XPT_TRACE_WRITE_REG:
+        a[0] = kbp_xpt_replay_u32(c);
+        a[1] = kbp_xpt_replay_u32(c);
+        d0 = kbp_xpt_replay_bytes(c, KBP_XPT_TRACE_REG_BYTES);
+        if (c->bad || !x->op_write_reg)
+            break;
+        status = x->op_write_reg(x->handle, a[0], d0, a[1]);
+        st->num_writes++;
+        break;
+
+    case KBP_XPT_TRACE_READ_REG:
+        a[0] = kbp_xpt_replay_u32(c);
+        a[1] = kbp_xpt_replay_u32(c);
+        d0 = kbp_xpt_replay_bytes(c, KBP_XPT_TRACE_REG_BYTES);
+        if (c->bad || !x->op_read_reg)
+            break;
+        status = x->op_read_reg(x->handle, a[0], out, a[1]);
+        st->num_reads++;
+        if (verify && status == KBP_OK && kbp_memcmp(out, d0, KBP_XPT_TRACE_REG_BYTES) != 0)
+            *mismatch = 1;
+        break;
+
+    case KBP_XPT_TRACE_WRITE_DBA:
+        for (i = 0; i < 4; i++)
+            a[i] = kbp_xpt_replay_u32(c);
+        d0 = kbp_xpt_replay_bytes(c, KBP_XPT_TRACE_REG_BYTES);
+        d1 = kbp_xpt_replay_bytes(c, KBP_XPT_TRACE_REG_BYTES);
+        if (c->bad || !x->op_write_dba_entry)
+            break;
+        status = x->op_write_dba_entry(x->handle, a[0], d0, d1, a[1], a[2], a[3]);
+        st->num_writes++;
+        break;
+
+    case KBP_XPT_TRACE_READ_DBA: {
+        uint32_t valid_bit = 0, parity = 0;
+
+        for (i = 0; i < 5; i++)
+            a[i] = kbp_xpt_replay_u32(c);
+        d0 = kbp_xpt_replay_bytes(c, KBP_XPT_TRACE_REG_BYTES);
+        if (c->bad || !x->op_read_dba_entry)
+            break;
+        status = x->op_read_dba_entry(x->handle, a[0], a[1], out, &valid_bit, &parity, a[2]);
+        st->num_reads++;
+        if (verify && status == KBP_OK
+            && (valid_bit != a[3] || parity != a[4] || kbp_memcmp(out, d0, KBP_XPT_TRACE_REG_BYTES) != 0))
+            *mismatch = 1;
+        break;
+    }
+
+    case KBP_XPT_TRACE_WRITE_UDA:
+    case KBP_XPT_TRACE_READ_UDA: {
+        uint64_t value, got = 0;
+
+        for (i = 0; i < 3; i++)
+            a[i] = kbp_xpt_replay_u32(c);
+        d0 = kbp_xpt_replay_bytes(c, sizeof(value));
+        if (c->bad)
+            break;
+        kbp_memcpy(&value, d0, sizeof(value));
+        if (rec->op == KBP_XPT_TRACE_WRITE_UDA) {
+            if (!x->op_write_uda)
+                break;
+            status = x->op_write_uda(x->handle, a[0], a[1], value, a[2]);
+            st->num_writes++;
+        } else {
+            if (!x->op_read_uda)
+                break;
+            status = x->op_read_uda(x->handle, a[0], a[1], &got, a[2]);
+            st->num_reads++;
+            if (verify && status == KBP_OK && got != value)
+                *mismatch = 1;
+        }
+        break;
+    }
+
+    case KBP_XPT_TRACE_COMMAND: {
+        uint8_t *buf;
+
+        for (i = 0; i < 3; i++)
+            a[i] = kbp_xpt_replay_u32(c);
+        d0 = kbp_xpt_replay_bytes(c, a[1]);
+        d1 = kbp_xpt_replay_bytes(c, a[1]);
+        if (c->bad || !x->op_kbp_command)
+            break;
+        /* Commands may write into their buffer, the recorded input must stay intact for verify */
+        buf = kbp_sysmalloc(a[1] ? a[1] : 1);
+        if (!buf)
+            return KBP_OUT_OF_MEMORY;
+        kbp_memcpy(buf, d0, a[1]);
+        status = x->op_kbp_command(x->handle, a[0], a[1], buf, a[2]);
+        st->num_commands++;
+        if (verify && status == KBP_OK && kbp_memcmp(buf, d1, a[1]) != 0)
+            *mismatch = 1;
+        kbp_sysfree(buf);
+        break;
+    }
+
+    case KBP_XPT_TRACE_SEARCH:
+        for (i = 0; i < 3; i++)
+            a[i] = kbp_xpt_replay_u32(c);
+        d0 = kbp_xpt_replay_bytes(c, a[2]);
+        d1 = kbp_xpt_replay_bytes(c, sizeof(r0));
+        if (c->bad || !x->op_search)
+            break;
+        kbp_memset(&r0, 0, sizeof(r0));
+        status = x->op_search(x->search_handle, a[0], a[1], d0, a[2], &r0);
+        st->num_searches++;
+        if (verify && status == KBP_OK
+            && kbp_xpt_replay_result_differs(&r0, d1))
+            *mismatch = 1;
+        break;
+
+    case KBP_XPT_TRACE_OP2_SEARCH: {
+        uint32_t has_key1;
+
+        for (i = 0; i < 8; i++)
+            a[i] = kbp_xpt_replay_u32(c);
+        has_key1 = a[7] != KBP_XPT_TRACE_NO_KEY;
+        d0 = kbp_xpt_replay_bytes(c, a[3]);
+        d1 = kbp_xpt_replay_bytes(c, sizeof(r0));
+        d2 = has_key1 ? kbp_xpt_replay_bytes(c, a[7]) : NULL;
+        /* A second key without a second result leaves nothing to read back */
+        d3 = has_key1 && c->pos < c->end ? kbp_xpt_replay_bytes(c, sizeof(r1)) : NULL;
+        if (c->bad || !x2 || !x2->op2_search)
+            break;
+        kbp_memset(&r0, 0, sizeof(r0));
+        kbp_memset(&r1, 0, sizeof(r1));
+        status = x2->op2_search(x->search_handle, a[0], a[1], a[2], d0, a[3], &r0,
+                                a[4], a[5], a[6], d2, has_key1 ? a[7] : 0, d3 ? &r1 : NULL);
+        st->num_searches++;
+        if (verify && status == KBP_OK
+            && (kbp_xpt_replay_result_differs(&r0, d1)
+                || (d3 && kbp_xpt_replay_result_differs(&r1, d3))))
+            *mismatch = 1;
+        break;
+    }
+
+    case KBP_XPT_TRACE_STATS_PROCESS:
+        for (i = 0; i < 3; i++)
+            a[i] = kbp_xpt_replay_u32(c);
+        d0 = kbp_xpt_replay_bytes(c, a[0]);
+        if (c->bad || !x2 || !x2->op2_stats_process)
+            break;
+        status = x2->op2_stats_process(x->handle, d0, a[0], a[1], a[2]);
+        st->num_commands++;
+        break;
+
+    case KBP_XPT_TRACE_STATS_WRITE:
+        a[0] = kbp_xpt_replay_u32(c);
+        a[1] = kbp_xpt_replay_u32(c);
+        d0 = kbp_xpt_replay_bytes(c, KBP_XPT_TRACE_STATS_BYTES);
+        if (c->bad || !x2 || !x2->op2_stats_write)
+            break;
+        status = x2->op2_stats_write(x->handle, a[0], d0, a[1]);
+        st->num_writes++;
+        break;
+
+    case KBP_XPT_TRACE_STATS_READ:
+        a[0] = kbp_xpt_replay_u32(c);
+        a[1] = kbp_xpt_replay_u32(c);
+        d0 = kbp_xpt_replay_bytes(c, KBP_XPT_TRACE_STATS_BYTES);
+        if (c->bad || !x2 || !x2->op2_stats_read)
+            break;
+        status = x2->op2_stats_read(x->handle, a[0], out, a[1]);
+        st->num_reads++;
+        if (verify && status == KBP_OK && kbp_memcmp(out, d0, KBP_XPT_TRACE_STATS_BYTES) != 0)
+            *mismatch = 1;
+        break;
+
+    case KBP_XPT_TRACE_SCRUB: {
+        uint64_t *buf;
+        uint32_t num = 0;
+
+        for (i = 0; i < 3; i++)
+            a[i] = kbp_xpt_replay_u32(c);
+        kbp_xpt_replay_bytes(c, a[2] * sizeof(uint64_t));
+        if (c->bad || !x2 || !x2->op2_scrub_dma_buffer)
+            break;
+        /* Counter contents depend on traffic, only the call pattern is replayed */
+        buf = kbp_sysmalloc((a[1] ? a[1] : 1) * sizeof(uint64_t));
+        if (!buf)
+            return KBP_OUT_OF_MEMORY;
+        status = x2->op2_scrub_dma_buffer(x->handle, (int32_t) a[0], buf, a[1], &num);
+        st->num_commands++;
+        kbp_sysfree(buf);
+        break;
+    }
+
+    case KBP_XPT_TRACE_SW_RESET:
+        a[0] = kbp_xpt_replay_u32(c);
+        a[1] = kbp_xpt_replay_u32(c);
+        if (c->bad || !x->sw_reset)
+            break;
+        status = x->sw_reset(a[0], x->handle, a[1]);
+        st->num_commands++;
+        break;
+
+    default:
+        c->bad = 1;
+        break;
+    }
+
+    if (c->bad)
+        return KBP_NV_DATA_CORRUPT;
+    if (*mismatch)
+        st->num_mismatches++;
+    if (status != (kbp_status) rec->status) {
+        st->num_status_diffs++;
+        *mismatch = 1;
+    }
+    return KBP_OK;
+}
+
+kbp_status kbp_xpt_replay(FILE *fp, void *xpt, uint32_t flags, struct kbp_xpt_replay_stats *stats)
+{
+    struct kbp_xpt_trace_file_header hdr;
+    struct kbp_xpt_replay_stats st;
+    struct op_xpt *x = xpt;
+    struct op2_xpt *x2;
+    uint8_t *payload = NULL;
+    uint32_t payload_max = 0;
+    uint64_t start_ns;
+    kbp_status status = KBP_OK;
+
+    if (!fp || !xpt)
+        return KBP_INVALID_ARGUMENT;
+
+    if (fread(&hdr, sizeof(hdr), 1, fp) != 1 || hdr.magic != KBP_XPT_TRACE_MAGIC
+        || hdr.version != KBP_XPT_TRACE_VERSION)
+        return KBP_NV_DATA_CORRUPT;
+    if (hdr.device_type != x->device_type)
+        return KBP_INVALID_ARGUMENT;
+    x2 = x->device_type == KBP_DEVICE_OP2 ? xpt : NULL;
+
+    kbp_memset(&st, 0, sizeof(st));
+    start_ns = kbp_xpt_trace_now_ns();
+
+    for (;;) {
+        struct kbp_xpt_trace_record rec;
+        struct kbp_xpt_replay_cursor c;
+        uint32_t mismatch;
+
+        if (fread(&rec, sizeof(rec), 1, fp) != 1)
+            break;
+        if (rec.len > KBP_XPT_TRACE_MAX_PAYLOAD) {
+            status = KBP_NV_DATA_CORRUPT;
+            break;
+        }
+        if (rec.len > payload_max) {
+            kbp_sysfree(payload);
+            payload = kbp_sysmalloc(rec.len);
+            if (!payload) {
+                payload_max = 0;
+                status = KBP_OUT_OF_MEMORY;
+                break;
+            }
+            payload_max = rec.len;
+        }
+        if (rec.len && fread(payload, rec.len, 1, fp) != 1) {
+            status = KBP_NV_DATA_CORRUPT;
+            break;
+        }
+
+        c.pos = payload;
+        c.end = payload + rec.len;
+        c.bad = 0;
+        status = kbp_xpt_replay_one(x, x2, &rec, &c, flags & KBP_XPT_REPLAY_VERIFY, &st, &mismatch);
+        if (status != KBP_OK)
+            break;
+        st.num_records++;
+        st.recorded_ns += rec.duration_ns;
+
+        if (mismatch && (flags & KBP_XPT_REPLAY_STOP_ON_MISMATCH)) {
+            status = KBP_INTERNAL_ERROR;
+            break;
+        }
+    }
+
+    st.replay_ns = kbp_xpt_trace_now_ns() - start_ns;
+    kbp_sysfree(payload);
+    if (stats)
+        kbp_memcpy(stats, &st, sizeof(st));
+    return status;
+}
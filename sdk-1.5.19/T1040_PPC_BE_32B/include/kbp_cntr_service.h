@@ -0,0 +1,184 @@
+/*
+ * $Id$
+ *
+ * This license is set out in https://raw.githubusercontent.com/Broadcom/Broadcom-Compute-Connectivity-Software-KBP-SDK/master/Legal/LICENSE file.
+ *
+ * $Copyright: (c) 2023 Broadcom Inc.
+ * All Rights Reserved.$
+ *
+ */
+
+#ifndef __KBP_CNTR_SERVICE_H
+#define __KBP_CNTR_SERVICE_H
+
+#include <stdint.h>
+
+#include "errors.h"
+#include "device.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @file kbp_cntr_service.h
+ *
+ * Background counter maintenance.
+ *
+ * The service runs a thread that drains the counter DMA channels on a timer,
+ * or right away when kbp_cntr_service_kick() is called from an interrupt
+ * handler. kbp_device_scrub_tap_dma_buffer() is always drained. Other
+ * channels, such as a ::kbp_op2_evict reader or an age scan consumer, are
+ * added with kbp_cntr_service_add_channel().
+ *
+ * Each drain reports how many 64b words it took out of its ring. This gives
+ * the ring fill at drain time, which is tracked as a watermark. When a drain
+ * finds a ring filled past the high watermark, the drain rate is falling
+ * behind the fill rate. The service then warns and halves its interval. When
+ * every ring stays below half the high watermark, the interval doubles back
+ * toward the maximum.
+ *
+ * The TAP scrub is channel 0 and has no fill measure: the SDK does not say
+ * how much kbp_device_scrub_tap_dma_buffer() took out of the TAP DMA buffer,
+ * so the channel always reports zero words and a zero fill. It is drained on
+ * every interval but never shortens it, and its statistics only count drains
+ * and errors. With TAP counters and no other channel, the interval climbs to
+ * max_interval_us; set max_interval_us to the longest period the TAP DMA
+ * buffer can go without a scrub.
+ *
+ * @addtogroup STATS_API
+ * @{
+ */
+
+/**
+ * Maximum number of channels per service, including the TAP scrub
+ */
+#define KBP_CNTR_SERVICE_MAX_CHANNELS (8)
+
+/**
+ * Opaque counter maintenance service handle
+ */
+
+struct kbp_cntr_service;
+
+/**
+ * Channel drain callback.
+ *
+ * @param ctx Context passed to kbp_cntr_service_add_channel().
+ * @param num_words Number of 64b words drained, zero if unknown.
+ *
+ * @return KBP_OK on success or an error code otherwise.
+ */
+
+typedef kbp_status (*kbp_cntr_drain_fn) (void *ctx, uint32_t *num_words);
+
+/**
+ * Warning callback, invoked from the service thread when a ring is found
+ * filled past the high watermark.
+ *
+ * @param ctx Context from ::kbp_cntr_service_config.
+ * @param channel Name of the channel.
+ * @param fill_pct Ring fill at drain time in percent.
+ * @param interval_us Drain interval the service switches to.
+ */
+
+typedef void (*kbp_cntr_warn_fn) (void *ctx, const char *channel, uint32_t fill_pct, uint32_t interval_us);
+
+/**
+ * Counter maintenance service configuration
+ */
+
+struct kbp_cntr_service_config {
+    uint32_t min_interval_us;   /**< Shortest drain interval. Zero picks 1000 */
+    uint32_t max_interval_us;   /**< Longest drain interval. Zero picks 100000 */
+    uint32_t high_watermark_pct; /**< Ring fill that triggers a warning. Zero picks 50 */
+    kbp_cntr_warn_fn warn;      /**< Warning callback, NULL prints through kbp_printf() */
+    void *warn_ctx;             /**< Passed back to warn */
+};
+
+/**
+ * Per channel statistics
+ */
+
+struct kbp_cntr_channel_stats {
+    const char *name;           /**< Channel name */
+    uint64_t num_drains;        /**< Drain calls */
+    uint64_t words_drained;     /**< 64b words drained */
+    uint64_t num_errors;        /**< Drain calls that failed */
+    uint64_t num_warnings;      /**< Drains that found the ring past the high watermark */
+    uint32_t last_fill_pct;     /**< Ring fill at the last drain */
+    uint32_t max_fill_pct;      /**< Highest ring fill seen */
+    uint32_t interval_us;       /**< Current drain interval of the service */
+};
+
+/**
+ * Starts the counter maintenance service.
+ *
+ * @param device Valid device handle.
+ * @param config Drain cadence and warning policy, NULL for the defaults.
+ * @param svc Service handle, initialized and returned on success.
+ *
+ * @return KBP_OK on success or an error code otherwise.
+ */
+
+kbp_status kbp_cntr_service_start(struct kbp_device *device, const struct kbp_cntr_service_config *config,
+                                  struct kbp_cntr_service **svc);
+
+/**
+ * Drains every channel one last time, then stops the service.
+ *
+ * @param svc Valid service handle.
+ *
+ * @return KBP_OK on success or an error code otherwise.
+ */
+
+kbp_status kbp_cntr_service_stop(struct kbp_cntr_service *svc);
+
+/**
+ * Adds a channel to drain.
+ *
+ * @param svc Valid service handle.
+ * @param name Channel name used in statistics and warnings.
+ * @param drain Drain callback.
+ * @param ctx Passed back to drain.
+ * @param ring_words Ring size in 64b words, for example KBP_OP2_TX_DMA_BUFFER_SIZE_COUNTER_EVICTION.
+ * @param channel_id Channel identifier returned on success.
+ *
+ * @return KBP_OK on success or an error code otherwise.
+ */
+
+kbp_status kbp_cntr_service_add_channel(struct kbp_cntr_service *svc, const char *name, kbp_cntr_drain_fn drain,
+                                        void *ctx, uint32_t ring_words, uint32_t *channel_id);
+
+/**
+ * Wakes the service thread to drain now, for example from the thread that
+ * handles the DMA interrupt. Not async signal safe.
+ *
+ * @param svc Valid service handle.
+ *
+ * @return KBP_OK on success or an error code otherwise.
+ */
+
+kbp_status kbp_cntr_service_kick(struct kbp_cntr_service *svc);
+
+/**
+ * Returns the statistics of a channel. Channel 0 is the TAP scrub.
+ *
+ * @param svc Valid service handle.
+ * @param channel_id Channel identifier.
+ * @param stats Valid pointer populated on return.
+ *
+ * @return KBP_OK on success or an error code otherwise.
+ */
+
+kbp_status kbp_cntr_service_get_stats(struct kbp_cntr_service *svc, uint32_t channel_id,
+                                      struct kbp_cntr_channel_stats *stats);
+
+/**
+ * @}
+ */
+
+#ifdef __cplusplus
+}
+#endif
+#endif                          /* __KBP_CNTR_SERVICE_H */
@@ -0,0 +1,210 @@
+/*
+ * $Id$
+ *
+ * This license is set out in https://raw.githubusercontent.com/Broadcom/Broadcom-Compute-Connectivity-Software-KBP-SDK/master/Legal/LICENSE file.
+ *
+ * $Copyright: (c) 2023 Broadcom Inc.
+ * All Rights Reserved.$
+ *
+ */
+
+#ifndef __KBP_CR_JOURNAL_H
+#define __KBP_CR_JOURNAL_H
+
+#include <stdint.h>
+
+#include "errors.h"
+#include "device.h"
+#include "db.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @file kbp_cr_journal.h
+ *
+ * Journaled nonvolatile memory for crash recovery.
+ *
+ * With KBP_DEVICE_PROP_CRASH_RECOVERY the SDK persists every entry change
+ * with a small write through the NV callbacks. When kbp_cr_journal_read() and
+ * kbp_cr_journal_write() are registered instead, the SDK writes land in
+ * a memory copy of the NV region, and the byte ranges they touch are
+ * collected. At the end of a transaction (kbp_cr_journal_commit(), or one of the
+ * wrappers below) the ranges are appended to a sequential log on the real NV
+ * memory with a single write that ends in a CRC protected commit record.
+ * Writes made outside a transaction are committed individually.
+ *
+ * The log is compacted into the slot area when it fills up, when
+ * kbp_cr_journal_compact() is called, or periodically by a background thread.
+ * kbp_cr_journal_create() replays every complete record over the slot area,
+ * so after a crash the SDK sees the NV state as of the last committed
+ * transaction. A transaction whose record was torn by the crash is dropped
+ * entirely, as if the crash happened before it started.
+ *
+ * The NV region passed to the callbacks must hold 4K + nv_size + log_size bytes.
+ * log_size bounds the largest atomic transaction. A transaction whose record
+ * does not fit in the log is written with a full checkpoint instead: the log
+ * is compacted, then the pages the transaction touched are written straight
+ * to the slot area. NV stays in step with the SDK, but a crash during the
+ * checkpoint can leave that one transaction partially applied. Such
+ * checkpoints are counted in kbp_cr_journal_stats::num_checkpoints; size the
+ * log so that they do not happen in normal operation.
+ *
+ * @addtogroup CRASH_RECOVERY_API
+ * @{
+ */
+
+/**
+ * Opaque crash recovery journal handle
+ */
+
+struct kbp_cr_journal;
+
+/**
+ * Crash recovery journal configuration
+ */
+
+struct kbp_cr_journal_config {
+    uint32_t nv_size;           /**< Size of the NV region presented to the SDK */
+    uint32_t log_size;          /**< Bytes reserved for the journal */
+    uint32_t compact_interval_us; /**< Background compaction period, zero to compact only on demand or when the log is full */
+};
+
+/**
+ * Crash recovery journal statistics
+ */
+
+struct kbp_cr_journal_stats {
+    uint64_t num_sdk_writes;    /**< Write callbacks issued by the SDK */
+    uint64_t num_commits;       /**< Journal records written */
+    uint64_t bytes_logged;      /**< Journal bytes written, including record headers */
+    uint64_t num_compactions;   /**< Compactions of the log into the slot area */
+    uint64_t bytes_compacted;   /**< Slot area bytes written by compaction */
+    uint32_t num_replayed;      /**< Records replayed by kbp_cr_journal_create() */
+    uint32_t num_checkpoints;   /**< Transactions too large for the log, written by a full checkpoint */
+};
+
+/**
+ * Creates the journal. The slot area is read into memory and every complete
+ * record in the log is replayed over it.
+ *
+ * @param config Region sizes and compaction policy.
+ * @param read_fn Callback to read data from nonvolatile memory.
+ * @param write_fn Callback to write data to nonvolatile memory.
+ * @param handle User handle passed back through read_fn and write_fn.
+ * @param journal Journal handle, initialized and returned on success.
+ *
+ * @return KBP_OK on success or an error code otherwise.
+ */
+
+kbp_status kbp_cr_journal_create(const struct kbp_cr_journal_config *config, kbp_device_issu_read_fn read_fn,
+                                 kbp_device_issu_write_fn write_fn, void *handle, struct kbp_cr_journal **journal);
+
+/**
+ * Compacts the log, stops the background thread and frees the journal.
+ *
+ * @param journal Valid journal handle.
+ *
+ * @return KBP_OK on success or an error code otherwise.
+ */
+
+kbp_status kbp_cr_journal_destroy(struct kbp_cr_journal *journal);
+
+/**
+ * NV read callback to register with KBP_DEVICE_PROP_CRASH_RECOVERY, with the
+ * journal as the handle.
+ */
+
+int32_t kbp_cr_journal_read(void *handle, uint8_t *buffer, uint32_t size, uint32_t offset);
+
+/**
+ * NV write callback to register with KBP_DEVICE_PROP_CRASH_RECOVERY, with the
+ * journal as the handle.
+ */
+
+int32_t kbp_cr_journal_write(void *handle, uint8_t *buffer, uint32_t size, uint32_t offset);
+
+/**
+ * Starts collecting SDK writes into one journal record.
+ *
+ * @param journal Valid journal handle.
+ *
+ * @return KBP_OK on success or an error code otherwise.
+ */
+
+kbp_status kbp_cr_journal_begin(struct kbp_cr_journal *journal);
+
+/**
+ * Writes the collected SDK writes to the log with a single NV write, or with
+ * a full checkpoint if they do not fit in the log.
+ *
+ * @param journal Valid journal handle.
+ *
+ * @return KBP_OK on success or an error code otherwise.
+ */
+
+kbp_status kbp_cr_journal_commit(struct kbp_cr_journal *journal);
+
+/**
+ * kbp_device_start_transaction() followed by kbp_cr_journal_begin().
+ *
+ * @param journal Valid journal handle.
+ * @param device Valid device handle.
+ *
+ * @return KBP_OK on success or an error code otherwise.
+ */
+
+kbp_status kbp_cr_journal_start_transaction(struct kbp_cr_journal *journal, struct kbp_device *device);
+
+/**
+ * kbp_device_end_transaction() followed by kbp_cr_journal_commit().
+ *
+ * @param journal Valid journal handle.
+ * @param device Valid device handle.
+ *
+ * @return KBP_OK on success or an error code otherwise.
+ */
+
+kbp_status kbp_cr_journal_end_transaction(struct kbp_cr_journal *journal, struct kbp_device *device);
+
+/**
+ * kbp_db_install() with all NV writes it makes committed as one journal record.
+ *
+ * @param journal Valid journal handle.
+ * @param db Valid database handle.
+ *
+ * @return KBP_OK on success or an error code otherwise.
+ */
+
+kbp_status kbp_cr_journal_install(struct kbp_cr_journal *journal, struct kbp_db *db);
+
+/**
+ * Applies the committed log to the slot area and empties the log.
+ *
+ * @param journal Valid journal handle.
+ *
+ * @return KBP_OK on success or an error code otherwise.
+ */
+
+kbp_status kbp_cr_journal_compact(struct kbp_cr_journal *journal);
+
+/**
+ * Returns the journal statistics.
+ *
+ * @param journal Valid journal handle.
+ * @param stats Valid pointer populated on return.
+ *
+ * @return KBP_OK on success or an error code otherwise.
+ */
+
+kbp_status kbp_cr_journal_get_stats(struct kbp_cr_journal *journal, struct kbp_cr_journal_stats *stats);
+
+/**
+ * @}
+ */
+
+#ifdef __cplusplus
+}
+#endif
+#endif                          /* __KBP_CR_JOURNAL_H */
@@ -31,6 +31,12 @@ extern "C" {
  * are expected to implement the functions below on any other propriety
  * Operating Systems
  *
+ * The Linux implementation in portability/kbp_portable.c is not self-contained:
+ * the print functions route through the asynchronous log in portability/kbp_log.c,
+ * and kbp_assert_detail() records into the flight recorder in portability/kbp_flight.c.
+ * Anyone building kbp_portable.c from source must compile and link those two files
+ * with it.
+ *
  * @addtogroup PORTABILITY_API
  * @{
  */
@@ -0,0 +1,120 @@
+/*
+ * $Id$
+ *
+ * This license is set out in https://raw.githubusercontent.com/Broadcom/Broadcom-Compute-Connectivity-Software-KBP-SDK/master/Legal/LICENSE file.
+ *
+ * $Copyright: (c) 2023 Broadcom Inc.
+ * All Rights Reserved.$
+ *
+ */
+
+#ifndef __KBP_RECONCILE_H
+#define __KBP_RECONCILE_H
+
+#include <stdint.h>
+
+#include "errors.h"
+#include "device.h"
+#include "db.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @file kbp_reconcile.h
+ *
+ * Bulk post ISSU reconciliation.
+ *
+ * An alternative to the kbp_device_reconcile_start(), kbp_entry_set_used()
+ * and kbp_device_reconcile_end() sequence for databases with many entries.
+ * kbp_reconcile_start() takes a snapshot of the entry handles of each database
+ * and keeps the reconcile state as one bit per entry. kbp_reconcile_mark()
+ * marks entries in bulk. kbp_reconcile_end() scans the bitmaps on a pool of
+ * threads, then deletes the unmarked entries of each database with a single
+ * kbp_db_install() per database.
+ *
+ * The databases must not be modified between kbp_reconcile_start() and
+ * kbp_reconcile_end().
+ *
+ * @addtogroup ISSU_API
+ * @{
+ */
+
+/**
+ * Opaque reconcile handle
+ */
+
+struct kbp_reconcile;
+
+/**
+ * Reconcile statistics
+ */
+
+struct kbp_reconcile_stats {
+    uint32_t num_dbs;           /**< Databases reconciled */
+    uint32_t num_entries;       /**< Entries present at kbp_reconcile_start() */
+    uint32_t num_marked;        /**< Entries marked as still in use */
+    uint32_t num_deleted;       /**< Entries deleted by kbp_reconcile_end() */
+};
+
+/**
+ * Starts reconciliation of a set of databases.
+ *
+ * @param device Valid device handle.
+ * @param dbs Databases to reconcile, with their post ISSU handles.
+ * @param num_dbs Number of databases.
+ * @param num_threads Threads used to sort the snapshots and scan the bitmaps, zero for one.
+ * @param rec Reconcile handle, initialized and returned on success.
+ *
+ * @return KBP_OK on success or an error code otherwise.
+ */
+
+kbp_status kbp_reconcile_start(struct kbp_device *device, struct kbp_db **dbs, uint32_t num_dbs,
+                               uint32_t num_threads, struct kbp_reconcile **rec);
+
+/**
+ * Marks entries as still in use.
+ *
+ * @param rec Valid reconcile handle.
+ * @param db Database the entries belong to, one of those passed to kbp_reconcile_start().
+ * @param entries Entry handles to keep.
+ * @param num_entries Number of entry handles.
+ *
+ * @return KBP_OK on success, KBP_INVALID_ARGUMENT if an entry is not in the database
+ *         (the other entries are still marked), or an error code otherwise.
+ */
+
+kbp_status kbp_reconcile_mark(struct kbp_reconcile *rec, struct kbp_db *db, struct kbp_entry **entries,
+                              uint32_t num_entries);
+
+/**
+ * Deletes every unmarked entry, installs each database once and frees the
+ * reconcile handle.
+ *
+ * @param rec Valid reconcile handle.
+ * @param stats Populated on return if not NULL.
+ *
+ * @return KBP_OK on success or an error code otherwise.
+ */
+
+kbp_status kbp_reconcile_end(struct kbp_reconcile *rec, struct kbp_reconcile_stats *stats);
+
+/**
+ * Frees the reconcile handle without deleting any entries.
+ *
+ * @param rec Valid reconcile handle.
+ *
+ * @return KBP_OK on success or an error code otherwise.
+ */
+
+kbp_status kbp_reconcile_abort(struct kbp_reconcile *rec);
+
+/**
+ * @}
+ */
+
+#ifdef __cplusplus
+}
+#endif
+#endif                          /* __KBP_RECONCILE_H */
@@ -0,0 +1,177 @@
+/*
+ * $Id$
+ *
+ * This license is set out in https://raw.githubusercontent.com/Broadcom/Broadcom-Compute-Connectivity-Software-KBP-SDK/master/Legal/LICENSE file.
+ *
+ * $Copyright: (c) 2023 Broadcom Inc.
+ * All Rights Reserved.$
+ *
+ */
+
+#ifndef __KBP_SEARCH_CACHE_H
+#define __KBP_SEARCH_CACHE_H
+
+#include <stdint.h>
+
+#include "errors.h"
+#include "db.h"
+#include "ad.h"
+#include "instruction.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @file kbp_search_cache.h
+ *
+ * Functional search result cache.
+ *
+ * Regression tests on the software model spend most of their search time in
+ * the cycle level pipeline simulation, even though they only check results.
+ * Many of them search the same keys again and again between updates. The
+ * cache returns the stored result of a search that was already evaluated
+ * since the last update, without going through the model.
+ * kbp_search_cache_install(), kbp_search_cache_ad_update() and
+ * kbp_search_cache_ad_delete() make the change and invalidate every stored
+ * result in constant time. kbp_search_cache_invalidate() does the same after
+ * any other change that affects search results.
+ *
+ * The cache is a memo of exact (instruction, key, context address) triples,
+ * with these limits:
+ *
+ * - It only saves time on keys that repeat between updates. Tests that
+ *   search each key once see no hits and pay for the lookup.
+ * - It only knows about changes made through it or signalled to it. A
+ *   kbp_ad_db_update_entry(), entry add or delete, or any other change made
+ *   directly returns stale results until kbp_search_cache_invalidate().
+ * - A hit does not reach the device or the model, so hit bits are not set
+ *   and counters are not incremented. Tests of aging, hit bits or
+ *   statistics must not search through the cache.
+ *
+ * It is meant for functional testing of search results, not for traffic.
+ *
+ * @addtogroup INSTRUCTION_API
+ * @{
+ */
+
+/**
+ * Opaque search cache handle
+ */
+
+struct kbp_search_cache;
+
+/**
+ * Search cache statistics
+ */
+
+struct kbp_search_cache_stats {
+    uint64_t num_hits;          /**< Searches answered from the cache */
+    uint64_t num_misses;        /**< Searches sent to kbp_instruction_search() */
+    uint64_t num_invalidations; /**< Invalidations, including those by kbp_search_cache_install() */
+};
+
+/**
+ * Creates a search cache.
+ *
+ * @param num_slots Number of cached results, rounded up to a power of two. Zero picks 65536.
+ * @param cache Cache handle, initialized and returned on success.
+ *
+ * @return KBP_OK on success or an error code otherwise.
+ */
+
+kbp_status kbp_search_cache_create(uint32_t num_slots, struct kbp_search_cache **cache);
+
+/**
+ * Destroys the search cache.
+ *
+ * @param cache Valid cache handle.
+ *
+ * @return KBP_OK on success or an error code otherwise.
+ */
+
+kbp_status kbp_search_cache_destroy(struct kbp_search_cache *cache);
+
+/**
+ * kbp_instruction_search() through the cache.
+ *
+ * @param cache Valid cache handle.
+ * @param instruction Valid instruction handle.
+ * @param master_key The master key.
+ * @param key_len Master key length in bytes, at most KBP_HW_MAX_SEARCH_KEY_WIDTH_8.
+ * @param cb_addrs Address of the context buffer.
+ * @param result The search result.
+ *
+ * @return KBP_OK on success or an error code otherwise.
+ */
+
+kbp_status kbp_search_cache_search(struct kbp_search_cache *cache, struct kbp_instruction *instruction,
+                                   uint8_t *master_key, uint32_t key_len, uint32_t cb_addrs,
+                                   struct kbp_search_result *result);
+
+/**
+ * Drops every cached result.
+ *
+ * @param cache Valid cache handle.
+ *
+ * @return KBP_OK on success or an error code otherwise.
+ */
+
+kbp_status kbp_search_cache_invalidate(struct kbp_search_cache *cache);
+
+/**
+ * kbp_db_install() followed by kbp_search_cache_invalidate().
+ *
+ * @param cache Valid cache handle.
+ * @param db Valid database handle.
+ *
+ * @return KBP_OK on success or an error code otherwise.
+ */
+
+kbp_status kbp_search_cache_install(struct kbp_search_cache *cache, struct kbp_db *db);
+
+/**
+ * kbp_ad_db_update_entry() followed by kbp_search_cache_invalidate().
+ *
+ * @param cache Valid cache handle.
+ * @param db Valid AD database handle.
+ * @param ad Valid AD handle.
+ * @param value The new associated data.
+ *
+ * @return The status of kbp_ad_db_update_entry().
+ */
+
+kbp_status kbp_search_cache_ad_update(struct kbp_search_cache *cache, struct kbp_ad_db *db, struct kbp_ad *ad,
+                                      uint8_t *value);
+
+/**
+ * kbp_ad_db_delete_entry() followed by kbp_search_cache_invalidate().
+ *
+ * @param cache Valid cache handle.
+ * @param db Valid AD database handle.
+ * @param ad Valid AD handle.
+ *
+ * @return The status of kbp_ad_db_delete_entry().
+ */
+
+kbp_status kbp_search_cache_ad_delete(struct kbp_search_cache *cache, struct kbp_ad_db *db, struct kbp_ad *ad);
+
+/**
+ * Returns the cache statistics.
+ *
+ * @param cache Valid cache handle.
+ * @param stats Valid pointer populated on return.
+ *
+ * @return KBP_OK on success or an error code otherwise.
+ */
+
+kbp_status kbp_search_cache_get_stats(struct kbp_search_cache *cache, struct kbp_search_cache_stats *stats);
+
+/**
+ * @}
+ */
+
+#ifdef __cplusplus
+}
+#endif
+#endif                          /* __KBP_SEARCH_CACHE_H */
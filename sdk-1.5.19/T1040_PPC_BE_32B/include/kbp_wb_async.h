@@ -0,0 +1,106 @@
+/*
+ * $Id$
+ *
+ * This license is set out in https://raw.githubusercontent.com/Broadcom/Broadcom-Compute-Connectivity-Software-KBP-SDK/master/Legal/LICENSE file.
+ *
+ * $Copyright: (c) 2023 Broadcom Inc.
+ * All Rights Reserved.$
+ *
+ */
+
+#ifndef __KBP_WB_ASYNC_H
+#define __KBP_WB_ASYNC_H
+
+#include <stdint.h>
+
+#include "errors.h"
+#include "device.h"
+#include "db.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @file kbp_wb_async.h
+ *
+ * Background warmboot restore.
+ *
+ * The device keeps forwarding with its hardware state untouched while
+ * kbp_device_restore_state() rebuilds the software state. This module runs the
+ * restore on a worker thread, so the caller can restore its own state, and
+ * resume anything that does not touch the device, in the meantime.
+ *
+ * Only the caller's wait moves; the restore itself takes as long as a direct
+ * kbp_device_restore_state() call, and no database can be used before it
+ * returns. Refresh database handles with kbp_db_refresh_handle() once
+ * kbp_wb_async_wait() has returned KBP_OK.
+ *
+ * No other API may be called on the device until kbp_wb_async_wait() has
+ * returned KBP_OK.
+ *
+ * @addtogroup ISSU_API
+ * @{
+ */
+
+/**
+ * Opaque background restore handle
+ */
+
+struct kbp_wb_async;
+
+/**
+ * Starts kbp_device_restore_state() on a worker thread and returns
+ * immediately. The callbacks are invoked from the worker thread.
+ *
+ * @param device Valid device handle.
+ * @param read_fn Callback to read data from nonvolatile memory.
+ * @param write_fn Callback to write data to nonvolatile memory.
+ * @param handle User handle passed back through read_fn and write_fn.
+ * @param wb Restore handle, initialized and returned on success.
+ *
+ * @return KBP_OK on success or an error code otherwise.
+ */
+
+kbp_status kbp_wb_async_restore(struct kbp_device *device, kbp_device_issu_read_fn read_fn,
+                                kbp_device_issu_write_fn write_fn, void *handle, struct kbp_wb_async **wb);
+
+/**
+ * Checks whether the restore has finished without blocking.
+ *
+ * @param wb Valid restore handle.
+ * @param done Set to one if the restore has finished, zero otherwise.
+ *
+ * @return KBP_OK on success or an error code otherwise.
+ */
+
+kbp_status kbp_wb_async_poll(struct kbp_wb_async *wb, int32_t *done);
+
+/**
+ * Waits for the restore to finish.
+ *
+ * @param wb Valid restore handle.
+ *
+ * @return The status of kbp_device_restore_state().
+ */
+
+kbp_status kbp_wb_async_wait(struct kbp_wb_async *wb);
+
+/**
+ * Waits for the restore and frees the handle.
+ *
+ * @param wb Valid restore handle.
+ *
+ * @return The status of kbp_device_restore_state().
+ */
+
+kbp_status kbp_wb_async_destroy(struct kbp_wb_async *wb);
+
+/**
+ * @}
+ */
+
+#ifdef __cplusplus
+}
+#endif
+#endif                          /* __KBP_WB_ASYNC_H */
@@ -0,0 +1,167 @@
+/*
+ * $Id$
+ *
+ * This license is set out in https://raw.githubusercontent.com/Broadcom/Broadcom-Compute-Connectivity-Software-KBP-SDK/master/Legal/LICENSE file.
+ *
+ * $Copyright: (c) 2023 Broadcom Inc.
+ * All Rights Reserved.$
+ *
+ */
+
+#ifndef __KBP_WB_COMPRESS_H
+#define __KBP_WB_COMPRESS_H
+
+#include <stdint.h>
+
+#include "errors.h"
+#include "device.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @file kbp_wb_compress.h
+ *
+ * Block compressed warmboot images.
+ *
+ * The image the SDK streams through the ISSU callbacks is cut into fixed
+ * size blocks. Each block is compressed independently with a pluggable
+ * codec and appended to the nonvolatile region, and a block index and
+ * header are written at the end of the save. The header is cleared before
+ * the first block is written and every block carries a CRC, so a save
+ * interrupted by a crash, or a damaged block, fails the restore instead of
+ * restoring wrong data. Because blocks are
+ * independent, any offset of the image can be read by decompressing a single
+ * block, and blocks can be decompressed concurrently. Blocks that do not
+ * shrink are stored as is.
+ *
+ * The SDK side buffering configured with KBP_DEVICE_PROP_WB_BUFF_SIZE is
+ * unchanged, since compression happens below the callbacks.
+ *
+ * @addtogroup ISSU_API
+ * @{
+ */
+
+/**
+ * Compression codec
+ */
+
+struct kbp_wb_codec {
+    uint32_t id;                /**< Stored in the image, must match on restore */
+    const char *name;           /**< Codec name for diagnostics */
+    void *ctx;                  /**< Passed back to the functions below */
+
+    /**
+     * Compresses len bytes from src into dst. Returns the compressed size,
+     * or zero if the output would not fit in dst_cap bytes.
+     */
+    uint32_t (*compress) (void *ctx, const uint8_t *src, uint32_t len, uint8_t *dst, uint32_t dst_cap);
+
+    /**
+     * Decompresses len bytes from src into exactly dst_len bytes at dst.
+     * Returns 0 on success, nonzero if the input is malformed.
+     */
+    int32_t (*decompress) (void *ctx, const uint8_t *src, uint32_t len, uint8_t *dst, uint32_t dst_len);
+};
+
+/**
+ * Built-in byte oriented LZ77 codec tuned for speed
+ */
+
+extern const struct kbp_wb_codec kbp_wb_codec_lz;
+
+/**
+ * Opaque compressed warmboot handle
+ */
+
+struct kbp_wb_compress;
+
+/**
+ * Compressed warmboot configuration
+ */
+
+struct kbp_wb_compress_config {
+    uint32_t block_size;                /**< Uncompressed bytes per block, power of two. Zero picks 64K */
+    uint32_t capacity;                  /**< Largest uncompressed image in bytes */
+    const struct kbp_wb_codec *codec;   /**< Codec, NULL for kbp_wb_codec_lz */
+};
+
+/**
+ * Compressed warmboot statistics for the last save or restore
+ */
+
+struct kbp_wb_compress_stats {
+    uint32_t image_size;        /**< Uncompressed image bytes */
+    uint32_t stored_size;       /**< Bytes used in the nonvolatile region, including index and header */
+    uint32_t num_blocks;        /**< Blocks in the image */
+    uint32_t num_raw_blocks;    /**< Blocks stored uncompressed */
+};
+
+/**
+ * Creates a compressed warmboot handle.
+ *
+ * @param config Block size, capacity and codec.
+ * @param read_fn Callback to read data from nonvolatile memory.
+ * @param write_fn Callback to write data to nonvolatile memory.
+ * @param handle User handle passed back through read_fn and write_fn.
+ * @param wc Compressed warmboot handle, initialized and returned on success.
+ *
+ * @return KBP_OK on success or an error code otherwise.
+ */
+
+kbp_status kbp_wb_compress_create(const struct kbp_wb_compress_config *config, kbp_device_issu_read_fn read_fn,
+                                  kbp_device_issu_write_fn write_fn, void *handle, struct kbp_wb_compress **wc);
+
+/**
+ * Destroys the compressed warmboot handle.
+ *
+ * @param wc Valid compressed warmboot handle.
+ *
+ * @return KBP_OK on success or an error code otherwise.
+ */
+
+kbp_status kbp_wb_compress_destroy(struct kbp_wb_compress *wc);
+
+/**
+ * Saves the device state as a compressed image.
+ *
+ * @param wc Valid compressed warmboot handle.
+ * @param device Valid device handle.
+ * @param and_continue Use kbp_device_save_state_and_continue() instead of kbp_device_save_state().
+ *
+ * @return KBP_OK on success or an error code otherwise.
+ */
+
+kbp_status kbp_wb_compress_save(struct kbp_wb_compress *wc, struct kbp_device *device, int32_t and_continue);
+
+/**
+ * Restores the device state from a compressed image.
+ *
+ * @param wc Valid compressed warmboot handle.
+ * @param device Valid device handle.
+ *
+ * @return KBP_OK on success or an error code otherwise.
+ */
+
+kbp_status kbp_wb_compress_restore(struct kbp_wb_compress *wc, struct kbp_device *device);
+
+/**
+ * Returns the statistics of the last save or restore.
+ *
+ * @param wc Valid compressed warmboot handle.
+ * @param stats Valid pointer populated on return.
+ *
+ * @return KBP_OK on success or an error code otherwise.
+ */
+
+kbp_status kbp_wb_compress_get_stats(struct kbp_wb_compress *wc, struct kbp_wb_compress_stats *stats);
+
+/**
+ * @}
+ */
+
+#ifdef __cplusplus
+}
+#endif
+#endif                          /* __KBP_WB_COMPRESS_H */
@@ -0,0 +1,168 @@
+/*
+ * $Id$
+ *
+ * This license is set out in https://raw.githubusercontent.com/Broadcom/Broadcom-Compute-Connectivity-Software-KBP-SDK/master/Legal/LICENSE file.
+ *
+ * $Copyright: (c) 2023 Broadcom Inc.
+ * All Rights Reserved.$
+ *
+ */
+
+#ifndef __KBP_WB_PARALLEL_H
+#define __KBP_WB_PARALLEL_H
+
+#include <stdint.h>
+
+#include "errors.h"
+#include "device.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @file kbp_wb_parallel.h
+ *
+ * Concurrent nonvolatile I/O for warmboot save and restore.
+ *
+ * The SDK produces and consumes the warmboot image as one ordered stream
+ * through the ISSU callbacks. This layer takes the stream I/O off that path. On
+ * save, writes are coalesced into chunks and handed to a pool of worker
+ * threads that issue them concurrently at their own offsets while the SDK
+ * keeps serializing. On restore, the workers read chunks ahead of the SDK
+ * so that parsing overlaps with the nonvolatile reads.
+ *
+ * The user read/write callbacks must be safe to call concurrently from
+ * several threads for disjoint offsets (for example pread()/pwrite() on a
+ * file descriptor).
+ *
+ * kbp_wb_parallel_read() and kbp_wb_parallel_write() follow the ISSU callback
+ * prototypes with the parallel handle as their handle. They can be passed
+ * directly to the SDK or stacked under another warmboot layer such as
+ * kbp_wb_delta. Write errors are reported by kbp_wb_parallel_sync().
+ *
+ * @addtogroup ISSU_API
+ * @{
+ */
+
+/**
+ * Opaque parallel warmboot I/O handle
+ */
+
+struct kbp_wb_parallel;
+
+/**
+ * Parallel warmboot I/O configuration
+ */
+
+struct kbp_wb_parallel_config {
+    uint32_t num_threads;       /**< Worker threads. Zero picks 4 */
+    uint32_t chunk_size;        /**< Bytes per I/O request, power of two. Zero picks 1M */
+    uint32_t num_chunks;        /**< Chunks in flight, bounds the memory used. Zero picks 2 * num_threads */
+    uint32_t region_size;       /**< Size of the nonvolatile region, limits read-ahead. Zero for unknown */
+};
+
+/**
+ * Parallel warmboot I/O statistics
+ */
+
+struct kbp_wb_parallel_stats {
+    uint64_t bytes_written;     /**< Bytes written through the workers */
+    uint64_t bytes_read_ahead;  /**< Bytes read ahead by the workers */
+    uint64_t read_hits;         /**< Reads served from read-ahead chunks */
+    uint64_t read_misses;       /**< Reads issued directly to the read callback */
+};
+
+/**
+ * Creates the parallel I/O handle and starts the worker threads.
+ *
+ * @param config Configuration, NULL for defaults.
+ * @param read_fn Callback to read data from nonvolatile memory.
+ * @param write_fn Callback to write data to nonvolatile memory.
+ * @param handle User handle passed back through read_fn and write_fn.
+ * @param par Parallel I/O handle, initialized and returned on success.
+ *
+ * @return KBP_OK on success or an error code otherwise.
+ */
+
+kbp_status kbp_wb_parallel_create(const struct kbp_wb_parallel_config *config, kbp_device_issu_read_fn read_fn,
+                                  kbp_device_issu_write_fn write_fn, void *handle, struct kbp_wb_parallel **par);
+
+/**
+ * Waits for outstanding writes, stops the worker threads and frees the handle.
+ *
+ * @param par Valid parallel I/O handle.
+ *
+ * @return KBP_OK on success or an error code otherwise.
+ */
+
+kbp_status kbp_wb_parallel_destroy(struct kbp_wb_parallel *par);
+
+/**
+ * ISSU read callback. Serves the read from the read-ahead chunks, starting
+ * read-ahead at this offset if it is not already covered. Reads past
+ * region_size, when it is set, fail.
+ */
+
+int32_t kbp_wb_parallel_read(void *handle, uint8_t *buffer, uint32_t size, uint32_t offset);
+
+/**
+ * ISSU write callback. Copies the data into a chunk that the workers write out
+ * asynchronously. Returns nonzero only if an earlier write has already failed.
+ */
+
+int32_t kbp_wb_parallel_write(void *handle, uint8_t *buffer, uint32_t size, uint32_t offset);
+
+/**
+ * Waits until every write issued so far has reached the write callback and
+ * drops any read-ahead data.
+ *
+ * @param par Valid parallel I/O handle.
+ *
+ * @return KBP_OK on success, KBP_NV_READ_WRITE_FAILED if any write failed since the last sync.
+ */
+
+kbp_status kbp_wb_parallel_sync(struct kbp_wb_parallel *par);
+
+/**
+ * Saves the device state through the parallel layer and waits for the writes.
+ *
+ * @param par Valid parallel I/O handle.
+ * @param device Valid device handle.
+ * @param and_continue Use kbp_device_save_state_and_continue() instead of kbp_device_save_state().
+ *
+ * @return KBP_OK on success or an error code otherwise.
+ */
+
+kbp_status kbp_wb_parallel_save(struct kbp_wb_parallel *par, struct kbp_device *device, int32_t and_continue);
+
+/**
+ * Restores the device state through the parallel layer with read-ahead.
+ *
+ * @param par Valid parallel I/O handle.
+ * @param device Valid device handle.
+ *
+ * @return KBP_OK on success or an error code otherwise.
+ */
+
+kbp_status kbp_wb_parallel_restore(struct kbp_wb_parallel *par, struct kbp_device *device);
+
+/**
+ * Returns the parallel I/O statistics.
+ *
+ * @param par Valid parallel I/O handle.
+ * @param stats Valid pointer populated on return.
+ *
+ * @return KBP_OK on success or an error code otherwise.
+ */
+
+kbp_status kbp_wb_parallel_get_stats(struct kbp_wb_parallel *par, struct kbp_wb_parallel_stats *stats);
+
+/**
+ * @}
+ */
+
+#ifdef __cplusplus
+}
+#endif
+#endif                          /* __KBP_WB_PARALLEL_H */
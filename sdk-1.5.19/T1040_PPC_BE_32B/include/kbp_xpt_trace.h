@@ -0,0 +1,236 @@
+/*
+ * $Id$
+ *
+ * This license is set out in https://raw.githubusercontent.com/Broadcom/Broadcom-Compute-Connectivity-Software-KBP-SDK/master/Legal/LICENSE file.
+ *
+ * $Copyright: (c) 2023 Broadcom Inc.
+ * All Rights Reserved.$
+ *
+ */
+
+#ifndef __KBP_XPT_TRACE_H
+#define __KBP_XPT_TRACE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "errors.h"
+#include "xpt_op.h"
+#include "xpt_op2.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @file kbp_xpt_trace.h
+ *
+ * Binary transport trace capture and replay.
+ *
+ * The recorder sits between the SDK and a struct op_xpt or struct op2_xpt
+ * transport. Pass the transport returned by kbp_xpt_trace_create() to
+ * kbp_device_init() in place of the real one. Every register, DBA, UDA,
+ * command, search, statistics and DMA scrub call is forwarded unchanged and
+ * written to the trace as a fixed header followed by the call arguments,
+ * the data returned by the transport and the time the call took.
+ *
+ * kbp_xpt_replay() reads a trace back and issues the same calls, in order
+ * and without delays, on another transport: the software model or the PCIe
+ * driver. With ::KBP_XPT_REPLAY_VERIFY it also compares the data returned by
+ * reads and searches with what was recorded, which turns a trace captured in
+ * the field into a standalone reproduction.
+ *
+ * Traces are written in host byte order. The file header records it, and
+ * kbp_xpt_replay() rejects traces from a host of the other byte order.
+ *
+ * @addtogroup DEVICE_API
+ * @{
+ */
+
+/**
+ * Trace file magic, "KBPT"
+ */
+
+#define KBP_XPT_TRACE_MAGIC     (0x5450424B)
+
+/**
+ * Trace file format version
+ */
+
+#define KBP_XPT_TRACE_VERSION   (1)
+
+/**
+ * Transport call recorded in a trace
+ */
+
+enum kbp_xpt_trace_op {
+    KBP_XPT_TRACE_WRITE_REG = 1, /**< op_write_reg */
+    KBP_XPT_TRACE_READ_REG,      /**< op_read_reg */
+    KBP_XPT_TRACE_WRITE_DBA,     /**< op_write_dba_entry */
+    KBP_XPT_TRACE_READ_DBA,      /**< op_read_dba_entry */
+    KBP_XPT_TRACE_WRITE_UDA,     /**< op_write_uda */
+    KBP_XPT_TRACE_READ_UDA,      /**< op_read_uda */
+    KBP_XPT_TRACE_COMMAND,       /**< op_kbp_command, used for bulk operations */
+    KBP_XPT_TRACE_SEARCH,        /**< op_search */
+    KBP_XPT_TRACE_OP2_SEARCH,    /**< op2_search */
+    KBP_XPT_TRACE_STATS_PROCESS, /**< op2_stats_process */
+    KBP_XPT_TRACE_STATS_WRITE,   /**< op2_stats_write */
+    KBP_XPT_TRACE_STATS_READ,    /**< op2_stats_read */
+    KBP_XPT_TRACE_SCRUB,         /**< op2_scrub_dma_buffer */
+    KBP_XPT_TRACE_SW_RESET       /**< sw_reset */
+};
+
+/**
+ * Trace file header, written once at the start of the trace
+ */
+
+struct kbp_xpt_trace_file_header {
+    uint32_t magic;             /**< ::KBP_XPT_TRACE_MAGIC in host byte order */
+    uint32_t version;           /**< ::KBP_XPT_TRACE_VERSION */
+    uint32_t device_type;       /**< Device type of the recorded transport */
+    uint32_t reserved;
+};
+
+/**
+ * Record header. It is followed by len bytes of payload holding the
+ * uint32_t arguments of the call in prototype order, then the buffers it
+ * reads or writes.
+ */
+
+struct kbp_xpt_trace_record {
+    uint16_t op;                /**< ::kbp_xpt_trace_op */
+    uint16_t reserved;
+    int32_t status;             /**< Status returned by the transport */
+    uint32_t len;               /**< Payload length in bytes */
+    uint32_t duration_ns;       /**< Time spent in the transport, saturated */
+    uint64_t timestamp_ns;      /**< Start of the call, relative to the start of the trace */
+};
+
+/**
+ * Opaque trace recorder handle
+ */
+
+struct kbp_xpt_trace;
+
+/**
+ * Trace recorder statistics
+ */
+
+struct kbp_xpt_trace_stats {
+    uint64_t num_records;       /**< Calls recorded */
+    uint64_t num_bytes;         /**< Bytes written to the trace */
+    uint64_t num_write_errors;  /**< Records lost because the trace file could not be written */
+};
+
+/**
+ * Replay flags
+ */
+
+enum kbp_xpt_replay_flags {
+    KBP_XPT_REPLAY_VERIFY = 1,      /**< Compare read data and search results with the trace */
+    KBP_XPT_REPLAY_STOP_ON_MISMATCH = 2 /**< Stop at the first mismatch or status difference */
+};
+
+/**
+ * Replay statistics
+ */
+
+struct kbp_xpt_replay_stats {
+    uint64_t num_records;       /**< Records replayed */
+    uint64_t num_writes;        /**< Register, DBA, UDA and statistics writes */
+    uint64_t num_reads;         /**< Register, DBA, UDA and statistics reads */
+    uint64_t num_commands;      /**< Commands, statistics records and DMA scrubs */
+    uint64_t num_searches;      /**< Searches */
+    uint64_t num_status_diffs;  /**< Calls whose status differs from the recorded one */
+    uint64_t num_mismatches;    /**< Reads and searches that returned different data */
+    uint64_t recorded_ns;       /**< Time the recorded calls took in the traced transport */
+    uint64_t replay_ns;         /**< Wall clock time of the replay */
+};
+
+/**
+ * Creates a trace recorder in front of a transport.
+ *
+ * @param xpt The transport to record, a struct op_xpt or struct op2_xpt.
+ * @param fp File the trace is written to, opened for binary writing. It is not closed by the recorder.
+ * @param trace Recorder handle, initialized and returned on success.
+ * @param traced_xpt Set to the recording transport to use in place of xpt.
+ *
+ * @return KBP_OK on success or an error code otherwise.
+ */
+
+kbp_status kbp_xpt_trace_create(void *xpt, FILE *fp, struct kbp_xpt_trace **trace, void **traced_xpt);
+
+/**
+ * Record callback for kbp_xpt_trace_create_sink(). Called after every
+ * recorded transport call, from the thread that made it, with the header
+ * of the record that would have been written. Transport calls can come
+ * from several threads, so the callback must do its own locking.
+ *
+ * @param ctx Context passed to kbp_xpt_trace_create_sink().
+ * @param record Record header, only valid during the call.
+ */
+
+typedef void (*kbp_xpt_trace_sink_fn) (void *ctx, const struct kbp_xpt_trace_record *record);
+
+/**
+ * Creates a recorder that passes record headers to a callback instead of
+ * writing a trace file. Used to time and count transport traffic in
+ * process.
+ *
+ * @param xpt The transport to record, a struct op_xpt or struct op2_xpt.
+ * @param sink Record callback.
+ * @param ctx Passed back to sink.
+ * @param trace Recorder handle, initialized and returned on success.
+ * @param traced_xpt Set to the recording transport to use in place of xpt.
+ *
+ * @return KBP_OK on success or an error code otherwise.
+ */
+
+kbp_status kbp_xpt_trace_create_sink(void *xpt, kbp_xpt_trace_sink_fn sink, void *ctx,
+                                     struct kbp_xpt_trace **trace, void **traced_xpt);
+
+/**
+ * Flushes the trace and destroys the recorder. The device using the
+ * recording transport must be destroyed first.
+ *
+ * @param trace Valid recorder handle.
+ *
+ * @return KBP_OK on success or an error code otherwise.
+ */
+
+kbp_status kbp_xpt_trace_destroy(struct kbp_xpt_trace *trace);
+
+/**
+ * Returns the recorder statistics.
+ *
+ * @param trace Valid recorder handle.
+ * @param stats Valid pointer populated on return.
+ *
+ * @return KBP_OK on success or an error code otherwise.
+ */
+
+kbp_status kbp_xpt_trace_get_stats(struct kbp_xpt_trace *trace, struct kbp_xpt_trace_stats *stats);
+
+/**
+ * Replays a trace on a transport as fast as the transport accepts the calls.
+ *
+ * @param fp Trace file, opened for binary reading and positioned at the file header.
+ * @param xpt Transport to replay on, of the same device type as the recorded one.
+ * @param flags ::kbp_xpt_replay_flags ORed together.
+ * @param stats Replay statistics populated on return, may be NULL.
+ *
+ * @return KBP_OK on success, KBP_NV_DATA_CORRUPT for a truncated or malformed trace,
+ *         KBP_INTERNAL_ERROR if stopped by ::KBP_XPT_REPLAY_STOP_ON_MISMATCH,
+ *         or an error code otherwise.
+ */
+
+kbp_status kbp_xpt_replay(FILE *fp, void *xpt, uint32_t flags, struct kbp_xpt_replay_stats *stats);
+
+/**
+ * @}
+ */
+
+#ifdef __cplusplus
+}
+#endif
+#endif                          /* __KBP_XPT_TRACE_H */
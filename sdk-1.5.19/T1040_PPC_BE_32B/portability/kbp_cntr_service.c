@@ -0,0 +1,280 @@
+/*
+ * $Id$
+ *
+ * This license is set out in https://raw.githubusercontent.com/Broadcom/Broadcom-Compute-Connectivity-Software-KBP-SDK/master/Legal/LICENSE file.
+ *
+ * $Copyright: (c) 2023 Broadcom Inc.
+ * All Rights Reserved.$
+ *
+ */
+
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "kbp_portable.h"
+#include "kbp_cntr_service.h"
+#include "kbp_probes.h"
+#include "kbp_flight.h"
+
+#define KBP_CNTR_SERVICE_MIN_INTERVAL   (1000)
+#define KBP_CNTR_SERVICE_MAX_INTERVAL   (100000)
+#define KBP_CNTR_SERVICE_HIGH_WM        (50)
+
+struct kbp_cntr_channel {
+    kbp_cntr_drain_fn drain;
+    void *ctx;
+    uint32_t ring_words;
+    struct kbp_cntr_channel_stats stats;
+};
+
+struct kbp_cntr_service {
+    struct kbp_device *device;
+    struct kbp_cntr_service_config config;
+    struct kbp_cntr_channel channels[KBP_CNTR_SERVICE_MAX_CHANNELS];
+    uint32_t num_channels;
+    uint32_t interval_us;
+    uint32_t kicked;
+    uint32_t stop;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t thread;
+};
+
+/*
+ * The SDK has no fill level for the TAP DMA buffer, so this channel reports
+ * zero words and never drives the interval.
+ */
+static kbp_status kbp_cntr_service_tap_drain(void *ctx, uint32_t *num_words)
+{
+    *num_words = 0;
+    return kbp_device_scrub_tap_dma_buffer((struct kbp_device *) ctx);
+}
+
+static void kbp_cntr_service_default_warn(void *ctx, const char *channel, uint32_t fill_pct, uint32_t interval_us)
+{
+    (void) ctx;
+    kbp_printf("Warning: counter channel %s was %u%% full when drained, interval now %u us\n",
+               channel, fill_pct, interval_us);
+}
+
+/*
+ * Drains every channel once and adapts the interval. Called with the lock
+ * held, which is dropped around each drain callback.
+ */
+static void kbp_cntr_service_drain_all(struct kbp_cntr_service *svc)
+{
+    uint32_t i, behind = 0, quiet = 1;
+
+    for (i = 0; i < svc->num_channels; i++) {
+        struct kbp_cntr_channel *ch = &svc->channels[i];
+        uint32_t num_words = 0, fill_pct = 0;
+        kbp_status status;
+
+        pthread_mutex_unlock(&svc->lock);
+        status = ch->drain(ch->ctx, &num_words);
+        pthread_mutex_lock(&svc->lock);
+
+        ch->stats.num_drains++;
+        if (status != KBP_OK) {
+            KBP_PROBE4(ring_drain, ch->stats.name, 0, 0, status);
+            kbp_flight_record(KBP_FLIGHT_RING_DRAIN_ERROR, svc, NULL, i, status, 0, 0);
+            ch->stats.num_errors++;
+            continue;
+        }
+
+        ch->stats.words_drained += num_words;
+        if (ch->ring_words) {
+            fill_pct = (uint32_t) ((uint64_t) num_words * 100 / ch->ring_words);
+            if (fill_pct > 100)
+                fill_pct = 100;
+        }
+        ch->stats.last_fill_pct = fill_pct;
+        KBP_PROBE4(ring_drain, ch->stats.name, num_words, fill_pct, status);
+        if (fill_pct > ch->stats.max_fill_pct)
+            ch->stats.max_fill_pct = fill_pct;
+
+        if (fill_pct >= svc->config.high_watermark_pct) {
+            ch->stats.num_warnings++;
+            behind |= 1U << i;
+        }
+        if (fill_pct >= svc->config.high_watermark_pct / 2)
+            quiet = 0;
+    }
+
+    if (behind) {
+        svc->interval_us /= 2;
+        if (svc->interval_us < svc->config.min_interval_us)
+            svc->interval_us = svc->config.min_interval_us;
+        for (i = 0; i < svc->num_channels; i++) {
+            if (behind & (1U << i))
+                svc->config.warn(svc->config.warn_ctx, svc->channels[i].stats.name,
+                                 svc->channels[i].stats.last_fill_pct, svc->interval_us);
+        }
+    } else if (quiet && svc->interval_us < svc->config.max_interval_us) {
+        svc->interval_us *= 2;
+        if (svc->interval_us > svc->config.max_interval_us)
+            svc->interval_us = svc->config.max_interval_us;
+    }
+}
+
+static void *kbp_cntr_service_thread(void *arg)
+{
+    struct kbp_cntr_service *svc = (struct kbp_cntr_service *) arg;
+
+    pthread_mutex_lock(&svc->lock);
+    while (!svc->stop) {
+        struct timespec deadline;
+
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += svc->interval_us / 1000000;
+        deadline.tv_nsec += (long) (svc->interval_us % 1000000) * 1000;
+        if (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+
+        while (!svc->stop && !svc->kicked) {
+            if (pthread_cond_timedwait(&svc->cond, &svc->lock, &deadline) == ETIMEDOUT)
+                break;
+        }
+        if (svc->stop)
+            break;
+
+        svc->kicked = 0;
+        kbp_cntr_service_drain_all(svc);
+    }
+    pthread_mutex_unlock(&svc->lock);
+
+    return NULL;
+}
+
+kbp_status kbp_cntr_service_start(struct kbp_device *device, const struct kbp_cntr_service_config *config,
+                                  struct kbp_cntr_service **svc)
+{
+    struct kbp_cntr_service *s;
+    pthread_condattr_t attr;
+
+    if (!device || !svc)
+        return KBP_INVALID_ARGUMENT;
+
+    s = kbp_syscalloc(1, sizeof(*s));
+    if (!s)
+        return KBP_OUT_OF_MEMORY;
+
+    if (config)
+        kbp_memcpy(&s->config, config, sizeof(*config));
+    if (!s->config.min_interval_us)
+        s->config.min_interval_us = KBP_CNTR_SERVICE_MIN_INTERVAL;
+    if (!s->config.max_interval_us)
+        s->config.max_interval_us = KBP_CNTR_SERVICE_MAX_INTERVAL;
+    if (!s->config.high_watermark_pct)
+        s->config.high_watermark_pct = KBP_CNTR_SERVICE_HIGH_WM;
+    if (!s->config.warn)
+        s->config.warn = kbp_cntr_service_default_warn;
+    if (s->config.min_interval_us > s->config.max_interval_us || s->config.high_watermark_pct > 100) {
+        kbp_sysfree(s);
+        return KBP_INVALID_ARGUMENT;
+    }
+
+    s->device = device;
+    s->interval_us = s->config.min_interval_us;
+    pthread_mutex_init(&s->lock, NULL);
+
+    /* Time the interval on the monotonic clock, so wall clock steps do not stretch it */
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&s->cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    s->channels[0].drain = kbp_cntr_service_tap_drain;
+    s->channels[0].ctx = device;
+    s->channels[0].stats.name = "tap";
+    s->num_channels = 1;
+
+    if (pthread_create(&s->thread, NULL, kbp_cntr_service_thread, s) != 0) {
+        pthread_cond_destroy(&s->cond);
+        pthread_mutex_destroy(&s->lock);
+        kbp_sysfree(s);
+        return KBP_OUT_OF_MEMORY;
+    }
+
+    *svc = s;
+    return KBP_OK;
+}
+
+kbp_status kbp_cntr_service_stop(struct kbp_cntr_service *svc)
+{
+    if (!svc)
+        return KBP_INVALID_ARGUMENT;
+
+    pthread_mutex_lock(&svc->lock);
+    svc->stop = 1;
+    pthread_cond_signal(&svc->cond);
+    pthread_mutex_unlock(&svc->lock);
+    pthread_join(svc->thread, NULL);
+
+    /* Leave nothing behind in the rings */
+    pthread_mutex_lock(&svc->lock);
+    kbp_cntr_service_drain_all(svc);
+    pthread_mutex_unlock(&svc->lock);
+
+    pthread_cond_destroy(&svc->cond);
+    pthread_mutex_destroy(&svc->lock);
+    kbp_sysfree(svc);
+    return KBP_OK;
+}
+
+kbp_status kbp_cntr_service_add_channel(struct kbp_cntr_service *svc, const char *name, kbp_cntr_drain_fn drain,
+                                        void *ctx, uint32_t ring_words, uint32_t *channel_id)
+{
+    struct kbp_cntr_channel *ch;
+
+    if (!svc || !name || !drain || !channel_id)
+        return KBP_INVALID_ARGUMENT;
+
+    pthread_mutex_lock(&svc->lock);
+    if (svc->num_channels == KBP_CNTR_SERVICE_MAX_CHANNELS) {
+        pthread_mutex_unlock(&svc->lock);
+        return KBP_OUT_OF_MEMORY;
+    }
+
+    ch = &svc->channels[svc->num_channels];
+    kbp_memset(ch, 0, sizeof(*ch));
+    ch->drain = drain;
+    ch->ctx = ctx;
+    ch->ring_words = ring_words;
+    ch->stats.name = name;
+    *channel_id = svc->num_channels++;
+    pthread_mutex_unlock(&svc->lock);
+    return KBP_OK;
+}
+
+kbp_status kbp_cntr_service_kick(struct kbp_cntr_service *svc)
+{
+    if (!svc)
+        return KBP_INVALID_ARGUMENT;
+
+    pthread_mutex_lock(&svc->lock);
+    svc->kicked = 1;
+    pthread_cond_signal(&svc->cond);
+    pthread_mutex_unlock(&svc->lock);
+    return KBP_OK;
+}
+
+kbp_status kbp_cntr_service_get_stats(struct kbp_cntr_service *svc, uint32_t channel_id,
+                                      struct kbp_cntr_channel_stats *stats)
+{
+    if (!svc || !stats)
+        return KBP_INVALID_ARGUMENT;
+
+    pthread_mutex_lock(&svc->lock);
+    if (channel_id >= svc->num_channels) {
+        pthread_mutex_unlock(&svc->lock);
+        return KBP_INVALID_ARGUMENT;
+    }
+    kbp_memcpy(stats, &svc->channels[channel_id].stats, sizeof(*stats));
+    stats->interval_us = svc->interval_us;
+    pthread_mutex_unlock(&svc->lock);
+    return KBP_OK;
+}
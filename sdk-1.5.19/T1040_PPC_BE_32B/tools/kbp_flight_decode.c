@@ -0,0 +1,183 @@
+/*
+ * $Id$
+ *
+ * This license is set out in https://raw.githubusercontent.com/Broadcom/Broadcom-Compute-Connectivity-Software-KBP-SDK/master/Legal/LICENSE file.
+ *
+ * $Copyright: (c) 2023 Broadcom Inc.
+ * All Rights Reserved.$
+ *
+ */
+
+/*
+ * Flight recorder dump decoder.
+ *
+ * Prints a dump written by kbp_flight_dump() or by an assert, one record
+ * per line, oldest first. Dumps from big endian targets decode on little
+ * endian hosts and the other way round. Does not need the SDK libraries.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+
+#include "kbp_flight.h"
+
+static const char *flight_op_names[] = {
+    "?",
+    "db_add_ace",
+    "db_add_prefix",
+    "db_add_em",
+    "db_delete",
+    "db_install",
+    "search",
+    "ad_add",
+    "ad_update",
+    "ad_delete",
+    "wb_save",
+    "wb_restore",
+    "hb_timer",
+    "xpt_error",
+    "ring_drain_error",
+    "assert"
+};
+
+static const char *flight_status_names[] = {
+#define KBP_INC_SEL(name, string) #name,
+#include "error_tbl.def"
+#undef KBP_INC_SEL
+};
+
+static uint16_t flight_swap16(uint16_t v)
+{
+    return (uint16_t) ((v >> 8) | (v << 8));
+}
+
+static uint32_t flight_swap32(uint32_t v)
+{
+    return (v >> 24) | ((v >> 8) & 0xFF00) | ((v << 8) & 0xFF0000) | (v << 24);
+}
+
+static uint64_t flight_swap64(uint64_t v)
+{
+    return ((uint64_t) flight_swap32((uint32_t) v) << 32) | flight_swap32((uint32_t) (v >> 32));
+}
+
+static void flight_print_op(uint16_t op)
+{
+    if (op >= KBP_FLIGHT_USER)
+        printf("%-16s", "user");
+    else if (op < sizeof(flight_op_names) / sizeof(flight_op_names[0]))
+        printf("%-16s", flight_op_names[op]);
+    else
+        printf("op_%-13u", op);
+}
+
+static void flight_usage(const char *prog)
+{
+    printf("Usage: %s [options] dump_file\n"
+           "  -n <count>  Print the last count records only\n"
+           "  -h          This help\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+    struct kbp_flight_dump_header hdr;
+    struct kbp_flight_record r;
+    uint32_t i, swap = 0, skip = 0, last = 0;
+    uint64_t first_ns = 0;
+    time_t secs;
+    char buf[64];
+    FILE *fp;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:h")) != -1) {
+        switch (opt) {
+        case 'n':
+            last = (uint32_t) strtoul(optarg, NULL, 0);
+            break;
+        default:
+            flight_usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (optind != argc - 1) {
+        flight_usage(argv[0]);
+        return 1;
+    }
+
+    fp = fopen(argv[optind], "rb");
+    if (!fp) {
+        fprintf(stderr, "Cannot open %s\n", argv[optind]);
+        return 1;
+    }
+    if (fread(&hdr, sizeof(hdr), 1, fp) != 1) {
+        fprintf(stderr, "%s: short header\n", argv[optind]);
+        return 1;
+    }
+
+    if (hdr.magic == flight_swap32(KBP_FLIGHT_MAGIC)) {
+        swap = 1;
+        hdr.version = flight_swap16(hdr.version);
+        hdr.record_size = flight_swap16(hdr.record_size);
+        hdr.num_records = flight_swap32(hdr.num_records);
+        hdr.total_records = flight_swap32(hdr.total_records);
+        hdr.dump_ns = flight_swap64(hdr.dump_ns);
+        hdr.dump_wall_ns = flight_swap64(hdr.dump_wall_ns);
+    } else if (hdr.magic != KBP_FLIGHT_MAGIC) {
+        fprintf(stderr, "%s: not a flight recorder dump\n", argv[optind]);
+        return 1;
+    }
+    if (hdr.version != KBP_FLIGHT_VERSION || hdr.record_size != sizeof(r)) {
+        fprintf(stderr, "%s: unsupported version %u, record size %u\n", argv[optind], hdr.version,
+                hdr.record_size);
+        return 1;
+    }
+
+    secs = (time_t) (hdr.dump_wall_ns / 1000000000ULL);
+    strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", gmtime(&secs));
+    printf("# dumped %s.%06u UTC, %u of %u records, %s endian\n", buf,
+           (uint32_t) (hdr.dump_wall_ns % 1000000000ULL / 1000), hdr.num_records, hdr.total_records,
+           swap ? "foreign" : "host");
+    printf("# %14s %7s %-16s %-18s %-18s %10s %12s  %s\n", "ms", "tid", "op", "object", "handle", "arg", "us",
+           "status");
+
+    if (last && last < hdr.num_records)
+        skip = hdr.num_records - last;
+
+    for (i = 0; i < hdr.num_records; i++) {
+        if (fread(&r, sizeof(r), 1, fp) != 1) {
+            fprintf(stderr, "%s: truncated after %u records\n", argv[optind], i);
+            return 1;
+        }
+        if (i < skip)
+            continue;
+        if (swap) {
+            r.ts_ns = flight_swap64(r.ts_ns);
+            r.object = flight_swap64(r.object);
+            r.handle = flight_swap64(r.handle);
+            r.duration_ns = flight_swap32(r.duration_ns);
+            r.arg = flight_swap32(r.arg);
+            r.status = (int32_t) flight_swap32((uint32_t) r.status);
+            r.tid = flight_swap32(r.tid);
+            r.op = flight_swap16(r.op);
+        }
+        if (i == skip)
+            first_ns = r.ts_ns;
+
+        /* Time relative to the first printed record, which is at zero */
+        printf("%16.3f %7u ", r.ts_ns >= first_ns ? (r.ts_ns - first_ns) / 1e6 : -((first_ns - r.ts_ns) / 1e6),
+               r.tid);
+        flight_print_op(r.op);
+        printf(" 0x%016llx 0x%016llx %10u %12.3f  ", (unsigned long long) r.object,
+               (unsigned long long) r.handle, r.arg, r.duration_ns / 1e3);
+        if (r.status >= 0 && (uint32_t) r.status < sizeof(flight_status_names) / sizeof(flight_status_names[0]))
+            printf("%s\n", flight_status_names[r.status]);
+        else
+            printf("%d\n", r.status);
+    }
+
+    fclose(fp);
+    return 0;
+}